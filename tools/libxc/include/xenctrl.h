@@ -1282,6 +1282,22 @@ int xc_domain_getvnuma(xc_interface *xch,
 int xc_domain_soft_reset(xc_interface *xch,
                          uint32_t domid);
 
+/*
+ * Exit latency histograms, see XEN_DOMCTL_exit_latency.
+ *
+ * xc_domain_exit_latency_query() fills in up to *nr_reasons entries of
+ * reasons, summed up over all vCPUs if vcpu is XEN_EXITLAT_ALL_VCPUS, and
+ * returns the number of reasons there are in *nr_reasons.
+ */
+typedef xen_domctl_exitlat_reason_t xc_exitlat_reason_t;
+int xc_domain_exit_latency_enable(xc_interface *xch, uint32_t domid);
+int xc_domain_exit_latency_disable(xc_interface *xch, uint32_t domid);
+int xc_domain_exit_latency_reset(xc_interface *xch, uint32_t domid);
+int xc_domain_exit_latency_query(xc_interface *xch, uint32_t domid,
+                                 uint32_t vcpu, uint32_t *nr_reasons,
+                                 uint32_t *type, uint64_t *cycles_per_sec,
+                                 xc_exitlat_reason_t *reasons);
+
 #if defined(__i386__) || defined(__x86_64__)
 /*
  * PC BIOS standard E820 types and structure.
@@ -1466,6 +1482,34 @@ int xc_lockprof_query(xc_interface *xch,
                       uint64_t *time,
                       xc_hypercall_buffer_t *data);
 
+/*
+ * Hypervisor sampling profiler.  xc_profile_read() drains the samples of
+ * one CPU into data, *nr_words being its size on entry and the number of
+ * words filled on return; see XEN_SYSCTL_profile_op for their format.
+ */
+int xc_profile_enable(xc_interface *xch, uint32_t hz);
+int xc_profile_disable(xc_interface *xch);
+int xc_profile_read(xc_interface *xch, uint32_t cpu, uint32_t *nr_words,
+                    uint64_t *lost, xc_hypercall_buffer_t *data);
+int xc_profile_symbol(xc_interface *xch, uint64_t addr, char *name,
+                      uint32_t name_size, uint64_t *offset, uint64_t *size);
+
+/*
+ * Sampled lock contention statistics.  xc_lockstat_query() fills in up to
+ * *nr_classes entries of data, entry i for lock class i + 1, and returns
+ * the number of classes there are in *nr_classes.  rate is one in how many
+ * acquisitions is timed, 0 meaning sampling is off.
+ */
+typedef xen_sysctl_lockstat_class_t xc_lockstat_class_t;
+int xc_lockstat_query(xc_interface *xch, uint32_t *nr_classes,
+                      uint64_t *time, uint32_t *rate,
+                      xc_hypercall_buffer_t *data);
+int xc_lockstat_reset(xc_interface *xch);
+int xc_lockstat_set_rate(xc_interface *xch, uint32_t rate);
+/* Resolve a caller's address to a symbol name and the offset into it. */
+int xc_lockstat_symbol(xc_interface *xch, uint64_t addr, char *name,
+                       uint32_t name_size, uint64_t *offset);
+
 void *xc_memalign(xc_interface *xch, size_t alignment, size_t size);
 
 /**
@@ -1580,6 +1624,16 @@ int xc_tbuf_set_evt_mask(xc_interface *xch, uint32_t mask);
 int xc_domctl(xc_interface *xch, struct xen_domctl *domctl);
 int xc_sysctl(xc_interface *xch, struct xen_sysctl *sysctl);
 
+/*
+ * Issue several domctls with a single trap into Xen, by means of a
+ * multicall.  The per-operation return value (0 or -errno) is stored in
+ * results[i] (if non-NULL), and any output is copied back into domctls[i].
+ * Only operations which don't embed guest handles to other buffers may be
+ * batched this way.  Returns 0 if the batch was submitted, -1 otherwise.
+ */
+int xc_domctl_batch(xc_interface *xch, uint32_t nr_ops,
+                    struct xen_domctl *domctls, int *results);
+
 int xc_version(xc_interface *xch, int cmd, void *arg);
 
 int xc_flask_op(xc_interface *xch, xen_flask_op_t *op);
@@ -2068,6 +2122,16 @@ int xc_memshr_control(xc_interface *xch,
                       domid_t domid,
                       int enable);
 
+/* Start/stop the hypervisor's background scanner for the domid, which
+ * looks for pages with identical contents and shares them, within the
+ * domid and with the other domains being scanned.
+ *
+ * Returns EINVAL if trying to enable and sharing is not turned on for the
+ * domain.  Turning sharing off also stops the scanner. */
+int xc_memshr_scan(xc_interface *xch,
+                   domid_t domid,
+                   int enable);
+
 /* Create a communication ring in which the hypervisor will place ENOMEM
  * notifications.
  *
@@ -29,6 +29,9 @@
 #define XCFLAGS_HVM       (1 << 2)
 #define XCFLAGS_STDVGA    (1 << 3)
 #define XCFLAGS_CHECKPOINT_COMPRESS    (1 << 4)
+#define XCFLAGS_STREAM_COMPRESS        (1 << 5)
+#define XCFLAGS_POSTCOPY               (1 << 6)
+#define XCFLAGS_STREAM_DEDUP           (1 << 7)
 
 #define X86_64_B_SIZE   64 
 #define X86_32_B_SIZE   32
@@ -117,6 +120,16 @@ struct restore_callbacks {
      */
     int (*postcopy)(void* data);
 
+    /*
+     * Post-copy migration (XCFLAGS_POSTCOPY): resume the guest and its
+     * device model while the rest of its memory is still being received.
+     * Called after restore_results.  Without it, and a back channel, the
+     * domain is only resumed once all of its memory has arrived.
+     *
+     * returns 1 on success.
+     */
+    int (*postcopy_resume)(void* data);
+
     /* A checkpoint record has been found in the stream.
      * returns: */
 #define XGR_CHECKPOINT_ERROR    0 /* Terminate processing */
@@ -248,7 +248,7 @@ static int set_mode(xc_interface *xch, domid_t domid, char *guest_type)
  */
 static int populate_one_size(struct xc_dom_image *dom, int pfn_shift,
                              xen_pfn_t base_pfn, xen_pfn_t *nr_pfns,
-                             xen_pfn_t *extents)
+                             unsigned int memflags, xen_pfn_t *extents)
 {
     /* The mask for this level */
     const uint64_t mask = ((uint64_t)1<<(pfn_shift))-1;
@@ -286,7 +286,7 @@ static int populate_one_size(struct xc_dom_image *dom, int pfn_shift,
         extents[i] = base_pfn + (i<<pfn_shift);
 
     nr = xc_domain_populate_physmap(dom->xch, dom->guest_domid, count,
-                                    pfn_shift, 0, extents);
+                                    pfn_shift, memflags, extents);
     if ( nr <= 0 ) return nr;
     DOMPRINTF("%s: populated %#x/%#x entries with shift %d",
               __FUNCTION__, nr, count, pfn_shift);
@@ -297,7 +297,8 @@ static int populate_one_size(struct xc_dom_image *dom, int pfn_shift,
 }
 
 static int populate_guest_memory(struct xc_dom_image *dom,
-                                 xen_pfn_t base_pfn, xen_pfn_t nr_pfns)
+                                 xen_pfn_t base_pfn, xen_pfn_t nr_pfns,
+                                 unsigned int memflags)
 {
     int rc = 0;
     xen_pfn_t allocsz, pfn, *extents;
@@ -324,7 +325,8 @@ static int populate_guest_memory(struct xc_dom_image *dom,
         {
             allocsz = 1;
             rc = populate_one_size(dom, PFN_4K_SHIFT,
-                                   base_pfn + pfn, &allocsz, extents);
+                                   base_pfn + pfn, &allocsz, memflags,
+                                   extents);
             if (rc < 0) break;
             if (rc > 0) continue;
             /* Failed to allocate a single page? */
@@ -333,22 +335,22 @@ static int populate_guest_memory(struct xc_dom_image *dom,
 #endif
 
         rc = populate_one_size(dom, PFN_512G_SHIFT,
-                               base_pfn + pfn, &allocsz, extents);
+                               base_pfn + pfn, &allocsz, memflags, extents);
         if ( rc < 0 ) break;
         if ( rc > 0 ) continue;
 
         rc = populate_one_size(dom, PFN_1G_SHIFT,
-                               base_pfn + pfn, &allocsz, extents);
+                               base_pfn + pfn, &allocsz, memflags, extents);
         if ( rc < 0 ) break;
         if ( rc > 0 ) continue;
 
         rc = populate_one_size(dom, PFN_2M_SHIFT,
-                               base_pfn + pfn, &allocsz, extents);
+                               base_pfn + pfn, &allocsz, memflags, extents);
         if ( rc < 0 ) break;
         if ( rc > 0 ) continue;
 
         rc = populate_one_size(dom, PFN_4K_SHIFT,
-                               base_pfn + pfn, &allocsz, extents);
+                               base_pfn + pfn, &allocsz, memflags, extents);
         if ( rc < 0 ) break;
         if ( rc == 0 )
         {
@@ -372,6 +374,7 @@ static int meminit(struct xc_dom_image *dom)
     int i, rc;
     xen_pfn_t pfn;
     uint64_t modbase;
+    unsigned int memflags = 0;
 
     uint64_t ramsize = (uint64_t)dom->total_pages << XC_PAGE_SHIFT;
 
@@ -440,15 +443,34 @@ static int meminit(struct xc_dom_image *dom)
     for ( pfn = 0; pfn < p2m_size; pfn++ )
         dom->p2m_host[pfn] = INVALID_PFN;
 
+    /*
+     * If the target is below the RAM size, populate the RAM on demand and
+     * let the guest balloon down to the target.
+     */
+    if ( dom->target_pages && dom->target_pages < dom->total_pages )
+        memflags |= XENMEMF_populate_on_demand;
+
     /* setup initial p2m and allocate guest memory */
     for ( i = 0; i < GUEST_RAM_BANKS && dom->rambank_size[i]; i++ )
     {
         if ((rc = populate_guest_memory(dom,
                                         bankbase[i] >> XC_PAGE_SHIFT,
-                                        dom->rambank_size[i])))
+                                        dom->rambank_size[i], memflags)))
             return rc;
     }
 
+    if ( memflags & XENMEMF_populate_on_demand )
+    {
+        /* Fill the PoD cache, so that tot_pages reaches the target. */
+        rc = xc_domain_set_pod_target(dom->xch, dom->guest_domid,
+                                      dom->target_pages, NULL, NULL, NULL);
+        if ( rc != 0 )
+        {
+            DOMPRINTF("%s: Could not set PoD target", __FUNCTION__);
+            return rc;
+        }
+    }
+
     /*
      * We try to place dtb+initrd at 128MB or if we have less RAM
      * as high as possible. If there is no space then fallback to
@@ -2397,6 +2397,70 @@ int xc_domain_soft_reset(xc_interface *xch,
     domctl.domain = (domid_t)domid;
     return do_domctl(xch, &domctl);
 }
+
+static int xc_domain_exit_latency_op(xc_interface *xch, uint32_t domid,
+                                     uint32_t cmd)
+{
+    DECLARE_DOMCTL;
+
+    domctl.cmd = XEN_DOMCTL_exit_latency;
+    domctl.domain = (domid_t)domid;
+    domctl.u.exit_latency.cmd = cmd;
+    set_xen_guest_handle(domctl.u.exit_latency.reasons, HYPERCALL_BUFFER_NULL);
+
+    return do_domctl(xch, &domctl);
+}
+
+int xc_domain_exit_latency_enable(xc_interface *xch, uint32_t domid)
+{
+    return xc_domain_exit_latency_op(xch, domid, XEN_DOMCTL_EXITLAT_enable);
+}
+
+int xc_domain_exit_latency_disable(xc_interface *xch, uint32_t domid)
+{
+    return xc_domain_exit_latency_op(xch, domid, XEN_DOMCTL_EXITLAT_disable);
+}
+
+int xc_domain_exit_latency_reset(xc_interface *xch, uint32_t domid)
+{
+    return xc_domain_exit_latency_op(xch, domid, XEN_DOMCTL_EXITLAT_reset);
+}
+
+int xc_domain_exit_latency_query(xc_interface *xch, uint32_t domid,
+                                 uint32_t vcpu, uint32_t *nr_reasons,
+                                 uint32_t *type, uint64_t *cycles_per_sec,
+                                 xc_exitlat_reason_t *reasons)
+{
+    int rc;
+    DECLARE_DOMCTL;
+    DECLARE_HYPERCALL_BOUNCE(reasons, *nr_reasons * sizeof(*reasons),
+                             XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, reasons) )
+        return -1;
+
+    domctl.cmd = XEN_DOMCTL_exit_latency;
+    domctl.domain = (domid_t)domid;
+    domctl.u.exit_latency.cmd = XEN_DOMCTL_EXITLAT_query;
+    domctl.u.exit_latency.vcpu = vcpu;
+    domctl.u.exit_latency.nr_reasons = *nr_reasons;
+    set_xen_guest_handle(domctl.u.exit_latency.reasons, reasons);
+
+    rc = do_domctl(xch, &domctl);
+
+    xc_hypercall_bounce_post(xch, reasons);
+
+    if ( !rc )
+    {
+        *nr_reasons = domctl.u.exit_latency.nr_reasons;
+        if ( type )
+            *type = domctl.u.exit_latency.type;
+        if ( cycles_per_sec )
+            *cycles_per_sec = domctl.u.exit_latency.cycles_per_sec;
+    }
+
+    return rc;
+}
 /*
  * Local variables:
  * mode: C
@@ -443,6 +443,154 @@ int xc_lockprof_query(xc_interface *xch,
     return rc;
 }
 
+int xc_profile_enable(xc_interface *xch, uint32_t hz)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_profile_op;
+    sysctl.u.profile_op.cmd = XEN_SYSCTL_PROFILE_enable;
+    sysctl.u.profile_op.u.enable.hz = hz;
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_profile_disable(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_profile_op;
+    sysctl.u.profile_op.cmd = XEN_SYSCTL_PROFILE_disable;
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_profile_read(xc_interface *xch, uint32_t cpu, uint32_t *nr_words,
+                    uint64_t *lost, struct xc_hypercall_buffer *data)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(data);
+
+    sysctl.cmd = XEN_SYSCTL_profile_op;
+    sysctl.u.profile_op.cmd = XEN_SYSCTL_PROFILE_read;
+    sysctl.u.profile_op.u.read.cpu = cpu;
+    sysctl.u.profile_op.u.read.nr_words = *nr_words;
+    set_xen_guest_handle(sysctl.u.profile_op.u.read.buffer, data);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *nr_words = sysctl.u.profile_op.u.read.nr_words;
+    if ( lost )
+        *lost = sysctl.u.profile_op.u.read.lost;
+
+    return rc;
+}
+
+int xc_profile_symbol(xc_interface *xch, uint64_t addr, char *name,
+                      uint32_t name_size, uint64_t *offset, uint64_t *size)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(name, name_size, XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, name) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_profile_op;
+    sysctl.u.profile_op.cmd = XEN_SYSCTL_PROFILE_symbol;
+    sysctl.u.profile_op.u.symbol.addr = addr;
+    sysctl.u.profile_op.u.symbol.name_size = name_size;
+    set_xen_guest_handle(sysctl.u.profile_op.u.symbol.name, name);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, name);
+
+    if ( !rc )
+    {
+        if ( offset )
+            *offset = sysctl.u.profile_op.u.symbol.offset;
+        if ( size )
+            *size = sysctl.u.profile_op.u.symbol.size;
+    }
+
+    return rc;
+}
+
+int xc_lockstat_query(xc_interface *xch, uint32_t *nr_classes,
+                      uint64_t *time, uint32_t *rate,
+                      struct xc_hypercall_buffer *data)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BUFFER_ARGUMENT(data);
+
+    sysctl.cmd = XEN_SYSCTL_lockstat_op;
+    sysctl.u.lockstat_op.cmd = XEN_SYSCTL_LOCKSTAT_query;
+    sysctl.u.lockstat_op.nr_classes = *nr_classes;
+    set_xen_guest_handle(sysctl.u.lockstat_op.classes, data);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    *nr_classes = sysctl.u.lockstat_op.nr_classes;
+    if ( time )
+        *time = sysctl.u.lockstat_op.time;
+    if ( rate )
+        *rate = sysctl.u.lockstat_op.rate;
+
+    return rc;
+}
+
+int xc_lockstat_reset(xc_interface *xch)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockstat_op;
+    sysctl.u.lockstat_op.cmd = XEN_SYSCTL_LOCKSTAT_reset;
+    set_xen_guest_handle(sysctl.u.lockstat_op.classes, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_lockstat_set_rate(xc_interface *xch, uint32_t rate)
+{
+    DECLARE_SYSCTL;
+
+    sysctl.cmd = XEN_SYSCTL_lockstat_op;
+    sysctl.u.lockstat_op.cmd = XEN_SYSCTL_LOCKSTAT_set_rate;
+    sysctl.u.lockstat_op.rate = rate;
+    set_xen_guest_handle(sysctl.u.lockstat_op.classes, HYPERCALL_BUFFER_NULL);
+
+    return do_sysctl(xch, &sysctl);
+}
+
+int xc_lockstat_symbol(xc_interface *xch, uint64_t addr, char *name,
+                       uint32_t name_size, uint64_t *offset)
+{
+    int rc;
+    DECLARE_SYSCTL;
+    DECLARE_HYPERCALL_BOUNCE(name, name_size, XC_HYPERCALL_BUFFER_BOUNCE_OUT);
+
+    if ( xc_hypercall_bounce_pre(xch, name) )
+        return -1;
+
+    sysctl.cmd = XEN_SYSCTL_lockstat_op;
+    sysctl.u.lockstat_op.cmd = XEN_SYSCTL_LOCKSTAT_symbol;
+    sysctl.u.lockstat_op.addr = addr;
+    sysctl.u.lockstat_op.name_size = name_size;
+    set_xen_guest_handle(sysctl.u.lockstat_op.classes, HYPERCALL_BUFFER_NULL);
+    set_xen_guest_handle(sysctl.u.lockstat_op.name, name);
+
+    rc = do_sysctl(xch, &sysctl);
+
+    xc_hypercall_bounce_post(xch, name);
+
+    if ( !rc && offset )
+        *offset = sysctl.u.lockstat_op.addr;
+
+    return rc;
+}
+
 int xc_getcpuinfo(xc_interface *xch, int max_cpus,
                   xc_cpuinfo_t *info, int *nr_cpus)
 {
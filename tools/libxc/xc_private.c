@@ -464,6 +464,57 @@ int xc_sysctl(xc_interface *xch, struct xen_sysctl *sysctl)
     return do_sysctl(xch, sysctl);
 }
 
+int xc_domctl_batch(xc_interface *xch, uint32_t nr_ops,
+                    struct xen_domctl *domctls, int *results)
+{
+    int rc = -1;
+    uint32_t i;
+    multicall_entry_t *call;
+    DECLARE_HYPERCALL_BUFFER(multicall_entry_t, call_list);
+    DECLARE_HYPERCALL_BOUNCE(domctls, nr_ops * sizeof(*domctls),
+                             XC_HYPERCALL_BUFFER_BOUNCE_BOTH);
+
+    if ( nr_ops == 0 )
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for ( i = 0; i < nr_ops; i++ )
+        domctls[i].interface_version = XEN_DOMCTL_INTERFACE_VERSION;
+
+    call_list = xc_hypercall_buffer_alloc(xch, call_list,
+                                          sizeof(*call_list) * nr_ops);
+    if ( !call_list )
+        return -1;
+
+    if ( xc_hypercall_bounce_pre(xch, domctls) )
+    {
+        PERROR("Could not bounce buffer for domctl batch");
+        goto out;
+    }
+
+    /* All operations live in one bounce buffer: point each call into it. */
+    for ( i = 0; i < nr_ops; i++ )
+    {
+        call = call_list + i;
+        call->op = __HYPERVISOR_domctl;
+        call->args[0] = HYPERCALL_BUFFER_AS_ARG(domctls) +
+                        i * sizeof(*domctls);
+    }
+
+    rc = do_multicall_op(xch, HYPERCALL_BUFFER(call_list), nr_ops);
+
+    if ( rc == 0 && results )
+        for ( i = 0; i < nr_ops; i++ )
+            results[i] = (long)call_list[i].result;
+
+    xc_hypercall_bounce_post(xch, domctls);
+ out:
+    xc_hypercall_buffer_free(xch, call_list);
+    return rc;
+}
+
 int xc_version(xc_interface *xch, int cmd, void *arg)
 {
     DECLARE_HYPERCALL_BOUNCE(arg, 0, XC_HYPERCALL_BUFFER_BOUNCE_OUT); /* Size unknown until cmd decoded */
@@ -38,6 +38,12 @@ static const char *mandatory_rec_types[] =
     [REC_TYPE_VERIFY]                       = "Verify",
     [REC_TYPE_CHECKPOINT]                   = "Checkpoint",
     [REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST]    = "Checkpoint dirty pfn list",
+    [REC_TYPE_PAGE_DATA_COMPRESSED]         = "Page data (compressed)",
+    [REC_TYPE_POSTCOPY_PFNS]                = "Postcopy pfns",
+    [REC_TYPE_POSTCOPY_TRANSITION]          = "Postcopy transition",
+    [REC_TYPE_POSTCOPY_FAULT]               = "Postcopy fault",
+    [REC_TYPE_ZERO_PAGES]                   = "Zero pages",
+    [REC_TYPE_DUPLICATE_PAGES]              = "Duplicate pages",
 };
 
 const char *rec_type_to_str(uint32_t type)
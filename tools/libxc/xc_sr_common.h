@@ -8,6 +8,9 @@
 #include "xc_dom.h"
 #include "xc_bitops.h"
 
+#include <xenevtchn.h>
+#include <xen/vm_event.h>
+
 #include "xc_sr_stream_format.h"
 
 /* String representation of Domain Header types. */
@@ -172,6 +175,8 @@ struct xc_sr_x86_pv_restore_vcpu
     size_t basicsz, extdsz, xsavesz, msrsz;
 };
 
+struct xc_sr_dup_entry;
+
 struct xc_sr_context
 {
     xc_interface *xch;
@@ -209,6 +214,39 @@ struct xc_sr_context
             unsigned long *deferred_pages;
             unsigned long nr_deferred_pages;
             xc_hypercall_buffer_t dirty_bitmap_hbuf;
+
+            /* Dirty pfns returned by XEN_DOMCTL_SHADOW_OP_CLEAN_LIST. */
+            xc_hypercall_buffer_t dirty_list_hbuf;
+            bool dirty_list_unsupported;
+
+            /* Send PAGE_DATA_COMPRESSED rather than PAGE_DATA records. */
+            bool compress;
+            struct xc_sr_workers *workers;
+            /* Output space for the chunks of a batch. */
+            void *compress_buf;
+
+            /*
+             * Post-copy: the final dirty pages are sent after the domain has
+             * been resumed on the destination, which requests them over
+             * recv_fd as it faults on them.  The outstanding pages are the
+             * ones left set in the dirty bitmap.
+             */
+            bool postcopy;
+
+            /*
+             * Send ZERO_PAGES and DUPLICATE_PAGES records rather than the
+             * data of zero and duplicate pages.  Duplicates are only sought
+             * among pages sent since the domain was last paused, as only
+             * then is their content known to be what the restorer has.
+             */
+            bool dedup;
+            bool dedup_paused;
+            struct xc_sr_dup_entry *dup_table;
+            uint64_t *zero_pfns;
+            unsigned nr_zero_pfns;
+            struct xc_sr_rec_duplicate_pages_entry *dup_pages;
+            unsigned nr_dup_pages;
+            unsigned long zero_count, dup_count;
         } save;
 
         struct /* Restore data. */
@@ -260,6 +298,56 @@ struct xc_sr_context
 
             /* Sender has invoked verify mode on the stream. */
             bool verify;
+
+            /* Decompression of PAGE_DATA_COMPRESSED records.  The pool is
+             * created on the first such record seen in the stream. */
+            struct xc_sr_workers *workers;
+            bool workers_created;
+
+            /* ZERO_PAGES: populate pfns as PoD, 0 = unknown, 1 = yes, -1 = no. */
+            int zero_pod;
+            /* DUPLICATE_PAGES: mem_sharing isn't enabled for the domain. */
+            bool no_sharing;
+
+            /* Post-copy migration. */
+            struct
+            {
+                /* Pfns whose final contents have yet to be received. */
+                unsigned long *outstanding;
+                xen_pfn_t max_outstanding_pfn;
+                unsigned long nr_outstanding;
+
+                /* A POSTCOPY_TRANSITION record has been seen. */
+                bool active;
+                /* The domain has been resumed ahead of its memory. */
+                bool resumed;
+
+                /*
+                 * mem_paging, used to mark the outstanding pfns as paged
+                 * out and to learn of the domain faulting on them.
+                 */
+                bool paging;
+                void *ring_page;
+                uint32_t evtchn_port;
+                xenevtchn_handle *xce;
+                xenevtchn_port_or_error_t port;
+                vm_event_back_ring_t back_ring;
+
+                /* Paging requests waiting for their page to arrive. */
+                vm_event_request_t *pending;
+                unsigned nr_pending, max_pending;
+
+                /* Page aligned buffer for xc_mem_paging_load(). */
+                void *buffer;
+
+                /*
+                 * POSTCOPY_FAULT records yet to be written to the back
+                 * channel.  It is written without blocking, as the sender
+                 * may itself be blocked writing page data to us.
+                 */
+                void *requests;
+                size_t requests_len, requests_sent, requests_size;
+            } postcopy;
         } restore;
     };
 
@@ -399,6 +487,26 @@ int read_record(struct xc_sr_context *ctx, int fd, struct xc_sr_record *rec);
 int populate_pfns(struct xc_sr_context *ctx, unsigned count,
                   const xen_pfn_t *original_pfns, const uint32_t *types);
 
+/*
+ * Pool of worker threads for CPU bound processing of page data.  A NULL pool
+ * is valid, and runs every job in the calling thread.
+ */
+struct xc_sr_workers;
+typedef int (*sr_worker_fn_t)(void *arg, unsigned int job);
+
+/* Number of workers worth creating on this host. */
+unsigned int sr_workers_default(void);
+
+struct xc_sr_workers *sr_workers_create(xc_interface *xch, unsigned int nr);
+void sr_workers_destroy(struct xc_sr_workers *w);
+
+/*
+ * Run fn(arg, job) for every job in [0, nr_jobs), and wait for all of them
+ * to complete.  Returns 0, or the non-zero value returned by a failing job.
+ */
+int sr_workers_run(struct xc_sr_workers *w, unsigned int nr_jobs,
+                   sr_worker_fn_t fn, void *arg);
+
 #endif
 /*
  * Local variables:
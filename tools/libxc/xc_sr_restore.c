@@ -1,6 +1,8 @@
 #include <arpa/inet.h>
 
 #include <assert.h>
+#include <poll.h>
+#include <zlib.h>
 
 #include "xc_sr_common.h"
 
@@ -79,15 +81,16 @@ static bool pfn_is_populated(const struct xc_sr_context *ctx, xen_pfn_t pfn)
 }
 
 /*
- * Set a pfn as populated, expanding the tracking structures if needed. To
- * avoid realloc()ing too excessively, the size increased to the nearest power
- * of two large enough to contain the required pfn.
+ * Expand a pfn bitmap, if needed, to contain pfn.  To avoid realloc()ing too
+ * excessively, the size increased to the nearest power of two large enough
+ * to contain the required pfn.
  */
-static int pfn_set_populated(struct xc_sr_context *ctx, xen_pfn_t pfn)
+static int expand_pfn_bitmap(struct xc_sr_context *ctx, unsigned long **bitmap,
+                             xen_pfn_t *max_pfn, xen_pfn_t pfn)
 {
     xc_interface *xch = ctx->xch;
 
-    if ( pfn > ctx->restore.max_populated_pfn )
+    if ( !*bitmap || pfn > *max_pfn )
     {
         xen_pfn_t new_max;
         size_t old_sz, new_sz;
@@ -104,22 +107,34 @@ static int pfn_set_populated(struct xc_sr_context *ctx, xen_pfn_t pfn)
         new_max |= new_max >> 32;
 #endif
 
-        old_sz = bitmap_size(ctx->restore.max_populated_pfn + 1);
+        old_sz = *bitmap ? bitmap_size(*max_pfn + 1) : 0;
         new_sz = bitmap_size(new_max + 1);
-        p = realloc(ctx->restore.populated_pfns, new_sz);
+        p = realloc(*bitmap, new_sz);
         if ( !p )
         {
-            ERROR("Failed to realloc populated bitmap");
+            ERROR("Failed to realloc pfn bitmap");
             errno = ENOMEM;
             return -1;
         }
 
         memset((uint8_t *)p + old_sz, 0x00, new_sz - old_sz);
 
-        ctx->restore.populated_pfns    = p;
-        ctx->restore.max_populated_pfn = new_max;
+        *bitmap  = p;
+        *max_pfn = new_max;
     }
 
+    return 0;
+}
+
+/*
+ * Set a pfn as populated, expanding the tracking structures if needed.
+ */
+static int pfn_set_populated(struct xc_sr_context *ctx, xen_pfn_t pfn)
+{
+    if ( expand_pfn_bitmap(ctx, &ctx->restore.populated_pfns,
+                           &ctx->restore.max_populated_pfn, pfn) )
+        return -1;
+
     assert(!test_bit(pfn, ctx->restore.populated_pfns));
     set_bit(pfn, ctx->restore.populated_pfns);
 
@@ -194,6 +209,10 @@ int populate_pfns(struct xc_sr_context *ctx, unsigned count,
     return rc;
 }
 
+static int postcopy_load_pages(struct xc_sr_context *ctx, unsigned count,
+                               xen_pfn_t *pfns, uint32_t *types,
+                               void *page_data);
+
 /*
  * Given a list of pfns, their types, and a block of page data from the
  * stream, populate and record their types, map the relevant subset and copy
@@ -219,6 +238,12 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
         goto err;
     }
 
+    if ( ctx->restore.postcopy.paging )
+    {
+        rc = postcopy_load_pages(ctx, count, pfns, types, page_data);
+        goto err;
+    }
+
     rc = populate_pfns(ctx, count, pfns, types);
     if ( rc )
     {
@@ -325,6 +350,51 @@ static int process_page_data(struct xc_sr_context *ctx, unsigned count,
     return rc;
 }
 
+/*
+ * Decode and validate the pfn array of a PAGE_DATA or PAGE_DATA_COMPRESSED
+ * record.  Returns the number of pages of data which should follow it in
+ * *pages_of_data.
+ */
+static int decode_pfns(struct xc_sr_context *ctx, unsigned count,
+                       const uint64_t *rec_pfns, xen_pfn_t *pfns,
+                       uint32_t *types, unsigned *pages_of_data)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t pfn;
+    uint32_t type;
+    unsigned i;
+
+    *pages_of_data = 0;
+
+    for ( i = 0; i < count; ++i )
+    {
+        pfn = rec_pfns[i] & PAGE_DATA_PFN_MASK;
+        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
+        {
+            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
+            return -1;
+        }
+
+        type = (rec_pfns[i] & PAGE_DATA_TYPE_MASK) >> 32;
+        if ( ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) >= 5) &&
+             ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) <= 8) )
+        {
+            ERROR("Invalid type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
+                  type, pfn, i);
+            return -1;
+        }
+        else if ( type < XEN_DOMCTL_PFINFO_BROKEN )
+            /* NOTAB and all L1 through L4 tables (including pinned) should
+             * have a page worth of data in the record. */
+            (*pages_of_data)++;
+
+        pfns[i] = pfn;
+        types[i] = type;
+    }
+
+    return 0;
+}
+
 /*
  * Validate a PAGE_DATA record from the stream, and pass the results to
  * process_page_data() to actually perform the legwork.
@@ -333,11 +403,11 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 {
     xc_interface *xch = ctx->xch;
     struct xc_sr_rec_page_data_header *pages = rec->data;
-    unsigned i, pages_of_data = 0;
+    unsigned pages_of_data = 0;
     int rc = -1;
 
-    xen_pfn_t *pfns = NULL, pfn;
-    uint32_t *types = NULL, type;
+    xen_pfn_t *pfns = NULL;
+    uint32_t *types = NULL;
 
     if ( rec->length < sizeof(*pages) )
     {
@@ -366,31 +436,9 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         goto err;
     }
 
-    for ( i = 0; i < pages->count; ++i )
-    {
-        pfn = pages->pfn[i] & PAGE_DATA_PFN_MASK;
-        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfn) )
-        {
-            ERROR("pfn %#"PRIpfn" (index %u) outside domain maximum", pfn, i);
-            goto err;
-        }
-
-        type = (pages->pfn[i] & PAGE_DATA_TYPE_MASK) >> 32;
-        if ( ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) >= 5) &&
-             ((type >> XEN_DOMCTL_PFINFO_LTAB_SHIFT) <= 8) )
-        {
-            ERROR("Invalid type %#"PRIx32" for pfn %#"PRIpfn" (index %u)",
-                  type, pfn, i);
-            goto err;
-        }
-        else if ( type < XEN_DOMCTL_PFINFO_BROKEN )
-            /* NOTAB and all L1 through L4 tables (including pinned) should
-             * have a page worth of data in the record. */
-            pages_of_data++;
-
-        pfns[i] = pfn;
-        types[i] = type;
-    }
+    if ( decode_pfns(ctx, pages->count, pages->pfn, pfns, types,
+                     &pages_of_data) )
+        goto err;
 
     if ( rec->length != (sizeof(*pages) +
                          (sizeof(uint64_t) * pages->count) +
@@ -412,183 +460,1442 @@ static int handle_page_data(struct xc_sr_context *ctx, struct xc_sr_record *rec)
 }
 
 /*
- * Send checkpoint dirty pfn list to primary.
+ * ZERO_PAGES and DUPLICATE_PAGES records carry no page data.  Zero pages are
+ * left to PoD where the domain uses it, and duplicates share their source
+ * page where the domain has mem_sharing enabled; otherwise the pages are
+ * cleared or copied.  In verify mode, and while post-copy has pages paged
+ * out, the pages are instead expanded and passed to process_page_data().
  */
-static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
+
+/* Map count pfns, which must all succeed. */
+static void *map_pfns(struct xc_sr_context *ctx, int prot, unsigned count,
+                      const xen_pfn_t *pfns)
 {
     xc_interface *xch = ctx->xch;
-    int rc = -1;
-    unsigned count, written;
-    uint64_t i, *pfns = NULL;
-    struct iovec *iov = NULL;
-    xc_shadow_op_stats_t stats = { 0, ctx->restore.p2m_size };
-    struct xc_sr_record rec =
+    xen_pfn_t *gfns = malloc(count * sizeof(*gfns));
+    int *errs = malloc(count * sizeof(*errs));
+    void *mapping = NULL;
+    unsigned i;
+
+    if ( !gfns || !errs )
     {
-        .type = REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST,
-    };
-    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
-                                    &ctx->restore.dirty_bitmap_hbuf);
+        ERROR("Unable to allocate memory to map %u pfns", count);
+        goto out;
+    }
 
-    if ( xc_shadow_control(
-             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
-             HYPERCALL_BUFFER(dirty_bitmap), ctx->restore.p2m_size,
-             NULL, 0, &stats) != ctx->restore.p2m_size )
+    for ( i = 0; i < count; ++i )
+        gfns[i] = ctx->restore.ops.pfn_to_gfn(ctx, pfns[i]);
+
+    mapping = xenforeignmemory_map(xch->fmem, ctx->domid, prot, count,
+                                   gfns, errs);
+    if ( !mapping )
     {
-        PERROR("Failed to retrieve logdirty bitmap");
-        goto err;
+        PERROR("Unable to map %u pfns", count);
+        goto out;
     }
 
-    for ( i = 0, count = 0; i < ctx->restore.p2m_size; i++ )
+    for ( i = 0; i < count; ++i )
     {
-        if ( test_bit(i, dirty_bitmap) )
-            count++;
+        if ( errs[i] )
+        {
+            ERROR("Mapping pfn %#"PRIpfn" failed with %d", pfns[i], errs[i]);
+            xenforeignmemory_unmap(xch->fmem, mapping, count);
+            mapping = NULL;
+            goto out;
+        }
     }
 
+ out:
+    free(errs);
+    free(gfns);
 
-    pfns = malloc(count * sizeof(*pfns));
-    if ( !pfns )
+    return mapping;
+}
+
+static int handle_zero_pages(struct xc_sr_context *ctx,
+                             struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_pfn_list *zero = rec->data;
+    xen_pfn_t *pfns = NULL, *pod = NULL;
+    uint32_t *types = NULL;
+    void *data = NULL, *mapping = NULL;
+    unsigned i, nr_pfns = 0, nr_pod = 0;
+    uint64_t pod_cache = 0;
+    int rc = -1;
+
+    if ( rec->length < sizeof(*zero) || zero->count < 1 ||
+         rec->length != sizeof(*zero) + zero->count * sizeof(uint64_t) )
     {
-        ERROR("Unable to allocate %zu bytes of memory for dirty pfn list",
-              count * sizeof(*pfns));
+        ERROR("ZERO_PAGES record wrong size: length %u", rec->length);
         goto err;
     }
 
-    for ( i = 0, written = 0; i < ctx->restore.p2m_size; ++i )
+    pfns = malloc(zero->count * sizeof(*pfns));
+    pod = malloc(zero->count * sizeof(*pod));
+    types = malloc(zero->count * sizeof(*types));
+    if ( !pfns || !pod || !types )
     {
-        if ( !test_bit(i, dirty_bitmap) )
-            continue;
+        ERROR("Unable to allocate memory for %u zero pages", zero->count);
+        goto err;
+    }
 
-        if ( written > count )
+    for ( i = 0; i < zero->count; ++i )
+    {
+        if ( !ctx->restore.ops.pfn_is_valid(ctx, zero->pfn[i]) )
         {
-            ERROR("Dirty pfn list exceed");
+            ERROR("pfn %#"PRIx64" (index %u) outside domain maximum",
+                  zero->pfn[i], i);
             goto err;
         }
 
-        pfns[written++] = i;
+        pfns[i] = zero->pfn[i];
+        types[i] = XEN_DOMCTL_PFINFO_NOTAB;
     }
 
-    /* iovec[] for writev(). */
-    iov = malloc(3 * sizeof(*iov));
-    if ( !iov )
+    if ( ctx->restore.verify || ctx->restore.postcopy.paging )
     {
-        ERROR("Unable to allocate memory for sending dirty bitmap");
+        data = calloc(zero->count, PAGE_SIZE);
+        if ( !data )
+        {
+            ERROR("Unable to allocate memory for %u zero pages",
+                  zero->count);
+            goto err;
+        }
+
+        rc = process_page_data(ctx, zero->count, pfns, types, data);
         goto err;
     }
 
-    rec.length = count * sizeof(*pfns);
+    /* PoD entries are backed by zeroed pages when first touched. */
+    if ( ctx->restore.zero_pod == 0 )
+        ctx->restore.zero_pod =
+            (ctx->dominfo.hvm &&
+             !xc_domain_get_pod_target(xch, ctx->domid, NULL, &pod_cache,
+                                       NULL) &&
+             pod_cache) ? 1 : -1;
 
-    iov[0].iov_base = &rec.type;
-    iov[0].iov_len = sizeof(rec.type);
+    for ( i = 0; i < zero->count; ++i )
+    {
+        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
 
-    iov[1].iov_base = &rec.length;
-    iov[1].iov_len = sizeof(rec.length);
+        if ( ctx->restore.zero_pod > 0 && !pfn_is_populated(ctx, pfns[i]) )
+            pod[nr_pod++] = pfns[i];
+        else
+            pfns[nr_pfns++] = pfns[i];
+    }
 
-    iov[2].iov_base = pfns;
-    iov[2].iov_len = count * sizeof(*pfns);
+    if ( nr_pod )
+    {
+        rc = xc_domain_populate_physmap_exact(xch, ctx->domid, nr_pod, 0,
+                                              XENMEMF_populate_on_demand,
+                                              pod);
+        if ( rc )
+        {
+            PERROR("Failed to populate %u zero pages on demand", nr_pod);
+            goto err;
+        }
 
-    if ( writev_exact(ctx->restore.send_back_fd, iov, 3) )
+        for ( i = 0; i < nr_pod; ++i )
+        {
+            rc = pfn_set_populated(ctx, pod[i]);
+            if ( rc )
+                goto err;
+        }
+    }
+
+    /* Freshly populated pages aren't necessarily clear. */
+    if ( nr_pfns )
     {
-        PERROR("Failed to write dirty bitmap to stream");
-        goto err;
+        rc = populate_pfns(ctx, nr_pfns, pfns, NULL);
+        if ( rc )
+            goto err;
+
+        rc = -1;
+        mapping = map_pfns(ctx, PROT_READ | PROT_WRITE, nr_pfns, pfns);
+        if ( !mapping )
+            goto err;
+
+        memset(mapping, 0, (size_t)nr_pfns * PAGE_SIZE);
+        xenforeignmemory_unmap(xch->fmem, mapping, nr_pfns);
     }
 
     rc = 0;
+
  err:
+    free(data);
+    free(types);
+    free(pod);
     free(pfns);
-    free(iov);
+
     return rc;
 }
 
-static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec);
-static int handle_checkpoint(struct xc_sr_context *ctx)
+/*
+ * Share pfn with source_pfn.  Returns 0 on success, or non-zero if the pages
+ * need copying instead.
+ */
+static int share_page(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                      xen_pfn_t source_pfn)
 {
     xc_interface *xch = ctx->xch;
-    int rc = 0, ret;
-    unsigned i;
+    uint64_t source_handle, handle;
 
-    if ( !ctx->restore.checkpointed )
+    if ( ctx->restore.no_sharing )
+        return -1;
+
+    if ( xc_memshr_nominate_gfn(xch, ctx->domid, source_pfn,
+                                &source_handle) ||
+         xc_memshr_nominate_gfn(xch, ctx->domid, pfn, &handle) )
     {
-        ERROR("Found checkpoint in non-checkpointed stream");
-        rc = -1;
-        goto err;
+        if ( errno == ENODEV )
+        {
+            DPRINTF("mem_sharing not enabled, copying duplicate pages");
+            ctx->restore.no_sharing = true;
+        }
+        return -1;
     }
 
-    ret = ctx->restore.callbacks->checkpoint(ctx->restore.callbacks->data);
-    switch ( ret )
-    {
-    case XGR_CHECKPOINT_SUCCESS:
-        break;
+    return xc_memshr_share_gfns(xch, ctx->domid, source_pfn, source_handle,
+                                ctx->domid, pfn, handle);
+}
 
-    case XGR_CHECKPOINT_FAILOVER:
-        if ( ctx->restore.buffer_all_records )
-            rc = BROKEN_CHANNEL;
-        else
-            /* We don't have a consistent state */
-            rc = -1;
+static int handle_duplicate_pages(struct xc_sr_context *ctx,
+                                  struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_duplicate_pages *dup = rec->data;
+    xen_pfn_t *pfns = NULL, *sources = NULL;
+    uint32_t *types = NULL;
+    void *data = NULL, *source_map = NULL, *map = NULL;
+    unsigned i, nr_copy = 0, nr_mapped = 0;
+    int rc = -1;
+
+    if ( rec->length < sizeof(*dup) || dup->count < 1 ||
+         rec->length != sizeof(*dup) + dup->count * sizeof(dup->pages[0]) )
+    {
+        ERROR("DUPLICATE_PAGES record wrong size: length %u", rec->length);
         goto err;
+    }
 
-    default: /* Other fatal error */
-        rc = -1;
+    pfns = malloc(dup->count * sizeof(*pfns));
+    sources = malloc(dup->count * sizeof(*sources));
+    types = malloc(dup->count * sizeof(*types));
+    if ( !pfns || !sources || !types )
+    {
+        ERROR("Unable to allocate memory for %u duplicate pages", dup->count);
         goto err;
     }
 
-    if ( ctx->restore.buffer_all_records )
+    for ( i = 0; i < dup->count; ++i )
     {
-        IPRINTF("All records buffered");
+        pfns[i] = dup->pages[i].pfn;
+        sources[i] = dup->pages[i].source_pfn;
+        types[i] = XEN_DOMCTL_PFINFO_NOTAB;
 
-        for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
+        if ( !ctx->restore.ops.pfn_is_valid(ctx, pfns[i]) ||
+             !pfn_is_populated(ctx, sources[i]) )
         {
-            rc = process_record(ctx, &ctx->restore.buffered_records[i]);
-            if ( rc )
-                goto err;
+            ERROR("Bad duplicate pfn %#"PRIpfn" of %#"PRIpfn" (index %u)",
+                  pfns[i], sources[i], i);
+            goto err;
         }
-        ctx->restore.buffered_rec_num = 0;
-        IPRINTF("All records processed");
     }
-    else
-        ctx->restore.buffer_all_records = true;
 
-    if ( ctx->restore.checkpointed == XC_MIG_STREAM_COLO )
+    if ( ctx->restore.verify || ctx->restore.postcopy.paging )
     {
-#define HANDLE_CALLBACK_RETURN_VALUE(ret)                   \
-    do {                                                    \
-        if ( ret == 1 )                                     \
-            rc = 0; /* Success */                           \
-        else                                                \
-        {                                                   \
-            if ( ret == 2 )                                 \
-                rc = BROKEN_CHANNEL;                        \
-            else                                            \
-                rc = -1; /* Some unspecified error */       \
-            goto err;                                       \
-        }                                                   \
-    } while (0)
-
-        /* COLO */
-
-        /* We need to resume guest */
-        rc = ctx->restore.ops.stream_complete(ctx);
-        if ( rc )
+        nr_mapped = dup->count;
+        data = malloc((size_t)dup->count * PAGE_SIZE);
+        source_map = map_pfns(ctx, PROT_READ, nr_mapped, sources);
+        if ( !data || !source_map )
+        {
+            ERROR("Unable to expand %u duplicate pages", dup->count);
             goto err;
+        }
 
-        ctx->restore.callbacks->restore_results(ctx->restore.xenstore_gfn,
-                                                ctx->restore.console_gfn,
-                                                ctx->restore.callbacks->data);
-
-        /* Resume secondary vm */
-        ret = ctx->restore.callbacks->postcopy(ctx->restore.callbacks->data);
-        HANDLE_CALLBACK_RETURN_VALUE(ret);
+        for ( i = 0; i < dup->count; ++i )
+            memcpy(data + i * PAGE_SIZE, source_map + i * PAGE_SIZE,
+                   PAGE_SIZE);
 
-        /* Wait for a new checkpoint */
-        ret = ctx->restore.callbacks->wait_checkpoint(
-                                                ctx->restore.callbacks->data);
-        HANDLE_CALLBACK_RETURN_VALUE(ret);
+        rc = process_page_data(ctx, dup->count, pfns, types, data);
+        goto err;
+    }
 
-        /* suspend secondary vm */
-        ret = ctx->restore.callbacks->suspend(ctx->restore.callbacks->data);
-        HANDLE_CALLBACK_RETURN_VALUE(ret);
+    rc = populate_pfns(ctx, dup->count, pfns, types);
+    if ( rc )
+        goto err;
+    rc = -1;
 
-#undef HANDLE_CALLBACK_RETURN_VALUE
+    for ( i = 0; i < dup->count; ++i )
+    {
+        ctx->restore.ops.set_page_type(ctx, pfns[i], types[i]);
+
+        if ( share_page(ctx, pfns[i], sources[i]) )
+        {
+            pfns[nr_copy] = pfns[i];
+            sources[nr_copy] = sources[i];
+            ++nr_copy;
+        }
+    }
+
+    if ( nr_copy )
+    {
+        nr_mapped = nr_copy;
+        source_map = map_pfns(ctx, PROT_READ, nr_mapped, sources);
+        map = map_pfns(ctx, PROT_READ | PROT_WRITE, nr_mapped, pfns);
+        if ( !source_map || !map )
+            goto err;
+
+        for ( i = 0; i < nr_copy; ++i )
+            memcpy(map + i * PAGE_SIZE, source_map + i * PAGE_SIZE,
+                   PAGE_SIZE);
+    }
+
+    rc = 0;
+
+ err:
+    if ( map )
+        xenforeignmemory_unmap(xch->fmem, map, nr_mapped);
+    if ( source_map )
+        xenforeignmemory_unmap(xch->fmem, source_map, nr_mapped);
+    free(data);
+    free(types);
+    free(sources);
+    free(pfns);
+
+    return rc;
+}
+
+struct decompress_batch
+{
+    const uint8_t *chunks;
+    const uint32_t *lengths;
+    size_t *offsets;
+    unsigned int nr_pages;
+    uint8_t *page_data;
+};
+
+static int decompress_chunk(void *arg, unsigned int chunk)
+{
+    struct decompress_batch *b = arg;
+    unsigned int first = chunk * PAGE_DATA_CHUNK_PAGES;
+    unsigned int nr = b->nr_pages - first < PAGE_DATA_CHUNK_PAGES ?
+        b->nr_pages - first : PAGE_DATA_CHUNK_PAGES;
+    uint8_t *out = b->page_data + (size_t)first * PAGE_SIZE;
+    const uint8_t *in = b->chunks + b->offsets[chunk];
+    uLongf out_len = nr * PAGE_SIZE;
+
+    /* Chunks which didn't shrink are sent as they are. */
+    if ( b->lengths[chunk] == nr * PAGE_SIZE )
+    {
+        memcpy(out, in, out_len);
+        return 0;
+    }
+
+    if ( uncompress(out, &out_len, in, b->lengths[chunk]) != Z_OK ||
+         out_len != nr * PAGE_SIZE )
+        return -1;
+
+    return 0;
+}
+
+/*
+ * Validate a PAGE_DATA_COMPRESSED record from the stream, decompress its
+ * chunks in parallel and pass the results to process_page_data().
+ */
+static int handle_page_data_compressed(struct xc_sr_context *ctx,
+                                       struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_page_data_compressed_header *pages = rec->data;
+    struct decompress_batch batch = { 0 };
+    unsigned i, pages_of_data = 0;
+    size_t hdr_len, data_len = 0;
+    int rc = -1;
+
+    xen_pfn_t *pfns = NULL;
+    uint32_t *types = NULL;
+
+    if ( rec->length < sizeof(*pages) )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record truncated: length %u, min %zu",
+              rec->length, sizeof(*pages));
+        goto err;
+    }
+    else if ( pages->count < 1 )
+    {
+        ERROR("Expected at least 1 pfn in PAGE_DATA_COMPRESSED record");
+        goto err;
+    }
+    else if ( pages->algorithm != PAGE_DATA_COMPRESS_ZLIB )
+    {
+        ERROR("Unsupported PAGE_DATA_COMPRESSED algorithm %#"PRIx32,
+              pages->algorithm);
+        goto err;
+    }
+
+    hdr_len = sizeof(*pages) + (pages->count * sizeof(uint64_t)) +
+        ROUNDUP(pages->nr_chunks * sizeof(uint32_t), REC_ALIGN_ORDER);
+    if ( rec->length < hdr_len )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record (length %u) too short to contain"
+              " %u pfns and %u chunks", rec->length, pages->count,
+              pages->nr_chunks);
+        goto err;
+    }
+
+    pfns = malloc(pages->count * sizeof(*pfns));
+    types = malloc(pages->count * sizeof(*types));
+    batch.offsets = malloc(pages->nr_chunks * sizeof(*batch.offsets));
+    if ( !pfns || !types || !batch.offsets )
+    {
+        ERROR("Unable to allocate enough memory for %u pfns and %u chunks",
+              pages->count, pages->nr_chunks);
+        goto err;
+    }
+
+    if ( decode_pfns(ctx, pages->count, pages->pfn, pfns, types,
+                     &pages_of_data) )
+        goto err;
+
+    if ( pages->nr_chunks !=
+         (pages_of_data + PAGE_DATA_CHUNK_PAGES - 1) / PAGE_DATA_CHUNK_PAGES )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record has %u chunks for %u pages",
+              pages->nr_chunks, pages_of_data);
+        goto err;
+    }
+
+    batch.lengths = (const uint32_t *)&pages->pfn[pages->count];
+    for ( i = 0; i < pages->nr_chunks; ++i )
+    {
+        batch.offsets[i] = data_len;
+        data_len += batch.lengths[i];
+    }
+
+    if ( rec->length != hdr_len + data_len )
+    {
+        ERROR("PAGE_DATA_COMPRESSED record wrong size: length %u, expected "
+              "%zu + %zu", rec->length, hdr_len, data_len);
+        goto err;
+    }
+
+    batch.chunks = rec->data + hdr_len;
+    batch.nr_pages = pages_of_data;
+    batch.page_data = malloc((size_t)pages_of_data * PAGE_SIZE);
+    if ( pages_of_data && !batch.page_data )
+    {
+        ERROR("Unable to allocate %u pages for decompressed data",
+              pages_of_data);
+        goto err;
+    }
+
+    if ( sr_workers_run(ctx->restore.workers, pages->nr_chunks,
+                        decompress_chunk, &batch) )
+    {
+        ERROR("Failed to decompress PAGE_DATA_COMPRESSED record");
+        goto err;
+    }
+
+    rc = process_page_data(ctx, pages->count, pfns, types, batch.page_data);
+ err:
+    free(batch.page_data);
+    free(batch.offsets);
+    free(types);
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * Send checkpoint dirty pfn list to primary.
+ */
+static int send_checkpoint_dirty_pfn_list(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc = -1;
+    unsigned count, written;
+    uint64_t i, *pfns = NULL;
+    struct iovec *iov = NULL;
+    xc_shadow_op_stats_t stats = { 0, ctx->restore.p2m_size };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST,
+    };
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->restore.dirty_bitmap_hbuf);
+
+    if ( xc_shadow_control(
+             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+             HYPERCALL_BUFFER(dirty_bitmap), ctx->restore.p2m_size,
+             NULL, 0, &stats) != ctx->restore.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        goto err;
+    }
+
+    for ( i = 0, count = 0; i < ctx->restore.p2m_size; i++ )
+    {
+        if ( test_bit(i, dirty_bitmap) )
+            count++;
+    }
+
+
+    pfns = malloc(count * sizeof(*pfns));
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate %zu bytes of memory for dirty pfn list",
+              count * sizeof(*pfns));
+        goto err;
+    }
+
+    for ( i = 0, written = 0; i < ctx->restore.p2m_size; ++i )
+    {
+        if ( !test_bit(i, dirty_bitmap) )
+            continue;
+
+        if ( written > count )
+        {
+            ERROR("Dirty pfn list exceed");
+            goto err;
+        }
+
+        pfns[written++] = i;
+    }
+
+    /* iovec[] for writev(). */
+    iov = malloc(3 * sizeof(*iov));
+    if ( !iov )
+    {
+        ERROR("Unable to allocate memory for sending dirty bitmap");
+        goto err;
+    }
+
+    rec.length = count * sizeof(*pfns);
+
+    iov[0].iov_base = &rec.type;
+    iov[0].iov_len = sizeof(rec.type);
+
+    iov[1].iov_base = &rec.length;
+    iov[1].iov_len = sizeof(rec.length);
+
+    iov[2].iov_base = pfns;
+    iov[2].iov_len = count * sizeof(*pfns);
+
+    if ( writev_exact(ctx->restore.send_back_fd, iov, 3) )
+    {
+        PERROR("Failed to write dirty bitmap to stream");
+        goto err;
+    }
+
+    rc = 0;
+ err:
+    free(pfns);
+    free(iov);
+    return rc;
+}
+
+static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec);
+
+/*
+ * Post-copy migration.
+ *
+ * The sender lists the pfns whose final contents it will only send once the
+ * domain is running here (POSTCOPY_PFNS), then sends the rest of the domain
+ * state and POSTCOPY_TRANSITION.  If mem_paging can be used, the outstanding
+ * pfns are paged out and the domain is resumed.  The pages it faults on are
+ * then requested over the back channel while the sender pushes the others in
+ * the background.  Otherwise, the remaining pages are received as usual
+ * before the domain is resumed.
+ */
+
+static bool postcopy_is_outstanding(const struct xc_sr_context *ctx,
+                                    xen_pfn_t pfn)
+{
+    if ( !ctx->restore.postcopy.outstanding ||
+         pfn > ctx->restore.postcopy.max_outstanding_pfn )
+        return false;
+    return test_bit(pfn, ctx->restore.postcopy.outstanding);
+}
+
+static int handle_postcopy_pfns(struct xc_sr_context *ctx,
+                                struct xc_sr_record *rec)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_pfn_list *hdr = rec->data;
+    xen_pfn_t *pfns = NULL;
+    unsigned i;
+    int rc = -1;
+
+    if ( ctx->restore.postcopy.active )
+    {
+        ERROR("POSTCOPY_PFNS record after POSTCOPY_TRANSITION");
+        goto err;
+    }
+
+    if ( rec->length < sizeof(*hdr) ||
+         rec->length != sizeof(*hdr) + hdr->count * sizeof(uint64_t) )
+    {
+        ERROR("POSTCOPY_PFNS record wrong size: length %u", rec->length);
+        goto err;
+    }
+
+    pfns = malloc(hdr->count * sizeof(*pfns));
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate memory for %u post-copy pfns", hdr->count);
+        goto err;
+    }
+
+    for ( i = 0; i < hdr->count; ++i )
+    {
+        pfns[i] = hdr->pfn[i];
+        if ( pfns[i] != hdr->pfn[i] ||
+             !ctx->restore.ops.pfn_is_valid(ctx, pfns[i]) )
+        {
+            ERROR("pfn %#"PRIx64" (index %u) outside domain maximum",
+                  hdr->pfn[i], i);
+            goto err;
+        }
+
+        if ( expand_pfn_bitmap(ctx, &ctx->restore.postcopy.outstanding,
+                               &ctx->restore.postcopy.max_outstanding_pfn,
+                               pfns[i]) )
+            goto err;
+
+        if ( !test_and_set_bit(pfns[i], ctx->restore.postcopy.outstanding) )
+            ctx->restore.postcopy.nr_outstanding++;
+    }
+
+    /* Paging out needs the pfns to be populated. */
+    rc = populate_pfns(ctx, hdr->count, pfns, NULL);
+
+ err:
+    free(pfns);
+
+    return rc;
+}
+
+/*
+ * Write as much of the queued POSTCOPY_FAULT records as the back channel
+ * takes without blocking.  Its flags are shared with whoever else has the
+ * file open, so rather than making it non-blocking, only write while poll()
+ * reports it writable, and no more than PIPE_BUF at a time.
+ */
+static int postcopy_flush_requests(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct pollfd pfd = { .fd = ctx->restore.send_back_fd, .events = POLLOUT };
+    ssize_t len;
+    int rc;
+
+    while ( ctx->restore.postcopy.requests_sent <
+            ctx->restore.postcopy.requests_len )
+    {
+        rc = poll(&pfd, 1, 0);
+        if ( rc < 0 && errno == EINTR )
+            continue;
+        if ( rc < 0 )
+        {
+            PERROR("Failed to poll the back channel");
+            return -1;
+        }
+        if ( rc == 0 )
+            return 0;
+
+        len = write(ctx->restore.send_back_fd,
+                    ctx->restore.postcopy.requests +
+                    ctx->restore.postcopy.requests_sent,
+                    min_t(size_t, PIPE_BUF,
+                          ctx->restore.postcopy.requests_len -
+                          ctx->restore.postcopy.requests_sent));
+        if ( len < 0 )
+        {
+            if ( errno == EINTR || errno == EAGAIN )
+                continue;
+
+            PERROR("Failed to write post-copy faults to the back channel");
+            return -1;
+        }
+
+        ctx->restore.postcopy.requests_sent += len;
+    }
+
+    ctx->restore.postcopy.requests_len = 0;
+    ctx->restore.postcopy.requests_sent = 0;
+
+    return 0;
+}
+
+/* Ask the sender for a set of pfns, ahead of its background push. */
+static int postcopy_request_pfns(struct xc_sr_context *ctx,
+                                 uint64_t *pfns, unsigned count)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_rec_pfn_list hdr = { .count = count };
+    struct xc_sr_rhdr rhdr =
+    {
+        .type = REC_TYPE_POSTCOPY_FAULT,
+        .length = sizeof(hdr) + count * sizeof(*pfns),
+    };
+    size_t len = sizeof(rhdr) + rhdr.length;
+    size_t sent = ctx->restore.postcopy.requests_sent;
+    size_t size = ctx->restore.postcopy.requests_size;
+    void *p;
+
+    if ( ctx->restore.postcopy.requests_len + len > size )
+    {
+        /* Drop what has already been written before growing the queue. */
+        memmove(ctx->restore.postcopy.requests,
+                ctx->restore.postcopy.requests + sent,
+                ctx->restore.postcopy.requests_len - sent);
+        ctx->restore.postcopy.requests_len -= sent;
+        ctx->restore.postcopy.requests_sent = 0;
+
+        while ( ctx->restore.postcopy.requests_len + len > size )
+            size = size * 2 ?: PAGE_SIZE;
+
+        if ( size != ctx->restore.postcopy.requests_size )
+        {
+            p = realloc(ctx->restore.postcopy.requests, size);
+            if ( !p )
+            {
+                ERROR("Unable to allocate %zu bytes of post-copy faults",
+                      size);
+                return -1;
+            }
+
+            ctx->restore.postcopy.requests = p;
+            ctx->restore.postcopy.requests_size = size;
+        }
+    }
+
+    p = ctx->restore.postcopy.requests + ctx->restore.postcopy.requests_len;
+    memcpy(p, &rhdr, sizeof(rhdr));
+    memcpy(p + sizeof(rhdr), &hdr, sizeof(hdr));
+    memcpy(p + sizeof(rhdr) + sizeof(hdr), pfns, count * sizeof(*pfns));
+    ctx->restore.postcopy.requests_len += len;
+
+    return postcopy_flush_requests(ctx);
+}
+
+static void postcopy_put_response(struct xc_sr_context *ctx,
+                                  const vm_event_request_t *req)
+{
+    vm_event_back_ring_t *back_ring = &ctx->restore.postcopy.back_ring;
+    vm_event_response_t rsp =
+    {
+        .version = VM_EVENT_INTERFACE_VERSION,
+        .vcpu_id = req->vcpu_id,
+        .flags = req->flags,
+        .reason = req->reason,
+        .u.mem_paging.gfn = req->u.mem_paging.gfn,
+    };
+
+    memcpy(RING_GET_RESPONSE(back_ring, back_ring->rsp_prod_pvt), &rsp,
+           sizeof(rsp));
+    back_ring->rsp_prod_pvt++;
+    RING_PUSH_RESPONSES(back_ring);
+}
+
+/* Let everything waiting on pfn go, now that its contents are in place. */
+static void postcopy_resume_pending(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                                    bool *notify)
+{
+    vm_event_request_t *pending = ctx->restore.postcopy.pending;
+    unsigned i = 0;
+
+    while ( i < ctx->restore.postcopy.nr_pending )
+    {
+        if ( pending[i].u.mem_paging.gfn != pfn )
+        {
+            ++i;
+            continue;
+        }
+
+        postcopy_put_response(ctx, &pending[i]);
+        pending[i] = pending[--ctx->restore.postcopy.nr_pending];
+        *notify = true;
+    }
+}
+
+/*
+ * Copy a page whose final contents arrived after it could not be paged out.
+ * Mapping it may fail transiently while Xen completes an aborted page-out.
+ */
+static int postcopy_copy_page(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                              const void *page_data)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t gfn = ctx->restore.ops.pfn_to_gfn(ctx, pfn);
+    unsigned tries;
+    void *page;
+    int err;
+
+    for ( tries = 0; tries < 10; ++tries )
+    {
+        page = xenforeignmemory_map(xch->fmem, ctx->domid,
+                                    PROT_READ | PROT_WRITE, 1, &gfn, &err);
+        if ( page && !err )
+        {
+            memcpy(page, page_data, PAGE_SIZE);
+            xenforeignmemory_unmap(xch->fmem, page, 1);
+            return 0;
+        }
+
+        if ( page )
+            xenforeignmemory_unmap(xch->fmem, page, 1);
+        if ( !page )
+            err = -errno;
+        if ( err != -ENOENT )
+            break;
+
+        usleep(1000);
+    }
+
+    ERROR("Unable to map pfn %#"PRIpfn": %d", pfn, err);
+    return -1;
+}
+
+/*
+ * Deal with a pfn which came without data.  Like every outstanding pfn, it
+ * was populated, and most likely paged out, by handle_postcopy_pfns().
+ * Holes and broken pages are removed again, as a regular restore doesn't
+ * populate them.  An allocated page gets its contents back, zeroed if it
+ * was paged out, or else left as they are.
+ */
+static int postcopy_load_empty(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                               uint32_t type)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t gfn = ctx->restore.ops.pfn_to_gfn(ctx, pfn);
+    int rc;
+
+    if ( type != XEN_DOMCTL_PFINFO_XALLOC )
+    {
+        rc = xc_domain_decrease_reservation_exact(xch, ctx->domid, 1, 0, &gfn);
+        if ( rc )
+            PERROR("Failed to remove pfn %#"PRIpfn, pfn);
+        return rc;
+    }
+
+    memset(ctx->restore.postcopy.buffer, 0, PAGE_SIZE);
+    rc = xc_mem_paging_load(xch, ctx->domid, pfn, ctx->restore.postcopy.buffer);
+    if ( rc && errno == ENOENT )
+        /* Not paged out. */
+        rc = 0;
+    if ( rc )
+        PERROR("Failed to load pfn %#"PRIpfn, pfn);
+
+    return rc;
+}
+
+/*
+ * process_page_data() for pages received while mem_paging is in use.
+ * Paged out pages are loaded directly, and anything which faulted on them
+ * is resumed.
+ */
+static int postcopy_load_pages(struct xc_sr_context *ctx, unsigned count,
+                               xen_pfn_t *pfns, uint32_t *types,
+                               void *page_data)
+{
+    xc_interface *xch = ctx->xch;
+    bool notify = false;
+    unsigned i;
+    int rc = 0;
+
+    for ( i = 0; i < count; ++i )
+    {
+        bool has_data = true;
+
+        switch ( types[i] )
+        {
+        case XEN_DOMCTL_PFINFO_XTAB:
+        case XEN_DOMCTL_PFINFO_BROKEN:
+        case XEN_DOMCTL_PFINFO_XALLOC:
+            has_data = false;
+            break;
+        }
+
+        if ( !postcopy_is_outstanding(ctx, pfns[i]) )
+        {
+            ERROR("Received pfn %#"PRIpfn" which is not outstanding", pfns[i]);
+            rc = -1;
+            goto out;
+        }
+
+        clear_bit(pfns[i], ctx->restore.postcopy.outstanding);
+        ctx->restore.postcopy.nr_outstanding--;
+
+        if ( has_data )
+        {
+            rc = ctx->restore.ops.localise_page(ctx, types[i], page_data);
+            if ( rc )
+            {
+                ERROR("Failed to localise pfn %#"PRIpfn" (type %#"PRIx32")",
+                      pfns[i], types[i] >> XEN_DOMCTL_PFINFO_LTAB_SHIFT);
+                goto out;
+            }
+
+            memcpy(ctx->restore.postcopy.buffer, page_data, PAGE_SIZE);
+            rc = xc_mem_paging_load(xch, ctx->domid, pfns[i],
+                                    ctx->restore.postcopy.buffer);
+            if ( rc && errno == ENOENT )
+                /* Not paged out. */
+                rc = postcopy_copy_page(ctx, pfns[i], page_data);
+            if ( rc )
+            {
+                PERROR("Failed to load pfn %#"PRIpfn, pfns[i]);
+                goto out;
+            }
+
+            page_data += PAGE_SIZE;
+        }
+        else
+        {
+            rc = postcopy_load_empty(ctx, pfns[i], types[i]);
+            if ( rc )
+                goto out;
+        }
+
+        postcopy_resume_pending(ctx, pfns[i], &notify);
+    }
+
+ out:
+    if ( notify )
+        xenevtchn_notify(ctx->restore.postcopy.xce,
+                         ctx->restore.postcopy.port);
+
+    return rc;
+}
+
+/*
+ * Consume the paging requests on the ring, asking the sender for pages which
+ * are outstanding and not already asked for.
+ */
+static int postcopy_handle_requests(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    vm_event_back_ring_t *back_ring = &ctx->restore.postcopy.back_ring;
+    vm_event_request_t req;
+    uint64_t faults[64];
+    unsigned i, nr_faults = 0;
+    bool notify = false, pending;
+    int rc = 0;
+
+    while ( RING_HAS_UNCONSUMED_REQUESTS(back_ring) )
+    {
+        memcpy(&req, RING_GET_REQUEST(back_ring, back_ring->req_cons),
+               sizeof(req));
+        back_ring->req_cons++;
+        back_ring->sring->req_event = back_ring->req_cons + 1;
+
+        if ( req.version != VM_EVENT_INTERFACE_VERSION )
+        {
+            ERROR("Paging request version %#x, expected %#x",
+                  req.version, VM_EVENT_INTERFACE_VERSION);
+            rc = -1;
+            goto out;
+        }
+
+        if ( !postcopy_is_outstanding(ctx, req.u.mem_paging.gfn) )
+        {
+            /* Already loaded, only a paused vcpu needs telling. */
+            if ( (req.flags & VM_EVENT_FLAG_VCPU_PAUSED) ||
+                 (req.u.mem_paging.flags & MEM_PAGING_EVICT_FAIL) )
+            {
+                postcopy_put_response(ctx, &req);
+                notify = true;
+            }
+            continue;
+        }
+
+        for ( i = 0, pending = false;
+              i < ctx->restore.postcopy.nr_pending; ++i )
+            if ( ctx->restore.postcopy.pending[i].u.mem_paging.gfn ==
+                 req.u.mem_paging.gfn )
+                pending = true;
+
+        if ( ctx->restore.postcopy.nr_pending ==
+             ctx->restore.postcopy.max_pending )
+        {
+            unsigned new_max = ctx->restore.postcopy.max_pending * 2 ?: 16;
+            vm_event_request_t *p = realloc(ctx->restore.postcopy.pending,
+                                            new_max * sizeof(*p));
+
+            if ( !p )
+            {
+                ERROR("Unable to allocate memory for %u paging requests",
+                      new_max);
+                rc = -1;
+                goto out;
+            }
+
+            ctx->restore.postcopy.pending = p;
+            ctx->restore.postcopy.max_pending = new_max;
+        }
+
+        ctx->restore.postcopy.pending[ctx->restore.postcopy.nr_pending++] = req;
+
+        if ( pending )
+            continue;
+
+        faults[nr_faults++] = req.u.mem_paging.gfn;
+        if ( nr_faults == ARRAY_SIZE(faults) )
+        {
+            rc = postcopy_request_pfns(ctx, faults, nr_faults);
+            if ( rc )
+                goto out;
+            nr_faults = 0;
+        }
+    }
+
+    if ( nr_faults )
+        rc = postcopy_request_pfns(ctx, faults, nr_faults);
+
+ out:
+    if ( notify )
+        xenevtchn_notify(ctx->restore.postcopy.xce,
+                         ctx->restore.postcopy.port);
+
+    return rc;
+}
+
+static int postcopy_enable_paging(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    vm_event_sring_t *sring;
+
+    ctx->restore.postcopy.buffer = xc_memalign(xch, PAGE_SIZE, PAGE_SIZE);
+    if ( !ctx->restore.postcopy.buffer )
+    {
+        ERROR("Unable to allocate post-copy page buffer");
+        return -1;
+    }
+
+    ctx->restore.postcopy.ring_page =
+        xc_vm_event_enable(xch, ctx->domid, HVM_PARAM_PAGING_RING_PFN,
+                           &ctx->restore.postcopy.evtchn_port);
+    if ( !ctx->restore.postcopy.ring_page )
+        return -1;
+
+    ctx->restore.postcopy.paging = true;
+
+    ctx->restore.postcopy.xce = xenevtchn_open(NULL, 0);
+    if ( !ctx->restore.postcopy.xce )
+    {
+        PERROR("Failed to open event channel");
+        return -1;
+    }
+
+    ctx->restore.postcopy.port =
+        xenevtchn_bind_interdomain(ctx->restore.postcopy.xce, ctx->domid,
+                                   ctx->restore.postcopy.evtchn_port);
+    if ( ctx->restore.postcopy.port < 0 )
+    {
+        PERROR("Failed to bind event channel");
+        return -1;
+    }
+
+    sring = ctx->restore.postcopy.ring_page;
+    SHARED_RING_INIT(sring);
+    BACK_RING_INIT(&ctx->restore.postcopy.back_ring, sring, PAGE_SIZE);
+
+    return 0;
+}
+
+static void postcopy_disable_paging(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+
+    if ( ctx->restore.postcopy.paging &&
+         xc_mem_paging_disable(xch, ctx->domid) )
+        PERROR("Failed to disable paging");
+    ctx->restore.postcopy.paging = false;
+
+    if ( ctx->restore.postcopy.xce )
+    {
+        if ( ctx->restore.postcopy.port >= 0 )
+            xenevtchn_unbind(ctx->restore.postcopy.xce,
+                             ctx->restore.postcopy.port);
+        xenevtchn_close(ctx->restore.postcopy.xce);
+        ctx->restore.postcopy.xce = NULL;
+    }
+
+    if ( ctx->restore.postcopy.ring_page )
+    {
+        munmap(ctx->restore.postcopy.ring_page, PAGE_SIZE);
+        ctx->restore.postcopy.ring_page = NULL;
+    }
+
+    free(ctx->restore.postcopy.buffer);
+    ctx->restore.postcopy.buffer = NULL;
+}
+
+/*
+ * Page out the outstanding pfns.  Those which can't be are returned in
+ * *busy, and must be received before the domain is resumed.
+ */
+static int postcopy_page_out(struct xc_sr_context *ctx, uint64_t **busy,
+                             unsigned *nr_busy)
+{
+    xc_interface *xch = ctx->xch;
+    xen_pfn_t pfn;
+    uint64_t *p;
+
+    for ( pfn = 0; pfn <= ctx->restore.postcopy.max_outstanding_pfn; ++pfn )
+    {
+        if ( !test_bit(pfn, ctx->restore.postcopy.outstanding) )
+            continue;
+
+        if ( !xc_mem_paging_nominate(xch, ctx->domid, pfn) &&
+             !xc_mem_paging_evict(xch, ctx->domid, pfn) )
+            continue;
+
+        if ( errno != EBUSY )
+        {
+            PERROR("Failed to page out pfn %#"PRIpfn, pfn);
+            return -1;
+        }
+
+        p = realloc(*busy, (*nr_busy + 1) * sizeof(**busy));
+        if ( !p )
+        {
+            ERROR("Unable to allocate memory for busy pfns");
+            return -1;
+        }
+
+        *busy = p;
+        (*busy)[(*nr_busy)++] = pfn;
+    }
+
+    return 0;
+}
+
+/*
+ * Process PAGE_DATA records until none of pfns are outstanding any more.
+ */
+static int postcopy_wait_pfns(struct xc_sr_context *ctx, const uint64_t *pfns,
+                              unsigned count)
+{
+    xc_interface *xch = ctx->xch;
+    struct pollfd pfds[] =
+    {
+        { .fd = ctx->fd, .events = POLLIN },
+        { .fd = ctx->restore.send_back_fd },
+    };
+    struct xc_sr_record rec;
+    unsigned i = 0;
+    int rc;
+
+    while ( i < count )
+    {
+        if ( !postcopy_is_outstanding(ctx, pfns[i]) )
+        {
+            ++i;
+            continue;
+        }
+
+        pfds[1].events = ctx->restore.postcopy.requests_len ? POLLOUT : 0;
+        rc = poll(pfds, ARRAY_SIZE(pfds), -1);
+        if ( rc < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            PERROR("Failed to poll during post-copy");
+            return -1;
+        }
+
+        if ( pfds[1].revents )
+        {
+            rc = postcopy_flush_requests(ctx);
+            if ( rc )
+                return rc;
+        }
+
+        if ( !pfds[0].revents )
+            continue;
+
+        rc = read_record(ctx, ctx->fd, &rec);
+        if ( rc )
+            return rc;
+
+        if ( rec.type != REC_TYPE_PAGE_DATA &&
+             rec.type != REC_TYPE_PAGE_DATA_COMPRESSED &&
+             rec.type != REC_TYPE_ZERO_PAGES &&
+             rec.type != REC_TYPE_DUPLICATE_PAGES )
+        {
+            ERROR("Unexpected record (0x%08x, %s) during post-copy",
+                  rec.type, rec_type_to_str(rec.type));
+            free(rec.data);
+            return -1;
+        }
+
+        rc = process_record(ctx, &rec);
+        if ( rc )
+            return rc;
+    }
+
+    return 0;
+}
+
+/*
+ * With the domain running, receive the remaining pages while forwarding the
+ * domain's faults to the sender, up to and including the END record.
+ */
+static int postcopy_serve(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct pollfd pfds[] =
+    {
+        { .fd = ctx->fd, .events = POLLIN },
+        { .fd = xenevtchn_fd(ctx->restore.postcopy.xce), .events = POLLIN },
+        { .fd = ctx->restore.send_back_fd },
+    };
+    struct xc_sr_record rec;
+    xenevtchn_port_or_error_t port;
+    int rc;
+
+    for ( ;; )
+    {
+        pfds[2].events = ctx->restore.postcopy.requests_len ? POLLOUT : 0;
+        rc = poll(pfds, ARRAY_SIZE(pfds), -1);
+        if ( rc < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            PERROR("Failed to poll during post-copy");
+            return -1;
+        }
+
+        if ( pfds[1].revents & POLLIN )
+        {
+            port = xenevtchn_pending(ctx->restore.postcopy.xce);
+            if ( port < 0 ||
+                 xenevtchn_unmask(ctx->restore.postcopy.xce, port) )
+            {
+                PERROR("Failed to handle the paging event channel");
+                return -1;
+            }
+
+            rc = postcopy_handle_requests(ctx);
+            if ( rc )
+                return rc;
+        }
+
+        if ( pfds[2].revents )
+        {
+            rc = postcopy_flush_requests(ctx);
+            if ( rc )
+                return rc;
+        }
+
+        if ( !pfds[0].revents )
+            continue;
+
+        rc = read_record(ctx, ctx->fd, &rec);
+        if ( rc )
+            return rc;
+
+        switch ( rec.type )
+        {
+        case REC_TYPE_END:
+            if ( ctx->restore.postcopy.nr_outstanding )
+            {
+                ERROR("Stream ended with %lu pages outstanding",
+                      ctx->restore.postcopy.nr_outstanding);
+                return -1;
+            }
+            return 0;
+
+        case REC_TYPE_PAGE_DATA:
+        case REC_TYPE_PAGE_DATA_COMPRESSED:
+        case REC_TYPE_ZERO_PAGES:
+        case REC_TYPE_DUPLICATE_PAGES:
+            rc = process_record(ctx, &rec);
+            if ( rc )
+                return rc;
+            break;
+
+        default:
+            ERROR("Unexpected record (0x%08x, %s) during post-copy",
+                  rec.type, rec_type_to_str(rec.type));
+            free(rec.data);
+            return -1;
+        }
+    }
+}
+
+static int handle_postcopy_transition(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct restore_callbacks *callbacks = ctx->restore.callbacks;
+    uint64_t *busy = NULL;
+    unsigned nr_busy = 0;
+    int rc;
+
+    if ( ctx->restore.postcopy.active )
+    {
+        ERROR("Duplicate POSTCOPY_TRANSITION record");
+        return -1;
+    }
+
+    ctx->restore.postcopy.active = true;
+
+    if ( !ctx->restore.postcopy.nr_outstanding )
+        return 0;
+
+    if ( !callbacks || !callbacks->postcopy_resume ||
+         !callbacks->restore_results ||
+         ctx->restore.send_back_fd < 0 )
+    {
+        DPRINTF("Unable to resume early, receiving remaining %lu pages",
+                ctx->restore.postcopy.nr_outstanding);
+        return 0;
+    }
+
+    if ( postcopy_enable_paging(ctx) )
+    {
+        IPRINTF("mem_paging unavailable, receiving remaining %lu pages",
+                ctx->restore.postcopy.nr_outstanding);
+        postcopy_disable_paging(ctx);
+        return 0;
+    }
+
+    rc = postcopy_page_out(ctx, &busy, &nr_busy);
+    if ( rc )
+        goto out;
+
+    if ( nr_busy )
+    {
+        DPRINTF("Post-copy: %u pages could not be paged out", nr_busy);
+
+        rc = postcopy_request_pfns(ctx, busy, nr_busy);
+        if ( rc )
+            goto out;
+
+        rc = postcopy_wait_pfns(ctx, busy, nr_busy);
+        if ( rc )
+            goto out;
+    }
+
+    rc = ctx->restore.ops.stream_complete(ctx);
+    if ( rc )
+        goto out;
+
+    callbacks->restore_results(ctx->restore.xenstore_gfn,
+                               ctx->restore.console_gfn, callbacks->data);
+
+    if ( callbacks->postcopy_resume(callbacks->data) != 1 )
+    {
+        ERROR("Failed to resume the domain");
+        rc = -1;
+        goto out;
+    }
+
+    ctx->restore.postcopy.resumed = true;
+    IPRINTF("Domain resumed with %lu pages outstanding",
+            ctx->restore.postcopy.nr_outstanding);
+
+    rc = postcopy_serve(ctx);
+
+ out:
+    free(busy);
+
+    return rc;
+}
+
+static int handle_checkpoint(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    int rc = 0, ret;
+    unsigned i;
+
+    if ( !ctx->restore.checkpointed )
+    {
+        ERROR("Found checkpoint in non-checkpointed stream");
+        rc = -1;
+        goto err;
+    }
+
+    ret = ctx->restore.callbacks->checkpoint(ctx->restore.callbacks->data);
+    switch ( ret )
+    {
+    case XGR_CHECKPOINT_SUCCESS:
+        break;
+
+    case XGR_CHECKPOINT_FAILOVER:
+        if ( ctx->restore.buffer_all_records )
+            rc = BROKEN_CHANNEL;
+        else
+            /* We don't have a consistent state */
+            rc = -1;
+        goto err;
+
+    default: /* Other fatal error */
+        rc = -1;
+        goto err;
+    }
+
+    if ( ctx->restore.buffer_all_records )
+    {
+        IPRINTF("All records buffered");
+
+        for ( i = 0; i < ctx->restore.buffered_rec_num; i++ )
+        {
+            rc = process_record(ctx, &ctx->restore.buffered_records[i]);
+            if ( rc )
+                goto err;
+        }
+        ctx->restore.buffered_rec_num = 0;
+        IPRINTF("All records processed");
+    }
+    else
+        ctx->restore.buffer_all_records = true;
+
+    if ( ctx->restore.checkpointed == XC_MIG_STREAM_COLO )
+    {
+#define HANDLE_CALLBACK_RETURN_VALUE(ret)                   \
+    do {                                                    \
+        if ( ret == 1 )                                     \
+            rc = 0; /* Success */                           \
+        else                                                \
+        {                                                   \
+            if ( ret == 2 )                                 \
+                rc = BROKEN_CHANNEL;                        \
+            else                                            \
+                rc = -1; /* Some unspecified error */       \
+            goto err;                                       \
+        }                                                   \
+    } while (0)
+
+        /* COLO */
+
+        /* We need to resume guest */
+        rc = ctx->restore.ops.stream_complete(ctx);
+        if ( rc )
+            goto err;
+
+        ctx->restore.callbacks->restore_results(ctx->restore.xenstore_gfn,
+                                                ctx->restore.console_gfn,
+                                                ctx->restore.callbacks->data);
+
+        /* Resume secondary vm */
+        ret = ctx->restore.callbacks->postcopy(ctx->restore.callbacks->data);
+        HANDLE_CALLBACK_RETURN_VALUE(ret);
+
+        /* Wait for a new checkpoint */
+        ret = ctx->restore.callbacks->wait_checkpoint(
+                                                ctx->restore.callbacks->data);
+        HANDLE_CALLBACK_RETURN_VALUE(ret);
+
+        /* suspend secondary vm */
+        ret = ctx->restore.callbacks->suspend(ctx->restore.callbacks->data);
+        HANDLE_CALLBACK_RETURN_VALUE(ret);
+
+#undef HANDLE_CALLBACK_RETURN_VALUE
 
         rc = send_checkpoint_dirty_pfn_list(ctx);
         if ( rc )
@@ -640,6 +1947,17 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         rc = handle_page_data(ctx, rec);
         break;
 
+    case REC_TYPE_PAGE_DATA_COMPRESSED:
+        if ( !ctx->restore.workers_created )
+        {
+            /* Not fatal, the records are then handled by this thread. */
+            ctx->restore.workers = sr_workers_create(xch,
+                                                     sr_workers_default());
+            ctx->restore.workers_created = true;
+        }
+        rc = handle_page_data_compressed(ctx, rec);
+        break;
+
     case REC_TYPE_VERIFY:
         DPRINTF("Verify mode enabled");
         ctx->restore.verify = true;
@@ -649,6 +1967,22 @@ static int process_record(struct xc_sr_context *ctx, struct xc_sr_record *rec)
         rc = handle_checkpoint(ctx);
         break;
 
+    case REC_TYPE_ZERO_PAGES:
+        rc = handle_zero_pages(ctx, rec);
+        break;
+
+    case REC_TYPE_DUPLICATE_PAGES:
+        rc = handle_duplicate_pages(ctx, rec);
+        break;
+
+    case REC_TYPE_POSTCOPY_PFNS:
+        rc = handle_postcopy_pfns(ctx, rec);
+        break;
+
+    case REC_TYPE_POSTCOPY_TRANSITION:
+        rc = handle_postcopy_transition(ctx);
+        break;
+
     default:
         rc = ctx->restore.ops.process_record(ctx, rec);
         break;
@@ -723,6 +2057,11 @@ static void cleanup(struct xc_sr_context *ctx)
                                    NRPAGES(bitmap_size(ctx->restore.p2m_size)));
     free(ctx->restore.buffered_records);
     free(ctx->restore.populated_pfns);
+    sr_workers_destroy(ctx->restore.workers);
+    postcopy_disable_paging(ctx);
+    free(ctx->restore.postcopy.pending);
+    free(ctx->restore.postcopy.outstanding);
+    free(ctx->restore.postcopy.requests);
     if ( ctx->restore.ops.cleanup(ctx) )
         PERROR("Failed to clean up");
 }
@@ -783,7 +2122,14 @@ static int restore(struct xc_sr_context *ctx)
                 goto err;
         }
 
-    } while ( rec.type != REC_TYPE_END );
+    } while ( rec.type != REC_TYPE_END && !ctx->restore.postcopy.resumed );
+
+    if ( ctx->restore.postcopy.resumed )
+    {
+        /* The post-copy transition has already called stream_complete. */
+        IPRINTF("Post-copy restore successful");
+        goto done;
+    }
 
  remus_failover:
 
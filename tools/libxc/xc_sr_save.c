@@ -1,7 +1,21 @@
 #include <assert.h>
 #include <arpa/inet.h>
+#include <poll.h>
+#include <zlib.h>
 
 #include "xc_sr_common.h"
+#include "../../xen/include/xen/zero_words.h"
+
+/* Capacity of the buffer used with XEN_DOMCTL_SHADOW_OP_CLEAN_LIST. */
+#define DIRTY_LIST_ENTRIES (1U << 16)
+#define DIRTY_LIST_PAGES   NRPAGES(DIRTY_LIST_ENTRIES * sizeof(uint64_t))
+
+/*
+ * Post-copy: pfns per POSTCOPY_PFNS record, and the size of the background
+ * batches, which bounds how long a fault waits behind them.
+ */
+#define POSTCOPY_PFNS_MAX   (1U << 16)
+#define POSTCOPY_BATCH_SIZE 256
 
 /*
  * Writes an Image header and Domain header into the stream.
@@ -66,6 +80,328 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
     return write_record(ctx, &checkpoint);
 }
 
+/* Number of chunks of a PAGE_DATA_COMPRESSED record, for nr pages of data. */
+#define NR_CHUNKS(nr) (((nr) + PAGE_DATA_CHUNK_PAGES - 1) / PAGE_DATA_CHUNK_PAGES)
+
+/* Output space needed for one compressed chunk. */
+#define CHUNK_BOUND compressBound(PAGE_DATA_CHUNK_PAGES * PAGE_SIZE)
+
+struct compress_batch
+{
+    void **pages;
+    unsigned int nr_pages;
+    void *buf;
+    uint32_t *lengths;
+};
+
+/*
+ * Compress one chunk of a batch.  Chunks which don't shrink are stored as
+ * they are, which the restorer spots by their length.
+ */
+static int compress_chunk(void *arg, unsigned int chunk)
+{
+    struct compress_batch *b = arg;
+    unsigned int first = chunk * PAGE_DATA_CHUNK_PAGES;
+    unsigned int nr = min_t(unsigned int, PAGE_DATA_CHUNK_PAGES,
+                            b->nr_pages - first);
+    uint8_t *out = b->buf + chunk * CHUNK_BOUND;
+    z_stream zs = { .zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL };
+    unsigned int i;
+    int rc = Z_STREAM_ERROR;
+
+    if ( deflateInit(&zs, Z_BEST_SPEED) == Z_OK )
+    {
+        zs.next_out = out;
+        zs.avail_out = CHUNK_BOUND;
+
+        for ( i = 0; i < nr; ++i )
+        {
+            zs.next_in = b->pages[first + i];
+            zs.avail_in = PAGE_SIZE;
+
+            rc = deflate(&zs, (i == nr - 1) ? Z_FINISH : Z_NO_FLUSH);
+            if ( rc != Z_OK && rc != Z_STREAM_END )
+                break;
+        }
+
+        if ( rc == Z_STREAM_END && zs.total_out < nr * PAGE_SIZE )
+            b->lengths[chunk] = zs.total_out;
+        else
+            rc = Z_STREAM_ERROR;
+
+        deflateEnd(&zs);
+    }
+
+    if ( rc != Z_STREAM_END )
+    {
+        for ( i = 0; i < nr; ++i )
+            memcpy(out + i * PAGE_SIZE, b->pages[first + i], PAGE_SIZE);
+        b->lengths[chunk] = nr * PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+/*
+ * Write the page data of a batch as a PAGE_DATA_COMPRESSED record.  The
+ * chunks are compressed in parallel by the worker threads.
+ */
+static int write_compressed_batch(struct xc_sr_context *ctx, unsigned nr_pfns,
+                                  uint64_t *rec_pfns, void **guest_data,
+                                  unsigned nr_pages)
+{
+    static const char zeroes[(1u << REC_ALIGN_ORDER) - 1] = { 0 };
+
+    xc_interface *xch = ctx->xch;
+    unsigned int nr_chunks = NR_CHUNKS(nr_pages);
+    uint32_t lengths[NR_CHUNKS(MAX_BATCH_SIZE) + 1] = { 0 };
+    size_t lengths_sz = ROUNDUP(nr_chunks * sizeof(*lengths), REC_ALIGN_ORDER);
+    void *pages[MAX_BATCH_SIZE];
+    struct iovec iov[NR_CHUNKS(MAX_BATCH_SIZE) + 6];
+    struct xc_sr_rec_page_data_compressed_header hdr = { 0 };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_PAGE_DATA_COMPRESSED,
+    };
+    struct compress_batch batch =
+    {
+        .pages = pages,
+        .nr_pages = nr_pages,
+        .buf = ctx->save.compress_buf,
+        .lengths = lengths,
+    };
+    unsigned int i, p;
+    int iovcnt;
+
+    for ( i = 0, p = 0; i < nr_pfns; ++i )
+        if ( guest_data[i] )
+            pages[p++] = guest_data[i];
+    assert(p == nr_pages);
+
+    if ( sr_workers_run(ctx->save.workers, nr_chunks, compress_chunk, &batch) )
+    {
+        ERROR("Failed to compress a batch of %u pages", nr_pages);
+        return -1;
+    }
+
+    hdr.count = nr_pfns;
+    hdr.nr_chunks = nr_chunks;
+    hdr.algorithm = PAGE_DATA_COMPRESS_ZLIB;
+
+    rec.length = sizeof(hdr);
+    rec.length += nr_pfns * sizeof(*rec_pfns);
+    rec.length += lengths_sz;
+
+    iov[0].iov_base = &rec.type;
+    iov[0].iov_len = sizeof(rec.type);
+
+    iov[1].iov_base = &rec.length;
+    iov[1].iov_len = sizeof(rec.length);
+
+    iov[2].iov_base = &hdr;
+    iov[2].iov_len = sizeof(hdr);
+
+    iov[3].iov_base = rec_pfns;
+    iov[3].iov_len = nr_pfns * sizeof(*rec_pfns);
+
+    iov[4].iov_base = lengths;
+    iov[4].iov_len = lengths_sz;
+
+    iovcnt = 5;
+
+    for ( i = 0; i < nr_chunks; ++i )
+    {
+        iov[iovcnt].iov_base = ctx->save.compress_buf + i * CHUNK_BOUND;
+        iov[iovcnt].iov_len = lengths[i];
+        iovcnt++;
+        rec.length += lengths[i];
+    }
+
+    iov[iovcnt].iov_base = (void *)zeroes;
+    iov[iovcnt].iov_len = ROUNDUP(rec.length, REC_ALIGN_ORDER) - rec.length;
+    iovcnt++;
+
+    if ( writev_exact(ctx->fd, iov, iovcnt) )
+    {
+        PERROR("Failed to write compressed page data to stream");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Slots in the direct-mapped table of recently sent pages. */
+#define DUP_TABLE_ENTRIES (1U << 16)
+
+struct xc_sr_dup_entry
+{
+    uint64_t hash;
+    xen_pfn_t pfn;
+};
+
+static bool page_is_zero(const void *page)
+{
+    return words_are_zero(page, PAGE_SIZE / sizeof(unsigned long));
+}
+
+static uint64_t page_hash(const void *page)
+{
+    const uint64_t *p = page;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*p); ++i )
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+
+    return h ^ (h >> 29);
+}
+
+/*
+ * Called when the domain has been paused: forget the pages sent while it
+ * was running, whose content may have changed since.
+ */
+static void reset_dup_table(struct xc_sr_context *ctx)
+{
+    if ( !ctx->save.dedup )
+        return;
+
+    memset(ctx->save.dup_table, 0xff,
+           DUP_TABLE_ENTRIES * sizeof(*ctx->save.dup_table));
+    ctx->save.dedup_paused = true;
+}
+
+/*
+ * Look for an earlier page with the same content as page.  Hash matches are
+ * confirmed against the earlier page, which is unchanged as the domain has
+ * been paused since it was sent.  Otherwise, remember page as the latest
+ * with its hash.
+ */
+static int find_dup_page(struct xc_sr_context *ctx, xen_pfn_t pfn,
+                         const void *page, xen_pfn_t *source_pfn)
+{
+    xc_interface *xch = ctx->xch;
+    uint64_t hash = page_hash(page);
+    struct xc_sr_dup_entry *e =
+        &ctx->save.dup_table[hash & (DUP_TABLE_ENTRIES - 1)];
+    xen_pfn_t gfn;
+    void *source;
+    int err, dup = 0;
+
+    if ( e->hash == hash && e->pfn != INVALID_PFN && e->pfn != pfn )
+    {
+        gfn = ctx->save.ops.pfn_to_gfn(ctx, e->pfn);
+        source = xenforeignmemory_map(xch->fmem, ctx->domid, PROT_READ,
+                                      1, &gfn, &err);
+        if ( source )
+        {
+            if ( !err && !memcmp(source, page, PAGE_SIZE) )
+            {
+                *source_pfn = e->pfn;
+                dup = 1;
+            }
+            xenforeignmemory_unmap(xch->fmem, source, 1);
+        }
+    }
+
+    if ( !dup )
+    {
+        e->hash = hash;
+        e->pfn = pfn;
+    }
+
+    return dup;
+}
+
+/*
+ * Take zero pages, and duplicates of pages already sent, out of a batch.  The
+ * batch is compacted in place and its new size returned.  The pfns taken out
+ * are sent by write_elided_pages() once the page data has been written.
+ */
+static unsigned elide_pages(struct xc_sr_context *ctx, unsigned nr_pfns,
+                            xen_pfn_t *types, void **guest_data,
+                            unsigned *nr_pages)
+{
+    xen_pfn_t pfn, source_pfn;
+    unsigned i, j;
+
+    for ( i = 0, j = 0; i < nr_pfns; ++i )
+    {
+        pfn = ctx->save.batch_pfns[i];
+
+        if ( guest_data[i] && types[i] == XEN_DOMCTL_PFINFO_NOTAB )
+        {
+            if ( page_is_zero(guest_data[i]) )
+            {
+                ctx->save.zero_pfns[ctx->save.nr_zero_pfns++] = pfn;
+                --*nr_pages;
+                continue;
+            }
+
+            if ( ctx->save.dedup_paused &&
+                 find_dup_page(ctx, pfn, guest_data[i], &source_pfn) )
+            {
+                ctx->save.dup_pages[ctx->save.nr_dup_pages].pfn = pfn;
+                ctx->save.dup_pages[ctx->save.nr_dup_pages].source_pfn =
+                    source_pfn;
+                ctx->save.nr_dup_pages++;
+                --*nr_pages;
+                continue;
+            }
+        }
+
+        ctx->save.batch_pfns[j] = pfn;
+        types[j] = types[i];
+        guest_data[j] = guest_data[i];
+        ++j;
+    }
+
+    return j;
+}
+
+/*
+ * Write the ZERO_PAGES and DUPLICATE_PAGES records for a batch.  They follow
+ * its PAGE_DATA, which may contain the source of a duplicate.
+ */
+static int write_elided_pages(struct xc_sr_context *ctx)
+{
+    struct xc_sr_rec_pfn_list zero = { .count = ctx->save.nr_zero_pfns };
+    struct xc_sr_rec_duplicate_pages dup = { .count = ctx->save.nr_dup_pages };
+    struct xc_sr_record rec;
+    int rc;
+
+    if ( ctx->save.nr_zero_pfns )
+    {
+        rec.type = REC_TYPE_ZERO_PAGES;
+        rec.length = sizeof(zero);
+        rec.data = &zero;
+
+        rc = write_split_record(ctx, &rec, ctx->save.zero_pfns,
+                                zero.count * sizeof(*ctx->save.zero_pfns));
+        if ( rc )
+            return rc;
+
+        ctx->save.zero_count += zero.count;
+        ctx->save.nr_zero_pfns = 0;
+    }
+
+    if ( ctx->save.nr_dup_pages )
+    {
+        rec.type = REC_TYPE_DUPLICATE_PAGES;
+        rec.length = sizeof(dup);
+        rec.data = &dup;
+
+        rc = write_split_record(ctx, &rec, ctx->save.dup_pages,
+                                dup.count * sizeof(*ctx->save.dup_pages));
+        if ( rc )
+            return rc;
+
+        ctx->save.dup_count += dup.count;
+        ctx->save.nr_dup_pages = 0;
+    }
+
+    return 0;
+}
+
 /*
  * Writes a batch of memory as a PAGE_DATA record into the stream.  The batch
  * is constructed in ctx->save.batch_pfns.
@@ -74,6 +410,7 @@ static int write_checkpoint_record(struct xc_sr_context *ctx)
  * - gets the types for each pfn in the batch.
  * - for each pfn with real data:
  *   - maps and attempts to localise the pages.
+ * - optionally takes zero and duplicate pages out of the batch.
  * - construct and writes a PAGE_DATA record into the stream.
  */
 static int write_batch(struct xc_sr_context *ctx)
@@ -85,7 +422,7 @@ static int write_batch(struct xc_sr_context *ctx)
     void **local_pages = NULL;
     int *errors = NULL, rc = -1;
     unsigned i, p, nr_pages = 0, nr_pages_mapped = 0;
-    unsigned nr_pfns = ctx->save.nr_batch_pfns;
+    unsigned nr_pfns = ctx->save.nr_batch_pfns, nr_rec_pfns = nr_pfns;
     void *page, *orig_page;
     uint64_t *rec_pfns = NULL;
     struct iovec *iov = NULL; int iovcnt = 0;
@@ -205,23 +542,40 @@ static int write_batch(struct xc_sr_context *ctx)
         }
     }
 
-    rec_pfns = malloc(nr_pfns * sizeof(*rec_pfns));
+    if ( ctx->save.dedup && nr_pages )
+    {
+        nr_rec_pfns = elide_pages(ctx, nr_pfns, types, guest_data, &nr_pages);
+        if ( nr_rec_pfns == 0 )
+            goto done;
+    }
+
+    rec_pfns = malloc(nr_rec_pfns * sizeof(*rec_pfns));
     if ( !rec_pfns )
     {
         ERROR("Unable to allocate %zu bytes of memory for page data pfn list",
-              nr_pfns * sizeof(*rec_pfns));
+              nr_rec_pfns * sizeof(*rec_pfns));
         goto err;
     }
 
-    hdr.count = nr_pfns;
+    for ( i = 0; i < nr_rec_pfns; ++i )
+        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
+
+    if ( ctx->save.compress && nr_pages )
+    {
+        if ( write_compressed_batch(ctx, nr_rec_pfns, rec_pfns, guest_data,
+                                    nr_pages) )
+            goto err;
+
+        nr_pages = 0;
+        goto done;
+    }
+
+    hdr.count = nr_rec_pfns;
 
     rec.length = sizeof(hdr);
-    rec.length += nr_pfns * sizeof(*rec_pfns);
+    rec.length += nr_rec_pfns * sizeof(*rec_pfns);
     rec.length += nr_pages * PAGE_SIZE;
 
-    for ( i = 0; i < nr_pfns; ++i )
-        rec_pfns[i] = ((uint64_t)(types[i]) << 32) | ctx->save.batch_pfns[i];
-
     iov[0].iov_base = &rec.type;
     iov[0].iov_len = sizeof(rec.type);
 
@@ -232,13 +586,13 @@ static int write_batch(struct xc_sr_context *ctx)
     iov[2].iov_len = sizeof(hdr);
 
     iov[3].iov_base = rec_pfns;
-    iov[3].iov_len = nr_pfns * sizeof(*rec_pfns);
+    iov[3].iov_len = nr_rec_pfns * sizeof(*rec_pfns);
 
     iovcnt = 4;
 
     if ( nr_pages )
     {
-        for ( i = 0; i < nr_pfns; ++i )
+        for ( i = 0; i < nr_rec_pfns; ++i )
         {
             if ( guest_data[i] )
             {
@@ -256,8 +610,13 @@ static int write_batch(struct xc_sr_context *ctx)
         goto err;
     }
 
+ done:
     /* Sanity check we have sent all the pages we expected to. */
     assert(nr_pages == 0);
+
+    if ( write_elided_pages(ctx) )
+        goto err;
+
     rc = ctx->save.nr_batch_pfns = 0;
 
  err:
@@ -351,6 +710,8 @@ static int suspend_domain(struct xc_sr_context *ctx)
 
     xc_report_progress_single(xch, "Domain now suspended");
 
+    reset_dup_table(ctx);
+
     return 0;
 }
 
@@ -398,6 +759,71 @@ static int send_dirty_pages(struct xc_sr_context *ctx,
     return ctx->save.ops.check_vm_state(ctx);
 }
 
+/*
+ * Send the pages listed by XEN_DOMCTL_SHADOW_OP_CLEAN_LIST.  The cost only
+ * depends on the number of dirty pages, not on the size of the guest.
+ */
+static int send_dirty_list(struct xc_sr_context *ctx, unsigned long entries)
+{
+    xc_interface *xch = ctx->xch;
+    unsigned long i;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
+
+    for ( i = 0; i < entries; ++i )
+    {
+        if ( dirty_list[i] >= ctx->save.p2m_size )
+            continue;
+
+        rc = add_to_batch(ctx, dirty_list[i]);
+        if ( rc )
+            return rc;
+
+        /* Update progress every 4MB worth of memory sent. */
+        if ( (i & ((1U << (22 - 12)) - 1)) == 0 )
+            xc_report_progress_step(xch, i, entries);
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        return rc;
+
+    xc_report_progress_step(xch, entries, entries);
+
+    return ctx->save.ops.check_vm_state(ctx);
+}
+
+/*
+ * Fetch and clean the list of pages dirtied since the last round.  Returns
+ * the number of entries, or -1 if the whole bitmap has to be used instead
+ * (list not started yet, overflowed, or not supported by Xen).
+ */
+static int clean_dirty_list(struct xc_sr_context *ctx,
+                            xc_shadow_op_stats_t *stats)
+{
+    xc_interface *xch = ctx->xch;
+    int rc;
+
+    if ( ctx->save.dirty_list_unsupported )
+        return -1;
+
+    rc = xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN_LIST,
+                           &ctx->save.dirty_list_hbuf, DIRTY_LIST_ENTRIES,
+                           NULL, 0, stats);
+    if ( rc < 0 )
+    {
+        if ( errno != ENOBUFS )
+        {
+            DPRINTF("Dirty pfn list unavailable, using the bitmap only");
+            ctx->save.dirty_list_unsupported = true;
+        }
+        return -1;
+    }
+
+    return rc;
+}
+
 /*
  * Send all pages in the guests p2m.  Used as the first iteration of the live
  * migration loop, and for a non-live save.
@@ -475,7 +901,7 @@ static int send_memory_live(struct xc_sr_context *ctx)
     xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
     char *progress_str = NULL;
     unsigned x;
-    int rc;
+    int rc, nr_list;
 
     rc = update_progress_string(ctx, &progress_str, 0);
     if ( rc )
@@ -489,7 +915,10 @@ static int send_memory_live(struct xc_sr_context *ctx)
           ((x < ctx->save.max_iterations) &&
            (stats.dirty_count > ctx->save.dirty_threshold)); ++x )
     {
-        if ( xc_shadow_control(
+        nr_list = clean_dirty_list(ctx, &stats);
+
+        if ( nr_list < 0 &&
+             xc_shadow_control(
                  xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
                  &ctx->save.dirty_bitmap_hbuf, ctx->save.p2m_size,
                  NULL, 0, &stats) != ctx->save.p2m_size )
@@ -506,7 +935,10 @@ static int send_memory_live(struct xc_sr_context *ctx)
         if ( rc )
             goto out;
 
-        rc = send_dirty_pages(ctx, stats.dirty_count);
+        if ( nr_list < 0 )
+            rc = send_dirty_pages(ctx, stats.dirty_count);
+        else
+            rc = send_dirty_list(ctx, nr_list);
         if ( rc )
             goto out;
     }
@@ -633,6 +1065,222 @@ static int suspend_and_send_dirty(struct xc_sr_context *ctx)
     return rc;
 }
 
+/*
+ * Post-copy: suspend the domain, and rather than sending the pages dirtied
+ * since the last iteration, tell the restorer which pfns they are.  The
+ * restorer marks them as paged out, resumes the domain, and demand-fetches
+ * them from send_postcopy_pages().
+ */
+static int suspend_and_send_postcopy_pfns(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    xc_shadow_op_stats_t stats = { 0, ctx->save.p2m_size };
+    struct xc_sr_rec_pfn_list hdr = { 0 };
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_POSTCOPY_PFNS,
+        .length = sizeof(hdr),
+        .data = &hdr,
+    };
+    uint64_t *pfns = NULL;
+    xen_pfn_t p;
+    unsigned long total = 0;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    rc = suspend_domain(ctx);
+    if ( rc )
+        goto out;
+
+    if ( xc_shadow_control(
+             xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_CLEAN,
+             HYPERCALL_BUFFER(dirty_bitmap), ctx->save.p2m_size,
+             NULL, XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL, &stats) !=
+         ctx->save.p2m_size )
+    {
+        PERROR("Failed to retrieve logdirty bitmap");
+        rc = -1;
+        goto out;
+    }
+
+    bitmap_or(dirty_bitmap, ctx->save.deferred_pages, ctx->save.p2m_size);
+    bitmap_clear(ctx->save.deferred_pages, ctx->save.p2m_size);
+    ctx->save.nr_deferred_pages = 0;
+
+    pfns = malloc(POSTCOPY_PFNS_MAX * sizeof(*pfns));
+    if ( !pfns )
+    {
+        ERROR("Unable to allocate memory for post-copy pfns");
+        rc = -1;
+        goto out;
+    }
+
+    for ( p = 0; p < ctx->save.p2m_size; ++p )
+    {
+        if ( test_bit(p, dirty_bitmap) )
+        {
+            pfns[hdr.count++] = p;
+            ++total;
+        }
+
+        if ( hdr.count == POSTCOPY_PFNS_MAX ||
+             (hdr.count && p == ctx->save.p2m_size - 1) )
+        {
+            rc = write_split_record(ctx, &rec, pfns,
+                                    hdr.count * sizeof(*pfns));
+            if ( rc )
+                goto out;
+
+            hdr.count = 0;
+        }
+    }
+
+    DPRINTF("Post-copy: %lu pages outstanding", total);
+    rc = 0;
+
+ out:
+    free(pfns);
+    return rc;
+}
+
+/*
+ * Read the POSTCOPY_FAULT records waiting on the back channel, if any, and
+ * send the faulted pages which are still outstanding.
+ */
+static int send_postcopy_faults(struct xc_sr_context *ctx,
+                                unsigned long *nr_faults)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec = { 0, 0, NULL };
+    struct xc_sr_rec_pfn_list *faults;
+    struct pollfd pfd = { .fd = ctx->save.recv_fd, .events = POLLIN };
+    unsigned i;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    for ( ;; )
+    {
+        rc = poll(&pfd, 1, 0);
+        if ( rc < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+
+            PERROR("Failed to poll for post-copy faults");
+            return -1;
+        }
+
+        if ( rc == 0 )
+            break;
+
+        rc = read_record(ctx, ctx->save.recv_fd, &rec);
+        if ( rc )
+            goto err;
+
+        faults = rec.data;
+        if ( rec.type != REC_TYPE_POSTCOPY_FAULT ||
+             rec.length < sizeof(*faults) ||
+             rec.length != sizeof(*faults) + faults->count * sizeof(uint64_t) )
+        {
+            ERROR("Bad record (0x%08x, %s, length %u) on the back channel",
+                  rec.type, rec_type_to_str(rec.type), rec.length);
+            rc = -1;
+            goto err;
+        }
+
+        for ( i = 0; i < faults->count; ++i )
+        {
+            if ( faults->pfn[i] >= ctx->save.p2m_size ||
+                 !test_and_clear_bit(faults->pfn[i], dirty_bitmap) )
+                continue;
+
+            ++*nr_faults;
+            rc = add_to_batch(ctx, faults->pfn[i]);
+            if ( rc )
+                goto err;
+        }
+
+        free(rec.data);
+        rec.data = NULL;
+    }
+
+    rc = flush_batch(ctx);
+
+ err:
+    free(rec.data);
+    return rc;
+}
+
+/*
+ * Post-copy: send the outstanding pages, in the background in pfn order and
+ * in preference whenever the restorer reports the domain faulting on one.
+ */
+static int send_postcopy_pages(struct xc_sr_context *ctx)
+{
+    xc_interface *xch = ctx->xch;
+    struct xc_sr_record rec =
+    {
+        .type = REC_TYPE_POSTCOPY_TRANSITION,
+        .length = 0,
+    };
+    unsigned long nr_faults = 0, nr_pushed = 0;
+    xen_pfn_t p;
+    int rc;
+    DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
+                                    &ctx->save.dirty_bitmap_hbuf);
+
+    rc = write_record(ctx, &rec);
+    if ( rc )
+        goto out;
+
+    xc_set_progress_prefix(xch, "Post-copy");
+
+    for ( p = 0; p < ctx->save.p2m_size; ++p )
+    {
+        if ( ctx->save.nr_batch_pfns == POSTCOPY_BATCH_SIZE )
+        {
+            rc = flush_batch(ctx);
+            if ( rc )
+                goto out;
+        }
+
+        if ( ctx->save.nr_batch_pfns == 0 )
+        {
+            rc = send_postcopy_faults(ctx, &nr_faults);
+            if ( rc )
+                goto out;
+        }
+
+        if ( !test_and_clear_bit(p, dirty_bitmap) )
+            continue;
+
+        ++nr_pushed;
+        rc = add_to_batch(ctx, p);
+        if ( rc )
+            goto out;
+    }
+
+    rc = flush_batch(ctx);
+    if ( rc )
+        goto out;
+
+    if ( ctx->save.nr_deferred_pages )
+    {
+        ERROR("%lu pages could not be sent after the domain was resumed",
+              ctx->save.nr_deferred_pages);
+        rc = -1;
+        goto out;
+    }
+
+    DPRINTF("Post-copy: %lu pages faulted, %lu pushed", nr_faults, nr_pushed);
+
+ out:
+    xc_set_progress_prefix(xch, NULL);
+    return rc;
+}
+
 static int verify_frames(struct xc_sr_context *ctx)
 {
     xc_interface *xch = ctx->xch;
@@ -687,7 +1335,10 @@ static int send_domain_memory_live(struct xc_sr_context *ctx)
     if ( rc )
         goto out;
 
-    rc = suspend_and_send_dirty(ctx);
+    if ( ctx->save.postcopy )
+        rc = suspend_and_send_postcopy_pfns(ctx);
+    else
+        rc = suspend_and_send_dirty(ctx);
     if ( rc )
         goto out;
 
@@ -739,6 +1390,8 @@ static int setup(struct xc_sr_context *ctx)
     int rc;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
 
     rc = ctx->save.ops.setup(ctx);
     if ( rc )
@@ -746,6 +1399,47 @@ static int setup(struct xc_sr_context *ctx)
 
     dirty_bitmap = xc_hypercall_buffer_alloc_pages(
                    xch, dirty_bitmap, NRPAGES(bitmap_size(ctx->save.p2m_size)));
+
+    /* Only an optimisation of the live rounds, fall back to the bitmap. */
+    if ( ctx->save.live )
+        dirty_list = xc_hypercall_buffer_alloc_pages(
+                     xch, dirty_list, DIRTY_LIST_PAGES);
+    ctx->save.dirty_list_unsupported = !dirty_list;
+
+    if ( ctx->save.compress )
+    {
+        ctx->save.compress_buf = malloc(NR_CHUNKS(MAX_BATCH_SIZE) *
+                                        CHUNK_BOUND);
+        if ( !ctx->save.compress_buf )
+        {
+            ERROR("Unable to allocate memory for compressing page data");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+
+        /* Not fatal, the batches are then compressed by this thread. */
+        ctx->save.workers = sr_workers_create(xch, sr_workers_default());
+    }
+
+    if ( ctx->save.dedup )
+    {
+        ctx->save.dup_table = malloc(DUP_TABLE_ENTRIES *
+                                     sizeof(*ctx->save.dup_table));
+        ctx->save.zero_pfns = malloc(MAX_BATCH_SIZE *
+                                     sizeof(*ctx->save.zero_pfns));
+        ctx->save.dup_pages = malloc(MAX_BATCH_SIZE *
+                                     sizeof(*ctx->save.dup_pages));
+        if ( !ctx->save.dup_table || !ctx->save.zero_pfns ||
+             !ctx->save.dup_pages )
+        {
+            ERROR("Unable to allocate memory for zero and duplicate pages");
+            rc = -1;
+            errno = ENOMEM;
+            goto err;
+        }
+    }
+
     ctx->save.batch_pfns = malloc(MAX_BATCH_SIZE *
                                   sizeof(*ctx->save.batch_pfns));
     ctx->save.deferred_pages = calloc(1, bitmap_size(ctx->save.p2m_size));
@@ -770,6 +1464,8 @@ static void cleanup(struct xc_sr_context *ctx)
     xc_interface *xch = ctx->xch;
     DECLARE_HYPERCALL_BUFFER_SHADOW(unsigned long, dirty_bitmap,
                                     &ctx->save.dirty_bitmap_hbuf);
+    DECLARE_HYPERCALL_BUFFER_SHADOW(uint64_t, dirty_list,
+                                    &ctx->save.dirty_list_hbuf);
 
 
     xc_shadow_control(xch, ctx->domid, XEN_DOMCTL_SHADOW_OP_OFF,
@@ -780,6 +1476,16 @@ static void cleanup(struct xc_sr_context *ctx)
 
     xc_hypercall_buffer_free_pages(xch, dirty_bitmap,
                                    NRPAGES(bitmap_size(ctx->save.p2m_size)));
+    xc_hypercall_buffer_free_pages(xch, dirty_list, DIRTY_LIST_PAGES);
+    sr_workers_destroy(ctx->save.workers);
+    free(ctx->save.compress_buf);
+
+    if ( ctx->save.dedup )
+        DPRINTF("Sent %lu zero and %lu duplicate pages without data",
+                ctx->save.zero_count, ctx->save.dup_count);
+    free(ctx->save.dup_pages);
+    free(ctx->save.zero_pfns);
+    free(ctx->save.dup_table);
     free(ctx->save.deferred_pages);
     free(ctx->save.batch_pfns);
 }
@@ -840,6 +1546,13 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
         if ( rc )
             goto err;
 
+        if ( ctx->save.postcopy )
+        {
+            rc = send_postcopy_pages(ctx);
+            if ( rc )
+                goto err;
+        }
+
         if ( ctx->save.checkpointed != XC_MIG_STREAM_NONE )
         {
             /*
@@ -867,6 +1580,9 @@ static int save(struct xc_sr_context *ctx, uint16_t guest_type)
             if ( rc <= 0 )
                 goto err;
 
+            /* The domain is running again. */
+            ctx->save.dedup_paused = false;
+
             if ( ctx->save.checkpointed == XC_MIG_STREAM_COLO )
             {
                 rc = ctx->save.callbacks->wait_checkpoint(
@@ -930,6 +1646,9 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
     ctx.save.callbacks = callbacks;
     ctx.save.live  = !!(flags & XCFLAGS_LIVE);
     ctx.save.debug = !!(flags & XCFLAGS_DEBUG);
+    ctx.save.compress = !!(flags & XCFLAGS_STREAM_COMPRESS);
+    ctx.save.postcopy = !!(flags & XCFLAGS_POSTCOPY);
+    ctx.save.dedup = !!(flags & XCFLAGS_STREAM_DEDUP);
     ctx.save.checkpointed = stream_type;
     ctx.save.recv_fd = recv_fd;
 
@@ -972,6 +1691,17 @@ int xc_domain_save(xc_interface *xch, int io_fd, uint32_t dom,
 
     ctx.domid = dom;
 
+    /* Post-copy relies on mem_paging at the destination, and a back channel. */
+    if ( ctx.save.postcopy &&
+         (!ctx.save.live || !ctx.dominfo.hvm ||
+          ctx.save.checkpointed != XC_MIG_STREAM_NONE || recv_fd < 0) )
+    {
+        ERROR("Post-copy requires a live, non-checkpointed migration of an"
+              " HVM domain with a back channel");
+        errno = EINVAL;
+        return -1;
+    }
+
     if ( ctx.dominfo.hvm )
     {
         ctx.save.ops = save_ops_x86_hvm;
@@ -76,6 +76,12 @@ struct xc_sr_rhdr
 #define REC_TYPE_VERIFY                     0x0000000dU
 #define REC_TYPE_CHECKPOINT                 0x0000000eU
 #define REC_TYPE_CHECKPOINT_DIRTY_PFN_LIST  0x0000000fU
+#define REC_TYPE_PAGE_DATA_COMPRESSED       0x00000010U
+#define REC_TYPE_POSTCOPY_PFNS              0x00000011U
+#define REC_TYPE_POSTCOPY_TRANSITION        0x00000012U
+#define REC_TYPE_POSTCOPY_FAULT             0x00000013U
+#define REC_TYPE_ZERO_PAGES                 0x00000014U
+#define REC_TYPE_DUPLICATE_PAGES            0x00000015U
 
 #define REC_TYPE_OPTIONAL             0x80000000U
 
@@ -90,6 +96,45 @@ struct xc_sr_rec_page_data_header
 #define PAGE_DATA_PFN_MASK  0x000fffffffffffffULL
 #define PAGE_DATA_TYPE_MASK 0xf000000000000000ULL
 
+/* PAGE_DATA_COMPRESSED */
+struct xc_sr_rec_page_data_compressed_header
+{
+    uint32_t count;
+    uint32_t nr_chunks;
+    uint32_t algorithm;
+    uint32_t _res1;
+    uint64_t pfn[0];
+    /* uint32_t chunk_length[nr_chunks], padded to 8 octets. */
+    /* Chunk data. */
+};
+
+#define PAGE_DATA_COMPRESS_ZLIB  0x00000001U
+
+/* Pages of data in each chunk, except possibly the last one. */
+#define PAGE_DATA_CHUNK_PAGES    64U
+
+/* POSTCOPY_PFNS, POSTCOPY_FAULT, ZERO_PAGES */
+struct xc_sr_rec_pfn_list
+{
+    uint32_t count;
+    uint32_t _res1;
+    uint64_t pfn[0];
+};
+
+/* DUPLICATE_PAGES */
+struct xc_sr_rec_duplicate_pages_entry
+{
+    uint64_t pfn;
+    uint64_t source_pfn;
+};
+
+struct xc_sr_rec_duplicate_pages
+{
+    uint32_t count;
+    uint32_t _res1;
+    struct xc_sr_rec_duplicate_pages_entry pages[0];
+};
+
 /* X86_PV_INFO */
 struct xc_sr_rec_x86_pv_info
 {
@@ -0,0 +1,209 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "xc_sr_common.h"
+
+/*
+ * A small pool of worker threads, used to spread CPU bound work on the
+ * contents of a batch of pages (e.g. compression) over several CPUs.
+ *
+ * The thread calling sr_workers_run() takes part in the work, so a pool of N
+ * threads runs up to N + 1 jobs in parallel.
+ */
+struct xc_sr_workers
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;  /* Signalled when a new set of jobs is available. */
+    pthread_cond_t done;  /* Signalled when the last job has completed. */
+
+    unsigned int nr_threads;
+    pthread_t *threads;
+    bool exit;
+
+    /* Current set of jobs.  Protected by lock. */
+    sr_worker_fn_t fn;
+    void *arg;
+    unsigned int nr_jobs, next_job, jobs_done;
+    int rc;
+};
+
+/* Upper bound on the size of a pool. */
+#define SR_MAX_WORKERS 8
+
+unsigned int sr_workers_default(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* The calling thread also takes part in the work. */
+    if ( cpus <= 1 )
+        return 0;
+
+    return cpus - 1 > SR_MAX_WORKERS ? SR_MAX_WORKERS : cpus - 1;
+}
+
+/* Run jobs until there are none left to start.  Called with lock held. */
+static void run_jobs(struct xc_sr_workers *w)
+{
+    while ( w->next_job < w->nr_jobs )
+    {
+        unsigned int job = w->next_job++;
+        int rc;
+
+        pthread_mutex_unlock(&w->lock);
+        rc = w->fn(w->arg, job);
+        pthread_mutex_lock(&w->lock);
+
+        if ( rc )
+            w->rc = rc;
+
+        if ( ++w->jobs_done == w->nr_jobs )
+            pthread_cond_signal(&w->done);
+    }
+}
+
+static void *worker(void *_w)
+{
+    struct xc_sr_workers *w = _w;
+
+    pthread_mutex_lock(&w->lock);
+
+    for ( ;; )
+    {
+        while ( !w->exit && w->next_job >= w->nr_jobs )
+            pthread_cond_wait(&w->work, &w->lock);
+
+        if ( w->exit )
+            break;
+
+        run_jobs(w);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+struct xc_sr_workers *sr_workers_create(xc_interface *xch, unsigned int nr)
+{
+    struct xc_sr_workers *w;
+    unsigned int i;
+    int rc;
+
+    if ( nr == 0 )
+        return NULL;
+
+    w = calloc(1, sizeof(*w));
+    if ( !w )
+        goto err;
+
+    w->threads = calloc(nr, sizeof(*w->threads));
+    if ( !w->threads )
+        goto err;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->done, NULL);
+
+    for ( i = 0; i < nr; ++i )
+    {
+        rc = pthread_create(&w->threads[i], NULL, worker, w);
+        if ( rc )
+        {
+            errno = rc;
+            PERROR("Unable to create worker thread %u", i);
+            break;
+        }
+        w->nr_threads++;
+    }
+
+    if ( w->nr_threads == 0 )
+    {
+        sr_workers_destroy(w);
+        return NULL;
+    }
+
+    return w;
+
+ err:
+    if ( w )
+        free(w->threads);
+    free(w);
+    ERROR("Unable to allocate a pool of %u workers", nr);
+    return NULL;
+}
+
+void sr_workers_destroy(struct xc_sr_workers *w)
+{
+    unsigned int i;
+
+    if ( !w )
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    w->exit = true;
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->lock);
+
+    for ( i = 0; i < w->nr_threads; ++i )
+        pthread_join(w->threads[i], NULL);
+
+    pthread_cond_destroy(&w->done);
+    pthread_cond_destroy(&w->work);
+    pthread_mutex_destroy(&w->lock);
+
+    free(w->threads);
+    free(w);
+}
+
+int sr_workers_run(struct xc_sr_workers *w, unsigned int nr_jobs,
+                   sr_worker_fn_t fn, void *arg)
+{
+    unsigned int i;
+    int rc = 0;
+
+    /* No pool, or nothing worth handing out: run the jobs inline. */
+    if ( !w || nr_jobs <= 1 )
+    {
+        for ( i = 0; i < nr_jobs; ++i )
+        {
+            int job_rc = fn(arg, i);
+
+            if ( job_rc )
+                rc = job_rc;
+        }
+
+        return rc;
+    }
+
+    pthread_mutex_lock(&w->lock);
+
+    w->fn = fn;
+    w->arg = arg;
+    w->nr_jobs = nr_jobs;
+    w->next_job = 0;
+    w->jobs_done = 0;
+    w->rc = 0;
+    pthread_cond_broadcast(&w->work);
+
+    run_jobs(w);
+
+    while ( w->jobs_done < w->nr_jobs )
+        pthread_cond_wait(&w->done, &w->lock);
+
+    rc = w->rc;
+    w->nr_jobs = w->next_job = 0;
+
+    pthread_mutex_unlock(&w->lock);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
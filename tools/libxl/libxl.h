@@ -1037,6 +1037,24 @@ void libxl_mac_copy(libxl_ctx *ctx, libxl_mac *dst, const libxl_mac *src);
  */
 #define LIBXL_HAVE_QED 1
 
+/*
+ * LIBXL_HAVE_EXIT_LATENCY
+ *
+ * If this is defined, libxl_domain_exit_latency_*() and the
+ * libxl_exit_latency_info type are available to collect histograms of
+ * how long the exits of a domain's vCPUs take, by exit reason.
+ */
+#define LIBXL_HAVE_EXIT_LATENCY 1
+
+/*
+ * LIBXL_HAVE_SUSPEND_DEDUP
+ *
+ * If this is defined, libxl_domain_suspend() takes LIBXL_SUSPEND_DEDUP,
+ * sending zero and duplicate pages without their data.  The receiving end
+ * must understand the resulting stream.
+ */
+#define LIBXL_HAVE_SUSPEND_DEDUP 1
+
 typedef char **libxl_string_list;
 void libxl_string_list_dispose(libxl_string_list *sl);
 int libxl_string_list_length(const libxl_string_list *sl);
@@ -1386,6 +1404,7 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd,
                          LIBXL_EXTERNAL_CALLERS_ONLY;
 #define LIBXL_SUSPEND_DEBUG 1
 #define LIBXL_SUSPEND_LIVE 2
+#define LIBXL_SUSPEND_DEDUP 4
 
 /* @param suspend_cancel [from xenctrl.h:xc_domain_resume( @param fast )]
  *   If this parameter is true, use co-operative resume. The guest
@@ -1436,6 +1455,17 @@ int libxl_domain_rename(libxl_ctx *ctx, uint32_t domid,
 int libxl_domain_pause(libxl_ctx *ctx, uint32_t domid);
 int libxl_domain_unpause(libxl_ctx *ctx, uint32_t domid);
 
+int libxl_domain_exit_latency_enable(libxl_ctx *ctx, uint32_t domid);
+int libxl_domain_exit_latency_disable(libxl_ctx *ctx, uint32_t domid);
+int libxl_domain_exit_latency_reset(libxl_ctx *ctx, uint32_t domid);
+/*
+ * Fills in info with the reasons the domain exited for, from one vCPU or,
+ * if vcpu is -1, from all of them.  Fails with ERROR_NOT_READY if the
+ * histograms aren't enabled.
+ */
+int libxl_domain_exit_latency_get(libxl_ctx *ctx, uint32_t domid, int vcpu,
+                                  libxl_exit_latency_info *info);
+
 int libxl_domain_core_dump(libxl_ctx *ctx, uint32_t domid,
                            const char *filename,
                            const libxl_asyncop_how *ao_how)
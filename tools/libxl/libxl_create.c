@@ -854,6 +854,18 @@ static void initiate_domain_create(libxl__egc *egc,
      */
     pod_enabled = (d_config->c_info.type == LIBXL_DOMAIN_TYPE_HVM) &&
         (d_config->b_info.target_memkb < d_config->b_info.max_memkb);
+#ifdef GUEST_RAM_BASE
+    /* On ARM this is the case for every guest. */
+    pod_enabled = d_config->b_info.target_memkb < d_config->b_info.max_memkb;
+
+    /* The IOMMU shares the stage-2 page tables, which have holes with PoD. */
+    if (d_config->num_dtdevs && pod_enabled) {
+        ret = ERROR_INVAL;
+        LOGD(ERROR, domid,
+             "Device tree device assignment failed due to PoD enabled");
+        goto error_out;
+    }
+#endif
 
     /* We cannot have PoD and PCI device assignment at the same time
      * for HVM guest. It was reported that IOMMU cannot work with PoD
@@ -663,6 +663,17 @@ static int libxl__build_dom(libxl__gc *gc, uint32_t domid,
 
     mem_kb = dom->container_type == XC_DOM_HVM_CONTAINER ?
              (info->max_memkb - info->video_memkb) : info->target_memkb;
+#ifdef GUEST_RAM_BASE
+    /*
+     * Give the guest its maximum RAM, backing only the target: the rest is
+     * populate-on-demand until the balloon driver hands it back.
+     */
+    if ( info->target_memkb < info->max_memkb )
+    {
+        mem_kb = info->max_memkb;
+        dom->target_pages = info->target_memkb >> 2;
+    }
+#endif
     if ( (ret = xc_dom_mem_init(dom, mem_kb / 1024)) != 0 ) {
         LOGE(ERROR, "xc_dom_mem_init failed");
         goto out;
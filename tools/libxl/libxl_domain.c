@@ -509,6 +509,7 @@ int libxl_domain_suspend(libxl_ctx *ctx, uint32_t domid, int fd, int flags,
     dss->type = type;
     dss->live = flags & LIBXL_SUSPEND_LIVE;
     dss->debug = flags & LIBXL_SUSPEND_DEBUG;
+    dss->dedup = flags & LIBXL_SUSPEND_DEDUP;
     dss->checkpointed_stream = LIBXL_CHECKPOINTED_STREAM_NONE;
 
     rc = libxl__fd_flags_modify_save(gc, dss->fd,
@@ -591,6 +592,122 @@ int libxl_domain_unpause(libxl_ctx *ctx, uint32_t domid)
     return rc;
 }
 
+int libxl_domain_exit_latency_enable(libxl_ctx *ctx, uint32_t domid)
+{
+    GC_INIT(ctx);
+    int rc = 0;
+
+    if (xc_domain_exit_latency_enable(ctx->xch, domid)) {
+        LOGED(ERROR, domid, "Enabling exit latency histograms");
+        rc = ERROR_FAIL;
+    }
+
+    GC_FREE;
+    return rc;
+}
+
+int libxl_domain_exit_latency_disable(libxl_ctx *ctx, uint32_t domid)
+{
+    GC_INIT(ctx);
+    int rc = 0;
+
+    if (xc_domain_exit_latency_disable(ctx->xch, domid)) {
+        LOGED(ERROR, domid, "Disabling exit latency histograms");
+        rc = ERROR_FAIL;
+    }
+
+    GC_FREE;
+    return rc;
+}
+
+int libxl_domain_exit_latency_reset(libxl_ctx *ctx, uint32_t domid)
+{
+    GC_INIT(ctx);
+    int rc = 0;
+
+    if (xc_domain_exit_latency_reset(ctx->xch, domid)) {
+        LOGED(ERROR, domid, "Resetting exit latency histograms");
+        rc = ERROR_FAIL;
+    }
+
+    GC_FREE;
+    return rc;
+}
+
+int libxl_domain_exit_latency_get(libxl_ctx *ctx, uint32_t domid, int vcpu,
+                                  libxl_exit_latency_info *info)
+{
+    GC_INIT(ctx);
+    xc_exitlat_reason_t *reasons;
+    uint32_t nr = XEN_EXITLAT_NR_REASONS, type, i, j, n;
+    uint64_t cycles_per_sec;
+    int rc;
+
+    reasons = libxl__calloc(gc, nr, sizeof(*reasons));
+
+    if (xc_domain_exit_latency_query(ctx->xch, domid,
+                                     vcpu < 0 ? XEN_EXITLAT_ALL_VCPUS : vcpu,
+                                     &nr, &type, &cycles_per_sec, reasons)) {
+        if (errno == ENODATA) {
+            rc = ERROR_NOT_READY;
+        } else {
+            LOGED(ERROR, domid, "Getting exit latency histograms");
+            rc = ERROR_FAIL;
+        }
+        goto out;
+    }
+    if (nr > XEN_EXITLAT_NR_REASONS)
+        nr = XEN_EXITLAT_NR_REASONS;
+
+    libxl_exit_latency_info_init(info);
+    switch (type) {
+    case XEN_EXITLAT_TYPE_vmx:
+        info->type = LIBXL_EXIT_LATENCY_TYPE_VMX;
+        break;
+    case XEN_EXITLAT_TYPE_svm:
+        info->type = LIBXL_EXIT_LATENCY_TYPE_SVM;
+        break;
+    case XEN_EXITLAT_TYPE_arm:
+        info->type = LIBXL_EXIT_LATENCY_TYPE_ARM;
+        break;
+    default:
+        info->type = LIBXL_EXIT_LATENCY_TYPE_UNKNOWN;
+        break;
+    }
+    info->cycles_per_sec = cycles_per_sec;
+
+    /* Only report the reasons the domain actually exited for. */
+    for (i = n = 0; i < nr; i++)
+        if (reasons[i].count)
+            n++;
+    info->reasons = libxl__calloc(NOGC, n, sizeof(*info->reasons));
+    info->num_reasons = n;
+
+    for (i = n = 0; i < nr; i++) {
+        libxl_exit_latency *el = &info->reasons[n];
+
+        if (!reasons[i].count)
+            continue;
+
+        libxl_exit_latency_init(el);
+        el->reason = i;
+        el->count = reasons[i].count;
+        el->cycles = reasons[i].cycles;
+        el->max_cycles = reasons[i].max;
+        el->buckets = libxl__calloc(NOGC, XEN_EXITLAT_BUCKETS,
+                                    sizeof(*el->buckets));
+        el->num_buckets = XEN_EXITLAT_BUCKETS;
+        for (j = 0; j < XEN_EXITLAT_BUCKETS; j++)
+            el->buckets[j] = reasons[i].buckets[j];
+        n++;
+    }
+
+    rc = 0;
+ out:
+    GC_FREE;
+    return rc;
+}
+
 int libxl__domain_pvcontrol_available(libxl__gc *gc, uint32_t domid)
 {
     libxl_ctx *ctx = libxl__gc_owner(gc);
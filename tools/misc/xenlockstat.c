@@ -0,0 +1,182 @@
+/*
+ * xenlockstat.c
+ *
+ * Print the sampled contention statistics of the hypervisor's busiest
+ * locks, by lock class, together with the places they are most often
+ * taken from.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xenctrl.h>
+
+#define NAME_LEN        128
+
+static xc_interface *xch;
+
+static struct option options[] = {
+    { "reset", 0, NULL, 'r' },
+    { "rate", 1, NULL, 'R' },
+    { "help", 0, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+static void usage(int ret)
+{
+    FILE *out = ret ? stderr : stdout;
+
+    fprintf(out, "usage: xenlockstat [<options>]\n");
+    fprintf(out, "  <options> are:\n");
+    fprintf(out, "  -r|--reset       clear the statistics after printing them\n");
+    fprintf(out, "  -R|--rate <n>    time one in <n> acquisitions (0: off)\n");
+    fprintf(out, "  -h|--help        print this usage information\n");
+    exit(ret);
+}
+
+static void print_caller(const struct xen_sysctl_lockstat_caller *c)
+{
+    char name[NAME_LEN];
+    uint64_t offset;
+
+    if ( xc_lockstat_symbol(xch, c->addr, name, sizeof(name), &offset) )
+        snprintf(name, sizeof(name), "0x%"PRIx64, c->addr);
+    else
+        snprintf(name + strlen(name), sizeof(name) - strlen(name),
+                 "+%#"PRIx64, offset);
+
+    printf("    %-40s %12"PRIu64" %14"PRIu64" %10"PRIu64"\n", name,
+           c->count, c->wait, c->count ? c->wait / c->count : 0);
+}
+
+static void print_class(const xc_lockstat_class_t *cls)
+{
+    unsigned int i;
+
+    printf("%-10s %12"PRIu64" %12"PRIu64" %14"PRIu64" %10"PRIu64
+           " %14"PRIu64" %10"PRIu64"\n", cls->name, cls->count,
+           cls->contended, cls->wait, cls->wait_max, cls->hold,
+           cls->hold_max);
+
+    for ( i = 0; i < XEN_LOCKSTAT_CALLERS && cls->callers[i].count; i++ )
+        print_caller(&cls->callers[i]);
+}
+
+int main(int argc, char *argv[])
+{
+    DECLARE_HYPERCALL_BUFFER(xc_lockstat_class_t, data);
+    uint32_t nr = XEN_LOCKSTAT_CLASS_NR - 1, rate, i;
+    long new_rate = -1;
+    uint64_t time;
+    int opt, reset = 0, ret = 1;
+
+    while ( (opt = getopt_long(argc, argv, "rR:h", options, NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'r':
+            reset = 1;
+            break;
+        case 'R':
+            new_rate = strtoul(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage(0);
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if ( optind != argc )
+        usage(1);
+
+    xch = xc_interface_open(0, 0, 0);
+    if ( !xch )
+    {
+        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( new_rate >= 0 )
+    {
+        if ( xc_lockstat_set_rate(xch, new_rate) )
+        {
+            fprintf(stderr, "Error setting the sample rate: %d (%s)\n",
+                    errno, strerror(errno));
+            goto out;
+        }
+        ret = 0;
+        goto out;
+    }
+
+    data = xc_hypercall_buffer_alloc(xch, data, nr * sizeof(*data));
+    if ( !data )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    if ( xc_lockstat_query(xch, &nr, &time, &rate, HYPERCALL_BUFFER(data)) )
+    {
+        fprintf(stderr, "Error getting lock statistics: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+    if ( nr > XEN_LOCKSTAT_CLASS_NR - 1 )
+        nr = XEN_LOCKSTAT_CLASS_NR - 1;
+
+    if ( rate )
+        printf("1 in %u acquisitions sampled over %.3fs\n", rate,
+               time / 1e9);
+    else
+        printf("Sampling off, %.3fs since reset\n", time / 1e9);
+
+    printf("%-10s %12s %12s %14s %10s %14s %10s\n", "class", "samples",
+           "contended", "wait(ns)", "max", "hold(ns)", "max");
+    printf("    %-40s %12s %14s %10s\n", "caller", "samples", "wait(ns)",
+           "avg");
+
+    for ( i = 0; i < nr; i++ )
+        print_class(&data[i]);
+
+    if ( reset && xc_lockstat_reset(xch) )
+    {
+        fprintf(stderr, "Error resetting lock statistics: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    ret = 0;
+
+ out:
+    xc_hypercall_buffer_free(xch, data);
+    xc_interface_close(xch);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
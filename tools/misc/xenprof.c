@@ -0,0 +1,322 @@
+/*
+ * xenprof.c
+ *
+ * Drive the hypervisor sampling profiler and print the samples as folded
+ * stacks ("frame;frame;frame count" lines, outermost frame first), ready
+ * for flamegraph.pl.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <xenctrl.h>
+
+/* Words per read: comfortably more than a poll interval's worth. */
+#define READ_WORDS      (1u << 16)
+#define HASH_BITS       12
+#define HASH_SIZE       (1u << HASH_BITS)
+#define NAME_LEN        128
+
+static xc_interface *xch;
+static volatile sig_atomic_t stop;
+
+/* Resolved hypervisor addresses. */
+struct symbol {
+    struct symbol *next;
+    uint64_t addr;
+    char name[NAME_LEN];
+};
+
+/* Distinct folded stacks and how often they were seen. */
+struct stack {
+    struct stack *next;
+    unsigned long count;
+    char *frames;
+};
+
+static struct symbol *symbols[HASH_SIZE];
+static struct stack *stacks[HASH_SIZE];
+static unsigned long nr_samples, nr_guest;
+
+static struct option options[] = {
+    { "frequency", 1, NULL, 'F' },
+    { "time", 1, NULL, 't' },
+    { "output", 1, NULL, 'o' },
+    { "help", 0, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+static void usage(int ret)
+{
+    FILE *out = ret ? stderr : stdout;
+
+    fprintf(out, "usage: xenprof [<options>]\n");
+    fprintf(out, "  <options> are:\n");
+    fprintf(out, "  -F|--frequency <hz>  samples per second per CPU (default 997)\n");
+    fprintf(out, "  -t|--time <s>        stop after <s> seconds (default: on ^C)\n");
+    fprintf(out, "  -o|--output <file>   write folded stacks to <file>\n");
+    fprintf(out, "  -h|--help            print this usage information\n");
+    exit(ret);
+}
+
+static unsigned int hash(const void *p, size_t len)
+{
+    const unsigned char *c = p;
+    unsigned int h = 5381;
+
+    while ( len-- )
+        h = h * 33 + *c++;
+
+    return h & (HASH_SIZE - 1);
+}
+
+static const char *symbol_name(uint64_t addr)
+{
+    unsigned int h = hash(&addr, sizeof(addr));
+    struct symbol *sym;
+    uint64_t offset;
+
+    for ( sym = symbols[h]; sym; sym = sym->next )
+        if ( sym->addr == addr )
+            return sym->name;
+
+    sym = malloc(sizeof(*sym));
+    if ( !sym )
+        return "[unknown]";
+
+    if ( xc_profile_symbol(xch, addr, sym->name, sizeof(sym->name),
+                           &offset, NULL) )
+        snprintf(sym->name, sizeof(sym->name), "0x%"PRIx64, addr);
+    sym->addr = addr;
+    sym->next = symbols[h];
+    symbols[h] = sym;
+
+    return sym->name;
+}
+
+static void add_stack(const char *frames)
+{
+    unsigned int h = hash(frames, strlen(frames));
+    struct stack *s;
+
+    for ( s = stacks[h]; s; s = s->next )
+        if ( !strcmp(s->frames, frames) )
+        {
+            s->count++;
+            return;
+        }
+
+    s = malloc(sizeof(*s));
+    if ( !s || !(s->frames = strdup(frames)) )
+    {
+        free(s);
+        return;
+    }
+    s->count = 1;
+    s->next = stacks[h];
+    stacks[h] = s;
+}
+
+/* Fold one sample: the domain it interrupted, then its frames outermost first. */
+static void add_sample(const uint64_t *words)
+{
+    char frames[XEN_PROFILE_MAX_DEPTH * NAME_LEN + 32];
+    unsigned int depth = XEN_PROFILE_DEPTH(words[0]);
+    unsigned int domid = XEN_PROFILE_DOMID(words[0]);
+    size_t len;
+
+    nr_samples++;
+
+    if ( domid == DOMID_IDLE )
+        len = snprintf(frames, sizeof(frames), "idle");
+    else
+        len = snprintf(frames, sizeof(frames), "d%u", domid);
+
+    if ( words[0] & XEN_PROFILE_GUEST )
+    {
+        nr_guest++;
+        snprintf(frames + len, sizeof(frames) - len, ";[guest]");
+    }
+
+    while ( depth && len < sizeof(frames) )
+        len += snprintf(frames + len, sizeof(frames) - len, ";%s",
+                        symbol_name(words[depth--]));
+
+    add_stack(frames);
+}
+
+static int drain(unsigned int nr_cpus, uint64_t *buf,
+                 xc_hypercall_buffer_t *hbuf, uint64_t *lost)
+{
+    unsigned int cpu, i, nr;
+    uint64_t cpu_lost, read_lost;
+
+    *lost = 0;
+    for ( cpu = 0; cpu < nr_cpus; cpu++ )
+    {
+        /* The count is since profiling started: keep the latest one. */
+        cpu_lost = 0;
+        do {
+            nr = READ_WORDS;
+            if ( xc_profile_read(xch, cpu, &nr, &read_lost, hbuf) )
+            {
+                if ( errno == EINVAL )  /* Offline CPU. */
+                    break;
+                return -1;
+            }
+            cpu_lost = read_lost;
+
+            for ( i = 0; i < nr; i += 1 + XEN_PROFILE_DEPTH(buf[i]) )
+                add_sample(buf + i);
+        } while ( nr );
+
+        *lost += cpu_lost;
+    }
+
+    return 0;
+}
+
+static void sigint(int sig)
+{
+    stop = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    DECLARE_HYPERCALL_BUFFER(uint64_t, buf);
+    unsigned int hz = 997, seconds = 0, nr_cpus, i;
+    const char *output = NULL;
+    xc_physinfo_t info = { 0 };
+    struct timespec start, now;
+    uint64_t lost = 0;
+    struct stack *s;
+    FILE *out = stdout;
+    int opt, ret = 1;
+
+    while ( (opt = getopt_long(argc, argv, "F:t:o:h", options, NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'F':
+            hz = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'h':
+            usage(0);
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if ( optind != argc || !hz )
+        usage(1);
+
+    xch = xc_interface_open(0, 0, 0);
+    if ( !xch )
+    {
+        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    if ( xc_physinfo(xch, &info) )
+    {
+        fprintf(stderr, "Error getting physinfo: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+    nr_cpus = info.max_cpu_id + 1;
+
+    buf = xc_hypercall_buffer_alloc(xch, buf, READ_WORDS * sizeof(*buf));
+    if ( !buf )
+    {
+        fprintf(stderr, "Could not allocate buffers: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    if ( output && !(out = fopen(output, "w")) )
+    {
+        fprintf(stderr, "Could not open %s: %s\n", output, strerror(errno));
+        goto out;
+    }
+
+    if ( xc_profile_enable(xch, hz) )
+    {
+        fprintf(stderr, "Error enabling the profiler: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    signal(SIGINT, sigint);
+    signal(SIGTERM, sigint);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for ( ret = 0; !stop && !ret; )
+    {
+        usleep(100000);
+        ret = drain(nr_cpus, buf, HYPERCALL_BUFFER(buf), &lost);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ( seconds && now.tv_sec - start.tv_sec >= seconds )
+            break;
+    }
+
+    xc_profile_disable(xch);
+    if ( !ret )
+        ret = drain(nr_cpus, buf, HYPERCALL_BUFFER(buf), &lost);
+    if ( ret )
+    {
+        fprintf(stderr, "Error reading samples: %d (%s)\n",
+                errno, strerror(errno));
+        goto out;
+    }
+
+    for ( i = 0; i < HASH_SIZE; i++ )
+        for ( s = stacks[i]; s; s = s->next )
+            fprintf(out, "%s %lu\n", s->frames, s->count);
+
+    fprintf(stderr, "%lu samples, %lu in guests, %"PRIu64" lost\n",
+            nr_samples, nr_guest, lost);
+
+ out:
+    if ( out != stdout && out )
+        fclose(out);
+    xc_hypercall_buffer_free(xch, buf);
+    xc_interface_close(xch);
+
+    return ret ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -65,6 +65,12 @@ REC_TYPE_x86_pv_vcpu_msrs           = 0x0000000c
 REC_TYPE_verify                     = 0x0000000d
 REC_TYPE_checkpoint                 = 0x0000000e
 REC_TYPE_checkpoint_dirty_pfn_list  = 0x0000000f
+REC_TYPE_page_data_compressed       = 0x00000010
+REC_TYPE_postcopy_pfns              = 0x00000011
+REC_TYPE_postcopy_transition        = 0x00000012
+REC_TYPE_postcopy_fault             = 0x00000013
+REC_TYPE_zero_pages                 = 0x00000014
+REC_TYPE_duplicate_pages            = 0x00000015
 
 rec_type_to_str = {
     REC_TYPE_end                        : "End",
@@ -82,7 +88,13 @@ rec_type_to_str = {
     REC_TYPE_x86_pv_vcpu_msrs           : "x86 PV vcpu msrs",
     REC_TYPE_verify                     : "Verify",
     REC_TYPE_checkpoint                 : "Checkpoint",
-    REC_TYPE_checkpoint_dirty_pfn_list  : "Checkpoint dirty pfn list"
+    REC_TYPE_checkpoint_dirty_pfn_list  : "Checkpoint dirty pfn list",
+    REC_TYPE_page_data_compressed       : "Page data (compressed)",
+    REC_TYPE_postcopy_pfns              : "Postcopy pfns",
+    REC_TYPE_postcopy_transition        : "Postcopy transition",
+    REC_TYPE_postcopy_fault             : "Postcopy fault",
+    REC_TYPE_zero_pages                 : "Zero pages",
+    REC_TYPE_duplicate_pages            : "Duplicate pages",
 }
 
 # page_data
@@ -105,6 +117,18 @@ PAGE_DATA_TYPE_BROKEN        = (long(0xd) << PAGE_DATA_TYPE_SHIFT) # Broken
 PAGE_DATA_TYPE_XALLOC        = (long(0xe) << PAGE_DATA_TYPE_SHIFT) # Allocate-only
 PAGE_DATA_TYPE_XTAB          = (long(0xf) << PAGE_DATA_TYPE_SHIFT) # Invalid
 
+# postcopy_pfns
+POSTCOPY_PFNS_FORMAT         = "II"
+
+# duplicate_pages
+DUPLICATE_PAGES_FORMAT       = "II"
+DUPLICATE_PAGES_ENTRY_FORMAT = "QQ"
+
+# page_data_compressed
+PAGE_DATA_COMPRESSED_FORMAT  = "IIII"
+PAGE_DATA_COMPRESS_ZLIB      = 0x00000001
+PAGE_DATA_CHUNK_PAGES        = 64
+
 # x86_pv_info
 X86_PV_INFO_FORMAT        = "BBHI"
 
@@ -242,6 +266,28 @@ class VerifyLibxc(VerifyBase):
             raise RecordError("End record with non-zero length")
 
 
+    def count_page_data_pfns(self, pfns):
+        """ Validate the pfns of a PAGE_DATA or PAGE_DATA_COMPRESSED
+        record, returning how many pages of data are expected """
+
+        nr_pages = 0
+        for idx, pfn in enumerate(pfns):
+
+            if pfn & PAGE_DATA_PFN_RESZ_MASK:
+                raise RecordError("Reserved bits set in pfn[%d]: 0x%016x",
+                                  idx, pfn & PAGE_DATA_PFN_RESZ_MASK)
+
+            if pfn >> PAGE_DATA_TYPE_SHIFT in (5, 6, 7, 8):
+                raise RecordError("Invalid type value in pfn[%d]: 0x%016x",
+                                  idx, pfn & PAGE_DATA_TYPE_LTAB_MASK)
+
+            # We expect page data for each normal page or pagetable
+            if PAGE_DATA_TYPE_NOTAB <= (pfn & PAGE_DATA_TYPE_LTABTYPE_MASK) \
+                    <= PAGE_DATA_TYPE_L4TAB:
+                nr_pages += 1
+
+        return nr_pages
+
     def verify_record_page_data(self, content):
         """ Page Data record """
         minsz = calcsize(PAGE_DATA_FORMAT)
@@ -263,27 +309,56 @@ class VerifyLibxc(VerifyBase):
 
         pfns = list(unpack("=%dQ" % (count,), content[minsz:minsz + pfnsz]))
 
-        nr_pages = 0
-        for idx, pfn in enumerate(pfns):
-
-            if pfn & PAGE_DATA_PFN_RESZ_MASK:
-                raise RecordError("Reserved bits set in pfn[%d]: 0x%016x",
-                                  idx, pfn & PAGE_DATA_PFN_RESZ_MASK)
-
-            if pfn >> PAGE_DATA_TYPE_SHIFT in (5, 6, 7, 8):
-                raise RecordError("Invalid type value in pfn[%d]: 0x%016x",
-                                  idx, pfn & PAGE_DATA_TYPE_LTAB_MASK)
-
-            # We expect page data for each normal page or pagetable
-            if PAGE_DATA_TYPE_NOTAB <= (pfn & PAGE_DATA_TYPE_LTABTYPE_MASK) \
-                    <= PAGE_DATA_TYPE_L4TAB:
-                nr_pages += 1
+        nr_pages = self.count_page_data_pfns(pfns)
 
         pagesz = nr_pages * 4096
         if len(content) != minsz + pfnsz + pagesz:
             raise RecordError("Expected %u + %u + %u, got %u"
                               % (minsz, pfnsz, pagesz, len(content)))
 
+    def verify_record_page_data_compressed(self, content):
+        """ Compressed Page Data record """
+        minsz = calcsize(PAGE_DATA_COMPRESSED_FORMAT)
+
+        if len(content) <= minsz:
+            raise RecordError("PAGE_DATA_COMPRESSED record must be at least %d"
+                              " bytes long" % (minsz, ))
+
+        count, nr_chunks, algorithm, res1 = \
+            unpack(PAGE_DATA_COMPRESSED_FORMAT, content[:minsz])
+
+        if res1 != 0:
+            raise StreamError("Reserved bits set in PAGE_DATA_COMPRESSED "
+                              "record 0x%04x" % (res1, ))
+
+        if algorithm != PAGE_DATA_COMPRESS_ZLIB:
+            raise RecordError("Unknown PAGE_DATA_COMPRESSED algorithm 0x%x"
+                              % (algorithm, ))
+
+        pfnsz = count * 8
+        lensz = (nr_chunks * 4 + 7) & ~7
+        if (len(content) - minsz) < pfnsz + lensz:
+            raise RecordError("PAGE_DATA_COMPRESSED record must contain a pfn"
+                              " for each count and a length for each chunk")
+
+        pfns = list(unpack("=%dQ" % (count,), content[minsz:minsz + pfnsz]))
+
+        nr_pages = self.count_page_data_pfns(pfns)
+
+        exp_chunks = ((nr_pages + PAGE_DATA_CHUNK_PAGES - 1)
+                      // PAGE_DATA_CHUNK_PAGES)
+        if nr_chunks != exp_chunks:
+            raise RecordError("Expected %u chunks for %u pages, got %u"
+                              % (exp_chunks, nr_pages, nr_chunks))
+
+        lens = unpack("=%dI" % (nr_chunks, ),
+                      content[minsz + pfnsz:minsz + pfnsz + nr_chunks * 4])
+
+        datasz = sum(lens)
+        if len(content) != minsz + pfnsz + lensz + datasz:
+            raise RecordError("Expected %u + %u + %u + %u, got %u"
+                              % (minsz, pfnsz, lensz, datasz, len(content)))
+
 
     def verify_record_x86_pv_info(self, content):
         """ x86 PV Info record """
@@ -424,6 +499,78 @@ class VerifyLibxc(VerifyBase):
         """ checkpoint dirty pfn list """
         raise RecordError("Found checkpoint dirty pfn list record in stream")
 
+    def verify_record_postcopy_pfns(self, content):
+        """ postcopy pfns record """
+        minsz = calcsize(POSTCOPY_PFNS_FORMAT)
+
+        if len(content) < minsz:
+            raise RecordError("POSTCOPY_PFNS record must be at least %d bytes"
+                              " long" % (minsz, ))
+
+        count, res1 = unpack(POSTCOPY_PFNS_FORMAT, content[:minsz])
+
+        if res1 != 0:
+            raise StreamError("Reserved bits set in POSTCOPY_PFNS record "
+                              "0x%04x" % (res1, ))
+
+        if len(content) != minsz + count * 8:
+            raise RecordError("Expected %u + %u, got %u"
+                              % (minsz, count * 8, len(content)))
+
+    def verify_record_postcopy_transition(self, content):
+        """ postcopy transition record """
+
+        if len(content) != 0:
+            raise RecordError("Postcopy transition record with non-zero "
+                              "length")
+
+    def verify_record_postcopy_fault(self, content):
+        """ postcopy fault record """
+        raise RecordError("Found postcopy fault record in stream")
+
+    def verify_record_zero_pages(self, content):
+        """ zero pages record """
+        minsz = calcsize(POSTCOPY_PFNS_FORMAT)
+
+        if len(content) < minsz:
+            raise RecordError("ZERO_PAGES record must be at least %d bytes"
+                              " long" % (minsz, ))
+
+        count, res1 = unpack(POSTCOPY_PFNS_FORMAT, content[:minsz])
+
+        if res1 != 0:
+            raise StreamError("Reserved bits set in ZERO_PAGES record "
+                              "0x%04x" % (res1, ))
+
+        if count == 0:
+            raise RecordError("ZERO_PAGES record with zero count")
+
+        if len(content) != minsz + count * 8:
+            raise RecordError("Expected %u + %u, got %u"
+                              % (minsz, count * 8, len(content)))
+
+    def verify_record_duplicate_pages(self, content):
+        """ duplicate pages record """
+        minsz = calcsize(DUPLICATE_PAGES_FORMAT)
+        entsz = calcsize(DUPLICATE_PAGES_ENTRY_FORMAT)
+
+        if len(content) < minsz:
+            raise RecordError("DUPLICATE_PAGES record must be at least %d"
+                              " bytes long" % (minsz, ))
+
+        count, res1 = unpack(DUPLICATE_PAGES_FORMAT, content[:minsz])
+
+        if res1 != 0:
+            raise StreamError("Reserved bits set in DUPLICATE_PAGES record "
+                              "0x%04x" % (res1, ))
+
+        if count == 0:
+            raise RecordError("DUPLICATE_PAGES record with zero count")
+
+        if len(content) != minsz + count * entsz:
+            raise RecordError("Expected %u + %u, got %u"
+                              % (minsz, count * entsz, len(content)))
+
 
 record_verifiers = {
     REC_TYPE_end:
@@ -466,4 +613,16 @@ record_verifiers = {
         VerifyLibxc.verify_record_checkpoint,
     REC_TYPE_checkpoint_dirty_pfn_list:
         VerifyLibxc.verify_record_checkpoint_dirty_pfn_list,
+    REC_TYPE_page_data_compressed:
+        VerifyLibxc.verify_record_page_data_compressed,
+    REC_TYPE_postcopy_pfns:
+        VerifyLibxc.verify_record_postcopy_pfns,
+    REC_TYPE_postcopy_transition:
+        VerifyLibxc.verify_record_postcopy_transition,
+    REC_TYPE_postcopy_fault:
+        VerifyLibxc.verify_record_postcopy_fault,
+    REC_TYPE_zero_pages:
+        VerifyLibxc.verify_record_zero_pages,
+    REC_TYPE_duplicate_pages:
+        VerifyLibxc.verify_record_duplicate_pages,
     }
@@ -0,0 +1,662 @@
+/*
+ * xen-bench.c
+ *
+ * Micro-benchmarks of hypervisor hot paths, run from dom0: hypercall
+ * round trip, event channel ping-pong, grant map, unmap and copy, page
+ * populate and decrease, timer accuracy and vCPU context switch cost.
+ * The results are printed as JSON, with percentiles of the time each
+ * operation took, so that they can be compared between builds.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xenctrl.h>
+#include <xencall.h>
+#include <xenevtchn.h>
+#include <xengnttab.h>
+#include <xen/version.h>
+
+#define PAGE_SIZE       4096
+#define MAX_PAGES       4096
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+/* The samples of one benchmark, and how many of them to throw away first. */
+struct result {
+    uint64_t *ns;
+    unsigned int nr, warmup, max;
+    unsigned int per_op;        /* Pages handled by each operation. */
+};
+
+/* Benchmarks which time two operations fill in the second result too. */
+struct bench {
+    const char *name, *second;
+    int (*fn)(struct result *r, struct result *second);
+    unsigned int samples;       /* Default number of samples. */
+};
+
+static xc_interface *xch;
+static uint32_t self_domid;
+static unsigned int nr_samples, batch = 256, timer_period_us = 1000;
+static int pcpu = -1;
+
+static struct option options[] = {
+    { "domid", 1, NULL, 'D' },
+    { "samples", 1, NULL, 'n' },
+    { "batch", 1, NULL, 'b' },
+    { "period", 1, NULL, 'p' },
+    { "cpu", 1, NULL, 'c' },
+    { "help", 0, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+static void usage(int ret)
+{
+    FILE *out = ret ? stderr : stdout;
+
+    fprintf(out, "usage: xen-bench [<options>] [<benchmark> ...]\n");
+    fprintf(out, "  <options> are:\n");
+    fprintf(out, "  -D|--domid <d>    id of the domain running us (default 0)\n");
+    fprintf(out, "  -n|--samples <n>  time <n> operations of each benchmark\n");
+    fprintf(out, "  -b|--batch <n>    pages per populate/decrease (default 256)\n");
+    fprintf(out, "  -p|--period <us>  timer period (default 1000)\n");
+    fprintf(out, "  -c|--cpu <c>      physical CPU for ctxsw (default: first\n");
+    fprintf(out, "                    one vCPU 0 may run on)\n");
+    fprintf(out, "  -h|--help         print this usage information\n");
+    fprintf(out, "  <benchmark> is one of hypercall, evtchn, grant-map,\n");
+    fprintf(out, "  grant-copy, populate, timer or ctxsw (default: all)\n");
+    exit(ret);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+static void record(struct result *r, uint64_t ns)
+{
+    if ( r->warmup )
+        r->warmup--;
+    else if ( r->nr < r->max )
+        r->ns[r->nr++] = ns;
+}
+
+static bool done(const struct result *r)
+{
+    return r->nr == r->max;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    const uint64_t *x = a, *y = b;
+
+    return *x < *y ? -1 : *x > *y;
+}
+
+static uint64_t percentile(const struct result *r, unsigned int permille)
+{
+    return r->ns[(uint64_t)(r->nr - 1) * permille / 1000];
+}
+
+static void print_result(const char *name, struct result *r, bool first)
+{
+    uint64_t sum = 0;
+    unsigned int i;
+
+    for ( i = 0; i < r->nr; i++ )
+        sum += r->ns[i];
+    qsort(r->ns, r->nr, sizeof(*r->ns), compare_u64);
+
+    printf("%s    \"%s\": {\n", first ? "" : ",\n", name);
+    printf("      \"unit\": \"ns\",\n");
+    printf("      \"samples\": %u,\n", r->nr);
+    printf("      \"min\": %"PRIu64",\n", r->ns[0]);
+    printf("      \"mean\": %"PRIu64",\n", sum / r->nr);
+    printf("      \"p50\": %"PRIu64",\n", percentile(r, 500));
+    printf("      \"p90\": %"PRIu64",\n", percentile(r, 900));
+    printf("      \"p99\": %"PRIu64",\n", percentile(r, 990));
+    printf("      \"p999\": %"PRIu64",\n", percentile(r, 999));
+    printf("      \"max\": %"PRIu64",\n", r->ns[r->nr - 1]);
+    if ( r->per_op > 1 )
+        printf("      \"pages_per_op\": %u,\n", r->per_op);
+    printf("      \"ops_per_sec\": %.1f\n", sum ? r->nr * 1e9 / sum : 0);
+    printf("    }");
+}
+
+/* The cheapest hypercall there is, issued through privcmd. */
+static int bench_hypercall(struct result *r, struct result *unused)
+{
+    xencall_handle *xcall = xencall_open(NULL, 0);
+    uint64_t t;
+
+    if ( !xcall )
+        return errno;
+
+    while ( !done(r) )
+    {
+        t = now_ns();
+        xencall2(xcall, __HYPERVISOR_xen_version, XENVER_version, 0);
+        record(r, now_ns() - t);
+    }
+
+    xencall_close(xcall);
+
+    return 0;
+}
+
+/*
+ * Event channel ping-pong between two threads, over an interdomain channel
+ * looped back to ourselves.  Each thread has an evtchn handle of its own,
+ * and is pinned to a vCPU of its own when there are at least two.
+ */
+struct pingpong {
+    xenevtchn_handle *xce;
+    evtchn_port_t port;
+    unsigned int rounds;
+    int cpu;
+};
+
+static int wait_event(xenevtchn_handle *xce)
+{
+    xenevtchn_port_or_error_t port = xenevtchn_pending(xce);
+
+    if ( port < 0 )
+        return errno;
+
+    return xenevtchn_unmask(xce, port) ? errno : 0;
+}
+
+static void pin_thread(int cpu)
+{
+    cpu_set_t set;
+
+    if ( cpu < 0 )
+        return;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *pong(void *arg)
+{
+    struct pingpong *p = arg;
+    unsigned int i;
+
+    pin_thread(p->cpu);
+    for ( i = 0; i < p->rounds; i++ )
+        if ( wait_event(p->xce) || xenevtchn_notify(p->xce, p->port) )
+            break;
+
+    return NULL;
+}
+
+static int pingpong(struct result *r)
+{
+    xenevtchn_handle *xce_a = xenevtchn_open(NULL, 0);
+    xenevtchn_handle *xce_b = xenevtchn_open(NULL, 0);
+    struct pingpong b = { .xce = xce_b, .cpu = -1 };
+    xenevtchn_port_or_error_t port_a = -1, port_b = -1;
+    bool two_cpus = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+    pthread_t thread;
+    cpu_set_t saved;
+    uint64_t t;
+    int rc = 0;
+
+    if ( !xce_a || !xce_b )
+    {
+        rc = errno;
+        goto out;
+    }
+
+    port_a = xenevtchn_bind_unbound_port(xce_a, DOMID_SELF);
+    if ( port_a >= 0 )
+        port_b = xenevtchn_bind_interdomain(xce_b, DOMID_SELF, port_a);
+    if ( port_a < 0 || port_b < 0 )
+    {
+        rc = errno;
+        goto out;
+    }
+
+    b.port = port_b;
+    b.rounds = r->warmup + r->max;
+    if ( two_cpus )
+        b.cpu = 1;
+    rc = pthread_create(&thread, NULL, pong, &b);
+    if ( rc )
+        goto out;
+
+    pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved);
+    if ( two_cpus )
+        pin_thread(0);
+
+    while ( !done(r) )
+    {
+        t = now_ns();
+        rc = xenevtchn_notify(xce_a, port_a) ? errno : wait_event(xce_a);
+        if ( rc )
+        {
+            pthread_cancel(thread);
+            break;
+        }
+        record(r, now_ns() - t);
+    }
+
+    pthread_join(thread, NULL);
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+
+ out:
+    if ( port_b >= 0 )
+        xenevtchn_unbind(xce_b, port_b);
+    if ( port_a >= 0 )
+        xenevtchn_unbind(xce_a, port_a);
+    if ( xce_b )
+        xenevtchn_close(xce_b);
+    if ( xce_a )
+        xenevtchn_close(xce_a);
+
+    return rc;
+}
+
+static int bench_evtchn(struct result *r, struct result *unused)
+{
+    return pingpong(r);
+}
+
+/*
+ * The same ping-pong with vCPUs 0 and 1 of our domain made to share one
+ * physical CPU, so that every round trip takes two vCPU context switches.
+ */
+static int bench_ctxsw(struct result *r, struct result *unused)
+{
+    xc_cpumap_t saved[2] = { NULL, NULL }, map = NULL;
+    int i, cpu = pcpu, rc = 0;
+
+    if ( sysconf(_SC_NPROCESSORS_ONLN) < 2 )
+        return EOPNOTSUPP;
+
+    map = xc_cpumap_alloc(xch);
+    for ( i = 0; i < 2; i++ )
+    {
+        saved[i] = xc_cpumap_alloc(xch);
+        if ( !map || !saved[i] ||
+             xc_vcpu_getaffinity(xch, self_domid, i, saved[i], NULL,
+                                 XEN_VCPUAFFINITY_HARD) )
+        {
+            rc = errno ?: ENOMEM;
+            goto out;
+        }
+    }
+
+    if ( cpu < 0 )
+        for ( cpu = 0; cpu < xc_get_cpumap_size(xch) * 8; cpu++ )
+            if ( xc_cpumap_testcpu(cpu, saved[0]) )
+                break;
+
+    for ( i = 0; i < 2; i++ )
+    {
+        memset(map, 0, xc_get_cpumap_size(xch));
+        xc_cpumap_setcpu(cpu, map);
+        if ( xc_vcpu_setaffinity(xch, self_domid, i, map, NULL,
+                                 XEN_VCPUAFFINITY_HARD) )
+        {
+            rc = errno;
+            goto restore;
+        }
+    }
+
+    rc = pingpong(r);
+
+ restore:
+    for ( i = 0; i < 2; i++ )
+        xc_vcpu_setaffinity(xch, self_domid, i, saved[i], NULL,
+                            XEN_VCPUAFFINITY_HARD);
+ out:
+    free(saved[1]);
+    free(saved[0]);
+    free(map);
+
+    return rc;
+}
+
+/* Map and unmap a page we granted to ourselves. */
+static int bench_grant_map(struct result *r, struct result *unmap)
+{
+    xengntshr_handle *xgs = xengntshr_open(NULL, 0);
+    xengnttab_handle *xgt = xengnttab_open(NULL, 0);
+    void *shared = NULL, *addr;
+    uint32_t ref;
+    uint64_t t;
+    int rc = 0;
+
+    if ( !xgs || !xgt )
+    {
+        rc = errno;
+        goto out;
+    }
+
+    shared = xengntshr_share_pages(xgs, self_domid, 1, &ref, 1);
+    if ( !shared )
+    {
+        rc = errno;
+        goto out;
+    }
+
+    while ( !done(r) || !done(unmap) )
+    {
+        t = now_ns();
+        addr = xengnttab_map_grant_ref(xgt, self_domid, ref,
+                                       PROT_READ | PROT_WRITE);
+        if ( !addr )
+        {
+            rc = errno;
+            break;
+        }
+        record(r, now_ns() - t);
+
+        t = now_ns();
+        xengnttab_unmap(xgt, addr, 1);
+        record(unmap, now_ns() - t);
+    }
+
+ out:
+    if ( shared )
+        xengntshr_unshare(xgs, shared, 1);
+    if ( xgt )
+        xengnttab_close(xgt);
+    if ( xgs )
+        xengntshr_close(xgs);
+
+    return rc;
+}
+
+/* Copy a whole page out of a grant of our own. */
+static int bench_grant_copy(struct result *r, struct result *unused)
+{
+    xengntshr_handle *xgs = xengntshr_open(NULL, 0);
+    xengnttab_handle *xgt = xengnttab_open(NULL, 0);
+    xengnttab_grant_copy_segment_t seg;
+    void *shared = NULL, *buf = NULL;
+    uint32_t ref;
+    uint64_t t;
+    int rc = 0;
+
+    if ( !xgs || !xgt || posix_memalign(&buf, PAGE_SIZE, PAGE_SIZE) )
+    {
+        rc = errno ?: ENOMEM;
+        goto out;
+    }
+
+    shared = xengntshr_share_pages(xgs, self_domid, 1, &ref, 1);
+    if ( !shared )
+    {
+        rc = errno;
+        goto out;
+    }
+    memset(shared, 0x5a, PAGE_SIZE);
+
+    while ( !done(r) )
+    {
+        memset(&seg, 0, sizeof(seg));
+        seg.source.foreign.ref = ref;
+        seg.source.foreign.domid = self_domid;
+        seg.dest.virt = buf;
+        seg.len = PAGE_SIZE;
+        seg.flags = GNTCOPY_source_gref;
+
+        t = now_ns();
+        if ( xengnttab_grant_copy(xgt, 1, &seg) || seg.status != GNTST_okay )
+        {
+            rc = errno ?: EIO;
+            break;
+        }
+        record(r, now_ns() - t);
+    }
+
+ out:
+    free(buf);
+    if ( shared )
+        xengntshr_unshare(xgs, shared, 1);
+    if ( xgt )
+        xengnttab_close(xgt);
+    if ( xgs )
+        xengntshr_close(xgs);
+
+    return rc;
+}
+
+/*
+ * Populate and free batches of pages in an empty scratch domain.  For a
+ * PV domain populate_physmap hands back the MFNs, which are what the
+ * decrease then takes, so the same array works for either kind.
+ */
+static int bench_populate(struct result *r, struct result *decrease)
+{
+    xen_domain_handle_t handle = { 0 };
+    xen_pfn_t pfns[MAX_PAGES];
+    uint32_t domid = 0;
+    unsigned int i;
+    uint64_t t;
+    int rc;
+
+    if ( xc_domain_create(xch, 0, handle, 0, &domid, NULL) )
+        return errno;
+
+    if ( xc_domain_setmaxmem(xch, domid, batch * (PAGE_SIZE >> 10)) )
+    {
+        rc = errno;
+        goto out;
+    }
+
+    r->per_op = decrease->per_op = batch;
+    for ( rc = 0; !done(r) || !done(decrease); )
+    {
+        for ( i = 0; i < batch; i++ )
+            pfns[i] = i;
+
+        t = now_ns();
+        if ( xc_domain_populate_physmap_exact(xch, domid, batch, 0, 0, pfns) )
+        {
+            rc = errno;
+            break;
+        }
+        record(r, now_ns() - t);
+
+        t = now_ns();
+        if ( xc_domain_decrease_reservation_exact(xch, domid, batch, 0,
+                                                  pfns) )
+        {
+            rc = errno;
+            break;
+        }
+        record(decrease, now_ns() - t);
+    }
+
+ out:
+    xc_domain_destroy(xch, domid);
+
+    return rc;
+}
+
+/* How late periodic absolute timer wakeups are. */
+static int bench_timer(struct result *r, struct result *unused)
+{
+    uint64_t period = timer_period_us * 1000ULL, next = now_ns() + period;
+    struct timespec ts;
+
+    while ( !done(r) )
+    {
+        ts.tv_sec = next / 1000000000ULL;
+        ts.tv_nsec = next % 1000000000ULL;
+        if ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) )
+            return errno;
+        record(r, now_ns() - next);
+        next += period;
+    }
+
+    return 0;
+}
+
+static const struct bench benches[] = {
+    { "hypercall",  NULL,          bench_hypercall,  100000 },
+    { "evtchn",     NULL,          bench_evtchn,     10000 },
+    { "grant-map",  "grant-unmap", bench_grant_map,  10000 },
+    { "grant-copy", NULL,          bench_grant_copy, 10000 },
+    { "populate",   "decrease",    bench_populate,   1000 },
+    { "timer",      NULL,          bench_timer,      1000 },
+    { "ctxsw",      NULL,          bench_ctxsw,      10000 },
+};
+
+static int init_result(struct result *r, unsigned int samples)
+{
+    r->nr = 0;
+    r->max = samples;
+    r->warmup = samples / 10;
+    r->per_op = 1;
+    r->ns = calloc(samples, sizeof(*r->ns));
+
+    return r->ns ? 0 : ENOMEM;
+}
+
+static bool selected(const char *name, int argc, char *argv[])
+{
+    int i;
+
+    if ( optind == argc )
+        return true;
+    for ( i = optind; i < argc; i++ )
+        if ( !strcmp(argv[i], name) )
+            return true;
+
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    struct result r, second;
+    unsigned int i, samples;
+    bool first = true;
+    int opt, rc, ret = 0;
+
+    while ( (opt = getopt_long(argc, argv, "D:n:b:p:c:h", options,
+                               NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'D':
+            self_domid = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            nr_samples = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            timer_period_us = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            pcpu = atoi(optarg);
+            break;
+        case 'h':
+            usage(0);
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if ( !batch || batch > MAX_PAGES || !timer_period_us )
+        usage(1);
+    for ( i = optind; i < argc; i++ )
+    {
+        unsigned int j;
+
+        for ( j = 0; j < ARRAY_SIZE(benches); j++ )
+            if ( !strcmp(argv[i], benches[j].name) )
+                break;
+        if ( j == ARRAY_SIZE(benches) )
+            usage(1);
+    }
+
+    xch = xc_interface_open(0, 0, 0);
+    if ( !xch )
+    {
+        fprintf(stderr, "Error opening xc interface: %d (%s)\n",
+                errno, strerror(errno));
+        return 1;
+    }
+
+    printf("{\n  \"benchmarks\": {\n");
+
+    for ( i = 0; i < ARRAY_SIZE(benches); i++ )
+    {
+        if ( !selected(benches[i].name, argc, argv) )
+            continue;
+
+        samples = nr_samples ?: benches[i].samples;
+        if ( init_result(&r, samples) || init_result(&second, samples) )
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(2);
+        }
+
+        rc = benches[i].fn(&r, &second);
+        if ( rc )
+        {
+            fprintf(stderr, "%s failed: %d (%s)\n", benches[i].name, rc,
+                    strerror(rc));
+            ret = 1;
+        }
+        else
+        {
+            print_result(benches[i].name, &r, first);
+            if ( benches[i].second )
+                print_result(benches[i].second, &second, false);
+            first = false;
+        }
+
+        free(second.ns);
+        free(r.ns);
+    }
+
+    printf("\n  }\n}\n");
+
+    xc_interface_close(xch);
+
+    return ret;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -403,6 +403,75 @@ static int test_ta3_deinit(uintptr_t par)
     return verify_node(paths[0], "b", 1);
 }
 
+static int test_ta4_init(uintptr_t par)
+{
+    if ( !xs_write(xsh, XBT_NULL, paths[0], write_buffers[0], 1) ||
+         !xs_write(xsh, XBT_NULL, paths[1], write_buffers[1], 1) )
+        return errno;
+    return 0;
+}
+
+/* Remove a node only read so far in the transaction, see access_node(). */
+static int test_ta4(uintptr_t par)
+{
+    xs_transaction_t t;
+    char *buf;
+    unsigned int len;
+    int ret;
+    int l;
+
+    for ( l = 0; l < MAX_TA_LOOPS; l++ )
+    {
+        t = xs_transaction_start(xsh);
+        if ( t == XBT_NULL )
+            return errno;
+        buf = xs_read(xsh, t, paths[0], &len);
+        if ( !buf )
+            goto out;
+        free(buf);
+        if ( !xs_rm(xsh, t, paths[0]) )
+            goto out;
+        buf = xs_read(xsh, t, paths[0], &len);
+        free(buf);
+        if ( buf || errno != ENOENT )
+        {
+            errno = ENODATA;
+            goto out;
+        }
+        errno = verify_node(paths[0], "a", 1);
+        if ( errno )
+            goto out;
+        if ( xs_transaction_end(xsh, t, par ? true : false) )
+            return 0;
+        if ( errno != EAGAIN )
+            return errno;
+    }
+
+    ta_loops++;
+    return 0;
+
+ out:
+    ret = errno;
+    xs_transaction_end(xsh, t, true);
+    return ret;
+}
+
+static int test_ta4_deinit(uintptr_t par)
+{
+    char *buf;
+    unsigned int len;
+
+    if ( par )
+        return verify_node(paths[0], "a", 1);
+
+    buf = xs_read(xsh, XBT_NULL, paths[0], &len);
+    free(buf);
+    if ( buf || errno != ENOENT )
+        return ENODATA;
+
+    return verify_node(paths[1], "b", 1);
+}
+
 #define TEST(s, f, p, l) { s, f ## _init, f, f ## _deinit, (uintptr_t)(p), l }
 struct test tests[] = {
 TEST("read 1", test_read, 1, "Read node with 1 byte data"),
@@ -417,6 +486,8 @@ TEST("ta empty x", test_ta1, 1, "Empty transaction abort"),
 TEST("ta rmw", test_ta2, 0, "Read-modify-write transaction"),
 TEST("ta rmw x", test_ta2, 1, "Read-modify-write transaction abort"),
 TEST("ta err", test_ta3, 0, "Transaction with conflict"),
+TEST("ta rm", test_ta4, 0, "Transaction removing a node it read"),
+TEST("ta rm x", test_ta4, 1, "Transaction removing a node it read abort"),
 };
 
 static void cleanup(void)
@@ -0,0 +1,208 @@
+/*
+ * xs-watch-bench.c
+ *
+ * Measure the latency of Xenstore writes as the number of registered
+ * watches grows.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms and conditions of the GNU General Public
+ * License, version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <xenstore.h>
+
+#define BENCH_PATH "xenstore-watch-bench"
+
+static struct xs_handle *xsh, *watch_xsh;
+static char *path;
+
+static struct option options[] = {
+    { "watches", 1, NULL, 'w' },
+    { "writes", 1, NULL, 'n' },
+    { "help", 0, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+static void usage(int ret)
+{
+    FILE *out;
+
+    out = ret ? stderr : stdout;
+
+    fprintf(out, "usage: xs-watch-bench [<options>]\n");
+    fprintf(out, "  <options> are:\n");
+    fprintf(out, "  -w|--watches <w>  go up to <w> watches (default 10000)\n");
+    fprintf(out, "  -n|--writes <n>   time <n> writes per step (default 1000)\n");
+    fprintf(out, "  -h|--help         print this usage information\n");
+    exit(ret);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec tp;
+
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+}
+
+/* Register watches up to nr, each on a node of its own. */
+static int add_watches(unsigned int from, unsigned int nr)
+{
+    char node[64], token[16];
+    unsigned int i;
+
+    for ( i = from; i < nr; i++ )
+    {
+        snprintf(node, sizeof(node), "%s/w/%u/%u", path, i % 100, i);
+        snprintf(token, sizeof(token), "%u", i);
+        if ( !xs_watch(watch_xsh, node, token) )
+            return errno;
+    }
+
+    return 0;
+}
+
+/* Time a number of writes to node, printing average, minimum and maximum. */
+static int time_writes(const char *node, unsigned int writes)
+{
+    uint64_t t, nsec, nsec_min = -1, nsec_max = 0, nsec_sum = 0;
+    char val[16];
+    unsigned int i;
+
+    for ( i = 0; i < writes; i++ )
+    {
+        snprintf(val, sizeof(val), "%u", i);
+        t = now_ns();
+        if ( !xs_write(xsh, XBT_NULL, node, val, strlen(val)) )
+            return errno;
+        nsec = now_ns() - t;
+        if ( nsec < nsec_min )
+            nsec_min = nsec;
+        if ( nsec > nsec_max )
+            nsec_max = nsec;
+        nsec_sum += nsec;
+    }
+
+    printf(" %8"PRIu64" ns (%"PRIu64" .. %"PRIu64")",
+           nsec_sum / writes, nsec_min, nsec_max);
+
+    return 0;
+}
+
+/* Throw away the events queued for the watches. */
+static void drain_events(void)
+{
+    char **vec;
+
+    while ( (vec = xs_check_watch(watch_xsh)) )
+        free(vec);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int max_watches = 10000, writes = 1000, nr, done = 0;
+    char *data, *watched;
+    int opt, ret = 0;
+
+    while ( (opt = getopt_long(argc, argv, "w:n:h", options, NULL)) != -1 )
+    {
+        switch ( opt )
+        {
+        case 'w':
+            max_watches = atoi(optarg);
+            break;
+        case 'n':
+            writes = atoi(optarg);
+            break;
+        case 'h':
+            usage(0);
+            break;
+        default:
+            usage(1);
+        }
+    }
+    if ( optind != argc || !writes )
+        usage(1);
+
+    if ( asprintf(&path, "%s/%u", BENCH_PATH, getpid()) < 0 ||
+         asprintf(&data, "%s/data", path) < 0 ||
+         asprintf(&watched, "%s/w/0/0", path) < 0 )
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+
+    xsh = xs_open(0);
+    watch_xsh = xs_open(0);
+    if ( !xsh || !watch_xsh )
+    {
+        fprintf(stderr, "could not connect to xenstore\n");
+        exit(2);
+    }
+
+    printf("%8s  %-37s %s\n", "watches", "write, not watched",
+           "write, watched");
+
+    for ( nr = 0; ; nr = nr ? nr * 10 : 1 )
+    {
+        if ( nr > max_watches )
+            nr = max_watches;
+
+        ret = add_watches(done, nr);
+        if ( ret )
+        {
+            fprintf(stderr, "adding watches failed: %s\n", strerror(ret));
+            break;
+        }
+        done = nr;
+        drain_events();
+
+        printf("%8u ", nr);
+        ret = time_writes(data, writes);
+        if ( !ret )
+            ret = time_writes(watched, writes);
+        printf("\n");
+        if ( ret )
+        {
+            fprintf(stderr, "write failed: %s\n", strerror(ret));
+            break;
+        }
+        drain_events();
+
+        if ( nr == max_watches )
+            break;
+    }
+
+    xs_close(watch_xsh);
+    xs_rm(xsh, XBT_NULL, path);
+    xs_close(xsh);
+
+    return ret ? 1 : 0;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -483,44 +483,74 @@ xenstat_vbd *xenstat_domain_vbd(xenstat_domain * domain,
 /* Collect information about VCPUs */
 static int xenstat_collect_vcpus(xenstat_node * node)
 {
-	unsigned int i, vcpu, inc_index;
+	unsigned int i, vcpu, inc_index, max_vcpus = 0;
+	struct xen_domctl *domctls = NULL;
+	int *rcs = NULL, ret = 0;
 
 	/* Fill in VCPU information */
 	for (i = 0; i < node->num_domains; i+=inc_index) {
+		unsigned int num_vcpus = node->domains[i].num_vcpus;
+
 		inc_index = 1; /* default is to increment to next domain */
 
-		node->domains[i].vcpus = malloc(node->domains[i].num_vcpus
+		node->domains[i].vcpus = malloc(num_vcpus
 						* sizeof(xenstat_vcpu));
 		if (node->domains[i].vcpus == NULL)
-			return 0;
-	
-		for (vcpu = 0; vcpu < node->domains[i].num_vcpus; vcpu++) {
-			/* FIXME: need to be using a more efficient mechanism*/
-			xc_vcpuinfo_t info;
+			goto out;
+
+		if (num_vcpus == 0)
+			continue;
+
+		if (num_vcpus > max_vcpus) {
+			free(domctls);
+			free(rcs);
+			domctls = malloc(num_vcpus * sizeof(*domctls));
+			rcs = malloc(num_vcpus * sizeof(*rcs));
+			if (domctls == NULL || rcs == NULL)
+				goto out;
+			max_vcpus = num_vcpus;
+		}
 
-			if (xc_vcpu_getinfo(node->handle->xc_handle,
-					    node->domains[i].id, vcpu, &info) != 0) {
-				if (errno == ENOMEM) {
-					/* fatal error */ 
-					return 0;
-				}
-				else {
-					/* domain is in transition - remove
-					   from list */
-					xenstat_prune_domain(node, i);
+		/* Query all of the domain's VCPUs with a single hypercall */
+		memset(domctls, 0, num_vcpus * sizeof(*domctls));
+		for (vcpu = 0; vcpu < num_vcpus; vcpu++) {
+			domctls[vcpu].cmd = XEN_DOMCTL_getvcpuinfo;
+			domctls[vcpu].domain = node->domains[i].id;
+			domctls[vcpu].u.getvcpuinfo.vcpu = vcpu;
+		}
 
-					/* remember not to increment index! */
-					inc_index = 0;
-					break;
-				}
+		if (xc_domctl_batch(node->handle->xc_handle, num_vcpus,
+				    domctls, rcs) != 0) {
+			if (errno == ENOMEM) {
+				/* fatal error */
+				goto out;
 			}
-			else {
-				node->domains[i].vcpus[vcpu].online = info.online;
-				node->domains[i].vcpus[vcpu].ns = info.cpu_time;
+			/* no results at all - as if the first query failed */
+			rcs[0] = -1;
+		}
+
+		for (vcpu = 0; vcpu < num_vcpus; vcpu++) {
+			if (rcs[vcpu] != 0) {
+				/* domain is in transition - remove
+				   from list */
+				xenstat_prune_domain(node, i);
+
+				/* remember not to increment index! */
+				inc_index = 0;
+				break;
 			}
+			node->domains[i].vcpus[vcpu].online =
+				domctls[vcpu].u.getvcpuinfo.online;
+			node->domains[i].vcpus[vcpu].ns =
+				domctls[vcpu].u.getvcpuinfo.cpu_time;
 		}
 	}
-	return 1;
+	ret = 1;
+
+ out:
+	free(domctls);
+	free(rcs);
+	return ret;
 }
 
 /* Free VCPU information */
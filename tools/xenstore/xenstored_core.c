@@ -40,6 +40,10 @@
 #include <signal.h>
 #include <assert.h>
 #include <setjmp.h>
+#if defined(__linux__) && !defined(NO_SOCKETS)
+#define USE_EPOLL 1
+#include <sys/epoll.h>
+#endif
 
 #include <xenevtchn.h>
 
@@ -65,19 +69,29 @@
 #endif
 
 extern xenevtchn_handle *xce_handle; /* in xenstored_domain.c */
-static int xce_pollfd_idx = -1;
+#ifdef USE_EPOLL
+#define MAX_EPOLL_EVENTS 64
+static int epoll_fd = -1;
+static struct epoll_event epoll_events[MAX_EPOLL_EVENTS];
+static int nr_epoll_events;
+#else
 static struct pollfd *fds;
+static void **fd_tags;
 static unsigned int current_array_size;
 static unsigned int nr_fds;
 
 #define ROUNDUP(_x, _w) (((unsigned long)(_x)+(1UL<<(_w))-1) & ~((1UL<<(_w))-1))
+#endif
 
 static bool verbose = false;
 LIST_HEAD(connections);
+/* Connections the main loop has to look at, see prepare_wait(). */
+static LIST_HEAD(ready_conns);
 int tracefd = -1;
 static bool recovery = true;
 static int reopen_log_pipe[2];
 static int reopen_log_pipe0_pollfd_idx = -1;
+static int *sock = NULL, *ro_sock = NULL;
 char *tracefile = NULL;
 TDB_CONTEXT *tdb_ctx = NULL;
 
@@ -253,35 +267,100 @@ static bool write_messages(struct connection *conn)
 	return true;
 }
 
-static int destroy_conn(void *_conn)
+/*
+ * The main loop waits for events on the listening sockets, the event
+ * channel device, the log reopen pipe and the socket connections.  Each
+ * is watched with a tag telling handle_fd_event() what it is: the
+ * connection, or the address of the daemon's own file descriptor.
+ *
+ * Domain connections have no file descriptor: they are put on ready_conns
+ * when their event channel fires or output is queued for them, and stay
+ * there as long as they have requests to read or responses to write.  An
+ * event thus only costs work for the connections concerned, however many
+ * domains there are.
+ */
+static void handle_fd_event(void *tag, short revents);
+
+#ifdef USE_EPOLL
+static void init_fds(void)
 {
-	struct connection *conn = _conn;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+		barf_perror("Failed to create epoll instance");
+}
 
-	/* Flush outgoing if possible, but don't block. */
-	if (!conn->domain) {
-		struct pollfd pfd;
-		pfd.fd = conn->fd;
-		pfd.events = POLLOUT;
+/* POLLIN, POLLPRI and POLLOUT have the same values as their EPOLL* twins. */
+static int watch_fd(int fd, short events, void *tag)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = tag };
 
-		while (!list_empty(&conn->out_list)
-		       && poll(&pfd, 1, 0) == 1)
-			if (!write_messages(conn))
-				break;
-		close(conn->fd);
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		syslog(LOG_ERR, "epoll_ctl failed, ignoring fd %d\n", fd);
+		return -1;
 	}
-        if (conn->target)
-                talloc_unlink(conn, conn->target);
-	list_del(&conn->list);
-	trace_destroy(conn, "connection");
+
 	return 0;
 }
 
+static void update_fd(int fd, int idx, short events, void *tag)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = tag };
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev))
+		syslog(LOG_ERR, "epoll_ctl failed for fd %d\n", fd);
+}
+
+static void forget_fd(int fd, int idx, void *tag)
+{
+	struct epoll_event ev = { 0 };
+	int i;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+
+	/* Drop the events still to be handled for it. */
+	for (i = 0; i < nr_epoll_events; i++)
+		if (epoll_events[i].data.ptr == tag)
+			epoll_events[i].data.ptr = NULL;
+}
+
+static void wait_fds(int timeout)
+{
+	int i;
+
+	nr_epoll_events = epoll_wait(epoll_fd, epoll_events, MAX_EPOLL_EVENTS,
+				     timeout);
+	if (nr_epoll_events < 0) {
+		nr_epoll_events = 0;
+		if (errno == EINTR)
+			return;
+		barf_perror("epoll_wait failed");
+	}
+
+	for (i = 0; i < nr_epoll_events; i++)
+		if (epoll_events[i].data.ptr)
+			handle_fd_event(epoll_events[i].data.ptr,
+					epoll_events[i].events);
+
+	nr_epoll_events = 0;
+}
+#else
+static void init_fds(void)
+{
+}
+
 /* This function returns index inside the array if succeed, -1 if fail */
-static int set_fd(int fd, short events)
+static int watch_fd(int fd, short events, void *tag)
 {
-	int ret;
-	if (current_array_size < nr_fds + 1) {
+	unsigned int idx;
+
+	/* Reuse the slot of a file descriptor no longer watched, if any. */
+	for (idx = 0; idx < nr_fds; idx++)
+		if (fds[idx].fd == -1)
+			break;
+
+	if (idx == current_array_size) {
 		struct pollfd *new_fds = NULL;
+		void **new_tags = NULL;
 		unsigned long newsize;
 
 		/* Round up to 2^8 boundary, in practice this just
@@ -294,62 +373,135 @@ static int set_fd(int fd, short events)
 			goto fail;
 		fds = new_fds;
 
+		new_tags = realloc(fd_tags, sizeof(void *)*newsize);
+		if (!new_tags)
+			goto fail;
+		fd_tags = new_tags;
+
 		memset(&fds[0] + current_array_size, 0,
 		       sizeof(struct pollfd ) * (newsize-current_array_size));
 		current_array_size = newsize;
 	}
 
-	fds[nr_fds].fd = fd;
-	fds[nr_fds].events = events;
-	ret = nr_fds;
-	nr_fds++;
+	if (idx == nr_fds)
+		nr_fds++;
 
-	return ret;
+	fds[idx].fd = fd;
+	fds[idx].events = events;
+	fds[idx].revents = 0;
+	fd_tags[idx] = tag;
+
+	return idx;
 fail:
 	syslog(LOG_ERR, "realloc failed, ignoring fd %d\n", fd);
 	return -1;
 }
 
-static void initialize_fds(int sock, int *p_sock_pollfd_idx,
-			   int ro_sock, int *p_ro_sock_pollfd_idx,
-			   int *ptimeout)
+static void update_fd(int fd, int idx, short events, void *tag)
 {
-	struct connection *conn;
-	struct wrl_timestampt now;
+	fds[idx].events = events;
+}
 
-	if (fds)
-		memset(fds, 0, sizeof(struct pollfd) * current_array_size);
-	nr_fds = 0;
+/* poll() skips the negative file descriptors. */
+static void forget_fd(int fd, int idx, void *tag)
+{
+	fds[idx].fd = -1;
+	fds[idx].revents = 0;
+	fd_tags[idx] = NULL;
+}
 
-	*ptimeout = -1;
+static void wait_fds(int timeout)
+{
+	unsigned int idx;
 
-	if (sock != -1)
-		*p_sock_pollfd_idx = set_fd(sock, POLLIN|POLLPRI);
-	if (ro_sock != -1)
-		*p_ro_sock_pollfd_idx = set_fd(ro_sock, POLLIN|POLLPRI);
-	if (reopen_log_pipe[0] != -1)
-		reopen_log_pipe0_pollfd_idx =
-			set_fd(reopen_log_pipe[0], POLLIN|POLLPRI);
+	if (poll(fds, nr_fds, timeout) < 0) {
+		if (errno == EINTR)
+			return;
+		barf_perror("Poll failed");
+	}
 
-	if (xce_handle != NULL)
-		xce_pollfd_idx = set_fd(xenevtchn_fd(xce_handle),
-					POLLIN|POLLPRI);
+	/* Slots may be forgotten, or reused, on the way. */
+	for (idx = 0; idx < nr_fds; idx++)
+		if (fds[idx].revents && fd_tags[idx])
+			handle_fd_event(fd_tags[idx], fds[idx].revents);
+}
+#endif
+
+static int destroy_conn(void *_conn)
+{
+	struct connection *conn = _conn;
+
+	/* Flush outgoing if possible, but don't block. */
+	if (!conn->domain) {
+		struct pollfd pfd;
+		pfd.fd = conn->fd;
+		pfd.events = POLLOUT;
+
+		while (!list_empty(&conn->out_list)
+		       && poll(&pfd, 1, 0) == 1)
+			if (!write_messages(conn))
+				break;
+		if (conn->pollfd_idx != -1)
+			forget_fd(conn->fd, conn->pollfd_idx, conn);
+		close(conn->fd);
+	}
+        if (conn->target)
+                talloc_unlink(conn, conn->target);
+	list_del(&conn->list);
+	list_del(&conn->ready_list);
+	trace_destroy(conn, "connection");
+	return 0;
+}
+
+void conn_wakeup(struct connection *conn)
+{
+	if (list_empty(&conn->ready_list))
+		list_add_tail(&conn->ready_list, &ready_conns);
+}
+
+/*
+ * Go through the ready connections after an event: bring the events
+ * waited for on sockets up to date, and work out how long to wait for
+ * the next one.  Domain connections which have nothing left to do are
+ * taken off the list, except those held up by the write rate limit.
+ */
+static void prepare_wait(int *ptimeout)
+{
+	static bool throttled;
+	struct connection *conn, *next;
+	struct wrl_timestampt now;
+
+	*ptimeout = -1;
 
 	wrl_gettime_now(&now);
 	wrl_log_periodic(now);
 
-	list_for_each_entry(conn, &connections, list) {
+	/* Let the domains held up draw on the credit of the idle ones. */
+	if (throttled)
+		wrl_credit_update_all(now);
+	throttled = false;
+
+	list_for_each_entry_safe(conn, next, &ready_conns, ready_list) {
 		if (conn->domain) {
 			wrl_check_timeout(conn->domain, now, ptimeout);
 			if (domain_can_read(conn) ||
 			    (domain_can_write(conn) &&
 			     !list_empty(&conn->out_list)))
 				*ptimeout = 0;
+			else if (domain_req_pending(conn))
+				throttled = true;
+			else
+				list_del_init(&conn->ready_list);
 		} else {
 			short events = POLLIN|POLLPRI;
 			if (!list_empty(&conn->out_list))
 				events |= POLLOUT;
-			conn->pollfd_idx = set_fd(conn->fd, events);
+			if (conn->pollfd_idx != -1 &&
+			    events != conn->pollfd_events)
+				update_fd(conn->fd, conn->pollfd_idx, events,
+					  conn);
+			conn->pollfd_events = events;
+			list_del_init(&conn->ready_list);
 		}
 	}
 }
@@ -706,6 +858,7 @@ void send_reply(struct connection *conn, enum xsd_sockmsg_type type,
 
 	/* Queue for later transmission. */
 	list_add_tail(&bdata->list, &conn->out_list);
+	conn_wakeup(conn);
 
 	return;
 }
@@ -891,7 +1044,8 @@ static void delete_node_single(struct connection *conn, struct node *node)
 	if (access_node(conn, node, NODE_ACCESS_DELETE, &key))
 		return;
 
-	if (tdb_delete(tdb_ctx, key) != 0) {
+	/* No key if only read in the transaction: nothing of its own yet. */
+	if (key.dptr && tdb_delete(tdb_ctx, key) != 0) {
 		corrupt(conn, "Could not delete '%s'", node->name);
 		return;
 	}
@@ -1425,6 +1579,7 @@ struct connection *new_connection(connwritefn_t *write, connreadfn_t *read)
 	new->can_write = true;
 	new->transaction_started = 0;
 	INIT_LIST_HEAD(&new->out_list);
+	INIT_LIST_HEAD(&new->ready_list);
 	INIT_LIST_HEAD(&new->watches);
 	INIT_LIST_HEAD(&new->transaction_list);
 
@@ -1490,11 +1645,109 @@ static void accept_connection(int sock, bool canwrite)
 	if (conn) {
 		conn->fd = fd;
 		conn->can_write = canwrite;
+		conn->pollfd_events = POLLIN|POLLPRI;
+		conn->pollfd_idx = watch_fd(fd, conn->pollfd_events, conn);
+		if (conn->pollfd_idx == -1)
+			talloc_free(conn);
 	} else
 		close(fd);
 }
 #endif
 
+static void watch_reopen_log_pipe(void)
+{
+	reopen_log_pipe0_pollfd_idx =
+		watch_fd(reopen_log_pipe[0], POLLIN|POLLPRI, &reopen_log_pipe[0]);
+}
+
+static void handle_conn_event(struct connection *conn, short revents)
+{
+	talloc_increase_ref_count(conn);
+	if (revents & ~(POLLIN|POLLOUT))
+		talloc_free(conn);
+	else if (revents & POLLIN)
+		handle_input(conn);
+	if (talloc_free(conn) == 0)
+		return;
+
+	talloc_increase_ref_count(conn);
+	if (revents & ~(POLLIN|POLLOUT))
+		talloc_free(conn);
+	else if (revents & POLLOUT)
+		handle_output(conn);
+	if (talloc_free(conn) == 0)
+		return;
+
+	/* Have prepare_wait() bring the events waited for up to date. */
+	conn_wakeup(conn);
+}
+
+static void handle_fd_event(void *tag, short revents)
+{
+	if (tag == &reopen_log_pipe[0]) {
+		if (revents & ~POLLIN) {
+			forget_fd(reopen_log_pipe[0],
+				  reopen_log_pipe0_pollfd_idx, tag);
+			close(reopen_log_pipe[0]);
+			close(reopen_log_pipe[1]);
+			init_pipe(reopen_log_pipe);
+			watch_reopen_log_pipe();
+		} else if (revents & POLLIN) {
+			char c;
+			if (read(reopen_log_pipe[0], &c, 1) != 1)
+				barf_perror("read failed");
+			reopen_log();
+		}
+	} else if (tag == sock) {
+		if (revents & ~POLLIN)
+			barf_perror("sock poll failed");
+		accept_connection(*sock, true);
+	} else if (tag == ro_sock) {
+		if (revents & ~POLLIN)
+			barf_perror("ro sock poll failed");
+		accept_connection(*ro_sock, false);
+	} else if (tag == &xce_handle) {
+		if (revents & ~POLLIN)
+			barf_perror("xce_handle poll failed");
+		handle_event();
+	} else
+		handle_conn_event(tag, revents);
+}
+
+/* Domain connections have their rings looked at here, see prepare_wait(). */
+static void handle_ready_conns(void)
+{
+	struct connection *conn, *next;
+
+	next = list_entry(ready_conns.next, typeof(*conn), ready_list);
+	if (&next->ready_list != &ready_conns)
+		talloc_increase_ref_count(next);
+	while (&next->ready_list != &ready_conns) {
+		conn = next;
+
+		next = list_entry(conn->ready_list.next,
+				  typeof(*conn), ready_list);
+		if (&next->ready_list != &ready_conns)
+			talloc_increase_ref_count(next);
+
+		if (!conn->domain) {
+			talloc_free(conn);
+			continue;
+		}
+
+		if (domain_can_read(conn))
+			handle_input(conn);
+		if (talloc_free(conn) == 0)
+			continue;
+
+		talloc_increase_ref_count(conn);
+		if (domain_can_write(conn) &&
+		    !list_empty(&conn->out_list))
+			handle_output(conn);
+		talloc_free(conn);
+	}
+}
+
 static int tdb_flags;
 
 /* We create initial nodes manually. */
@@ -1563,7 +1816,7 @@ static void setup_structure(void)
 }
 
 
-static unsigned int hash_from_key_fn(void *k)
+unsigned int hash_from_key_fn(void *k)
 {
 	char *str = k;
 	unsigned int hash = 5381;
@@ -1576,7 +1829,7 @@ static unsigned int hash_from_key_fn(void *k)
 }
 
 
-static int keys_equal_fn(void *key1, void *key2)
+int keys_equal_fn(void *key1, void *key2)
 {
 	return 0 == strcmp((char *)key1, (char *)key2);
 }
@@ -1909,8 +2162,7 @@ int priv_domid = 0;
 
 int main(int argc, char *argv[])
 {
-	int opt, *sock = NULL, *ro_sock = NULL;
-	int sock_pollfd_idx = -1, ro_sock_pollfd_idx = -1;
+	int opt;
 	bool dofork = true;
 	bool outputpid = false;
 	bool no_domain_init = false;
@@ -2025,8 +2277,18 @@ int main(int argc, char *argv[])
 		tracefile = talloc_strdup(NULL, tracefile);
 
 	/* Get ready to listen to the tools. */
-	initialize_fds(*sock, &sock_pollfd_idx, *ro_sock, &ro_sock_pollfd_idx,
-		       &timeout);
+	init_fds();
+	if (*sock != -1 && watch_fd(*sock, POLLIN|POLLPRI, sock) == -1)
+		barf("Failed to watch socket");
+	if (*ro_sock != -1 &&
+	    watch_fd(*ro_sock, POLLIN|POLLPRI, ro_sock) == -1)
+		barf("Failed to watch ro socket");
+	watch_reopen_log_pipe();
+	if (xce_handle != NULL &&
+	    watch_fd(xenevtchn_fd(xce_handle), POLLIN|POLLPRI,
+		     &xce_handle) == -1)
+		barf("Failed to watch event channel");
+	prepare_wait(&timeout);
 
 	/* Tell the kernel we're up and running. */
 	xenbus_notify_running();
@@ -2038,114 +2300,9 @@ int main(int argc, char *argv[])
 
 	/* Main loop. */
 	for (;;) {
-		struct connection *conn, *next;
-
-		if (poll(fds, nr_fds, timeout) < 0) {
-			if (errno == EINTR)
-				continue;
-			barf_perror("Poll failed");
-		}
-
-		if (reopen_log_pipe0_pollfd_idx != -1) {
-			if (fds[reopen_log_pipe0_pollfd_idx].revents
-			    & ~POLLIN) {
-				close(reopen_log_pipe[0]);
-				close(reopen_log_pipe[1]);
-				init_pipe(reopen_log_pipe);
-			} else if (fds[reopen_log_pipe0_pollfd_idx].revents
-				   & POLLIN) {
-				char c;
-				if (read(reopen_log_pipe[0], &c, 1) != 1)
-					barf_perror("read failed");
-				reopen_log();
-			}
-			reopen_log_pipe0_pollfd_idx = -1;
-		}
-
-		if (sock_pollfd_idx != -1) {
-			if (fds[sock_pollfd_idx].revents & ~POLLIN) {
-				barf_perror("sock poll failed");
-				break;
-			} else if (fds[sock_pollfd_idx].revents & POLLIN) {
-				accept_connection(*sock, true);
-				sock_pollfd_idx = -1;
-			}
-		}
-
-		if (ro_sock_pollfd_idx != -1) {
-			if (fds[ro_sock_pollfd_idx].revents & ~POLLIN) {
-				barf_perror("ro sock poll failed");
-				break;
-			} else if (fds[ro_sock_pollfd_idx].revents & POLLIN) {
-				accept_connection(*ro_sock, false);
-				ro_sock_pollfd_idx = -1;
-			}
-		}
-
-		if (xce_pollfd_idx != -1) {
-			if (fds[xce_pollfd_idx].revents & ~POLLIN) {
-				barf_perror("xce_handle poll failed");
-				break;
-			} else if (fds[xce_pollfd_idx].revents & POLLIN) {
-				handle_event();
-				xce_pollfd_idx = -1;
-			}
-		}
-
-		next = list_entry(connections.next, typeof(*conn), list);
-		if (&next->list != &connections)
-			talloc_increase_ref_count(next);
-		while (&next->list != &connections) {
-			conn = next;
-
-			next = list_entry(conn->list.next,
-					  typeof(*conn), list);
-			if (&next->list != &connections)
-				talloc_increase_ref_count(next);
-
-			if (conn->domain) {
-				if (domain_can_read(conn))
-					handle_input(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-				if (domain_can_write(conn) &&
-				    !list_empty(&conn->out_list))
-					handle_output(conn);
-				if (talloc_free(conn) == 0)
-					continue;
-			} else {
-				if (conn->pollfd_idx != -1) {
-					if (fds[conn->pollfd_idx].revents
-					    & ~(POLLIN|POLLOUT))
-						talloc_free(conn);
-					else if (fds[conn->pollfd_idx].revents
-						 & POLLIN)
-						handle_input(conn);
-				}
-				if (talloc_free(conn) == 0)
-					continue;
-
-				talloc_increase_ref_count(conn);
-
-				if (conn->pollfd_idx != -1) {
-					if (fds[conn->pollfd_idx].revents
-					    & ~(POLLIN|POLLOUT))
-						talloc_free(conn);
-					else if (fds[conn->pollfd_idx].revents
-						 & POLLOUT)
-						handle_output(conn);
-				}
-				if (talloc_free(conn) == 0)
-					continue;
-
-				conn->pollfd_idx = -1;
-			}
-		}
-
-		initialize_fds(*sock, &sock_pollfd_idx, *ro_sock,
-			       &ro_sock_pollfd_idx, &timeout);
+		wait_fds(timeout);
+		handle_ready_conns();
+		prepare_wait(&timeout);
 	}
 }
 
@@ -73,8 +73,13 @@ struct connection
 
 	/* The file descriptor we came in on. */
 	int fd;
-	/* The index of pollfd in global pollfd array */
+	/* The slot the file descriptor is watched in, -1 if it isn't. */
 	int pollfd_idx;
+	/* The events it is watched for. */
+	short pollfd_events;
+
+	/* On the list of connections the main loop has to look at. */
+	struct list_head ready_list;
 
 	/* Who am I? 0 for socket connections. */
 	unsigned int id;
@@ -160,6 +165,8 @@ struct node *get_node(struct connection *conn,
 		      enum xs_perm_type perm);
 
 struct connection *new_connection(connwritefn_t *write, connreadfn_t *read);
+/* Have the main loop look at this connection on its next pass. */
+void conn_wakeup(struct connection *conn);
 void check_store(void);
 void corrupt(struct connection *conn, const char *fmt, ...);
 
@@ -208,6 +215,9 @@ void init_pipe(int reopen_log_pipe[2]);
 
 xengnttab_handle **xgt_handle;
 
+/* Hashtables keyed by strings. */
+unsigned int hash_from_key_fn(void *k);
+int keys_equal_fn(void *key1, void *key2);
 int remember_string(struct hashtable *hash, const char *str);
 
 #endif /* _XENSTORED_CORE_H */
@@ -26,6 +26,7 @@
 
 #include "utils.h"
 #include "talloc.h"
+#include "hashtable.h"
 #include "xenstored_core.h"
 #include "xenstored_domain.h"
 #include "xenstored_transaction.h"
@@ -85,6 +86,42 @@ struct domain
 
 static LIST_HEAD(domains);
 
+/* The domains by local event channel port, for handle_event(). */
+static struct hashtable *domains_by_port;
+
+static unsigned int port_hash_fn(void *k)
+{
+	return *(evtchn_port_t *)k;
+}
+
+static int ports_equal_fn(void *key1, void *key2)
+{
+	return *(evtchn_port_t *)key1 == *(evtchn_port_t *)key2;
+}
+
+static int domain_hash_port(struct domain *domain)
+{
+	evtchn_port_t *key;
+
+	key = malloc(sizeof(*key));
+	if (!key)
+		return ENOMEM;
+	*key = domain->port;
+
+	if (!hashtable_insert(domains_by_port, key, domain)) {
+		free(key);
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+static void domain_unhash_port(struct domain *domain)
+{
+	if (domain->port)
+		hashtable_remove(domains_by_port, &domain->port);
+}
+
 static bool check_indexes(XENSTORE_RING_IDX cons, XENSTORE_RING_IDX prod)
 {
 	return ((prod - cons) <= XENSTORE_RING_SIZE);
@@ -198,6 +235,7 @@ static int destroy_domain(void *_domain)
 	list_del(&domain->list);
 
 	if (domain->port) {
+		domain_unhash_port(domain);
 		if (xenevtchn_unbind(xce_handle, domain->port) == -1)
 			eprintf("> Unbinding port %i failed!\n", domain->port);
 	}
@@ -244,16 +282,22 @@ static void domain_cleanup(void)
 		fire_watches(NULL, NULL, "@releaseDomain", false);
 }
 
-/* We scan all domains rather than use the information given here. */
+/* Hand the domain the event is for to the main loop. */
 void handle_event(void)
 {
 	evtchn_port_t port;
+	struct domain *domain;
 
 	if ((port = xenevtchn_pending(xce_handle)) == -1)
 		barf_perror("Failed to read from event fd");
 
 	if (port == virq_port)
 		domain_cleanup();
+	else {
+		domain = hashtable_search(domains_by_port, &port);
+		if (domain)
+			conn_wakeup(domain->conn);
+	}
 
 	if (xenevtchn_unmask(xce_handle, port) == -1)
 		barf_perror("Failed to write to event fd");
@@ -279,6 +323,14 @@ bool domain_is_unprivileged(struct connection *conn)
 	       domid_is_unprivileged(conn->domain->domid);
 }
 
+/* Are there requests left, whether the write rate limit lets us read them? */
+bool domain_req_pending(struct connection *conn)
+{
+	struct xenstore_domain_interface *intf = conn->domain->interface;
+
+	return (intf->req_cons != intf->req_prod);
+}
+
 bool domain_can_write(struct connection *conn)
 {
 	struct xenstore_domain_interface *intf = conn->domain->interface;
@@ -317,6 +369,10 @@ static struct domain *new_domain(void *context, unsigned int domid,
 	if (rc == -1)
 	    return NULL;
 	domain->port = rc;
+	if (domain_hash_port(domain)) {
+		errno = ENOMEM;
+		return NULL;
+	}
 
 	domain->conn = new_connection(writechn, readchn);
 	if (!domain->conn)
@@ -361,6 +417,8 @@ static void domain_conn_reset(struct domain *domain)
 
 	domain->interface->req_cons = domain->interface->req_prod = 0;
 	domain->interface->rsp_cons = domain->interface->rsp_prod = 0;
+
+	conn_wakeup(conn);
 }
 
 /* domid, mfn, evtchn, path */
@@ -410,11 +468,18 @@ int do_introduce(struct connection *conn, struct buffered_data *in)
 		fire_watches(NULL, in, "@introduceDomain", false);
 	} else if ((domain->mfn == mfn) && (domain->conn != conn)) {
 		/* Use XS_INTRODUCE for recreating the xenbus event-channel. */
-		if (domain->port)
+		if (domain->port) {
+			domain_unhash_port(domain);
 			xenevtchn_unbind(xce_handle, domain->port);
+		}
 		rc = xenevtchn_bind_interdomain(xce_handle, domid, port);
 		domain->port = (rc == -1) ? 0 : rc;
 		domain->remote_port = port;
+		if (domain->port && domain_hash_port(domain)) {
+			xenevtchn_unbind(xce_handle, domain->port);
+			domain->port = 0;
+			return ENOMEM;
+		}
 	} else
 		return EINVAL;
 
@@ -612,6 +677,7 @@ static int dom0_init(void)
 	talloc_steal(dom0->conn, dom0); 
 
 	xenevtchn_notify(xce_handle, dom0->port);
+	conn_wakeup(dom0->conn);
 
 	return 0; 
 }
@@ -645,6 +711,10 @@ void domain_init(void)
 	if (xce_handle == NULL)
 		barf_perror("Failed to open evtchn device");
 
+	domains_by_port = create_hashtable(16, port_hash_fn, ports_equal_fn);
+	if (!domains_by_port)
+		barf_perror("Failed to allocate domain port table");
+
 	if (dom0_init() != 0) 
 		barf_perror("Failed to initialize dom0 state"); 
 
@@ -879,6 +949,14 @@ void wrl_credit_update(struct domain *domain, struct wrl_timestampt now)
 	      (long)surplus);
 }
 
+void wrl_credit_update_all(struct wrl_timestampt now)
+{
+	struct domain *domain;
+
+	list_for_each_entry(domain, &domains, list)
+		wrl_credit_update(domain, now);
+}
+
 void wrl_check_timeout(struct domain *domain,
 		       struct wrl_timestampt now,
 		       int *ptimeout)
@@ -53,6 +53,7 @@ void restore_existing_connections(void);
 /* Can connection attached to domain read/write. */
 bool domain_can_read(struct connection *conn);
 bool domain_can_write(struct connection *conn);
+bool domain_req_pending(struct connection *conn);
 
 bool domain_is_unprivileged(struct connection *conn);
 
@@ -85,6 +86,7 @@ void wrl_gettime_now(struct wrl_timestampt *now_ts);
 void wrl_domain_new(struct domain *domain);
 void wrl_domain_destroy(struct domain *domain);
 void wrl_credit_update(struct domain *domain, struct wrl_timestampt now);
+void wrl_credit_update_all(struct wrl_timestampt now);
 void wrl_check_timeout(struct domain *domain,
                        struct wrl_timestampt now,
                        int *ptimeout);
@@ -101,6 +101,13 @@
  *    TA2: write node A:   g(2:A) = 6, G = 7
  *    End TA1: g(1:A) == g(A) => okay, B = 1:B, g(B) = 7, G = 8
  *    End TA2: g(2:B) != g(B) => EAGAIN
+ *
+ * Nodes read in a transaction are not copied to the transaction specific part
+ * of the data base: the transaction reads the global node as long as it has
+ * the generation count seen on the first read.  Only when a node read by a
+ * transaction is about to be modified or deleted globally, the node as it was
+ * read is copied to each transaction concerned (copy on write).  Transactions
+ * only reading nodes, the usual case, thus never copy any.
  */
 
 struct accessed_node
@@ -108,7 +115,7 @@ struct accessed_node
 	/* List of all changed nodes in the context of this transaction. */
 	struct list_head list;
 
-	/* The name of the node. */
+	/* The name of the node, key in the transaction's accessed_nodes. */
 	char *node;
 
 	/* Generation count (or NO_GENERATION) for conflict checking. */
@@ -120,6 +127,9 @@ struct accessed_node
 	/* Modified? */
 	bool modified;
 
+	/* Copied when modified globally after having been read? */
+	bool copied;
+
 	/* Transaction node in data base? */
 	bool ta_node;
 };
@@ -150,15 +160,22 @@ struct transaction
 	/* List of accessed nodes. */
 	struct list_head accessed;
 
+	/* The accessed nodes, by name. */
+	struct hashtable *accessed_nodes;
+
 	/* List of changed domains - to record the changed domain entry number */
 	struct list_head changed_domains;
 
 	/* Flag for letting transaction fail. */
 	bool fail;
+
+	/* List of all transactions, for copy on write. */
+	struct list_head all_list;
 };
 
 extern int quota_max_transaction;
 static uint64_t generation;
+static LIST_HEAD(transactions);
 
 static void set_tdb_key(const char *name, TDB_DATA *key)
 {
@@ -169,13 +186,16 @@ static void set_tdb_key(const char *name, TDB_DATA *key)
 static struct accessed_node *find_accessed_node(struct transaction *trans,
 						const char *name)
 {
-	struct accessed_node *i;
-
-	list_for_each_entry(i, &trans->accessed, list)
-		if (streq(i->node, name))
-			return i;
+	return hashtable_search(trans->accessed_nodes, (void *)name);
+}
 
-	return NULL;
+static void drop_accessed_node(struct transaction *trans,
+			       struct accessed_node *i)
+{
+	list_del(&i->list);
+	/* Frees the name too. */
+	hashtable_remove(trans->accessed_nodes, i->node);
+	talloc_free(i);
 }
 
 static char *transaction_get_node_name(void *ctx, struct transaction *trans,
@@ -184,9 +204,15 @@ static char *transaction_get_node_name(void *ctx, struct transaction *trans,
 	return talloc_asprintf(ctx, "%"PRIu64"/%s", trans->generation, name);
 }
 
+/* Is the node of the transaction in its own part of the data base? */
+static bool private_node(struct accessed_node *i)
+{
+	return i && (i->modified || i->copied);
+}
+
 /*
  * Prepend the transaction to name if node has been modified in the current
- * transaction.
+ * transaction, or copied for it.
  */
 int transaction_prepend(struct connection *conn, const char *name,
 			TDB_DATA *key)
@@ -194,7 +220,7 @@ int transaction_prepend(struct connection *conn, const char *name,
 	char *tdb_name;
 
 	if (!conn || !conn->transaction ||
-	    !find_accessed_node(conn->transaction, name)) {
+	    !private_node(find_accessed_node(conn->transaction, name))) {
 		set_tdb_key(name, key);
 		return 0;
 	}
@@ -209,6 +235,58 @@ int transaction_prepend(struct connection *conn, const char *name,
 	return 0;
 }
 
+/*
+ * A node is about to be modified or deleted in the global data base: give a
+ * copy of it to the transactions which have read it, but not yet modified it.
+ * They keep on seeing it as it was, and will fail to commit.
+ */
+static int copy_on_write(struct transaction *except, const char *name)
+{
+	struct transaction *trans;
+	struct accessed_node *i;
+	TDB_DATA key, ta_key, data = { NULL, 0 };
+	char *trans_name;
+	int ret = 0;
+
+	list_for_each_entry(trans, &transactions, all_list) {
+		if (trans == except)
+			continue;
+		i = find_accessed_node(trans, name);
+		if (!i || private_node(i))
+			continue;
+
+		i->copied = true;
+		if (i->generation == NO_GENERATION)
+			/* Absent when read: reading the copy gives ENOENT. */
+			continue;
+
+		if (!data.dptr) {
+			set_tdb_key(name, &key);
+			data = tdb_fetch(tdb_ctx, key);
+			if (!data.dptr) {
+				ret = EIO;
+				break;
+			}
+		}
+
+		trans_name = transaction_get_node_name(trans, trans, name);
+		if (!trans_name) {
+			trans->fail = true;
+			continue;
+		}
+		set_tdb_key(trans_name, &ta_key);
+		if (tdb_store(tdb_ctx, ta_key, data, TDB_REPLACE))
+			trans->fail = true;
+		else
+			i->ta_node = true;
+		talloc_free(trans_name);
+	}
+
+	talloc_free(data.dptr);
+
+	return ret;
+}
+
 /*
  * A node has been accessed.
  *
@@ -216,19 +294,19 @@ int transaction_prepend(struct connection *conn, const char *name,
  * node->generation).
  *
  * Accesses in a transaction will be added to the list of accessed nodes
- * if not already done. Read type accesses will copy the node to the
- * transaction specific data base part, write type accesses go there
- * anyway.
+ * if not already done. Write type accesses go to the transaction specific
+ * data base part, read type accesses only go there if the node has been
+ * modified in the transaction, or copied for it (see copy_on_write()).
  *
  * If not NULL, key will be supplied with name and length of name of the node
- * to be accessed in the data base.
+ * to be accessed in the data base.  For a delete, key->dptr is NULL if there
+ * is no record to delete there: the transaction had only read the node.
  */
 int access_node(struct connection *conn, struct node *node,
 		enum node_access_type type, TDB_DATA *key)
 {
 	struct accessed_node *i = NULL;
 	struct transaction *trans;
-	TDB_DATA local_key;
 	const char *trans_name = NULL;
 	int ret;
 	bool introduce = false;
@@ -241,6 +319,11 @@ int access_node(struct connection *conn, struct node *node,
 
 	if (!conn || !conn->transaction) {
 		/* They're changing the global database. */
+		if (type != NODE_ACCESS_READ &&
+		    (ret = copy_on_write(NULL, node->name))) {
+			errno = ret;
+			return ret;
+		}
 		if (key)
 			set_tdb_key(node->name, key);
 		return 0;
@@ -248,39 +331,33 @@ int access_node(struct connection *conn, struct node *node,
 
 	trans = conn->transaction;
 
-	trans_name = transaction_get_node_name(node, trans, node->name);
-	if (!trans_name)
-		goto nomem;
-
 	i = find_accessed_node(trans, node->name);
 	if (!i) {
 		i = talloc_zero(trans, struct accessed_node);
 		if (!i)
 			goto nomem;
-		i->node = talloc_strdup(i, node->name);
-		if (!i->node)
+		/* Allocated with malloc() as hashtable.c frees it. */
+		i->node = strdup(node->name);
+		if (!i->node) {
+			talloc_free(i);
+			goto nomem;
+		}
+		if (!hashtable_insert(trans->accessed_nodes, i->node, i)) {
+			free(i->node);
+			talloc_free(i);
 			goto nomem;
+		}
 
 		introduce = true;
-		i->ta_node = false;
 
 		/*
-		 * Additional transaction-specific node for read type. We only
-		 * have to verify read nodes if we didn't write them.
-		 *
-		 * The node is created and written to DB here to distinguish
-		 * from the write types.
+		 * We only have to verify read nodes if we didn't write them.
+		 * The node read stays in the global part of the data base
+		 * until it is modified there, see copy_on_write().
 		 */
 		if (type == NODE_ACCESS_READ) {
 			i->generation = node->generation;
 			i->check_gen = true;
-			if (node->generation != NO_GENERATION) {
-				set_tdb_key(trans_name, &local_key);
-				ret = write_node_raw(conn, &local_key, node);
-				if (ret)
-					goto err;
-				i->ta_node = true;
-			}
 		}
 		list_add_tail(&i->list, &trans->accessed);
 	}
@@ -293,6 +370,16 @@ int access_node(struct connection *conn, struct node *node,
 		return -1;
 
 	if (key) {
+		if (type == NODE_ACCESS_DELETE && !i->ta_node) {
+			key->dptr = NULL;
+			key->dsize = 0;
+			return 0;
+		}
+
+		trans_name = transaction_get_node_name(node, trans,
+						       node->name);
+		if (!trans_name)
+			goto nomem;
 		set_tdb_key(trans_name, key);
 		if (type == NODE_ACCESS_WRITE)
 			i->ta_node = true;
@@ -304,9 +391,8 @@ int access_node(struct connection *conn, struct node *node,
 
 nomem:
 	ret = ENOMEM;
-err:
-	talloc_free((void *)trans_name);
-	talloc_free(i);
+	if (introduce)
+		drop_accessed_node(trans, i);
 	trans->fail = true;
 	errno = ret;
 	return ret;
@@ -357,6 +443,8 @@ static int finalize_transaction(struct connection *conn,
 
 		if (i->modified) {
 			set_tdb_key(i->node, &key);
+			if (copy_on_write(trans, i->node))
+				goto err;
 			if (i->ta_node) {
 				data = tdb_fetch(tdb_ctx, ta_key);
 				if (!data.dptr)
@@ -375,8 +463,7 @@ static int finalize_transaction(struct connection *conn,
 
 		if (i->ta_node && tdb_delete(tdb_ctx, ta_key))
 			goto err;
-		list_del(&i->list);
-		talloc_free(i);
+		drop_accessed_node(trans, i);
 	}
 
 	return 0;
@@ -395,6 +482,7 @@ static int destroy_transaction(void *_transaction)
 
 	wrl_ntransactions--;
 	trace_destroy(trans, "transaction");
+	list_del(&trans->all_list);
 	while ((i = list_top(&trans->accessed, struct accessed_node, list))) {
 		if (i->ta_node) {
 			trans_name = transaction_get_node_name(i, trans,
@@ -404,9 +492,9 @@ static int destroy_transaction(void *_transaction)
 				tdb_delete(tdb_ctx, key);
 			}
 		}
-		list_del(&i->list);
-		talloc_free(i);
+		drop_accessed_node(trans, i);
 	}
+	hashtable_destroy(trans->accessed_nodes, 0);
 
 	return 0;
 }
@@ -444,6 +532,12 @@ int do_transaction_start(struct connection *conn, struct buffered_data *in)
 
 	INIT_LIST_HEAD(&trans->accessed);
 	INIT_LIST_HEAD(&trans->changed_domains);
+	trans->accessed_nodes = create_hashtable(16, hash_from_key_fn,
+						 keys_equal_fn);
+	if (!trans->accessed_nodes) {
+		talloc_free(trans);
+		return ENOMEM;
+	}
 	trans->fail = false;
 	trans->generation = generation++;
 
@@ -455,6 +549,7 @@ int do_transaction_start(struct connection *conn, struct buffered_data *in)
 
 	/* Now we own it. */
 	list_add_tail(&trans->list, &conn->transaction_list);
+	list_add_tail(&trans->all_list, &transactions);
 	talloc_steal(conn, trans);
 	talloc_set_destructor(trans, destroy_transaction);
 	conn->transaction_started++;
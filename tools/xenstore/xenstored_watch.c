@@ -25,6 +25,7 @@
 #include <assert.h>
 #include "talloc.h"
 #include "list.h"
+#include "hashtable.h"
 #include "xenstored_watch.h"
 #include "xenstore_lib.h"
 #include "utils.h"
@@ -40,6 +41,11 @@ struct watch
 	/* Current outstanding events applying to this watch. */
 	struct list_head events;
 
+	/* Watches on the same node, and the index entry for it. */
+	struct list_head node_list;
+	struct watch_node *wnode;
+	struct connection *conn;
+
 	/* Is this relative to connnection's implicit path? */
 	const char *relative_path;
 
@@ -47,6 +53,111 @@ struct watch
 	char *node;
 };
 
+/*
+ * Watches are indexed by the node they are on, in a tree mirroring the part
+ * of the store which is watched: there is an entry for each watched node and
+ * for each of its parents up to "/", or the special node itself for "@"
+ * watches.  The entries are looked up by path in watch_nodes, so firing the
+ * watches for a node costs a lookup per level of its path, plus one per entry
+ * below it when it is removed, instead of a look at every watch.
+ */
+struct watch_node
+{
+	/* Key in watch_nodes, allocated with malloc() as hashtable.c frees it. */
+	char *path;
+
+	struct watch_node *parent;
+	struct list_head children;
+	struct list_head sibling;
+
+	/* Watches on this node. */
+	struct list_head watches;
+};
+
+static struct hashtable *watch_nodes;
+
+static struct watch_node *find_watch_node(const char *path)
+{
+	if (!watch_nodes)
+		return NULL;
+	return hashtable_search(watch_nodes, (void *)path);
+}
+
+/* Drop the entry for a node if nothing is watched on it or below any more. */
+static void put_watch_node(struct watch_node *wnode)
+{
+	struct watch_node *parent;
+
+	while (wnode && list_empty(&wnode->watches) &&
+	       list_empty(&wnode->children)) {
+		parent = wnode->parent;
+		if (parent)
+			list_del(&wnode->sibling);
+		hashtable_remove(watch_nodes, wnode->path);
+		talloc_free(wnode);
+		wnode = parent;
+	}
+}
+
+static struct watch_node *get_watch_node(const char *path)
+{
+	struct watch_node *wnode, *parent = NULL;
+	char *slash;
+
+	wnode = find_watch_node(path);
+	if (wnode)
+		return wnode;
+
+	if (!watch_nodes) {
+		watch_nodes = create_hashtable(64, hash_from_key_fn,
+					       keys_equal_fn);
+		if (!watch_nodes)
+			return NULL;
+	}
+
+	/* "@" nodes and "/" have no parent. */
+	if (path[0] == '/' && path[1]) {
+		char *parent_path = talloc_strdup(NULL, path);
+
+		if (!parent_path)
+			return NULL;
+		slash = strrchr(parent_path, '/');
+		if (slash == parent_path)
+			slash++;
+		*slash = '\0';
+		parent = get_watch_node(parent_path);
+		talloc_free(parent_path);
+		if (!parent)
+			return NULL;
+	}
+
+	wnode = talloc_zero(NULL, struct watch_node);
+	if (!wnode)
+		goto nomem;
+	wnode->path = malloc(strlen(path) + 1);
+	if (!wnode->path)
+		goto nomem;
+	strcpy(wnode->path, path);
+	INIT_LIST_HEAD(&wnode->children);
+	INIT_LIST_HEAD(&wnode->watches);
+
+	if (!hashtable_insert(watch_nodes, wnode->path, wnode)) {
+		free(wnode->path);
+		goto nomem;
+	}
+
+	wnode->parent = parent;
+	if (parent)
+		list_add_tail(&wnode->sibling, &parent->children);
+
+	return wnode;
+
+ nomem:
+	talloc_free(wnode);
+	put_watch_node(parent);
+	return NULL;
+}
+
 static bool check_event_node(const char *node)
 {
 	if (!node || !strstarts(node, "@")) {
@@ -56,22 +167,28 @@ static bool check_event_node(const char *node)
 	return true;
 }
 
-/* Is child a subnode of parent, or equal? */
-static bool is_child(const char *child, const char *parent)
+/*
+ * Is the same event already queued and not being sent yet?  Then the client
+ * will see the node as it is now when it gets that one, and a second event
+ * would tell it nothing new.  Only look at the events queued after the last
+ * reply: this bounds the search, and keeps events in place relative to the
+ * replies.
+ */
+static bool event_pending(struct connection *conn, const char *data,
+			  unsigned int len)
 {
-	unsigned int len = strlen(parent);
-
-	/*
-	 * / should really be "" for this algorithm to work, but that's a
-	 * usability nightmare.
-	 */
-	if (streq(parent, "/"))
-		return true;
-
-	if (strncmp(child, parent, len) != 0)
-		return false;
+	struct buffered_data *out;
+
+	list_for_each_entry_reverse(out, &conn->out_list, list) {
+		if (out->hdr.msg.type != XS_WATCH_EVENT)
+			break;
+		if (!out->inhdr || out->used)
+			break;
+		if (out->hdr.msg.len == len && !memcmp(out->buffer, data, len))
+			return true;
+	}
 
-	return child[len] == '/' || child[len] == '\0';
+	return false;
 }
 
 /*
@@ -115,10 +232,31 @@ static void add_event(struct connection *conn,
 		return;
 	strcpy(data, name);
 	strcpy(data + strlen(name) + 1, watch->token);
-	send_reply(conn, XS_WATCH_EVENT, data, len);
+	if (!event_pending(conn, data, len))
+		send_reply(conn, XS_WATCH_EVENT, data, len);
 	talloc_free(data);
 }
 
+static void fire_watch_node(void *ctx, struct watch_node *wnode,
+			    const char *name)
+{
+	struct watch *watch;
+
+	list_for_each_entry(watch, &wnode->watches, node_list)
+		add_event(watch->conn, ctx, watch, name);
+}
+
+/* Fire the watches on a node and on all the nodes below it. */
+static void fire_watch_subtree(void *ctx, struct watch_node *wnode)
+{
+	struct watch_node *child;
+
+	fire_watch_node(ctx, wnode, wnode->path);
+
+	list_for_each_entry(child, &wnode->children, sibling)
+		fire_watch_subtree(ctx, child);
+}
+
 /*
  * Check whether any watch events are to be sent.
  * Temporary memory allocations are done with ctx.
@@ -126,26 +264,58 @@ static void add_event(struct connection *conn,
 void fire_watches(struct connection *conn, void *ctx, const char *name,
 		  bool recurse)
 {
-	struct connection *i;
-	struct watch *watch;
+	struct watch_node *root, *wnode, *child;
+	char *path, *p, *slash;
 
 	/* During transactions, don't fire watches. */
 	if (conn && conn->transaction)
 		return;
 
-	/* Create an event for each watch. */
-	list_for_each_entry(i, &connections, list) {
-		list_for_each_entry(watch, &i->watches, list) {
-			if (is_child(name, watch->node))
-				add_event(i, ctx, watch, name);
-			else if (recurse && is_child(watch->node, name))
-				add_event(i, ctx, watch, watch->node);
+	/* A watch on "/" sees everything, special nodes included. */
+	root = find_watch_node("/");
+	if (root)
+		fire_watch_node(ctx, root, name);
+
+	if (streq(name, "/"))
+		wnode = root;
+	else if (name[0] != '/') {
+		wnode = find_watch_node(name);
+		if (wnode)
+			fire_watch_node(ctx, wnode, name);
+	} else {
+		/*
+		 * Walk down from "/" to the node, as long as something is
+		 * watched on the way.
+		 */
+		path = talloc_strdup(ctx, name);
+		if (!path)
+			return;
+		wnode = root;
+		for (p = path + 1; wnode; p = slash + 1) {
+			slash = strchr(p, '/');
+			if (slash)
+				*slash = '\0';
+			wnode = find_watch_node(path);
+			if (wnode)
+				fire_watch_node(ctx, wnode, name);
+			if (!slash)
+				break;
+			*slash = '/';
 		}
+		talloc_free(path);
 	}
+
+	if (recurse && wnode)
+		list_for_each_entry(child, &wnode->children, sibling)
+			fire_watch_subtree(ctx, child);
 }
 
 static int destroy_watch(void *_watch)
 {
+	struct watch *watch = _watch;
+
+	list_del(&watch->node_list);
+	put_watch_node(watch->wnode);
 	trace_destroy(_watch, "watch");
 	return 0;
 }
@@ -199,6 +369,14 @@ int do_watch(struct connection *conn, struct buffered_data *in)
 
 	INIT_LIST_HEAD(&watch->events);
 
+	watch->wnode = get_watch_node(watch->node);
+	if (!watch->wnode) {
+		talloc_free(watch);
+		return ENOMEM;
+	}
+	watch->conn = conn;
+	list_add_tail(&watch->node_list, &watch->wnode->watches);
+
 	domain_watch_inc(conn);
 	list_add_tail(&watch->list, &conn->watches);
 	trace_create(watch, "watch");
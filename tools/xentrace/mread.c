@@ -5,6 +5,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <unistd.h>
 #include "mread.h"
 
 mread_handle_t mread_init(int fd)
@@ -30,6 +31,37 @@ mread_handle_t mread_init(int fd)
     return h;
 }
 
+/* Wait for a file still being written to reach end, or to stop growing. */
+static void mread_wait(mread_handle_t h, off_t end)
+{
+    struct stat s;
+    off_t last_size = h->file_size;
+    unsigned int idle = 0;
+
+    while ( !fstat(h->fd, &s) )
+    {
+        h->file_size = s.st_size;
+        if ( h->file_size >= end )
+            break;
+        if ( h->file_size != last_size )
+        {
+            last_size = h->file_size;
+            idle = 0;
+        }
+        else if ( idle++ >= h->follow * 10 )
+            break;
+        usleep(100000);
+    }
+}
+
+off_t mread_file_size(mread_handle_t h, off_t end)
+{
+    if ( h->follow && end > h->file_size )
+        mread_wait(h, end);
+
+    return h->file_size;
+}
+
 ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
 {
     /* Idea: have a "cache" of N mmaped regions.  If the offset is
@@ -53,6 +85,8 @@ ssize_t mread64(mread_handle_t h, void *rec, ssize_t len, off_t offset)
 
     dprintf(warn, "%s: offset %llx len %d\n", __func__,
             offset, len);
+    if ( h->follow && offset + len > h->file_size )
+        mread_wait(h, offset + len);
     if ( offset > h->file_size )
     {
         dprintf(warn, " offset > file size %llx, returning 0\n",
@@ -6,6 +6,7 @@
 typedef struct mread_ctrl {
     int fd;
     off_t file_size;
+    unsigned follow; /* Seconds to wait for the file to grow, 0 for none */
     struct mread_buffer {
         char * buffer;
         off_t start_offset;
@@ -16,3 +17,4 @@ typedef struct mread_ctrl {
 
 mread_handle_t mread_init(int fd);
 ssize_t mread64(mread_handle_t h, void *dst, ssize_t len, off_t offset);
+off_t mread_file_size(mread_handle_t h, off_t end);
@@ -178,8 +178,10 @@ struct {
         svm_mode:1,
         summary:1,
         report_pcpu:1,
+        json_summary:1,
         tsc_loop_fatal:1,
         summary_info;
+    unsigned follow;
     long long cpu_qhz, cpu_hz;
     int scatterplot_interrupt_vector;
     int scatterplot_extint_cycles_vector;
@@ -190,6 +192,10 @@ struct {
     int default_guest_paging_levels;
     int sample_size, sample_max;
     enum error_level tolerance; /* Tolerate up to this level of error */
+    struct {
+        tsc_t cycles;
+        unsigned msec;
+    } summary_interval;
     struct {
         tsc_t cycles;
         /* Used if interval is specified in seconds to delay calculating
@@ -1866,6 +1872,7 @@ struct {
     tsc_t now;
     struct cycle_framework f;
     tsc_t buffer_trace_virq_tsc;
+    tsc_t summary_tsc;
     struct pcpu_info pcpu[MAX_CPUS];
 
     struct {
@@ -1905,6 +1912,7 @@ void update_io_address(struct io_address ** list, unsigned int pa, int dir,
                        tsc_t arc_cycles, unsigned int va);
 int check_extra_words(struct record_info *ri, int expected_size, const char *record);
 int vcpu_set_data_type(struct vcpu_data *v, int type);
+void json_summary(void);
 
 void cpumask_init(cpu_mask_t *c) {
     *c = 0UL;
@@ -8920,6 +8928,15 @@ void activate_early_eof(void) {
     }
 }
 
+/* When following a trace still being written, wait for it to reach end. */
+static off_t trace_file_size(off_t end)
+{
+    if ( opt.follow && G.mh )
+        G.file_size = mread_file_size(G.mh, end);
+
+    return G.file_size;
+}
+
 off_t scan_for_new_pcpu(off_t offset) {
     ssize_t r;
     struct trace_record rec;
@@ -9070,6 +9087,17 @@ void process_record_tsc(tsc_t order_tsc, struct record_info *ri)
         P.f.total_cycles = P.f.last_tsc - P.f.first_tsc;
 
         P.now = tsc;
+
+        if ( opt.summary_interval.cycles ) {
+            if ( !P.summary_tsc )
+                P.summary_tsc = tsc;
+            else if ( tsc - P.summary_tsc >= opt.summary_interval.cycles ) {
+                json_summary();
+                P.summary_tsc += ((tsc - P.summary_tsc)
+                                  / opt.summary_interval.cycles)
+                    * opt.summary_interval.cycles;
+            }
+        }
     }
 }
 
@@ -9207,7 +9235,7 @@ void process_cpu_change(struct pcpu_info *p) {
         p->file_offset += ri->size + r->window_size;
         p->next_cpu_change_offset = p->file_offset;
 
-        if(p->file_offset > G.file_size) {
+        if(p->file_offset > trace_file_size(p->file_offset)) {
             activate_early_eof();
         } else if(P.early_eof && p->file_offset > P.last_epoch_offset) {
             fprintf(warn, "%s: early_eof activated, pcpu %d past last_epoch_offset %llx, deactivating.\n",
@@ -9268,7 +9296,8 @@ void process_cpu_change(struct pcpu_info *p) {
         p->file_offset += ri->size;
         p->next_cpu_change_offset = p->file_offset + r->window_size;
 
-        if(p->next_cpu_change_offset > G.file_size)
+        if(p->next_cpu_change_offset
+           > trace_file_size(p->next_cpu_change_offset))
             activate_early_eof();
         else if(p->pid == P.max_active_pcpu)
             scan_for_new_pcpu(p->next_cpu_change_offset);
@@ -9897,6 +9926,107 @@ void report_pcpu(void) {
 
 }
 
+/*
+ * Machine-readable summary: one JSON object per line, so that periodic
+ * summaries of a trace being followed can be consumed as a stream.
+ */
+static void json_cycle_summary(const char *name, struct cycle_summary *s,
+                               int *first)
+{
+    if ( !s->count )
+        return;
+
+    printf("%s\"%s\":{\"count\":%d,\"cycles\":%llu}",
+           *first ? "" : ",", name, s->count, s->cycles);
+    *first = 0;
+}
+
+static void json_vcpu_summary(struct vcpu_data *v)
+{
+    int i, first = 1;
+
+    printf("{\"vcpu\":%d,\"runstates\":{", v->vid);
+    for ( i = 0; i < RUNSTATE_MAX; i++ )
+        json_cycle_summary(runstate_name[i], v->runstates + i, &first);
+    printf("}");
+
+    if ( v->data_type == VCPU_DATA_HVM && v->hvm.init ) {
+        struct hvm_data *h = &v->hvm;
+        char name[16];
+
+        first = 1;
+        printf(",\"exit_reasons\":{");
+        for ( i = 0; i < h->exit_reason_max; i++ ) {
+            if ( !h->exit_reason_name[i] )
+                snprintf(name, sizeof(name), "%d", i);
+            json_cycle_summary(h->exit_reason_name[i] ? : name,
+                               h->summary.exit_reason + i, &first);
+        }
+        printf("}");
+    }
+    printf("}");
+}
+
+void json_summary(void)
+{
+    struct domain_data *d;
+    int i, j, first;
+
+    printf("{\"time\":%.6lf,\"cpu_hz\":%lld,\"total_cycles\":%llu",
+           ((double)(P.f.total_cycles))/opt.cpu_hz, opt.cpu_hz,
+           (unsigned long long)P.f.total_cycles);
+
+    printf(",\"pcpus\":[");
+    for ( i = 0, first = 1; i < MAX_CPUS; i++ )
+    {
+        struct pcpu_info *p = P.pcpu+i;
+        int f = 1;
+
+        if ( !p->summary )
+            continue;
+        printf("%s{\"pcpu\":%d,\"volume\":{", first ? "" : ",", i);
+        first = 0;
+        for ( j = 0; j < TOPLEVEL_MAX; j++ )
+            if ( p->volume.total.toplevel[j] ) {
+                printf("%s\"%s\":%llu", f ? "" : ",", toplevel_name[j],
+                       p->volume.total.toplevel[j]);
+                f = 0;
+            }
+        f = 1;
+        printf("},\"time\":{");
+        json_cycle_summary("running", &p->time.running, &f);
+        json_cycle_summary("idle", &p->time.idle, &f);
+        json_cycle_summary("lost", &p->time.lost, &f);
+        printf("}}");
+    }
+
+    printf("],\"domains\":[");
+    for ( d = domain_list, first = 1; d; d = d->next )
+    {
+        int f = 1;
+
+        printf("%s{\"domain\":%d,\"runstates\":{", first ? "" : ",",
+               d->did);
+        first = 0;
+        json_cycle_summary("total", &d->total_time, &f);
+        for ( i = 0; i < DOMAIN_RUNSTATE_MAX; i++ )
+            json_cycle_summary(domain_runstate_name[i], d->runstates + i, &f);
+
+        printf("},\"vcpus\":[");
+        for ( i = 0, f = 1; i < MAX_CPUS; i++ )
+        {
+            if ( !d->vcpu[i] )
+                continue;
+            printf("%s", f ? "" : ",");
+            f = 0;
+            json_vcpu_summary(d->vcpu[i]);
+        }
+        printf("]}");
+    }
+    printf("]}\n");
+    fflush(stdout);
+}
+
 void init_pcpus(void) {
     int i=0;
     off_t offset = 0;
@@ -9967,6 +10097,8 @@ enum {
     OPT_SAMPLE_SIZE,
     OPT_SAMPLE_MAX,
     OPT_REPORT_PCPU,
+    OPT_JSON_SUMMARY,
+    OPT_SUMMARY_INTERVAL,
     /* Guest info */
     OPT_DEFAULT_GUEST_PAGING_LEVELS,
     OPT_SYMBOL_FILE,
@@ -9977,6 +10109,7 @@ enum {
     OPT_PROGRESS,
     OPT_TOLERANCE,
     OPT_TSC_LOOP_FATAL,
+    OPT_FOLLOW,
     /* Specific letters */
     OPT_DUMP_ALL='a',
     OPT_INTERVAL_LENGTH='i',
@@ -10406,6 +10539,25 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         //opt.summary_info = 1;
         G.output_defined = 1;
         break;
+    case OPT_JSON_SUMMARY:
+        opt.json_summary = 1;
+        opt.summary_info = 1;
+        G.output_defined = 1;
+        break;
+    case OPT_SUMMARY_INTERVAL:
+    {
+        char * inval;
+
+        opt.summary_interval.msec = (unsigned) (strtof(arg, &inval) * 1000);
+
+        if ( inval == arg || !opt.summary_interval.msec )
+            argp_usage(state);
+
+        opt.json_summary = 1;
+        opt.summary_info = 1;
+        G.output_defined = 1;
+        break;
+    }
         /* Guest info group */
     case OPT_DEFAULT_GUEST_PAGING_LEVELS:
     {
@@ -10457,6 +10609,19 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
         opt.tsc_loop_fatal = 1;
         break;
 
+    case OPT_FOLLOW:
+    {
+        char * inval;
+
+        opt.follow = 5;
+        if ( arg ) {
+            opt.follow = (unsigned) strtoul(arg, &inval, 0);
+            if ( inval == arg || !opt.follow )
+                argp_usage(state);
+        }
+        break;
+    }
+
     case ARGP_KEY_ARG:
     {
         /* FIXME - strcpy */
@@ -10473,6 +10638,10 @@ error_t cmd_parser(int key, char *arg, struct argp_state *state)
             interval_header();
         }
 
+        if(opt.summary_interval.msec)
+            opt.summary_interval.cycles =
+                ( opt.summary_interval.msec * opt.cpu_hz ) / 1000 ;
+
         if(!G.output_defined)
         {
             fprintf(stderr, "No output defined, using summary.\n");
@@ -10713,6 +10882,17 @@ const struct argp_option cmd_opts[] =  {
       .group = OPT_GROUP_SUMMARY,
       .doc = "Report utilization for pcpus", },
 
+    { .name = "json",
+      .key = OPT_JSON_SUMMARY,
+      .group = OPT_GROUP_SUMMARY,
+      .doc = "Output a summary of pcpu, domain, runstate and vmexit time as a single line of JSON.", },
+
+    { .name = "summary-interval",
+      .key = OPT_SUMMARY_INTERVAL,
+      .group = OPT_GROUP_SUMMARY,
+      .arg = "s",
+      .doc = "Output a cumulative JSON summary every [s] seconds of trace time, in addition to the final one.  Implies --json.", },
+
     /* Guest info */
     { .name = "default-guest-paging-levels",
       .key = OPT_DEFAULT_GUEST_PAGING_LEVELS,
@@ -10746,6 +10926,12 @@ const struct argp_option cmd_opts[] =  {
       .key = OPT_TSC_LOOP_FATAL,
       .doc = "Stop processing and exit if tsc skew tracking detects a dependency loop.", },
 
+    { .name = "follow",
+      .key = OPT_FOLLOW,
+      .arg = "secs",
+      .flags = OPTION_ARG_OPTIONAL,
+      .doc = "Keep reading a trace file that is still being written, until it has not grown for [secs] seconds (default 5).", },
+
     { .name = "tolerance",
       .key = OPT_TOLERANCE,
       .arg = "errlevel",
@@ -10785,6 +10971,8 @@ int main(int argc, char *argv[]) {
 
     if ( (G.mh = mread_init(G.fd)) == NULL )
         perror("mread");
+    else
+        G.mh->follow = opt.follow;
 
     if (G.symbol_file != NULL)
         parse_symbol_file(G.symbol_file);
@@ -10805,6 +10993,9 @@ int main(int argc, char *argv[]) {
     if(opt.summary)
         summary();
 
+    if(opt.json_summary)
+        json_summary();
+
     if(opt.report_pcpu)
         report_pcpu();
 
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <poll.h>
 #include <sys/statvfs.h>
+#include <sys/uio.h>
 
 #include <xen/xen.h>
 #include <xen/trace.h>
@@ -332,6 +333,37 @@ fail:
     return;
 }
 
+/**
+ * check_disk_space - exit if writing would leave too little disk space
+ * @size     - size of the write to come
+ */
+static void check_disk_space(unsigned long size)
+{
+    struct statvfs stat;
+    unsigned long long freespace;
+
+    if ( opts.memory_buffer != 0 || opts.disk_rsvd == 0 )
+        return;
+
+    /* Check that filesystem has enough space. */
+    if ( fstatvfs (outfd, &stat) )
+    {
+        fprintf(stderr, "Statfs failed!\n");
+        PERROR("Failed to write trace data");
+        exit(EXIT_FAILURE);
+    }
+
+    freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
+    freespace -= size;
+    freespace >>= 20; /* Convert to MB */
+
+    if ( freespace <= opts.disk_rsvd )
+    {
+        fprintf(stderr, "Disk space limit reached (free space: %lluMB, limit: %luMB).\n", freespace, opts.disk_rsvd);
+        exit (EXIT_FAILURE);
+    }
+}
+
 /**
  * write_buffer - write a section of the trace buffer
  * @cpu      - source buffer CPU ID
@@ -346,35 +378,9 @@ fail:
 static void write_buffer(unsigned int cpu, unsigned char *start, int size,
                          int total_size)
 {
-    struct statvfs stat;
     size_t written = 0;
-    
-    if ( opts.memory_buffer == 0 && opts.disk_rsvd != 0 )
-    {
-        unsigned long long freespace;
-
-        /* Check that filesystem has enough space. */
-        if ( fstatvfs (outfd, &stat) )
-        {
-            fprintf(stderr, "Statfs failed!\n");
-            goto fail;
-        }
-
-        freespace = stat.f_frsize * (unsigned long long)stat.f_bfree;
-
-        if ( total_size )
-            freespace -= total_size;
-        else
-            freespace -= size;
 
-        freespace >>= 20; /* Convert to MB */
-
-        if ( freespace <= opts.disk_rsvd )
-        {
-            fprintf(stderr, "Disk space limit reached (free space: %lluMB, limit: %luMB).\n", freespace, opts.disk_rsvd);
-            exit (EXIT_FAILURE);
-        }
-    }
+    check_disk_space(total_size ? total_size : size);
 
     /* Write a CPU_BUF record on each buffer "window" written.  Wrapped
      * windows may involve two writes, so only write the record on the
@@ -425,6 +431,97 @@ fail:
     exit(EXIT_FAILURE);
 }
 
+/*
+ * Windows of the trace buffers waiting to be written to the output file.
+ * They are written all at once, with a single writev() straight from the
+ * mappings of the trace buffers, and only then handed back to Xen.
+ */
+static struct {
+    struct iovec *iov;
+    unsigned int nr_iov, max_iov;
+    struct cpu_change_record *recs;
+    unsigned long *prod;        /* New consumer index, per window. */
+    unsigned int *cpu;
+    unsigned int nr;
+    unsigned long size;
+} batch;
+
+static void batch_alloc(unsigned int num)
+{
+    long iov_max = sysconf(_SC_IOV_MAX);
+
+    /* POSIX guarantees at least 16, should there be no limit to read. */
+    if ( iov_max < 16 )
+        iov_max = 16;
+
+    /* One CPU_BUF record and up to two pieces of buffer per window. */
+    batch.max_iov = num * 3 > iov_max ? iov_max : num * 3;
+    batch.iov = calloc(batch.max_iov, sizeof(*batch.iov));
+    batch.recs = calloc(num, sizeof(*batch.recs));
+    batch.prod = calloc(num, sizeof(*batch.prod));
+    batch.cpu = calloc(num, sizeof(*batch.cpu));
+    if ( !batch.iov || !batch.recs || !batch.prod || !batch.cpu )
+    {
+        PERROR("Failed to allocate memory for the output batch");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void batch_add(unsigned char *start, unsigned long size)
+{
+    batch.iov[batch.nr_iov].iov_base = start;
+    batch.iov[batch.nr_iov].iov_len = size;
+    batch.nr_iov++;
+    batch.size += size;
+}
+
+/* Write out the windows in the batch, then let Xen reuse their space. */
+static void batch_flush(struct t_buf **meta)
+{
+    struct iovec *iov = batch.iov;
+    unsigned int nr_iov = batch.nr_iov, i;
+    ssize_t written;
+
+    if ( !batch.nr )
+        return;
+
+    check_disk_space(batch.size);
+
+    while ( nr_iov )
+    {
+        written = writev(outfd, iov, nr_iov);
+        if ( written < 0 && errno == EINTR )
+            continue;
+        if ( written <= 0 )
+        {
+            fprintf(stderr, "Write failed! (size %lu, returned %zd)\n",
+                    batch.size, written);
+            PERROR("Failed to write trace data");
+            exit(EXIT_FAILURE);
+        }
+
+        /* Skip what was written, in case of a short write. */
+        while ( nr_iov && written >= iov->iov_len )
+        {
+            written -= iov->iov_len;
+            iov++;
+            nr_iov--;
+        }
+        if ( nr_iov )
+        {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    xen_mb(); /* read buffer, then update cons. */
+    for ( i = 0; i < batch.nr; i++ )
+        meta[batch.cpu[i]]->cons = batch.prod[i];
+
+    batch.nr = batch.nr_iov = 0;
+    batch.size = 0;
+}
+
 static void disable_tbufs(void)
 {
     xc_interface *xc_handle = xc_interface_open(0,0,0);
@@ -704,6 +801,9 @@ static int monitor_tbufs(void)
         for ( i = 0; i < num; i++ )
             meta[i]->cons = meta[i]->prod;
 
+    if ( !opts.memory_buffer )
+        batch_alloc(num);
+
     /* now, scan buffers for events */
     while ( 1 )
     {
@@ -734,6 +834,35 @@ static int monitor_tbufs(void)
             start_offset = cons % data_size;
             end_offset = prod % data_size;
 
+            if ( !opts.memory_buffer )
+            {
+                struct cpu_change_record *rec;
+
+                if ( batch.nr_iov + 3 > batch.max_iov )
+                    batch_flush(meta);
+
+                rec = &batch.recs[batch.nr];
+                rec->header = CPU_CHANGE_HEADER;
+                rec->data.cpu = i;
+                rec->data.window_size = window_size;
+                batch_add((unsigned char *)rec, sizeof(*rec));
+
+                if ( end_offset > start_offset )
+                    batch_add(data[i] + start_offset, window_size);
+                else
+                {
+                    batch_add(data[i] + start_offset,
+                              data_size - start_offset);
+                    if ( end_offset )
+                        batch_add(data[i], end_offset);
+                }
+
+                batch.cpu[batch.nr] = i;
+                batch.prod[batch.nr] = prod;
+                batch.nr++;
+                continue;
+            }
+
             if ( end_offset > start_offset )
             {
                 /* If window does not wrap, write in one big chunk */
@@ -760,6 +889,8 @@ static int monitor_tbufs(void)
 
         }
 
+        batch_flush(meta);
+
         if ( interrupted )
         {
             if ( last_read )
@@ -165,6 +165,7 @@ struct cmd_spec cmd_table[] = {
       "-e              Do not wait in the background (on <host>) for the death\n"
       "                of the domain.\n"
       "--debug         Print huge (!) amount of debug during the migration process.\n"
+      "--dedup         Send zero and duplicate pages without their data.\n"
       "-p              Do not unpause domain after migrating it."
     },
     { "restore",
@@ -189,6 +190,18 @@ struct cmd_spec cmd_table[] = {
       "Core dump a domain",
       "<Domain> <filename>"
     },
+#ifdef LIBXL_HAVE_EXIT_LATENCY
+    { "exit-latency",
+      &main_exit_latency, 0, 1,
+      "Show how long a domain's VM exits take, by exit reason",
+      "[options] <Domain>",
+      "-e, --enable            Start collecting exit latency histograms.\n"
+      "-d, --disable           Stop collecting and free the histograms.\n"
+      "-r, --reset             Clear the histograms.\n"
+      "-v, --vcpu=VCPU         Only show the exits of one vCPU.\n"
+      "-H, --histogram         Show the full histogram of each exit reason."
+    },
+#endif
     { "cd-insert",
       &main_cd_insert, 1, 1,
       "Insert a cdrom into a guest's cd drive",
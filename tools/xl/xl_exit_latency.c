@@ -0,0 +1,300 @@
+/*
+ * Copyright 2009-2017 Citrix Ltd and other contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; version 2.1 only. with the special
+ * exception on linking described in file LICENSE.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libxl.h>
+#include <libxl_utils.h>
+#include <libxlutil.h>
+
+#include "xl.h"
+#include "xl_utils.h"
+
+#ifdef LIBXL_HAVE_EXIT_LATENCY
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+
+static const char *const vmx_reasons[] = {
+    [0]  = "EXCEPTION_NMI",       [1]  = "EXTERNAL_INTERRUPT",
+    [2]  = "TRIPLE_FAULT",        [3]  = "INIT",
+    [4]  = "SIPI",                [5]  = "IO_SMI",
+    [6]  = "OTHER_SMI",           [7]  = "PENDING_VIRT_INTR",
+    [8]  = "PENDING_VIRT_NMI",    [9]  = "TASK_SWITCH",
+    [10] = "CPUID",               [11] = "GETSEC",
+    [12] = "HLT",                 [13] = "INVD",
+    [14] = "INVLPG",              [15] = "RDPMC",
+    [16] = "RDTSC",               [17] = "RSM",
+    [18] = "VMCALL",              [19] = "VMCLEAR",
+    [20] = "VMLAUNCH",            [21] = "VMPTRLD",
+    [22] = "VMPTRST",             [23] = "VMREAD",
+    [24] = "VMRESUME",            [25] = "VMWRITE",
+    [26] = "VMXOFF",              [27] = "VMXON",
+    [28] = "CR_ACCESS",           [29] = "DR_ACCESS",
+    [30] = "IO_INSTRUCTION",      [31] = "MSR_READ",
+    [32] = "MSR_WRITE",           [33] = "INVALID_GUEST_STATE",
+    [34] = "MSR_LOADING",         [36] = "MWAIT_INSTRUCTION",
+    [37] = "MONITOR_TRAP_FLAG",   [39] = "MONITOR_INSTRUCTION",
+    [40] = "PAUSE_INSTRUCTION",   [41] = "MCE_DURING_VMENTRY",
+    [43] = "TPR_BELOW_THRESHOLD", [44] = "APIC_ACCESS",
+    [45] = "EOI_INDUCED",         [46] = "ACCESS_GDTR_OR_IDTR",
+    [47] = "ACCESS_LDTR_OR_TR",   [48] = "EPT_VIOLATION",
+    [49] = "EPT_MISCONFIG",       [50] = "INVEPT",
+    [51] = "RDTSCP",              [52] = "PREEMPTION_TIMER",
+    [53] = "INVVPID",             [54] = "WBINVD",
+    [55] = "XSETBV",              [56] = "APIC_WRITE",
+    [58] = "INVPCID",             [59] = "VMFUNC",
+    [62] = "PML_FULL",            [63] = "XSAVES",
+    [64] = "XRSTORS",
+};
+
+/* SVM exit codes from 0x60 up; the CR, DR and exception ones are below. */
+static const char *const svm_reasons[] = {
+    [0x00] = "INTR",              [0x01] = "NMI",
+    [0x02] = "SMI",               [0x03] = "INIT",
+    [0x04] = "VINTR",             [0x05] = "CR0_SEL_WRITE",
+    [0x06] = "IDTR_READ",         [0x07] = "GDTR_READ",
+    [0x08] = "LDTR_READ",         [0x09] = "TR_READ",
+    [0x0a] = "IDTR_WRITE",        [0x0b] = "GDTR_WRITE",
+    [0x0c] = "LDTR_WRITE",        [0x0d] = "TR_WRITE",
+    [0x0e] = "RDTSC",             [0x0f] = "RDPMC",
+    [0x10] = "PUSHF",             [0x11] = "POPF",
+    [0x12] = "CPUID",             [0x13] = "RSM",
+    [0x14] = "IRET",              [0x15] = "SWINT",
+    [0x16] = "INVD",              [0x17] = "PAUSE",
+    [0x18] = "HLT",               [0x19] = "INVLPG",
+    [0x1a] = "INVLPGA",           [0x1b] = "IOIO",
+    [0x1c] = "MSR",               [0x1d] = "TASK_SWITCH",
+    [0x1e] = "FERR_FREEZE",       [0x1f] = "SHUTDOWN",
+    [0x20] = "VMRUN",             [0x21] = "VMMCALL",
+    [0x22] = "VMLOAD",            [0x23] = "VMSAVE",
+    [0x24] = "STGI",              [0x25] = "CLGI",
+    [0x26] = "SKINIT",            [0x27] = "RDTSCP",
+    [0x28] = "ICEBP",             [0x29] = "WBINVD",
+    [0x2a] = "MONITOR",           [0x2b] = "MWAIT",
+    [0x2c] = "MWAIT_CONDITIONAL", [0x2d] = "XSETBV",
+};
+
+static const char *const arm_reasons[] = {
+    [0x00] = "UNKNOWN",           [0x01] = "WFI_WFE",
+    [0x03] = "CP15_32",           [0x04] = "CP15_64",
+    [0x05] = "CP14_32",           [0x06] = "CP14_DBG",
+    [0x07] = "CP",                [0x08] = "CP10",
+    [0x09] = "JAZELLE",           [0x0a] = "BXJ",
+    [0x0c] = "CP14_64",           [0x11] = "SVC32",
+    [0x12] = "HVC32",             [0x13] = "SMC32",
+    [0x15] = "SVC64",             [0x16] = "HVC64",
+    [0x17] = "SMC64",             [0x18] = "SYSREG",
+    [0x20] = "INSTR_ABORT_LOWER_EL",
+    [0x21] = "INSTR_ABORT_CURR_EL",
+    [0x24] = "DATA_ABORT_LOWER_EL",
+    [0x25] = "DATA_ABORT_CURR_EL",
+    [0x3c] = "BRK",
+};
+
+static void exit_reason_name(libxl_exit_latency_type type, uint32_t reason,
+                             char *buf, size_t len)
+{
+    const char *name = NULL;
+
+    switch (type) {
+    case LIBXL_EXIT_LATENCY_TYPE_VMX:
+        if (reason < ARRAY_SIZE(vmx_reasons))
+            name = vmx_reasons[reason];
+        break;
+    case LIBXL_EXIT_LATENCY_TYPE_SVM:
+        if (reason < 0x40) {
+            snprintf(buf, len, "%s%u_%s", reason & 0x20 ? "DR" : "CR",
+                     reason & 0xf, reason & 0x10 ? "WRITE" : "READ");
+            return;
+        }
+        if (reason < 0x60) {
+            snprintf(buf, len, "EXCEPTION_%u", reason - 0x40);
+            return;
+        }
+        if (reason - 0x60 < ARRAY_SIZE(svm_reasons))
+            name = svm_reasons[reason - 0x60];
+        else if (reason == 0xf0)
+            name = "NPF";
+        break;
+    case LIBXL_EXIT_LATENCY_TYPE_ARM:
+        if (reason < ARRAY_SIZE(arm_reasons))
+            name = arm_reasons[reason];
+        break;
+    default:
+        break;
+    }
+
+    if (name)
+        snprintf(buf, len, "%s", name);
+    else
+        snprintf(buf, len, "%#x", reason);
+}
+
+/* Upper bound of histogram bucket @b, in cycles; the last one has none. */
+static uint64_t bucket_limit(const libxl_exit_latency *el, int b)
+{
+    return b == el->num_buckets - 1 ? el->max_cycles : 1ULL << (b + 8);
+}
+
+/* The bucket limit below which at least @pct percent of the exits fall. */
+static uint64_t percentile(const libxl_exit_latency *el, unsigned int pct)
+{
+    uint64_t seen = 0;
+    int b;
+
+    for (b = 0; b < el->num_buckets; b++) {
+        seen += el->buckets[b];
+        if (seen * 100 >= el->count * pct)
+            break;
+    }
+
+    return b < el->num_buckets ? bucket_limit(el, b) : el->max_cycles;
+}
+
+static int compare_cycles(const void *a, const void *b)
+{
+    const libxl_exit_latency *x = a, *y = b;
+
+    return x->cycles < y->cycles ? 1 : x->cycles > y->cycles ? -1 : 0;
+}
+
+static void print_histogram(const libxl_exit_latency *el, double us)
+{
+    int b;
+
+    for (b = 0; b < el->num_buckets; b++) {
+        if (!el->buckets[b])
+            continue;
+        if (b == el->num_buckets - 1)
+            printf("    >= %10.3fus", (1ULL << (b + 7)) * us);
+        else
+            printf("    <  %10.3fus", bucket_limit(el, b) * us);
+        printf(" %12"PRIu64"\n", el->buckets[b]);
+    }
+}
+
+static void print_exit_latency(uint32_t domid, int vcpu, int histogram,
+                               libxl_exit_latency_info *info)
+{
+    /* Microseconds per cycle. */
+    double us = info->cycles_per_sec ? 1e6 / info->cycles_per_sec : 0;
+    uint64_t total = 0;
+    char name[32];
+    int i;
+
+    for (i = 0; i < info->num_reasons; i++)
+        total += info->reasons[i].cycles;
+    qsort(info->reasons, info->num_reasons, sizeof(*info->reasons),
+          compare_cycles);
+
+    if (vcpu < 0)
+        printf("Domain %u, all vCPUs (%s)\n", domid,
+               libxl_exit_latency_type_to_string(info->type));
+    else
+        printf("Domain %u, vCPU %d (%s)\n", domid, vcpu,
+               libxl_exit_latency_type_to_string(info->type));
+
+    printf("%-24s %12s %12s %6s %10s %10s %10s %10s\n", "Reason", "Exits",
+           "Total(ms)", "%", "Avg(us)", "p50(us)", "p99(us)", "Max(us)");
+
+    for (i = 0; i < info->num_reasons; i++) {
+        const libxl_exit_latency *el = &info->reasons[i];
+
+        exit_reason_name(info->type, el->reason, name, sizeof(name));
+        printf("%-24s %12"PRIu64" %12.3f %6.2f %10.3f %10.3f %10.3f %10.3f\n",
+               name, el->count, el->cycles * us / 1000,
+               total ? el->cycles * 100.0 / total : 0,
+               el->cycles * us / el->count, percentile(el, 50) * us,
+               percentile(el, 99) * us, el->max_cycles * us);
+        if (histogram)
+            print_histogram(el, us);
+    }
+}
+
+int main_exit_latency(int argc, char **argv)
+{
+    libxl_exit_latency_info info;
+    uint32_t domid;
+    int opt, rc, vcpu = -1, histogram = 0;
+    int enable = 0, disable = 0, reset = 0;
+    static struct option opts[] = {
+        {"enable", 0, 0, 'e'},
+        {"disable", 0, 0, 'd'},
+        {"reset", 0, 0, 'r'},
+        {"vcpu", 1, 0, 'v'},
+        {"histogram", 0, 0, 'H'},
+        COMMON_LONG_OPTS
+    };
+
+    SWITCH_FOREACH_OPT(opt, "edrv:H", opts, "exit-latency", 1) {
+    case 'e':
+        enable = 1;
+        break;
+    case 'd':
+        disable = 1;
+        break;
+    case 'r':
+        reset = 1;
+        break;
+    case 'v':
+        vcpu = atoi(optarg);
+        break;
+    case 'H':
+        histogram = 1;
+        break;
+    }
+
+    if (enable + disable + reset > 1 || optind != argc - 1) {
+        help("exit-latency");
+        return EXIT_FAILURE;
+    }
+
+    domid = find_domain(argv[optind]);
+
+    if (enable)
+        return libxl_domain_exit_latency_enable(ctx, domid)
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (disable)
+        return libxl_domain_exit_latency_disable(ctx, domid)
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (reset)
+        return libxl_domain_exit_latency_reset(ctx, domid)
+               ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    rc = libxl_domain_exit_latency_get(ctx, domid, vcpu, &info);
+    if (rc == ERROR_NOT_READY) {
+        fprintf(stderr, "Exit latency histograms are not enabled for domain"
+                " %u; use \"xl exit-latency -e\" first.\n", domid);
+        return EXIT_FAILURE;
+    }
+    if (rc)
+        return EXIT_FAILURE;
+
+    print_exit_latency(domid, vcpu, histogram, &info);
+    libxl_exit_latency_info_dispose(&info);
+
+    return EXIT_SUCCESS;
+}
+
+#endif /* LIBXL_HAVE_EXIT_LATENCY */
+
+/*
+ * Local variables:
+ * mode: C
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
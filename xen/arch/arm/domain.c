@@ -874,6 +874,11 @@ int domain_relinquish_resources(struct domain *d)
         /* Fallthrough */
 
     case RELMEM_page:
+        /* Hand the PoD cache back to page_list so it is freed below. */
+        ret = p2m_pod_empty_cache(d);
+        if ( ret )
+            return ret;
+
         ret = relinquish_memory(d, &d->page_list);
         if ( ret )
             return ret;
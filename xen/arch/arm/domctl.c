@@ -115,6 +115,28 @@ long arch_do_domctl(struct xen_domctl *domctl, struct domain *d,
         return 0;
     }
 
+    case XEN_DOMCTL_shadow_op:
+    {
+        long rc;
+
+        if ( unlikely(d == current->domain) )
+            return -EINVAL;
+
+        rc = xsm_shadow_control(XSM_HOOK, d, domctl->u.shadow_op.op);
+        if ( rc )
+            return rc;
+
+        rc = p2m_log_dirty_op(d, &domctl->u.shadow_op);
+        if ( rc == -ERESTART )
+            return hypercall_create_continuation(__HYPERVISOR_domctl,
+                                                 "h", u_domctl);
+
+        if ( !rc && __copy_to_guest(u_domctl, domctl, 1) )
+            rc = -EFAULT;
+
+        return rc;
+    }
+
     case XEN_DOMCTL_disable_migrate:
         d->disable_migrate = domctl->u.disable_migrate.disable;
         return 0;
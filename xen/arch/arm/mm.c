@@ -1348,6 +1348,61 @@ long arch_memory_op(int op, XEN_GUEST_HANDLE_PARAM(void) arg)
     case XENMEM_get_sharing_freed_pages:
         return 0;
 
+    case XENMEM_set_pod_target:
+    case XENMEM_get_pod_target:
+    {
+        xen_pod_target_t target;
+        struct domain *d;
+        struct p2m_domain *p2m;
+        int rc;
+
+        if ( copy_from_guest(&target, arg, 1) )
+            return -EFAULT;
+
+        d = rcu_lock_domain_by_any_id(target.domid);
+        if ( d == NULL )
+            return -ESRCH;
+
+        if ( op == XENMEM_set_pod_target )
+            rc = xsm_set_pod_target(XSM_PRIV, d);
+        else
+            rc = xsm_get_pod_target(XSM_PRIV, d);
+
+        if ( rc != 0 )
+            goto pod_target_out_unlock;
+
+        if ( op == XENMEM_set_pod_target )
+        {
+            if ( target.target_pages > d->max_pages )
+            {
+                rc = -EINVAL;
+                goto pod_target_out_unlock;
+            }
+
+            rc = p2m_pod_set_mem_target(d, target.target_pages);
+        }
+
+        if ( rc == -ERESTART )
+        {
+            rc = hypercall_create_continuation(
+                __HYPERVISOR_memory_op, "lh", op, arg);
+        }
+        else if ( rc >= 0 )
+        {
+            p2m = p2m_get_hostp2m(d);
+            target.tot_pages       = d->tot_pages;
+            target.pod_cache_pages = p2m->pod.count;
+            target.pod_entries     = p2m->pod.entry_count;
+
+            if ( __copy_to_guest(arg, &target, 1) )
+                rc = -EFAULT;
+        }
+
+    pod_target_out_unlock:
+        rcu_unlock_domain(d);
+        return rc;
+    }
+
     default:
         return -ENOSYS;
     }
@@ -1433,14 +1488,16 @@ void gnttab_clear_flag(unsigned long nr, uint16_t *addr)
     } while (cmpxchg(addr, old, old & mask) != old);
 }
 
-void gnttab_mark_dirty(struct domain *d, unsigned long l)
+void gnttab_mark_dirty(struct domain *d, unsigned long mfn,
+                       unsigned long gfn)
 {
-    /* XXX: mark dirty */
-    static int warning;
-    if (!warning) {
-        gdprintk(XENLOG_WARNING, "gnttab_mark_dirty not implemented yet\n");
-        warning = 1;
-    }
+    /*
+     * There is no M2P to find the gfn from the mfn, so the grant code passes
+     * it along. It is INVALID_GFN for transitive grants, and for copies to
+     * a granted page, which are logged once the grant is released.
+     */
+    if ( gfn != gfn_x(INVALID_GFN) )
+        p2m_log_dirty_write(d, _gfn(gfn));
 }
 
 int create_grant_host_mapping(unsigned long addr, unsigned long frame,
@@ -0,0 +1,292 @@
+/*
+ * arch/arm/p2m-coalesce.c
+ *
+ * Block mapping reassembly for stage-2 p2ms, driven by
+ * common/p2m-coalesce.c.  A 2M range:
+ *  - mapped by 512 contiguous, suitably aligned 4K entries of the same type
+ *    is merged back into a 2M block, and 512 such 2M blocks into a 1G one;
+ *  - otherwise fully populated with ordinary RAM has its contents moved to
+ *    a freshly allocated 2M block, which is then mapped with a single entry.
+ * The number of mappings at each level is already kept in p2m->stats.
+ *
+ * This follows the x86 implementation (arch/x86/mm/p2m-coalesce.c), except
+ * that a range is unmapped, rather than write-protected, while it is
+ * copied: the guest faults, waits for the p2m lock, and finds the new
+ * block when it retries.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/domain_page.h>
+#include <xen/iommu.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/sched.h>
+#include <asm/p2m.h>
+#include <asm/page.h>
+
+/* Override macros from asm/mm.h to make them work with mfn_t */
+#undef mfn_to_page
+#define mfn_to_page(mfn) __mfn_to_page(mfn_x(mfn))
+#undef page_to_mfn
+#define page_to_mfn(pg) _mfn(__page_to_mfn(pg))
+
+#define SUPERPAGE_ORDER SECOND_ORDER
+#define SUPERPAGE_PAGES (1UL << SUPERPAGE_ORDER)
+
+/* The mfns backing the range being looked at, by the scanner alone. */
+static mfn_t range_mfns[SUPERPAGE_PAGES];
+
+bool arch_p2m_coalesce_supported(void)
+{
+    return true;
+}
+
+/* p2m_set_entry() only uses 4K mappings while mem_access is in use. */
+bool arch_p2m_coalesce_domain(const struct domain *d)
+{
+    const struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    return !d->is_dying && !p2m->logdirty.enabled &&
+           !p2m->mem_access_enabled;
+}
+
+/*
+ * A page can only be moved if nothing but its allocation references it:
+ * not Xen, a grant or foreign mapping, nor a device.
+ */
+static bool coalesce_page_movable(const struct domain *d, mfn_t mfn)
+{
+    const struct page_info *pg = mfn_to_page(mfn);
+
+    return page_get_owner(pg) == d && !is_xen_heap_mfn(mfn_x(mfn)) &&
+           (pg->count_info & (PGC_allocated | PGC_count_mask)) ==
+           (PGC_allocated | 1) &&
+           !(pg->u.inuse.type_info & PGT_count_mask);
+}
+
+/* Merge 512 contiguous 2M blocks starting at gfn into a 1G one. */
+static bool coalesce_1g(struct p2m_domain *p2m, gfn_t gfn,
+                        mfn_t mfn0, p2m_type_t t0, p2m_access_t a0)
+{
+    const unsigned long mask = (1UL << FIRST_ORDER) - 1;
+    unsigned int i, order;
+    p2m_type_t t;
+    mfn_t mfn;
+
+    if ( t0 != p2m_ram_rw || ((gfn_x(gfn) | mfn_x(mfn0)) & mask) )
+        return false;
+
+    for ( i = 1; i < SUPERPAGE_PAGES; i++ )
+    {
+        mfn = p2m_get_entry(p2m, gfn_add(gfn, i << SECOND_ORDER), &t, NULL,
+                            &order);
+        if ( order != SECOND_ORDER || t != t0 ||
+             !mfn_eq(mfn, mfn_add(mfn0, i << SECOND_ORDER)) )
+            return false;
+    }
+
+    if ( p2m_set_entry(p2m, gfn, 1UL << FIRST_ORDER, mfn0, t0, a0) )
+        return false;
+
+    p2m->stats.coalesced[1]++;
+
+    return true;
+}
+
+/*
+ * Move the contents of the 2M range at gfn, backed by range_mfns[], to a
+ * new 2M block and map it with a single entry.
+ */
+static bool coalesce_migrate(struct p2m_domain *p2m, gfn_t gfn,
+                             p2m_access_t a)
+{
+    struct domain *d = p2m->domain;
+    struct page_info *pg;
+    unsigned int i;
+    mfn_t mfn;
+
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+        if ( !coalesce_page_movable(d, range_mfns[i]) )
+            return false;
+
+    pg = alloc_domheap_pages(d, SUPERPAGE_ORDER, MEMF_no_owner);
+    if ( !pg )
+        return false;
+    mfn = page_to_mfn(pg);
+
+    i = SUPERPAGE_PAGES;
+    if ( p2m_set_entry(p2m, gfn, SUPERPAGE_PAGES, INVALID_MFN, p2m_invalid,
+                       p2m_access_rwx) )
+        goto undo;
+    p2m_flush_tlb_sync(p2m);
+
+    /*
+     * The guest may have written to the pages with its caches off: clean
+     * the source before reading it, and the copy before handing it back.
+     */
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+    {
+        void *src = map_domain_page(range_mfns[i]);
+        void *dst = map_domain_page(mfn_add(mfn, i));
+
+        clean_and_invalidate_dcache_va_range(src, PAGE_SIZE);
+        memcpy(dst, src, PAGE_SIZE);
+        clean_and_invalidate_dcache_va_range(dst, PAGE_SIZE);
+
+        unmap_domain_page(dst);
+        unmap_domain_page(src);
+    }
+
+    /*
+     * The new pages replace as many: bypass the max_pages check, and
+     * account for them until either set is freed.
+     */
+    i = SUPERPAGE_PAGES;
+    if ( assign_pages(d, pg, SUPERPAGE_ORDER, MEMF_no_refcount) )
+        goto undo;
+
+    spin_lock(&d->page_alloc_lock);
+    domain_adjust_tot_pages(d, SUPERPAGE_PAGES);
+    spin_unlock(&d->page_alloc_lock);
+
+    if ( p2m_set_entry(p2m, gfn, SUPERPAGE_PAGES, mfn, p2m_ram_rw, a) )
+    {
+        for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+            if ( test_and_clear_bit(_PGC_allocated, &pg[i].count_info) )
+                put_page(&pg[i]);
+        pg = NULL;
+        i = SUPERPAGE_PAGES;
+        goto undo;
+    }
+
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+    {
+        struct page_info *old = mfn_to_page(range_mfns[i]);
+
+        if ( test_and_clear_bit(_PGC_allocated, &old->count_info) )
+            put_page(old);
+    }
+
+    p2m->stats.coalesced[2]++;
+    p2m->stats.migrated++;
+
+    return true;
+
+ undo:
+    while ( i-- )
+        if ( p2m_set_entry(p2m, gfn_add(gfn, i), 1, range_mfns[i],
+                           p2m_ram_rw, a) )
+            domain_crash(d);
+    if ( pg )
+        free_domheap_pages(pg, SUPERPAGE_ORDER);
+
+    return false;
+}
+
+/* Nothing is mapped below lowest_mapped_gfn, nor from max_mapped_gfn. */
+void arch_p2m_coalesce_bounds(struct domain *d, gfn_t *start, gfn_t *end)
+{
+    const struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    *start = _gfn(gfn_x(p2m->lowest_mapped_gfn) & ~(SUPERPAGE_PAGES - 1));
+    *end = p2m->max_mapped_gfn;
+}
+
+unsigned long arch_p2m_coalesce_range(struct domain *d, gfn_t gfn,
+                                      unsigned int *migrations)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long nr;
+    unsigned int i, order;
+    p2m_type_t t0, t;
+    p2m_access_t a0, a;
+    bool ok, contig;
+    mfn_t mfn0, mfn;
+
+    p2m_write_lock(p2m);
+
+    if ( !arch_p2m_coalesce_domain(d) )
+    {
+        nr = SUPERPAGE_PAGES;
+        goto out;
+    }
+
+    mfn0 = p2m_get_entry(p2m, gfn, &t0, &a0, &order);
+
+    if ( order >= SECOND_ORDER )
+    {
+        if ( order == SECOND_ORDER && !mfn_eq(mfn0, INVALID_MFN) &&
+             coalesce_1g(p2m, gfn, mfn0, t0, a0) )
+            order = FIRST_ORDER;
+
+        nr = gfn_x(gfn_next_boundary(gfn, order)) - gfn_x(gfn);
+        goto out;
+    }
+
+    nr = SUPERPAGE_PAGES;
+    ok = true;
+    contig = !(mfn_x(mfn0) & (SUPERPAGE_PAGES - 1));
+
+    for ( i = 0; i < SUPERPAGE_PAGES && ok; i++ )
+    {
+        if ( i )
+            mfn = p2m_get_entry(p2m, gfn_add(gfn, i), &t, &a, NULL);
+        else
+        {
+            mfn = mfn0;
+            t = t0;
+            a = a0;
+        }
+
+        if ( t != p2m_ram_rw || a != a0 || !mfn_valid(mfn) )
+            ok = false;
+        else if ( !mfn_eq(mfn, mfn_add(mfn0, i)) )
+            contig = false;
+
+        range_mfns[i] = mfn;
+    }
+
+    if ( ok && contig )
+    {
+        if ( !p2m_set_entry(p2m, gfn, SUPERPAGE_PAGES, mfn0, p2m_ram_rw, a0) )
+            p2m->stats.coalesced[2]++;
+    }
+    /*
+     * In-flight DMA to the old pages would be lost, and a direct mapped
+     * domain must keep gfn == mfn.
+     */
+    else if ( ok && *migrations && !need_iommu(d) &&
+              !is_domain_direct_mapped(d) &&
+              coalesce_migrate(p2m, gfn, a0) )
+        --*migrations;
+
+ out:
+    p2m_write_unlock(p2m);
+
+    return nr;
+}
+
+void arch_p2m_coalesce_pass_done(struct domain *d)
+{
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
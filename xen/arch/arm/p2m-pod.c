@@ -0,0 +1,692 @@
+/*
+ * arch/arm/p2m-pod.c
+ *
+ * Populate-on-demand stage-2 entries.
+ *
+ * A domain can be given more RAM than it has memory allocated to it: the
+ * difference is marked populate-on-demand in the p2m, and only backed when
+ * the guest touches it, from a cache of pages set aside for the domain.
+ * The balloon driver is expected to hand back the surplus before the cache
+ * runs out; until it does, zero pages are reclaimed from the guest to
+ * refill the cache.
+ *
+ * This follows the x86 implementation (arch/x86/mm/p2m-pod.c), except that
+ * all of the PoD state is protected by the p2m write lock.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/domain_page.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/sched.h>
+#include <asm/p2m.h>
+#include <asm/page.h>
+
+/* Override macros from asm/mm.h to make them work with mfn_t */
+#undef mfn_to_page
+#define mfn_to_page(mfn) __mfn_to_page(mfn_x(mfn))
+#undef page_to_mfn
+#define page_to_mfn(pg) _mfn(__page_to_mfn(pg))
+
+#define SUPERPAGE_ORDER SECOND_ORDER
+#define SUPERPAGE_PAGES (1UL << SUPERPAGE_ORDER)
+
+#define POD_SWEEP_LIMIT  1024
+#define POD_SWEEP_STRIDE 16
+
+/* Number of gfns from gfn to the end of its mapping of the given order. */
+static unsigned long pod_span(gfn_t gfn, unsigned int order)
+{
+    return gfn_x(gfn_next_boundary(gfn, order)) - gfn_x(gfn);
+}
+
+/*
+ * Add nr pages, starting at page, to the cache.  The pages must be
+ * allocated to the domain and no longer mapped by it.
+ */
+static void p2m_pod_cache_add(struct p2m_domain *p2m,
+                              struct page_info *page, unsigned long nr)
+{
+    struct domain *d = p2m->domain;
+    unsigned long i;
+
+    ASSERT(p2m_is_write_locked(p2m));
+
+    /*
+     * Pages from the allocator or returned by the balloon driver aren't
+     * guaranteed to be zero, but the cache promises zero pages.  The guest
+     * may first touch them with its caches off, so the zeroes need to
+     * reach memory.
+     */
+    for ( i = 0; i < nr; i++ )
+    {
+        void *p = __map_domain_page(page + i);
+
+        BUG_ON(page_get_owner(page + i) != d);
+
+        clear_page(p);
+        clean_and_invalidate_dcache_va_range(p, PAGE_SIZE);
+        unmap_domain_page(p);
+    }
+
+    spin_lock(&d->page_alloc_lock);
+    for ( i = 0; i < nr; i++ )
+        page_list_del(page + i, &d->page_list);
+    spin_unlock(&d->page_alloc_lock);
+
+    for ( i = 0; i < nr; )
+    {
+        if ( nr - i >= SUPERPAGE_PAGES &&
+             !(mfn_x(page_to_mfn(page + i)) & (SUPERPAGE_PAGES - 1)) )
+        {
+            page_list_add_tail(page + i, &p2m->pod.super);
+            i += SUPERPAGE_PAGES;
+        }
+        else
+            page_list_add_tail(page + i++, &p2m->pod.single);
+    }
+
+    p2m->pod.count += nr;
+}
+
+/*
+ * Take a page of the given order (4K or 2M) from the cache, and give it
+ * back to the domain.  Superpages are broken up for 4K requests.  Returns
+ * NULL if no page of that order is available.
+ */
+static struct page_info *p2m_pod_cache_get(struct p2m_domain *p2m,
+                                           unsigned int order)
+{
+    struct domain *d = p2m->domain;
+    struct page_info *p;
+    unsigned long i;
+
+    ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(order == 0 || order == SUPERPAGE_ORDER);
+
+    if ( order == 0 && page_list_empty(&p2m->pod.single) &&
+         !page_list_empty(&p2m->pod.super) )
+    {
+        p = page_list_remove_head(&p2m->pod.super);
+        for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+            page_list_add_tail(p + i, &p2m->pod.single);
+    }
+
+    p = page_list_remove_head(order ? &p2m->pod.super : &p2m->pod.single);
+    if ( !p )
+        return NULL;
+
+    p2m->pod.count -= 1L << order;
+
+    spin_lock(&d->page_alloc_lock);
+    for ( i = 0; i < (1UL << order); i++ )
+    {
+        BUG_ON(page_get_owner(p + i) != d);
+        page_list_add_tail(p + i, &d->page_list);
+    }
+    spin_unlock(&d->page_alloc_lock);
+
+    return p;
+}
+
+/* Set the size of the cache, allocating or freeing as necessary. */
+static int p2m_pod_set_cache_target(struct p2m_domain *p2m,
+                                    unsigned long pod_target,
+                                    bool preemptible)
+{
+    struct domain *d = p2m->domain;
+
+    ASSERT(p2m_is_write_locked(p2m));
+
+    /* Increasing the target */
+    while ( pod_target > p2m->pod.count )
+    {
+        struct page_info *page;
+        unsigned int order;
+
+        order = (pod_target - p2m->pod.count) >= SUPERPAGE_PAGES ?
+                SUPERPAGE_ORDER : 0;
+
+        page = alloc_domheap_pages(d, order, 0);
+        if ( unlikely(!page) && order )
+        {
+            /* If we can't allocate a superpage, try singleton pages */
+            order = 0;
+            page = alloc_domheap_pages(d, order, 0);
+        }
+
+        if ( unlikely(!page) )
+        {
+            printk(XENLOG_G_ERR
+                   "d%d: Unable to allocate page for PoD cache (target=%lu cache=%ld)\n",
+                   d->domain_id, pod_target, p2m->pod.count);
+            return -ENOMEM;
+        }
+
+        p2m_pod_cache_add(p2m, page, 1UL << order);
+
+        if ( preemptible && pod_target != p2m->pod.count &&
+             hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    /* Decreasing the target */
+    while ( pod_target < p2m->pod.count )
+    {
+        struct page_info *page;
+        unsigned int order;
+        unsigned long i;
+
+        order = ((p2m->pod.count - pod_target) >= SUPERPAGE_PAGES &&
+                 !page_list_empty(&p2m->pod.super)) ? SUPERPAGE_ORDER : 0;
+
+        page = p2m_pod_cache_get(p2m, order);
+        ASSERT(page != NULL);
+
+        /* Then free them, as guest_remove_page() would. */
+        for ( i = 0; i < (1UL << order); i++ )
+        {
+            if ( unlikely(!get_page(page + i, d)) )
+            {
+                gdprintk(XENLOG_INFO, "Bad page free for domain %u\n",
+                         d->domain_id);
+                return -EINVAL;
+            }
+
+            if ( test_and_clear_bit(_PGC_allocated, &(page + i)->count_info) )
+                put_page(page + i);
+
+            put_page(page + i);
+        }
+
+        if ( preemptible && pod_target != p2m->pod.count &&
+             hypercall_preempt_check() )
+            return -ERESTART;
+    }
+
+    return 0;
+}
+
+/*
+ * See the x86 p2m_pod_set_mem_target() for the reasoning: the cache is
+ * grown so that the domain's allocation reaches the target, but capped at
+ * the number of outstanding PoD entries, and never shrunk here.
+ */
+int p2m_pod_set_mem_target(struct domain *d, unsigned long target)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long populated, pod_target;
+    int ret = 0;
+
+    p2m_write_lock(p2m);
+
+    /* P == B: Nothing to do (unless the guest is being created). */
+    populated = d->tot_pages - p2m->pod.count;
+    if ( populated > 0 && p2m->pod.entry_count == 0 )
+        goto out;
+
+    /* Don't do anything if the domain is being torn down */
+    if ( d->is_dying )
+        goto out;
+
+    /* T' < B: Don't reduce the cache size; let the balloon driver do it. */
+    if ( target < d->tot_pages )
+        goto out;
+
+    pod_target = target - populated;
+
+    /*
+     * B < T': Set the cache size equal to # of outstanding entries, and
+     * let the balloon driver fill in the rest.
+     */
+    if ( populated > 0 && pod_target > p2m->pod.entry_count )
+        pod_target = p2m->pod.entry_count;
+
+    ASSERT(pod_target >= p2m->pod.count);
+
+    ret = p2m_pod_set_cache_target(p2m, pod_target, true);
+
+ out:
+    p2m_write_unlock(p2m);
+
+    return ret;
+}
+
+int p2m_pod_empty_cache(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct page_info *page;
+    unsigned int i;
+    int rc = 0;
+
+    BUG_ON(!d->is_dying);
+
+    p2m_write_lock(p2m);
+    spin_lock(&d->page_alloc_lock);
+
+    while ( (page = page_list_remove_head(&p2m->pod.super)) )
+    {
+        for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+        {
+            BUG_ON(page_get_owner(page + i) != d);
+            page_list_add_tail(page + i, &d->page_list);
+        }
+
+        p2m->pod.count -= SUPERPAGE_PAGES;
+
+        if ( hypercall_preempt_check() )
+            goto out;
+    }
+
+    for ( i = 0; (page = page_list_remove_head(&p2m->pod.single)); ++i )
+    {
+        BUG_ON(page_get_owner(page) != d);
+        page_list_add_tail(page, &d->page_list);
+
+        p2m->pod.count -= 1;
+
+        if ( i && !(i & 511) && hypercall_preempt_check() )
+            goto out;
+    }
+
+    BUG_ON(p2m->pod.count != 0);
+
+ out:
+    if ( p2m->pod.count )
+        rc = -ERESTART;
+
+    spin_unlock(&d->page_alloc_lock);
+    p2m_write_unlock(p2m);
+
+    return rc;
+}
+
+void p2m_pod_dump_data(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    printk("  PoD entries=%ld cachesize=%ld\n",
+           p2m->pod.entry_count, p2m->pod.count);
+}
+
+int guest_physmap_mark_populate_on_demand(struct domain *d,
+                                          unsigned long gfn,
+                                          unsigned int order)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long i, n;
+    int rc = 0;
+
+    p2m_write_lock(p2m);
+
+    /* Make sure all gfns are unused */
+    for ( i = 0; i < (1UL << order); i += n )
+    {
+        gfn_t cur = _gfn(gfn + i);
+        unsigned int cur_order;
+        p2m_type_t t;
+
+        p2m_get_entry(p2m, cur, &t, NULL, &cur_order);
+        n = min(pod_span(cur, cur_order), (1UL << order) - i);
+
+        if ( p2m_is_any_ram(t) )
+        {
+            rc = -EBUSY;
+            goto out;
+        }
+    }
+
+    /* Logged when populated, by p2m_pod_demand_populate(). */
+    rc = p2m_log_dirty_cover(p2m, _gfn(gfn + (1UL << order)));
+    if ( rc )
+        goto out;
+
+    /* __p2m_set_entry() keeps pod.entry_count up to date. */
+    rc = p2m_set_entry(p2m, _gfn(gfn), 1UL << order, INVALID_MFN,
+                       p2m_populate_on_demand, p2m_access_rwx);
+
+ out:
+    p2m_write_unlock(p2m);
+
+    return rc;
+}
+
+int p2m_pod_decrease_reservation(struct domain *d,
+                                 xen_pfn_t gpfn,
+                                 unsigned int order)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long i, n, pod = 0, nonpod = 0, ram = 0;
+    bool steal_for_cache;
+    int ret = 0;
+
+    p2m_write_lock(p2m);
+
+    /*
+     * If we don't have any outstanding PoD entries, let things take their
+     * course.
+     */
+    if ( p2m->pod.entry_count == 0 || unlikely(d->is_dying) )
+        goto out_unlock;
+
+    /* Figure out if we need to steal some freed memory for our cache */
+    steal_for_cache = p2m->pod.entry_count > p2m->pod.count;
+
+    for ( i = 0; i < (1UL << order); i += n )
+    {
+        gfn_t cur = _gfn(gpfn + i);
+        unsigned int cur_order;
+        p2m_type_t t;
+
+        p2m_get_entry(p2m, cur, &t, NULL, &cur_order);
+        n = min(pod_span(cur, cur_order), (1UL << order) - i);
+
+        if ( t == p2m_populate_on_demand )
+            pod += n;
+        else
+        {
+            nonpod += n;
+            if ( p2m_is_ram(t) )
+                ram += n;
+        }
+    }
+
+    /* No PoD, and no need to steal anything?  Then we're done! */
+    if ( !pod && !steal_for_cache )
+        goto out_unlock;
+
+    if ( !nonpod )
+    {
+        /* All PoD: remove the whole region and tell the caller we're done. */
+        p2m_set_entry(p2m, _gfn(gpfn), 1UL << order, INVALID_MFN,
+                      p2m_invalid, p2m_access_rwx);
+        ret = 1;
+        goto out_entry_check;
+    }
+
+    /*
+     * Process as long as there are PoD entries to handle, or there is ram
+     * left and we want to steal it.
+     */
+    for ( i = 0;
+          i < (1UL << order) && (pod > 0 || (steal_for_cache && ram > 0));
+          i += n )
+    {
+        gfn_t cur = _gfn(gpfn + i);
+        unsigned int cur_order;
+        p2m_type_t t;
+        mfn_t mfn;
+
+        mfn = p2m_get_entry(p2m, cur, &t, NULL, &cur_order);
+        n = min(pod_span(cur, cur_order), (1UL << order) - i);
+
+        if ( t == p2m_populate_on_demand )
+        {
+            p2m_set_entry(p2m, cur, n, INVALID_MFN, p2m_invalid,
+                          p2m_access_rwx);
+            pod -= n;
+        }
+        else if ( steal_for_cache && p2m_is_ram(t) )
+        {
+            ASSERT(mfn_valid(mfn));
+
+            p2m_set_entry(p2m, cur, n, INVALID_MFN, p2m_invalid,
+                          p2m_access_rwx);
+            p2m_flush_tlb_sync(p2m);
+            p2m_pod_cache_add(p2m, mfn_to_page(mfn), n);
+
+            steal_for_cache = p2m->pod.entry_count > p2m->pod.count;
+
+            nonpod -= n;
+            ram -= n;
+        }
+    }
+
+    /*
+     * If there are no more non-PoD entries, tell decrease_reservation()
+     * that there's nothing left to do.
+     */
+    if ( nonpod == 0 )
+        ret = 1;
+
+ out_entry_check:
+    /* If we've reduced our "liabilities" beyond our "assets", free some */
+    if ( p2m->pod.entry_count < p2m->pod.count )
+        p2m_pod_set_cache_target(p2m, p2m->pod.entry_count, false);
+
+ out_unlock:
+    p2m_write_unlock(p2m);
+
+    return ret;
+}
+
+/*
+ * Reclaim those of the given 4K gfns which are zero, replacing them with
+ * PoD entries and adding their pages to the cache.
+ */
+static void p2m_pod_zero_check(struct p2m_domain *p2m, const gfn_t *gfns,
+                               unsigned int count)
+{
+    mfn_t mfns[POD_SWEEP_STRIDE];
+    p2m_type_t types[POD_SWEEP_STRIDE];
+    bool candidate[POD_SWEEP_STRIDE];
+    unsigned int i;
+
+    ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(count <= POD_SWEEP_STRIDE);
+
+    /*
+     * First, find ram pages which are only referenced by their allocation,
+     * and look like they may be zero, and unmap them.
+     */
+    for ( i = 0; i < count; i++ )
+    {
+        const struct page_info *page;
+        unsigned long *map;
+
+        candidate[i] = false;
+
+        mfns[i] = p2m_get_entry(p2m, gfns[i], &types[i], NULL, NULL);
+        if ( types[i] != p2m_ram_rw || !mfn_valid(mfns[i]) )
+            continue;
+
+        page = mfn_to_page(mfns[i]);
+        if ( !(page->count_info & PGC_allocated) ||
+             is_xen_heap_mfn(mfn_x(mfns[i])) ||
+             (page->count_info & PGC_count_mask) > 1 )
+            continue;
+
+        /* Quick zero-check */
+        map = map_domain_page(mfns[i]);
+        candidate[i] = words_are_zero(map, 8);
+        unmap_domain_page(map);
+
+        if ( candidate[i] &&
+             p2m_set_entry(p2m, gfns[i], 1, INVALID_MFN,
+                           p2m_populate_on_demand, p2m_access_rwx) )
+            candidate[i] = false;
+    }
+
+    p2m_flush_tlb_sync(p2m);
+
+    /*
+     * Now that the guest can't write to them, check the pages for real.
+     * Clean the cache first: the guest may have written to the page with
+     * its caches off.  The page must also not have been mapped elsewhere
+     * (e.g. by a backend) in the meantime.
+     */
+    for ( i = 0; i < count; i++ )
+    {
+        unsigned long *map;
+        bool zero;
+
+        if ( !candidate[i] )
+            continue;
+
+        map = map_domain_page(mfns[i]);
+        clean_and_invalidate_dcache_va_range(map, PAGE_SIZE);
+        zero = (mfn_to_page(mfns[i])->count_info & PGC_count_mask) <= 1 &&
+               page_is_zero(map);
+        unmap_domain_page(map);
+
+        if ( !zero )
+        {
+            if ( p2m_set_entry(p2m, gfns[i], 1, mfns[i], types[i],
+                               p2m->default_access) )
+                domain_crash(p2m->domain);
+            continue;
+        }
+
+        p2m_log_dirty_mark(p2m, gfns[i]);
+        p2m_pod_cache_add(p2m, mfn_to_page(mfns[i]), 1);
+    }
+}
+
+/*
+ * Look for zero pages to reclaim when the cache is empty, working down
+ * from the highest gfn the guest has demand-populated.
+ */
+static void p2m_pod_emergency_sweep(struct p2m_domain *p2m)
+{
+    gfn_t gfns[POD_SWEEP_STRIDE];
+    unsigned long i, start, limit;
+    unsigned int j = 0;
+    p2m_type_t t;
+
+    if ( p2m->pod.reclaim_single == 0 )
+        p2m->pod.reclaim_single = p2m->pod.max_guest;
+
+    start = p2m->pod.reclaim_single;
+    limit = (start > POD_SWEEP_LIMIT) ? (start - POD_SWEEP_LIMIT) : 0;
+
+    for ( i = start; i > 0; i-- )
+    {
+        p2m_get_entry(p2m, _gfn(i), &t, NULL, NULL);
+        if ( t == p2m_ram_rw )
+        {
+            gfns[j++] = _gfn(i);
+            if ( j == POD_SWEEP_STRIDE )
+            {
+                p2m_pod_zero_check(p2m, gfns, j);
+                j = 0;
+            }
+        }
+
+        /* Stop if we're past our limit and we have found *something*. */
+        if ( i < limit && (p2m->pod.count > 0 || hypercall_preempt_check()) )
+            break;
+    }
+
+    if ( j )
+        p2m_pod_zero_check(p2m, gfns, j);
+
+    p2m->pod.reclaim_single = i ? i - 1 : i;
+}
+
+bool p2m_pod_demand_populate(struct domain *d, gfn_t gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    struct page_info *p = NULL;
+    unsigned int order;
+    unsigned long i;
+    gfn_t gfn_aligned;
+    p2m_type_t t;
+    bool ret = false;
+
+    /* Most faults have nothing to do with PoD. */
+    if ( !p2m->pod.entry_count )
+        return false;
+
+    p2m_write_lock(p2m);
+
+    /*
+     * This check is done with the p2m lock held, so p2m_pod_empty_cache()
+     * won't start until we're done.
+     */
+    if ( unlikely(d->is_dying) )
+        goto out;
+
+    p2m_get_entry(p2m, gfn, &t, NULL, &order);
+    if ( t != p2m_populate_on_demand )
+    {
+        /* Someone else may have got here first. */
+        ret = p2m_is_ram(t);
+        goto out;
+    }
+
+    /*
+     * Only sweep if we're actually out of memory.  Doing anything else
+     * causes unnecessary time and fragmentation of superpages in the p2m.
+     */
+    if ( p2m->pod.count == 0 )
+        p2m_pod_emergency_sweep(p2m);
+
+    /* If the sweep failed, give up. */
+    if ( p2m->pod.count == 0 )
+        goto out_of_memory;
+
+    /* Keep track of the highest gfn demand-populated by a guest fault */
+    if ( gfn_x(gfn) > p2m->pod.max_guest )
+        p2m->pod.max_guest = gfn_x(gfn);
+
+    /*
+     * Back a 2M (or larger) PoD block with a superpage where the cache has
+     * one; 1G blocks are populated 2M at a time.
+     */
+    if ( order >= SUPERPAGE_ORDER )
+        p = p2m_pod_cache_get(p2m, SUPERPAGE_ORDER);
+    order = p ? SUPERPAGE_ORDER : 0;
+    if ( !p )
+        p = p2m_pod_cache_get(p2m, 0);
+    ASSERT(p != NULL);
+
+    gfn_aligned = _gfn(gfn_x(gfn) & ~((1UL << order) - 1));
+
+    if ( p2m_set_entry(p2m, gfn_aligned, 1UL << order, page_to_mfn(p),
+                       p2m_ram_rw, p2m->default_access) )
+    {
+        /* Put the page back for later. */
+        p2m_pod_cache_add(p2m, p, 1UL << order);
+        goto out;
+    }
+
+    for ( i = 0; i < (1UL << order); i++ )
+        p2m_log_dirty_mark(p2m, gfn_add(gfn_aligned, i));
+
+    ret = true;
+
+ out:
+    p2m_write_unlock(p2m);
+
+    return ret;
+
+ out_of_memory:
+    p2m_write_unlock(p2m);
+
+    printk(XENLOG_G_ERR "d%d out of PoD memory! (tot=%u ents=%ld)\n",
+           d->domain_id, d->tot_pages, p2m->pod.entry_count);
+    domain_crash(d);
+
+    return false;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -8,6 +8,8 @@
 #include <xen/iocap.h>
 #include <xen/mem_access.h>
 #include <xen/xmalloc.h>
+#include <xen/vmap.h>
+#include <public/domctl.h>
 #include <public/vm_event.h>
 #include <asm/flushtlb.h>
 #include <asm/gic.h>
@@ -79,12 +81,16 @@ void p2m_dump_info(struct domain *d)
     printk("p2m mappings for domain %d (vmid %d):\n",
            d->domain_id, p2m->vmid);
     BUG_ON(p2m->stats.mappings[0] || p2m->stats.shattered[0]);
-    printk("  1G mappings: %ld (shattered %ld)\n",
-           p2m->stats.mappings[1], p2m->stats.shattered[1]);
-    printk("  2M mappings: %ld (shattered %ld)\n",
-           p2m->stats.mappings[2], p2m->stats.shattered[2]);
+    printk("  1G mappings: %ld (shattered %ld, coalesced %ld)\n",
+           p2m->stats.mappings[1], p2m->stats.shattered[1],
+           p2m->stats.coalesced[1]);
+    printk("  2M mappings: %ld (shattered %ld, coalesced %ld, migrated %ld)\n",
+           p2m->stats.mappings[2], p2m->stats.shattered[2],
+           p2m->stats.coalesced[2], p2m->stats.migrated);
     printk("  4K mappings: %ld\n", p2m->stats.mappings[3]);
     p2m_read_unlock(p2m);
+
+    p2m_pod_dump_data(d);
 }
 
 void memory_type_changed(struct domain *d)
@@ -170,7 +176,7 @@ static void p2m_flush_tlb(struct p2m_domain *p2m)
  *
  * Must be called with the p2m lock held.
  */
-static void p2m_flush_tlb_sync(struct p2m_domain *p2m)
+void p2m_flush_tlb_sync(struct p2m_domain *p2m)
 {
     ASSERT(p2m_is_write_locked(p2m));
 
@@ -228,6 +234,15 @@ static p2m_access_t p2m_mem_access_radix_get(struct p2m_domain *p2m, gfn_t gfn)
         return radix_tree_ptr_to_int(ptr);
 }
 
+/*
+ * Populate-on-demand entries are invalid as far as the hardware is
+ * concerned, with the type stored in the bits it ignores.
+ */
+static inline bool p2m_is_pod_pte(lpae_t pte)
+{
+    return !lpae_valid(pte) && pte.p2m.type == p2m_populate_on_demand;
+}
+
 #define GUEST_TABLE_MAP_FAILED 0
 #define GUEST_TABLE_SUPER_PAGE 1
 #define GUEST_TABLE_NORMAL_PAGE 2
@@ -341,15 +356,15 @@ mfn_t p2m_get_entry(struct p2m_domain *p2m, gfn_t gfn,
     for ( level = P2M_ROOT_LEVEL; level < 3; level++ )
     {
         rc = p2m_next_level(p2m, true, &table, offsets[level]);
-        if ( rc == GUEST_TABLE_MAP_FAILED )
-            goto out_unmap;
-        else if ( rc != GUEST_TABLE_NORMAL_PAGE )
+        if ( rc != GUEST_TABLE_NORMAL_PAGE )
             break;
     }
 
     entry = table[offsets[level]];
 
-    if ( lpae_valid(entry) )
+    if ( p2m_is_pod_pte(entry) )
+        *t = p2m_populate_on_demand;
+    else if ( lpae_valid(entry) )
     {
         *t = entry.p2m.type;
 
@@ -364,7 +379,6 @@ mfn_t p2m_get_entry(struct p2m_domain *p2m, gfn_t gfn,
         mfn = mfn_add(mfn, gfn_x(gfn) & ((1UL << level_orders[level]) - 1));
     }
 
-out_unmap:
     unmap_domain_page(table);
 
 out:
@@ -386,20 +400,6 @@ mfn_t p2m_lookup(struct domain *d, gfn_t gfn, p2m_type_t *t)
     return ret;
 }
 
-int guest_physmap_mark_populate_on_demand(struct domain *d,
-                                          unsigned long gfn,
-                                          unsigned int order)
-{
-    return -ENOSYS;
-}
-
-int p2m_pod_decrease_reservation(struct domain *d,
-                                 xen_pfn_t gpfn,
-                                 unsigned int order)
-{
-    return -ENOSYS;
-}
-
 static void p2m_set_permission(lpae_t *e, p2m_type_t t, p2m_access_t a)
 {
     /* First apply type permissions */
@@ -411,6 +411,7 @@ static void p2m_set_permission(lpae_t *e, p2m_type_t t, p2m_access_t a)
         break;
 
     case p2m_ram_ro:
+    case p2m_ram_logdirty:
         e->p2m.xn = 0;
         e->p2m.write = 0;
         break;
@@ -428,6 +429,7 @@ static void p2m_set_permission(lpae_t *e, p2m_type_t t, p2m_access_t a)
     case p2m_iommu_map_ro:
     case p2m_grant_map_ro:
     case p2m_invalid:
+    case p2m_populate_on_demand:
         e->p2m.xn = 1;
         e->p2m.write = 0;
         break;
@@ -553,6 +555,7 @@ static int p2m_create_table(struct p2m_domain *p2m, lpae_t *entry)
     struct page_info *page;
     lpae_t *p;
     lpae_t pte;
+    unsigned int i;
 
     ASSERT(!lpae_valid(*entry));
 
@@ -565,6 +568,11 @@ static int p2m_create_table(struct p2m_domain *p2m, lpae_t *entry)
     p = __map_domain_page(page);
     clear_page(p);
 
+    /* Breaking up a PoD block leaves PoD entries in its place. */
+    if ( p2m_is_pod_pte(*entry) )
+        for ( i = 0; i < LPAE_ENTRIES; i++ )
+            p[i] = *entry;
+
     if ( p2m->clean_pte )
         clean_dcache_va_range(p, PAGE_SIZE);
 
@@ -649,9 +657,13 @@ static void p2m_free_entry(struct p2m_domain *p2m,
     mfn_t mfn;
     struct page_info *pg;
 
-    /* Nothing to do if the entry is invalid. */
+    /* Nothing to do if the entry is invalid, other than PoD accounting. */
     if ( !lpae_valid(entry) )
+    {
+        if ( p2m_is_pod_pte(entry) )
+            p2m->pod.entry_count -= 1UL << level_orders[level];
         return;
+    }
 
     /* Nothing to do but updating the stats if the entry is a super-page. */
     if ( lpae_is_superpage(entry, level) )
@@ -791,6 +803,9 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
     unsigned int target = 3 - (page_order / LPAE_SHIFT);
     lpae_t *entry, *table, orig_pte;
     int rc;
+    /* PoD entries are written with INVALID_MFN, but aren't removals. */
+    bool removing = mfn_eq(smfn, INVALID_MFN) &&
+                    t != p2m_populate_on_demand;
 
     /* Convenience aliases */
     const unsigned int offsets[4] = {
@@ -816,9 +831,11 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
     {
         /*
          * Don't try to allocate intermediate page table if the mapping
-         * is about to be removed (i.e mfn == INVALID_MFN).
+         * is about to be removed (i.e mfn == INVALID_MFN), unless a PoD
+         * block has to be broken up to remove part of it.
          */
-        rc = p2m_next_level(p2m, mfn_eq(smfn, INVALID_MFN),
+        rc = p2m_next_level(p2m,
+                            removing && !p2m_is_pod_pte(table[offsets[level]]),
                             &table, offsets[level]);
         if ( rc == GUEST_TABLE_MAP_FAILED )
         {
@@ -829,7 +846,7 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
              * when removing a mapping as it may not exist in the
              * page table. In this case, just ignore it.
              */
-            rc = mfn_eq(smfn, INVALID_MFN) ? 0 : -ENOENT;
+            rc = removing ? 0 : -ENOENT;
             goto out;
         }
         else if ( rc != GUEST_TABLE_NORMAL_PAGE )
@@ -925,8 +942,23 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
         p2m_remove_pte(entry, p2m->clean_pte);
 
     if ( mfn_eq(smfn, INVALID_MFN) )
+    {
         /* Flush can be deferred if the entry is removed */
         p2m->need_flush |= !!lpae_valid(orig_pte);
+
+        if ( t == p2m_populate_on_demand )
+        {
+            lpae_t pte = (lpae_t) { .p2m.type = p2m_populate_on_demand };
+
+            p2m_write_pte(entry, pte, p2m->clean_pte);
+
+            p2m->max_mapped_gfn = gfn_max(p2m->max_mapped_gfn,
+                                          gfn_add(sgfn, 1 << page_order));
+            p2m->lowest_mapped_gfn = gfn_min(p2m->lowest_mapped_gfn, sgfn);
+        }
+        else if ( p2m_is_pod_pte(orig_pte) )
+            p2m_remove_pte(entry, p2m->clean_pte);
+    }
     else
     {
         lpae_t pte = mfn_to_p2m_entry(smfn, t, a);
@@ -939,17 +971,26 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
          * to keep coherency when the previous entry was valid.
          *
          * Although, it could be defered when only the permissions are
-         * changed (e.g in case of memaccess).
+         * changed (e.g in case of memaccess or log-dirty). The p2m type
+         * is ignored by the hardware so it may change as well.
          */
         if ( lpae_valid(orig_pte) )
         {
-            if ( likely(!p2m->mem_access_enabled) ||
-                 P2M_CLEAR_PERM(pte) != P2M_CLEAR_PERM(orig_pte) )
+            if ( likely(!p2m->mem_access_enabled && !p2m->logdirty.enabled) ||
+                 (P2M_CLEAR_PERM(pte) & ~P2M_TYPE_MASK) !=
+                 (P2M_CLEAR_PERM(orig_pte) & ~P2M_TYPE_MASK) )
                 p2m_flush_tlb_sync(p2m);
             else
                 p2m->need_flush = true;
         }
-        else /* new mapping */
+
+        /*
+         * Count the new mapping unless it only changes the permissions of
+         * the original one.  Anything else it replaces, be it a mapping or
+         * a table of them (e.g. when coalescing), is uncounted by
+         * p2m_free_entry() below.
+         */
+        if ( !lpae_valid(orig_pte) || pte.p2m.base != orig_pte.p2m.base )
             p2m->stats.mappings[level]++;
 
         p2m_write_pte(entry, pte, p2m->clean_pte);
@@ -966,6 +1007,12 @@ static int __p2m_set_entry(struct p2m_domain *p2m,
     if ( lpae_valid(orig_pte) && entry->p2m.base != orig_pte.p2m.base )
         p2m_free_entry(p2m, orig_pte, level);
 
+    /* Keep count of the PoD entries, whoever adds or replaces them. */
+    if ( p2m_is_pod_pte(orig_pte) )
+        p2m->pod.entry_count -= 1UL << page_order;
+    if ( p2m_is_pod_pte(*entry) )
+        p2m->pod.entry_count += 1UL << page_order;
+
     if ( need_iommu(p2m->domain) &&
          (lpae_valid(orig_pte) || lpae_valid(*entry)) )
         rc = iommu_iotlb_flush(p2m->domain, gfn_x(sgfn), 1UL << page_order);
@@ -1033,10 +1080,20 @@ static inline int p2m_insert_mapping(struct domain *d,
                                      p2m_type_t t)
 {
     struct p2m_domain *p2m = &d->arch.p2m;
-    int rc;
+    int rc = 0;
 
     p2m_write_lock(p2m);
-    rc = p2m_set_entry(p2m, start_gfn, nr, mfn, t, p2m->default_access);
+
+    /* RAM mapped while log-dirty is on has its first write logged too. */
+    if ( t == p2m_ram_rw && p2m->logdirty.enabled )
+    {
+        rc = p2m_log_dirty_cover(p2m, gfn_add(start_gfn, nr));
+        t = p2m_ram_logdirty;
+    }
+
+    if ( !rc )
+        rc = p2m_set_entry(p2m, start_gfn, nr, mfn, t, p2m->default_access);
+
     p2m_write_unlock(p2m);
 
     return rc;
@@ -1234,6 +1291,9 @@ void p2m_teardown(struct domain *d)
     p2m_free_vmid(d);
 
     radix_tree_destroy(&p2m->mem_access_settings, NULL);
+
+    vfree(p2m->logdirty.bitmap);
+    p2m->logdirty.bitmap = NULL;
 }
 
 int p2m_init(struct domain *d)
@@ -1243,7 +1303,10 @@ int p2m_init(struct domain *d)
     unsigned int cpu;
 
     rwlock_init(&p2m->lock);
+    rwlock_set_class(&p2m->lock, p2m);
     INIT_PAGE_LIST_HEAD(&p2m->pages);
+    INIT_PAGE_LIST_HEAD(&p2m->pod.super);
+    INIT_PAGE_LIST_HEAD(&p2m->pod.single);
 
     p2m->vmid = INVALID_VMID;
 
@@ -1306,23 +1369,50 @@ int relinquish_p2m_mapping(struct domain *d)
     for ( ; gfn_x(start) < gfn_x(end);
           start = gfn_next_boundary(start, order) )
     {
-        mfn_t mfn = p2m_get_entry(p2m, start, &t, NULL, &order);
+        mfn_t mfn;
 
-        count++;
         /*
-         * Arbitrarily preempt every 512 iterations.
+         * Arbitrarily preempt every 512 entries.
          */
-        if ( !(count % 512) && hypercall_preempt_check() )
+        if ( count >= 512 )
         {
-            rc = -ERESTART;
-            break;
+            if ( hypercall_preempt_check() )
+            {
+                rc = -ERESTART;
+                break;
+            }
+            count = 0;
         }
 
+        mfn = p2m_get_entry(p2m, start, &t, NULL, &order);
+        count++;
+
+        /*
+         * The gfn is mapped by a 3rd level table, which nothing below
+         * start is left in: remove the whole table at once.  Freeing it
+         * drops the references its entries hold, without walking the p2m
+         * again for each of them.
+         */
+        if ( order == THIRD_ORDER )
+        {
+            gfn_t gfn = _gfn(gfn_x(start) & ~((1UL << SECOND_ORDER) - 1));
+
+            order = SECOND_ORDER;
+            count += LPAE_ENTRIES;
+
+            rc = __p2m_set_entry(p2m, gfn, order, INVALID_MFN, p2m_invalid,
+                                 p2m_access_rwx);
+            if ( unlikely(rc) )
+            {
+                printk(XENLOG_G_ERR "Unable to remove mapping gfn=%#"PRI_gfn" order=%u from the p2m of domain %d\n", gfn_x(start), order, d->domain_id);
+                break;
+            }
+        }
         /*
          * p2m_set_entry will take care of removing reference on page
          * when it is necessary and removing the mapping in the p2m.
          */
-        if ( !mfn_eq(mfn, INVALID_MFN) )
+        else if ( !mfn_eq(mfn, INVALID_MFN) )
         {
             /*
              * For valid mapping, the start will always be aligned as
@@ -1395,6 +1485,443 @@ int p2m_cache_flush(struct domain *d, gfn_t start, unsigned long nr)
     return 0;
 }
 
+/*
+ * Log-dirty tracking.
+ *
+ * While log-dirty is enabled, RAM is mapped with p2m_ram_logdirty which is
+ * read-only in stage-2. The first write to such a page faults, the gfn is
+ * recorded in the dirty bitmap and the entry is switched back to
+ * p2m_ram_rw. Writing to a page mapped by a superpage only shatters that
+ * superpage, so untouched memory keeps its large mappings.
+ *
+ * XEN_DOMCTL_SHADOW_OP_CLEAN write-protects again every page logged in the
+ * bitmap. The bitmap and the stage-2 entries are only modified with the
+ * p2m write lock held.
+ *
+ * RAM populated while log-dirty is enabled is mapped p2m_ram_logdirty as
+ * well, the bitmap growing if it lies beyond the gfns known at enable time.
+ * Writes through grant mappings and copies are logged by gnttab_mark_dirty().
+ * Device writes can't be logged, so log-dirty is refused to domains using
+ * the IOMMU, which shares the stage-2 tables.
+ */
+
+/* Number of bits of the dirty bitmap handled in one go */
+#define LOGDIRTY_CHUNK_BITS (PAGE_SIZE * 8)
+
+void p2m_log_dirty_mark(struct p2m_domain *p2m, gfn_t gfn)
+{
+    ASSERT(p2m_is_write_locked(p2m));
+
+    if ( p2m->logdirty.bitmap && gfn_x(gfn) < p2m->logdirty.nr_gfns &&
+         !__test_and_set_bit(gfn_x(gfn), p2m->logdirty.bitmap) )
+        p2m->logdirty.dirty_count++;
+}
+
+int p2m_log_dirty_cover(struct p2m_domain *p2m, gfn_t end)
+{
+    unsigned long *bitmap, nr_gfns;
+
+    ASSERT(p2m_is_write_locked(p2m));
+
+    if ( !p2m->logdirty.enabled || gfn_x(end) <= p2m->logdirty.nr_gfns )
+        return 0;
+
+    /* Round up, not to reallocate for each page of a growing domain. */
+    nr_gfns = ROUNDUP(gfn_x(end), LOGDIRTY_CHUNK_BITS);
+    bitmap = vzalloc(BITS_TO_LONGS(nr_gfns) * sizeof(*bitmap));
+    if ( !bitmap )
+        return -ENOMEM;
+
+    if ( p2m->logdirty.bitmap )
+        memcpy(bitmap, p2m->logdirty.bitmap,
+               BITS_TO_LONGS(p2m->logdirty.nr_gfns) * sizeof(*bitmap));
+    vfree(p2m->logdirty.bitmap);
+
+    p2m->logdirty.bitmap = bitmap;
+    p2m->logdirty.nr_gfns = nr_gfns;
+
+    return 0;
+}
+
+void p2m_log_dirty_write(struct domain *d, gfn_t gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    if ( likely(!p2m->logdirty.enabled) )
+        return;
+
+    p2m_write_lock(p2m);
+    p2m_log_dirty_mark(p2m, gfn);
+    p2m_write_unlock(p2m);
+}
+
+bool p2m_log_dirty_fault(struct domain *d, gfn_t gfn)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    p2m_type_t t;
+    p2m_access_t a;
+    mfn_t mfn;
+    bool handled = false;
+
+    if ( likely(!p2m->logdirty.enabled) )
+        return false;
+
+    p2m_write_lock(p2m);
+
+    mfn = p2m_get_entry(p2m, gfn, &t, &a, NULL);
+    if ( !mfn_eq(mfn, INVALID_MFN) && t == p2m_ram_logdirty )
+    {
+        /* Only the faulting 4K page is made writable again. */
+        if ( __p2m_set_entry(p2m, gfn, 0, mfn, p2m_ram_rw, a) )
+        {
+            gdprintk(XENLOG_ERR, "Unable to make gfn %#"PRI_gfn" writable\n",
+                     gfn_x(gfn));
+            domain_crash(d);
+        }
+        else
+        {
+            p2m_log_dirty_mark(p2m, gfn);
+            p2m->logdirty.fault_count++;
+        }
+
+        handled = true;
+    }
+
+    p2m_write_unlock(p2m);
+
+    return handled;
+}
+
+/*
+ * Change the type of the entries of type ot to nt in the table at the
+ * given level, from *start until end.  Tables are descended into rather
+ * than walked from the root for every entry, so the cost is proportional
+ * to the number of mappings, and superpages are retyped as a whole.
+ *
+ * Only the permissions and the software type differ between RAM types,
+ * so the entries are rewritten in place without break-before-make, and
+ * the TLB flush is deferred until the p2m lock is released.
+ */
+static int p2m_change_type_table(struct p2m_domain *p2m, lpae_t *table,
+                                 unsigned int level, gfn_t *start, gfn_t end,
+                                 p2m_type_t ot, p2m_type_t nt,
+                                 unsigned long *count)
+{
+    unsigned int i = (gfn_x(*start) >> level_orders[level]) & LPAE_ENTRY_MASK;
+    int rc;
+
+    for ( ; i < LPAE_ENTRIES && gfn_x(*start) < gfn_x(end); i++ )
+    {
+        lpae_t *entry = table + i;
+
+        /*
+         * Arbitrarily preempt every 512 entries.
+         */
+        if ( !(++*count % 512) && hypercall_preempt_check() )
+            return -ERESTART;
+
+        if ( lpae_valid(*entry) && level < 3 && !lpae_mapping(*entry) )
+        {
+            lpae_t *next = map_domain_page(_mfn(entry->p2m.base));
+
+            /* This moves *start to the end of the range of the entry. */
+            rc = p2m_change_type_table(p2m, next, level + 1, start, end,
+                                       ot, nt, count);
+            unmap_domain_page(next);
+            if ( rc )
+                return rc;
+
+            continue;
+        }
+
+        if ( lpae_valid(*entry) && entry->p2m.type == ot )
+        {
+            lpae_t pte = mfn_to_p2m_entry(_mfn(entry->p2m.base), nt,
+                                          p2m_mem_access_radix_get(p2m,
+                                                                   *start));
+
+            if ( level < 3 )
+                pte.p2m.table = 0; /* Superpage entry */
+
+            p2m_write_pte(entry, pte, p2m->clean_pte);
+            p2m->need_flush = true;
+        }
+
+        *start = gfn_next_boundary(*start, level_orders[level]);
+    }
+
+    return 0;
+}
+
+/*
+ * Change the type of all the entries of type ot to nt, starting from
+ * *start. Returns -ERESTART when preempted, *start is then updated to
+ * where the walk should resume.
+ */
+static int p2m_change_type_range(struct p2m_domain *p2m, gfn_t *start,
+                                 p2m_type_t ot, p2m_type_t nt)
+{
+    gfn_t end = p2m->max_mapped_gfn;
+    unsigned long count = 0;
+    int rc = 0;
+
+    ASSERT(p2m_is_write_locked(p2m));
+    ASSERT(p2m_is_ram(ot) && p2m_is_ram(nt));
+
+    while ( !rc && gfn_x(*start) < gfn_x(end) )
+    {
+        lpae_t *table = p2m_get_root_pointer(p2m, *start);
+
+        if ( !table )
+            break;
+
+        rc = p2m_change_type_table(p2m, table, P2M_ROOT_LEVEL, start, end,
+                                   ot, nt, &count);
+        unmap_domain_page(table);
+    }
+
+    /* The IOMMU shares the stage-2 tables. */
+    if ( p2m->need_flush && need_iommu(p2m->domain) )
+    {
+        int ret = iommu_iotlb_flush_all(p2m->domain);
+
+        if ( !rc )
+            rc = ret;
+    }
+
+    return rc;
+}
+
+static int p2m_log_dirty_enable(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long *bitmap = NULL;
+    unsigned long nr_gfns = 0;
+    gfn_t start;
+    int rc;
+
+    /* Writes by devices would fault rather than be logged. */
+    if ( need_iommu(d) )
+        return -EINVAL;
+
+    if ( !p2m->logdirty.preempted )
+    {
+        /* Allocate the bitmap before taking the lock, it may be large. */
+        nr_gfns = gfn_x(p2m->max_mapped_gfn);
+        bitmap = vzalloc(BITS_TO_LONGS(nr_gfns) * sizeof(*bitmap));
+        if ( !bitmap )
+            return -ENOMEM;
+    }
+
+    p2m_write_lock(p2m);
+
+    if ( !p2m->logdirty.preempted )
+    {
+        rc = -EINVAL;
+        if ( p2m->logdirty.enabled )
+            goto out;
+
+        /* The mem_access radix tree only works with 4K mappings. */
+        rc = -EOPNOTSUPP;
+        if ( p2m->mem_access_enabled )
+            goto out;
+
+        p2m->logdirty.bitmap = bitmap;
+        p2m->logdirty.nr_gfns = nr_gfns;
+        p2m->logdirty.fault_count = 0;
+        p2m->logdirty.dirty_count = 0;
+        p2m->logdirty.enabled = true;
+        p2m->logdirty.resume = gfn_x(p2m->lowest_mapped_gfn);
+        bitmap = NULL;
+    }
+
+    start = _gfn(p2m->logdirty.resume);
+    rc = p2m_change_type_range(p2m, &start, p2m_ram_rw, p2m_ram_logdirty);
+    p2m->logdirty.resume = gfn_x(start);
+    p2m->logdirty.preempted = (rc == -ERESTART);
+
+ out:
+    p2m_write_unlock(p2m);
+
+    vfree(bitmap);
+
+    return rc;
+}
+
+static int p2m_log_dirty_disable(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long *bitmap = NULL;
+    gfn_t start;
+    int rc = 0;
+
+    p2m_write_lock(p2m);
+
+    if ( !p2m->logdirty.enabled )
+        goto out;
+
+    if ( !p2m->logdirty.preempted )
+        p2m->logdirty.resume = gfn_x(p2m->lowest_mapped_gfn);
+
+    start = _gfn(p2m->logdirty.resume);
+    rc = p2m_change_type_range(p2m, &start, p2m_ram_logdirty, p2m_ram_rw);
+    p2m->logdirty.resume = gfn_x(start);
+    p2m->logdirty.preempted = (rc == -ERESTART);
+
+    if ( !rc )
+    {
+        bitmap = p2m->logdirty.bitmap;
+        p2m->logdirty.bitmap = NULL;
+        p2m->logdirty.nr_gfns = 0;
+        p2m->logdirty.enabled = false;
+    }
+
+ out:
+    p2m_write_unlock(p2m);
+
+    vfree(bitmap);
+
+    return rc;
+}
+
+/*
+ * Copy the dirty bitmap to the toolstack and, for CLEAN, write-protect
+ * again the pages logged and clear the bitmap.
+ *
+ * This is done by chunks of LOGDIRTY_CHUNK_BITS. For a given chunk, the
+ * pages are write-protected and the TLBs flushed before the bitmap is
+ * copied and cleared, so a write is either part of this round or will
+ * fault and be logged for the next one.
+ */
+static int p2m_log_dirty_read(struct domain *d,
+                              struct xen_domctl_shadow_op *sc, bool clean)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long i, nr_gfns, pages;
+    int rc = 0;
+
+    p2m_read_lock(p2m);
+    nr_gfns = p2m->logdirty.enabled ? p2m->logdirty.nr_gfns : 0;
+    i = p2m->logdirty.preempted ? p2m->logdirty.resume : 0;
+    p2m_read_unlock(p2m);
+
+    if ( !nr_gfns )
+        return -EINVAL;
+
+    pages = min_t(unsigned long, sc->pages, nr_gfns);
+
+    for ( ; i < nr_gfns; i += LOGDIRTY_CHUNK_BITS )
+    {
+        unsigned long end = min(i + LOGDIRTY_CHUNK_BITS, nr_gfns);
+        unsigned long *bitmap;
+
+        p2m_write_lock(p2m);
+
+        bitmap = p2m->logdirty.bitmap;
+
+        if ( clean )
+        {
+            unsigned long gfn;
+
+            for ( gfn = find_next_bit(bitmap, end, i); gfn < end;
+                  gfn = find_next_bit(bitmap, end, gfn + 1) )
+            {
+                p2m_type_t t;
+                p2m_access_t a;
+                mfn_t mfn = p2m_get_entry(p2m, _gfn(gfn), &t, &a, NULL);
+
+                if ( mfn_eq(mfn, INVALID_MFN) || t != p2m_ram_rw )
+                    continue;
+
+                rc = __p2m_set_entry(p2m, _gfn(gfn), 0, mfn,
+                                     p2m_ram_logdirty, a);
+                if ( rc )
+                    break;
+            }
+
+            if ( p2m->need_flush )
+                p2m_flush_tlb_sync(p2m);
+        }
+
+        if ( !rc && i < pages && !guest_handle_is_null(sc->dirty_bitmap) &&
+             copy_to_guest_offset(sc->dirty_bitmap, i / 8,
+                                  (uint8_t *)bitmap + i / 8,
+                                  DIV_ROUND_UP(min(end, pages) - i, 8)) )
+            rc = -EFAULT;
+
+        if ( !rc && clean )
+            memset(bitmap + i / BITS_PER_LONG, 0,
+                   BITS_TO_LONGS(end - i) * sizeof(*bitmap));
+
+        p2m_write_unlock(p2m);
+
+        if ( rc )
+            break;
+
+        if ( end < nr_gfns && hypercall_preempt_check() )
+        {
+            p2m->logdirty.resume = end;
+            p2m->logdirty.preempted = true;
+            return -ERESTART;
+        }
+    }
+
+    p2m->logdirty.preempted = false;
+
+    if ( rc )
+        return rc;
+
+    sc->pages = pages;
+    sc->stats.fault_count = p2m->logdirty.fault_count;
+    sc->stats.dirty_count = p2m->logdirty.dirty_count;
+
+    if ( clean )
+    {
+        p2m->logdirty.fault_count = 0;
+        p2m->logdirty.dirty_count = 0;
+    }
+
+    return 0;
+}
+
+int p2m_log_dirty_op(struct domain *d, struct xen_domctl_shadow_op *sc)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    int rc;
+
+    /* Only the operation which has been preempted can be continued. */
+    if ( p2m->logdirty.preempted && p2m->logdirty.preempted_op != sc->op )
+        return -EBUSY;
+
+    switch ( sc->op )
+    {
+    case XEN_DOMCTL_SHADOW_OP_ENABLE:
+        if ( sc->mode != XEN_DOMCTL_SHADOW_ENABLE_LOG_DIRTY )
+            return -EOPNOTSUPP;
+        /* fallthrough */
+    case XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY:
+        rc = p2m_log_dirty_enable(d);
+        break;
+
+    case XEN_DOMCTL_SHADOW_OP_OFF:
+        rc = p2m_log_dirty_disable(d);
+        break;
+
+    case XEN_DOMCTL_SHADOW_OP_CLEAN:
+    case XEN_DOMCTL_SHADOW_OP_PEEK:
+        rc = p2m_log_dirty_read(d, sc, sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
+        break;
+
+    default:
+        return -EOPNOTSUPP;
+    }
+
+    if ( rc == -ERESTART )
+        p2m->logdirty.preempted_op = sc->op;
+
+    return rc;
+}
+
 mfn_t gfn_to_mfn(struct domain *d, gfn_t gfn)
 {
     return p2m_lookup(d, gfn, NULL);
@@ -1406,7 +1933,8 @@ struct page_info *get_page_from_gva(struct vcpu *v, vaddr_t va,
     struct domain *d = v->domain;
     struct p2m_domain *p2m = &d->arch.p2m;
     struct page_info *page = NULL;
-    paddr_t maddr = 0;
+    paddr_t maddr = 0, ipa;
+    bool retried = false;
     int rc;
 
     /*
@@ -1416,6 +1944,7 @@ struct page_info *get_page_from_gva(struct vcpu *v, vaddr_t va,
     if ( v != current )
         return NULL;
 
+ again:
     p2m_read_lock(p2m);
 
     rc = gvirt_to_maddr(va, &maddr, flags);
@@ -1438,6 +1967,20 @@ err:
 
     p2m_read_unlock(p2m);
 
+    /*
+     * The hardware walk fails when writing to a page tracked by log-dirty,
+     * and when the page is populate-on-demand.  Log or populate the page,
+     * and retry once.
+     */
+    if ( !page && !retried && !gva_to_ipa(va, &ipa, flags) &&
+         (((flags & GV2M_WRITE) &&
+           p2m_log_dirty_fault(d, gaddr_to_gfn(ipa))) ||
+          p2m_pod_demand_populate(d, gaddr_to_gfn(ipa))) )
+    {
+        retried = true;
+        goto again;
+    }
+
     return page;
 }
 
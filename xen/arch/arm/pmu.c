@@ -0,0 +1,186 @@
+/*
+ * xen/arch/arm/pmu.c
+ *
+ * PMUv3 cycle counter overflow interrupts driving the sampling profiler.
+ *
+ * Guest accesses to the PMU are trapped (MDCR_EL2.TPM) and ignored, so
+ * Xen is free to use the cycle counter for itself.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <xen/cpu.h>
+#include <xen/delay.h>
+#include <xen/device_tree.h>
+#include <xen/init.h>
+#include <xen/irq.h>
+#include <xen/lib.h>
+#include <xen/notifier.h>
+#include <xen/percpu.h>
+#include <xen/profile.h>
+#include <xen/smp.h>
+#include <asm/irq.h>
+#include <asm/processor.h>
+
+#define PMCR_E              (_AC(1,U) << 0)   /* Enable counters */
+#define PMCR_LC             (_AC(1,U) << 6)   /* 64-bit cycle counter */
+#define PMU_CYCLE_COUNTER   (_AC(1,U) << 31)  /* Bit in PMCNTEN, PMINTEN... */
+#define PMCCFILTR_NSH       (_AC(1,U) << 27)  /* Count cycles at EL2 */
+
+static unsigned int pmu_irq;
+static uint32_t pmu_period;
+static DEFINE_PER_CPU(struct irqaction, pmu_action);
+
+/* With PMCR_EL0.LC clear the cycle counter overflows at 32 bits. */
+static void pmu_load_counter(void)
+{
+    WRITE_SYSREG64((uint32_t)(0 - pmu_period), PMCCNTR_EL0);
+}
+
+static void pmu_interrupt(int irq, void *dev_id, struct cpu_user_regs *regs)
+{
+    if ( !(READ_SYSREG32(PMOVSCLR_EL0) & PMU_CYCLE_COUNTER) )
+        return;
+
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMOVSCLR_EL0);
+    pmu_load_counter();
+    profile_sample(regs);
+}
+
+static void pmu_start_cpu(void *unused)
+{
+    WRITE_SYSREG32(PMCCFILTR_NSH, PMCCFILTR_EL0);
+    WRITE_SYSREG32((READ_SYSREG32(PMCR_EL0) | PMCR_E) & ~PMCR_LC, PMCR_EL0);
+    pmu_load_counter();
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMOVSCLR_EL0);
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMINTENSET_EL1);
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMCNTENSET_EL0);
+    isb();
+}
+
+static void pmu_stop_cpu(void *unused)
+{
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMINTENCLR_EL1);
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMCNTENCLR_EL0);
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMOVSCLR_EL0);
+    isb();
+}
+
+/*
+ * The cycle counter runs at the CPU clock, which unlike the generic timer
+ * frequency isn't described by firmware: measure it.
+ */
+static uint64_t pmu_cycles_per_sec(void)
+{
+    uint64_t start;
+
+    WRITE_SYSREG32(PMCCFILTR_NSH, PMCCFILTR_EL0);
+    WRITE_SYSREG32(READ_SYSREG32(PMCR_EL0) | PMCR_E | PMCR_LC, PMCR_EL0);
+    WRITE_SYSREG32(PMU_CYCLE_COUNTER, PMCNTENSET_EL0);
+    isb();
+
+    start = READ_SYSREG64(PMCCNTR_EL0);
+    udelay(1000);
+
+    return (READ_SYSREG64(PMCCNTR_EL0) - start) * 1000;
+}
+
+int arch_profile_start(unsigned int hz)
+{
+    uint64_t rate;
+
+    if ( !pmu_irq )
+        return -EOPNOTSUPP;
+
+    rate = pmu_cycles_per_sec();
+    if ( !rate )
+        return -EOPNOTSUPP;
+
+    pmu_period = min_t(uint64_t, rate / hz, ~0u);
+    on_each_cpu(pmu_start_cpu, NULL, 1);
+
+    return 0;
+}
+
+void arch_profile_stop(void)
+{
+    on_each_cpu(pmu_stop_cpu, NULL, 1);
+}
+
+/* The overflow interrupt is a PPI, so every CPU sets it up for itself. */
+static void pmu_setup_irq(void)
+{
+    struct irqaction *action = &this_cpu(pmu_action);
+
+    action->handler = pmu_interrupt;
+    action->name = "pmu";
+    action->dev_id = NULL;
+
+    if ( setup_irq(pmu_irq, 0, action) )
+        printk(XENLOG_WARNING "CPU%u: unable to set up PMU IRQ%u\n",
+               smp_processor_id(), pmu_irq);
+}
+
+static int cpu_pmu_callback(
+    struct notifier_block *nfb, unsigned long action, void *hcpu)
+{
+    if ( action == CPU_STARTING )
+        pmu_setup_irq();
+
+    return NOTIFY_DONE;
+}
+
+static struct notifier_block cpu_pmu_nfb = {
+    .notifier_call = cpu_pmu_callback
+};
+
+static int __init pmu_init(void)
+{
+    static const struct dt_device_match pmu_ids[] __initconst =
+    {
+        DT_MATCH_COMPATIBLE("arm,armv8-pmuv3"),
+        DT_MATCH_COMPATIBLE("arm,cortex-a53-pmu"),
+        DT_MATCH_COMPATIBLE("arm,cortex-a57-pmu"),
+        DT_MATCH_COMPATIBLE("arm,cortex-a72-pmu"),
+        { /* sentinel */ },
+    };
+    struct dt_device_node *node;
+    int irq;
+
+    node = dt_find_matching_node(NULL, pmu_ids);
+    if ( !node )
+        return 0;
+
+    irq = platform_get_irq(node, 0);
+    if ( irq < 0 || irq >= NR_LOCAL_IRQS )
+    {
+        printk(XENLOG_INFO "PMU: IRQ %d is not a PPI, no profiling\n", irq);
+        return 0;
+    }
+
+    pmu_irq = irq;
+    dt_device_set_used_by(node, DOMID_XEN);
+
+    pmu_setup_irq();
+    register_cpu_notifier(&cpu_pmu_nfb);
+
+    return 0;
+}
+presmp_initcall(pmu_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
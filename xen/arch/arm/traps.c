@@ -20,6 +20,7 @@
 #include <xen/string.h>
 #include <xen/version.h>
 #include <xen/smp.h>
+#include <xen/exit_latency.h>
 #include <xen/symbols.h>
 #include <xen/irq.h>
 #include <xen/lib.h>
@@ -2614,6 +2615,11 @@ static void do_trap_instr_abort_guest(struct cpu_user_regs *regs,
         return;
     }
     case FSC_FLT_TRANS:
+        /* The guest may have touched a populate-on-demand entry. */
+        if ( p2m_pod_demand_populate(current->domain,
+                                     _gfn(paddr_to_pfn(gpa))) )
+            return;
+
         /*
          * The PT walk may have failed because someone was playing
          * with the Stage-2 page table. Walk the Stage-2 PT to check
@@ -2736,9 +2742,14 @@ static void do_trap_data_abort_guest(struct cpu_user_regs *regs,
             .kind = dabt.s1ptw ? npfec_kind_in_gpt : npfec_kind_with_gla
         };
 
+        /* Writes to pages tracked by log-dirty are logged and replayed. */
+        if ( dabt.write &&
+             p2m_log_dirty_fault(current->domain, gaddr_to_gfn(info.gpa)) )
+            return;
+
         p2m_mem_access_check(info.gpa, info.gva, npfec);
         /*
-         * The only way to get here right now is because of mem_access,
+         * The only other way to get here right now is because of mem_access,
          * thus reinjecting the exception to the guest is never required.
          */
         return;
@@ -2754,6 +2765,11 @@ static void do_trap_data_abort_guest(struct cpu_user_regs *regs,
             return;
         }
 
+        /* The guest may have touched a populate-on-demand entry. */
+        if ( p2m_pod_demand_populate(current->domain,
+                                     gaddr_to_gfn(info.gpa)) )
+            return;
+
         /*
          * The PT walk may have failed because someone was playing
          * with the Stage-2 page table. Walk the Stage-2 PT to check
@@ -2810,6 +2826,7 @@ asmlinkage void do_trap_guest_sync(struct cpu_user_regs *regs)
     const union hsr hsr = { .bits = regs->hsr };
 
     enter_hypervisor_head(regs);
+    exit_latency_begin(current, hsr.ec);
 
     switch (hsr.ec) {
     case HSR_EC_WFI_WFE:
@@ -2987,6 +3004,7 @@ asmlinkage void leave_hypervisor_tail(void)
         local_irq_disable();
         if (!softirq_pending(smp_processor_id())) {
             gic_inject();
+            exit_latency_end(current);
 
             /*
              * If the SErrors handle option is "DIVERSE", we have to prevent
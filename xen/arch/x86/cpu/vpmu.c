@@ -58,6 +58,8 @@ custom_param("vpmu", parse_vpmu_params);
 
 static DEFINE_SPINLOCK(vpmu_lock);
 static unsigned vpmu_count;
+/* The hypervisor's sampling profiler is driving the counters. */
+static bool vpmu_profiler;
 
 static DEFINE_PER_CPU(struct vcpu *, last_vcpu);
 
@@ -696,6 +698,32 @@ void vpmu_dump(struct vcpu *v)
         vpmu->arch_vpmu_ops->arch_vpmu_dump(v);
 }
 
+/*
+ * Have the counters to itself for the hypervisor's sampling profiler (see
+ * arch_profile_start()): the VPMU must be off, and stays so until
+ * vpmu_profile_release().
+ */
+int vpmu_profile_claim(void)
+{
+    int ret = 0;
+
+    spin_lock(&vpmu_lock);
+    if ( vpmu_mode != XENPMU_MODE_OFF || vpmu_profiler )
+        ret = -EBUSY;
+    else
+        vpmu_profiler = true;
+    spin_unlock(&vpmu_lock);
+
+    return ret;
+}
+
+void vpmu_profile_release(void)
+{
+    spin_lock(&vpmu_lock);
+    vpmu_profiler = false;
+    spin_unlock(&vpmu_lock);
+}
+
 long do_xenpmu_op(unsigned int op, XEN_GUEST_HANDLE_PARAM(xen_pmu_params_t) arg)
 {
     int ret;
@@ -741,13 +769,19 @@ long do_xenpmu_op(unsigned int op, XEN_GUEST_HANDLE_PARAM(xen_pmu_params_t) arg)
 
         spin_lock(&vpmu_lock);
 
+        if ( vpmu_profiler && pmu_params.val != XENPMU_MODE_OFF )
+        {
+            gprintk(XENLOG_WARNING,
+                    "VPMU: Cannot enable while the profiler is running\n");
+            ret = -EBUSY;
+        }
         /*
          * We can always safely switch between XENPMU_MODE_SELF and
          * XENPMU_MODE_HV while other VPMUs are active.
          */
-        if ( (vpmu_count == 0) ||
-             ((vpmu_mode ^ pmu_params.val) ==
-              (XENPMU_MODE_SELF | XENPMU_MODE_HV)) )
+        else if ( (vpmu_count == 0) ||
+                  ((vpmu_mode ^ pmu_params.val) ==
+                   (XENPMU_MODE_SELF | XENPMU_MODE_HV)) )
             vpmu_mode = pmu_params.val;
         else if ( vpmu_mode != pmu_params.val )
         {
@@ -178,6 +178,7 @@ int hvm_hypercall(struct cpu_user_regs *regs)
         return HVM_HCALL_completed;
     }
 
+    perfc_incra(hypercalls, eax);
     curr->hcall_preempted = false;
 
     if ( mode == 8 )
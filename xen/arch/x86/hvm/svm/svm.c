@@ -20,6 +20,7 @@
 #include <xen/lib.h>
 #include <xen/trace.h>
 #include <xen/sched.h>
+#include <xen/exit_latency.h>
 #include <xen/irq.h>
 #include <xen/softirq.h>
 #include <xen/hypercall.h>
@@ -2441,6 +2442,9 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     }
 
     exit_reason = vmcb->exitcode;
+    /* See XEN_DOMCTL_exit_latency for where the codes from NPF up go. */
+    exit_latency_begin(v, exit_reason < VMEXIT_NPF
+                          ? exit_reason : exit_reason - VMEXIT_NPF + 0xf0);
 
     if ( hvm_long_mode_active(v) )
         HVMTRACE_ND(VMEXIT64, vcpu_guestmode ? TRC_HVM_NESTEDFLAG : 0,
@@ -2851,6 +2855,13 @@ void svm_vmexit_handler(struct cpu_user_regs *regs)
     vmcb_set_vintr(vmcb, intr);
 }
 
+/* Called directly before VMRUN, with interrupts disabled. */
+void svm_vmenter_helper(void)
+{
+    svm_asid_handle_vmrun();
+    exit_latency_end(current);
+}
+
 void svm_trace_vmentry(void)
 {
     struct vcpu *curr = current;
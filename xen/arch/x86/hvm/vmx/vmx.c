@@ -19,6 +19,7 @@
 #include <xen/lib.h>
 #include <xen/trace.h>
 #include <xen/sched.h>
+#include <xen/exit_latency.h>
 #include <xen/irq.h>
 #include <xen/softirq.h>
 #include <xen/domain_page.h>
@@ -3550,6 +3551,7 @@ void vmx_vmexit_handler(struct cpu_user_regs *regs)
                     regs->eip, 0, 0, 0, 0);
 
     perfc_incra(vmexits, exit_reason);
+    exit_latency_begin(v, (uint16_t)exit_reason);
 
     /* Handle the interrupt we missed before allowing any more in. */
     switch ( (uint16_t)exit_reason )
@@ -4299,6 +4301,7 @@ void vmx_vmenter_helper(const struct cpu_user_regs *regs)
         lbr_fixup();
 
     HVMTRACE_ND(VMENTRY, 0, 1/*cycles*/, 0, 0, 0, 0, 0, 0, 0);
+    exit_latency_end(curr);
 
     __vmwrite(GUEST_RIP,    regs->rip);
     __vmwrite(GUEST_RSP,    regs->rsp);
@@ -29,6 +29,9 @@
 #include <xen/sched.h>
 #include <xen/rcupdate.h>
 #include <xen/guest_access.h>
+#include <xen/perfc.h>
+#include <xen/rbtree.h>
+#include <xen/domain_scan.h>
 #include <xen/vm_event.h>
 #include <asm/page.h>
 #include <asm/string.h>
@@ -1214,18 +1217,440 @@ private_page_found:
     return 0;
 }
 
+/*
+ * Background deduplication scanner.
+ *
+ * Rather than relying on the toolstack to nominate the pages to share,
+ * domains can opt in to a scanner which walks their p2m at a rate set by
+ * mem-sharing-scan-pages and mem-sharing-scan-ms, hashing each page.  In
+ * the manner of Linux KSM, candidates are looked up in two trees keyed by
+ * the hash of their contents:
+ *  - the stable tree holds pages which are already shared, and so can't
+ *    change under our feet;
+ *  - the unstable tree holds private pages seen during the current pass
+ *    over all the scanned domains.  It is emptied after every pass, as its
+ *    contents go stale as the guests run.
+ * A page matching a stable node is merged into it, while a page matching an
+ * unstable node is merged with that page, which then moves to the stable
+ * tree.  Pages are only shared once both have been nominated, i.e. made
+ * read-only, and their contents compared, so the hash need only be a hint.
+ * Writes break sharing as for pages shared by the toolstack.
+ *
+ * Nodes only record a <domain, gfn> tuple (and a handle for stable nodes),
+ * and are checked when they are used: a node whose page went away is
+ * dropped then, or at the end of a pass for the stable tree.
+ *
+ * The trees are only accessed from the scanner callbacks, which need no
+ * locking (see xen/domain_scan.h).
+ */
+static unsigned int __read_mostly opt_mem_sharing_scan_pages = 256;
+integer_param("mem-sharing-scan-pages", opt_mem_sharing_scan_pages);
+static unsigned int __read_mostly opt_mem_sharing_scan_ms = 20;
+integer_param("mem-sharing-scan-ms", opt_mem_sharing_scan_ms);
+
+/* Bound on the size of the unstable tree, i.e. on the memory it uses. */
+#define SCAN_UNSTABLE_MAX  (1UL << 18)
+/* gfns which aren't sharable ram are cheaper to skip than to hash. */
+#define SCAN_HOLE_COST     16
+
+struct scan_node {
+    struct rb_node node;
+    uint64_t hash;
+    unsigned long gfn;
+    shr_handle_t handle;        /* Stable nodes only. */
+    domid_t domain;
+};
+
+static struct {
+    struct rb_root stable, unstable;
+    unsigned long nr_stable, nr_unstable;
+    struct rb_node *prune;      /* Next stable node to check, if pruning. */
+    bool pruning;               /* End of pass clean up in progress. */
+    atomic_t nr_domains;        /* Domains with scanning enabled. */
+    struct domain_scan scanner;
+} scan;
+
+static bool scan_enabled(const struct domain *d)
+{
+    return mem_sharing_enabled(d) && d->arch.hvm_domain.mem_sharing_scan &&
+           !d->is_dying;
+}
+
+static uint64_t scan_hash_page(const void *p)
+{
+    const uint64_t *w = p;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned int i;
+
+    for ( i = 0; i < PAGE_SIZE / sizeof(*w); i++ )
+        h = (h ^ w[i]) * 0x100000001b3ULL;
+
+    return h ^ (h >> 32);
+}
+
+static struct scan_node *scan_tree_search(struct rb_root *root, uint64_t hash)
+{
+    struct rb_node *n = root->rb_node;
+
+    while ( n )
+    {
+        struct scan_node *node = rb_entry(n, struct scan_node, node);
+
+        if ( hash < node->hash )
+            n = n->rb_left;
+        else if ( hash > node->hash )
+            n = n->rb_right;
+        else
+            return node;
+    }
+
+    return NULL;
+}
+
+static void scan_tree_insert(struct rb_root *root, struct scan_node *new)
+{
+    struct rb_node **link = &root->rb_node, *parent = NULL;
+
+    while ( *link )
+    {
+        struct scan_node *node = rb_entry(*link, struct scan_node, node);
+
+        parent = *link;
+        ASSERT(new->hash != node->hash);
+        link = new->hash < node->hash ? &parent->rb_left : &parent->rb_right;
+    }
+
+    rb_link_node(&new->node, parent, link);
+    rb_insert_color(&new->node, root);
+}
+
+static struct scan_node *scan_node_alloc(uint64_t hash, struct domain *d,
+                                         unsigned long gfn, shr_handle_t h)
+{
+    struct scan_node *node = xmalloc(struct scan_node);
+
+    if ( node )
+    {
+        node->hash = hash;
+        node->domain = d->domain_id;
+        node->gfn = gfn;
+        node->handle = h;
+    }
+
+    return node;
+}
+
+/*
+ * Take a reference on the page backing gfn, if it is ram which could be
+ * shared.
+ */
+static struct page_info *scan_get_page(struct domain *d, unsigned long gfn,
+                                       p2m_type_t *t)
+{
+    struct page_info *page;
+
+    page = p2m_get_page_from_gfn(p2m_get_hostp2m(d), _gfn(gfn), t, NULL, 0);
+    if ( page && !p2m_is_sharable(*t) && !p2m_is_shared(*t) )
+    {
+        put_page(page);
+        page = NULL;
+    }
+
+    return page;
+}
+
+static bool scan_same_contents(struct domain *sd, unsigned long sgfn,
+                               struct domain *cd, unsigned long cgfn)
+{
+    struct page_info *spage, *cpage;
+    const void *sp, *cp;
+    p2m_type_t t;
+    bool same = false;
+
+    spage = scan_get_page(sd, sgfn, &t);
+    if ( !spage )
+        return false;
+
+    cpage = scan_get_page(cd, cgfn, &t);
+    if ( cpage )
+    {
+        sp = __map_domain_page(spage);
+        cp = __map_domain_page(cpage);
+        same = spage == cpage || !memcmp(sp, cp, PAGE_SIZE);
+        unmap_domain_page(cp);
+        unmap_domain_page(sp);
+        put_page(cpage);
+    }
+
+    put_page(spage);
+
+    return same;
+}
+
+/*
+ * Share cgfn of cd with the page of node, if they have the same contents.
+ * The node's page is nominated if it hasn't been yet (i.e. has no handle).
+ * Returns 0 on success, S_HANDLE_INVALID if the node's page can't be shared
+ * any more, and another error if the candidate can't be shared with it.
+ */
+static int scan_merge(struct scan_node *node, struct domain *cd,
+                      unsigned long cgfn)
+{
+    struct domain *sd;
+    shr_handle_t sh = node->handle, ch;
+    int rc;
+
+    sd = get_domain_by_id(node->domain);
+    if ( !sd )
+        return XENMEM_SHARING_OP_S_HANDLE_INVALID;
+
+    rc = XENMEM_SHARING_OP_S_HANDLE_INVALID;
+    if ( !scan_enabled(sd) )
+        goto out;
+
+    /* Nothing to do if the candidate is the node's own page. */
+    rc = -EAGAIN;
+    if ( sd == cd && node->gfn == cgfn )
+        goto out;
+
+    /*
+     * Compare first, so as not to leave pages nominated (i.e. read-only)
+     * after a false match.  The comparison is only authoritative once both
+     * pages have been nominated.
+     */
+    if ( !scan_same_contents(sd, node->gfn, cd, cgfn) )
+        goto out;
+
+    if ( !sh && nominate_page(sd, _gfn(node->gfn), 0, &sh) )
+    {
+        rc = XENMEM_SHARING_OP_S_HANDLE_INVALID;
+        goto out;
+    }
+
+    rc = nominate_page(cd, _gfn(cgfn), 0, &ch);
+    if ( rc )
+        goto out;
+
+    rc = -EAGAIN;
+    if ( !scan_same_contents(sd, node->gfn, cd, cgfn) )
+        goto out;
+
+    rc = share_pages(sd, _gfn(node->gfn), sh, cd, _gfn(cgfn), ch);
+    if ( !rc )
+    {
+        node->handle = sh;
+        perfc_incr(mem_sharing_scan_merged);
+    }
+
+ out:
+    put_domain(sd);
+
+    return rc;
+}
+
+static void scan_node_drop(struct rb_root *root, struct scan_node *node)
+{
+    rb_erase(&node->node, root);
+    xfree(node);
+
+    if ( root == &scan.stable )
+        scan.nr_stable--;
+    else
+        scan.nr_unstable--;
+}
+
+/* Scan one gfn.  Returns false if it wasn't worth hashing. */
+static bool scan_gfn(struct domain *d, unsigned long gfn)
+{
+    struct scan_node *node;
+    struct page_info *page;
+    const void *p;
+    p2m_type_t t;
+    shr_handle_t h;
+    uint64_t hash;
+    int rc;
+
+    page = scan_get_page(d, gfn, &t);
+    if ( !page )
+        return false;
+
+    p = __map_domain_page(page);
+    hash = scan_hash_page(p);
+    unmap_domain_page(p);
+    put_page(page);
+
+    perfc_incr(mem_sharing_scan_pages);
+
+    node = scan_tree_search(&scan.stable, hash);
+    if ( node )
+    {
+        rc = scan_merge(node, d, gfn);
+        if ( rc != XENMEM_SHARING_OP_S_HANDLE_INVALID )
+            return true;
+
+        scan_node_drop(&scan.stable, node);
+    }
+
+    node = scan_tree_search(&scan.unstable, hash);
+    if ( node )
+    {
+        rc = scan_merge(node, d, gfn);
+        if ( !rc )
+        {
+            /* The page is now shared: promote it to the stable tree. */
+            rb_erase(&node->node, &scan.unstable);
+            scan.nr_unstable--;
+            scan_tree_insert(&scan.stable, node);
+            scan.nr_stable++;
+            return true;
+        }
+
+        if ( rc != XENMEM_SHARING_OP_S_HANDLE_INVALID )
+            return true;
+
+        /* Stale: let this page take its place. */
+        node->domain = d->domain_id;
+        node->gfn = gfn;
+        return true;
+    }
+
+    /* Pages which are already shared can't change, so are stable. */
+    if ( p2m_is_shared(t) )
+    {
+        if ( nominate_page(d, _gfn(gfn), 0, &h) ||
+             !(node = scan_node_alloc(hash, d, gfn, h)) )
+            return true;
+
+        scan_tree_insert(&scan.stable, node);
+        scan.nr_stable++;
+    }
+    else if ( scan.nr_unstable < SCAN_UNSTABLE_MAX &&
+              (node = scan_node_alloc(hash, d, gfn, 0)) )
+    {
+        scan_tree_insert(&scan.unstable, node);
+        scan.nr_unstable++;
+    }
+
+    return true;
+}
+
+/*
+ * End of a pass over all the domains: forget the stable nodes whose page
+ * is no longer shared, and the unstable tree, a node per unit of budget.
+ * No page is scanned until this is done, so the trees don't change between
+ * runs but for the nodes dropped here, and scan.prune remains valid.
+ */
+static bool scan_end_pass(unsigned long *budget)
+{
+    struct rb_node *n;
+
+    if ( !scan.pruning )
+    {
+        scan.prune = rb_first(&scan.stable);
+        scan.pruning = true;
+    }
+
+    for ( ; scan.prune && *budget; --*budget )
+    {
+        struct scan_node *node = rb_entry(scan.prune, struct scan_node, node);
+        struct domain *d = get_domain_by_id(node->domain);
+        struct page_info *page = NULL, *pg;
+        p2m_type_t t;
+        bool stale = true;
+
+        scan.prune = rb_next(scan.prune);
+
+        if ( d && scan_enabled(d) )
+            page = scan_get_page(d, node->gfn, &t);
+
+        if ( page && p2m_is_shared(t) &&
+             (pg = __grab_shared_page(page_to_mfn(page))) != NULL )
+        {
+            stale = pg->sharing->handle != node->handle;
+            mem_sharing_page_unlock(pg);
+        }
+
+        if ( stale )
+            scan_node_drop(&scan.stable, node);
+
+        if ( page )
+            put_page(page);
+        if ( d )
+            put_domain(d);
+    }
+
+    for ( ; *budget && (n = rb_first(&scan.unstable)); --*budget )
+        scan_node_drop(&scan.unstable, rb_entry(n, struct scan_node, node));
+
+    if ( scan.prune || !RB_EMPTY_ROOT(&scan.unstable) )
+        return false;
+
+    scan.pruning = false;
+
+    return true;
+}
+
+static bool scan_domain(struct domain *d, unsigned long *budget)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn = d->arch.hvm_domain.mem_sharing_scan_gfn;
+
+    for ( ; *budget && gfn <= p2m->max_mapped_pfn; gfn++ )
+    {
+        unsigned long cost = scan_gfn(d, gfn) ? SCAN_HOLE_COST : 1;
+
+        *budget -= min(*budget, cost);
+    }
+
+    if ( gfn <= p2m->max_mapped_pfn )
+    {
+        d->arch.hvm_domain.mem_sharing_scan_gfn = gfn;
+        return false;
+    }
+
+    d->arch.hvm_domain.mem_sharing_scan_gfn = 0;
+
+    return true;
+}
+
+/* Stay idle while no domain has scanning enabled. */
+static bool scan_begin(void)
+{
+    return atomic_read(&scan.nr_domains);
+}
+
+static void mem_sharing_scan_control(struct domain *d, bool enable)
+{
+    if ( xchg(&d->arch.hvm_domain.mem_sharing_scan, enable) == enable )
+        return;
+
+    if ( !enable )
+    {
+        atomic_dec(&scan.nr_domains);
+        return;
+    }
+
+    d->arch.hvm_domain.mem_sharing_scan_gfn = 0;
+    if ( atomic_inc_return(&scan.nr_domains) == 1 &&
+         opt_mem_sharing_scan_pages )
+        domain_scan_kick(&scan.scanner);
+}
+
 int relinquish_shared_pages(struct domain *d)
 {
     int rc = 0;
     struct p2m_domain *p2m = p2m_get_hostp2m(d);
     unsigned long gfn, count = 0;
+    unsigned int order;
 
     if ( p2m == NULL )
         return 0;
 
+    mem_sharing_scan_control(d, false);
+
     p2m_lock(p2m);
     for ( gfn = p2m->next_shared_gfn_to_relinquish;
-          gfn <= p2m->max_mapped_pfn; gfn++ )
+          gfn <= p2m->max_mapped_pfn; gfn = (gfn | ((1UL << order) - 1)) + 1 )
     {
         p2m_access_t a;
         p2m_type_t t;
@@ -1234,7 +1659,11 @@ int relinquish_shared_pages(struct domain *d)
 
         if ( atomic_read(&d->shr_pages) == 0 )
             break;
-        mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, NULL, NULL);
+        /*
+         * Only 4k entries can be shared: superpages and holes are skipped
+         * as a whole.
+         */
+        mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, &order, NULL);
         if ( mfn_valid(mfn) && (t == p2m_ram_shared) )
         {
             /* Does not fail with ENOMEM given the DESTROY flag */
@@ -1251,7 +1680,7 @@ int relinquish_shared_pages(struct domain *d)
         else
             ++count;
 
-        /* Preempt every 2MiB (shared) or 32MiB (unshared) - arbitrary. */
+        /* Preempt every 512 shared or 8192 other entries - arbitrary. */
         if ( count >= 0x2000 )
         {
             if ( hypercall_preempt_check() )
@@ -1622,7 +2051,21 @@ int mem_sharing_domctl(struct domain *d, xen_domctl_mem_sharing_op_t *mec)
             if ( unlikely(need_iommu(d) && mec->u.enable) )
                 rc = -EXDEV;
             else
+            {
                 d->arch.hvm_domain.mem_sharing_enabled = mec->u.enable;
+                if ( !mec->u.enable )
+                    mem_sharing_scan_control(d, false);
+            }
+        }
+        break;
+
+        case XEN_DOMCTL_MEM_SHARING_SCAN:
+        {
+            rc = 0;
+            if ( mec->u.enable && !mem_sharing_enabled(d) )
+                rc = -EINVAL;
+            else
+                mem_sharing_scan_control(d, mec->u.enable);
         }
         break;
 
@@ -1636,6 +2079,15 @@ int mem_sharing_domctl(struct domain *d, xen_domctl_mem_sharing_op_t *mec)
 void __init mem_sharing_init(void)
 {
     printk("Initing memory sharing.\n");
+    scan.stable = scan.unstable = RB_ROOT;
+    atomic_set(&scan.nr_domains, 0);
+    scan.scanner.budget = opt_mem_sharing_scan_pages * SCAN_HOLE_COST;
+    scan.scanner.interval = MILLISECS(opt_mem_sharing_scan_ms);
+    scan.scanner.want = scan_enabled;
+    scan.scanner.scan = scan_domain;
+    scan.scanner.end_pass = scan_end_pass;
+    scan.scanner.begin = scan_begin;
+    domain_scan_init(&scan.scanner);
 #if MEM_SHARING_AUDIT
     spin_lock_init(&shr_audit_lock);
     INIT_LIST_HEAD(&shr_audit_list);
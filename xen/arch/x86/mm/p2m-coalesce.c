@@ -0,0 +1,296 @@
+/******************************************************************************
+ * arch/x86/mm/p2m-coalesce.c
+ *
+ * Superpage reassembly for HAP p2ms, driven by common/p2m-coalesce.c.
+ * A 2M range:
+ *  - mapped by 512 contiguous, suitably aligned 4k entries of the same type
+ *    and access is merged back into a 2M entry, and 512 such 2M entries
+ *    into a 1G one;
+ *  - otherwise fully populated with ordinary RAM has its contents moved to
+ *    a freshly allocated 2M block, which is then mapped with a 2M entry.
+ * Along the way, it counts how much of each domain's RAM is mapped by
+ * entries of each size.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/domain_page.h>
+#include <xen/iommu.h>
+#include <xen/sched.h>
+#include <asm/altp2m.h>
+#include <asm/p2m.h>
+#include <asm/paging.h>
+#include <asm/hvm/nestedhvm.h>
+
+#include "mm-locks.h"
+
+/* Override macros from asm/page.h to make them work with mfn_t */
+#undef mfn_to_page
+#define mfn_to_page(_m) __mfn_to_page(mfn_x(_m))
+#undef page_to_mfn
+#define page_to_mfn(_pg) _mfn(__page_to_mfn(_pg))
+
+/* The mfns backing the range being looked at, by the scanner alone. */
+static mfn_t range_mfns[SUPERPAGE_PAGES];
+
+bool arch_p2m_coalesce_supported(void)
+{
+    return hvm_enabled && hap_has_2mb;
+}
+
+bool arch_p2m_coalesce_domain(const struct domain *d)
+{
+    return hap_enabled(d) && !d->is_dying && !paging_mode_log_dirty(d) &&
+           !altp2m_active(d) && !nestedhvm_enabled(d);
+}
+
+/*
+ * A page can only be moved if nothing but its allocation references it:
+ * not Xen, a grant or foreign mapping, nor a device.
+ */
+static bool coalesce_page_movable(const struct domain *d, mfn_t mfn)
+{
+    const struct page_info *pg = mfn_to_page(mfn);
+
+    return page_get_owner(pg) == d && !is_xen_heap_page(pg) &&
+           (pg->count_info & (PGC_allocated | PGC_count_mask)) ==
+           (PGC_allocated | 1) &&
+           !(pg->u.inuse.type_info & PGT_count_mask);
+}
+
+/* Merge 512 contiguous 2M entries starting at gfn into a 1G one. */
+static bool coalesce_1g(struct p2m_domain *p2m, unsigned long gfn,
+                        mfn_t mfn0, p2m_type_t t0, p2m_access_t a0)
+{
+    const unsigned long mask = (1UL << PAGE_ORDER_1G) - 1;
+    unsigned int i, order;
+    p2m_type_t t;
+    p2m_access_t a;
+    mfn_t mfn;
+
+    if ( !hap_has_1gb || t0 != p2m_ram_rw || ((gfn | mfn_x(mfn0)) & mask) )
+        return false;
+
+    for ( i = 1; i < SUPERPAGE_PAGES; i++ )
+    {
+        mfn = p2m->get_entry(p2m, gfn + (i << PAGE_ORDER_2M), &t, &a, 0,
+                             &order, NULL);
+        if ( order != PAGE_ORDER_2M || t != t0 || a != a0 ||
+             !mfn_eq(mfn, mfn_add(mfn0, i << PAGE_ORDER_2M)) )
+            return false;
+    }
+
+    if ( p2m_set_entry(p2m, gfn, mfn0, PAGE_ORDER_1G, t0, a0) )
+        return false;
+
+    p2m->coalesce.promoted++;
+
+    return true;
+}
+
+/*
+ * Move the contents of the 2M range at gfn, backed by range_mfns[], to a
+ * new 2M block and map it with a single entry.
+ */
+static bool coalesce_migrate(struct p2m_domain *p2m, unsigned long gfn,
+                             p2m_access_t a)
+{
+    struct domain *d = p2m->domain;
+    struct page_info *pg;
+    unsigned int i;
+    mfn_t mfn;
+
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+        if ( !coalesce_page_movable(d, range_mfns[i]) )
+            return false;
+
+    pg = alloc_domheap_pages(d, PAGE_ORDER_2M, MEMF_no_owner);
+    if ( !pg )
+        return false;
+    mfn = page_to_mfn(pg);
+
+    /*
+     * Write-protect the range while copying it.  Writes fault, and the
+     * fault handler then waits for the p2m lock, after which it finds the
+     * new, writable, entry.
+     */
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+        if ( p2m_set_entry(p2m, gfn + i, range_mfns[i], PAGE_ORDER_4K,
+                           p2m_ram_logdirty, a) )
+            goto undo;
+    p2m_tlb_flush_sync(p2m);
+
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+        copy_domain_page(mfn_add(mfn, i), range_mfns[i]);
+
+    /*
+     * The new pages replace as many: bypass the max_pages check, and
+     * account for them until either set is freed.
+     */
+    if ( assign_pages(d, pg, PAGE_ORDER_2M, MEMF_no_refcount) )
+        goto undo;
+
+    spin_lock(&d->page_alloc_lock);
+    domain_adjust_tot_pages(d, SUPERPAGE_PAGES);
+    spin_unlock(&d->page_alloc_lock);
+
+    if ( p2m_set_entry(p2m, gfn, mfn, PAGE_ORDER_2M, p2m_ram_rw, a) )
+    {
+        for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+            if ( test_and_clear_bit(_PGC_allocated, &pg[i].count_info) )
+                put_page(&pg[i]);
+        pg = NULL;
+        i = SUPERPAGE_PAGES;
+        goto undo;
+    }
+
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+    {
+        struct page_info *old = mfn_to_page(range_mfns[i]);
+
+        set_gpfn_from_mfn(mfn_x(mfn) + i, gfn + i);
+        set_gpfn_from_mfn(mfn_x(range_mfns[i]), INVALID_M2P_ENTRY);
+
+        if ( test_and_clear_bit(_PGC_allocated, &old->count_info) )
+            put_page(old);
+    }
+
+    p2m->coalesce.migrated++;
+
+    return true;
+
+ undo:
+    while ( i-- )
+        p2m_set_entry(p2m, gfn + i, range_mfns[i], PAGE_ORDER_4K,
+                      p2m_ram_rw, a);
+    if ( pg )
+        free_domheap_pages(pg, PAGE_ORDER_2M);
+
+    return false;
+}
+
+void arch_p2m_coalesce_bounds(struct domain *d, gfn_t *start, gfn_t *end)
+{
+    *start = _gfn(0);
+    *end = _gfn(p2m_get_hostp2m(d)->max_mapped_pfn + 1);
+}
+
+unsigned long arch_p2m_coalesce_range(struct domain *d, gfn_t sgfn,
+                                      unsigned int *migrations)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+    unsigned long gfn = gfn_x(sgfn), nr, ram = 0;
+    unsigned int i, order;
+    p2m_type_t t0, t;
+    p2m_access_t a0, a;
+    bool ok, contig;
+    mfn_t mfn0, mfn;
+
+    p2m_lock(p2m);
+
+    mfn0 = p2m->get_entry(p2m, gfn, &t0, &a0, 0, &order, NULL);
+
+    if ( order >= PAGE_ORDER_2M )
+    {
+        if ( order == PAGE_ORDER_2M && coalesce_1g(p2m, gfn, mfn0, t0, a0) )
+            order = PAGE_ORDER_1G;
+
+        nr = (1UL << order) - (gfn & ((1UL << order) - 1));
+        if ( p2m_is_ram(t0) )
+            p2m->coalesce.pass[order == PAGE_ORDER_1G ? 2 : 1] += nr;
+        goto out;
+    }
+
+    nr = SUPERPAGE_PAGES;
+    ok = hap_has_2mb;
+    contig = !(mfn_x(mfn0) & (SUPERPAGE_PAGES - 1));
+
+    for ( i = 0; i < SUPERPAGE_PAGES; i++ )
+    {
+        if ( i )
+            mfn = p2m->get_entry(p2m, gfn + i, &t, &a, 0, NULL, NULL);
+        else
+        {
+            mfn = mfn0;
+            t = t0;
+            a = a0;
+        }
+
+        if ( p2m_is_ram(t) )
+            ram++;
+
+        if ( t != p2m_ram_rw || a != a0 || !mfn_valid(mfn) )
+            ok = false;
+        else if ( !mfn_eq(mfn, mfn_add(mfn0, i)) )
+            contig = false;
+
+        range_mfns[i] = mfn;
+    }
+
+    if ( ok && contig )
+    {
+        ok = !p2m_set_entry(p2m, gfn, mfn0, PAGE_ORDER_2M, p2m_ram_rw, a0);
+        if ( ok )
+            p2m->coalesce.promoted++;
+    }
+    else if ( ok )
+    {
+        /* In-flight DMA to the old pages would be lost. */
+        ok = *migrations && !need_iommu(d) &&
+             coalesce_migrate(p2m, gfn, a0);
+        if ( ok )
+            --*migrations;
+    }
+
+    if ( ok )
+        p2m->coalesce.pass[1] += SUPERPAGE_PAGES;
+    else
+        p2m->coalesce.pass[0] += ram;
+
+ out:
+    p2m_unlock(p2m);
+
+    return nr;
+}
+
+void arch_p2m_coalesce_pass_done(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    p2m_lock(p2m);
+    memcpy(p2m->coalesce.mapped, p2m->coalesce.pass,
+           sizeof(p2m->coalesce.mapped));
+    memset(p2m->coalesce.pass, 0, sizeof(p2m->coalesce.pass));
+    p2m_unlock(p2m);
+}
+
+void p2m_coalesce_dump(struct domain *d)
+{
+    struct p2m_domain *p2m = p2m_get_hostp2m(d);
+
+    printk("    p2m RAM mapped by 4k/2M/1G entries: %lu/%lu/%lu pages, "
+           "promoted=%lu migrated=%lu\n",
+           p2m->coalesce.mapped[0], p2m->coalesce.mapped[1],
+           p2m->coalesce.mapped[2], p2m->coalesce.promoted,
+           p2m->coalesce.migrated);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -42,6 +42,13 @@
 
 #define superpage_aligned(_x)  (((_x)&(SUPERPAGE_PAGES-1))==0)
 
+/*
+ * Number of cache pages the background sweeper tries to keep available
+ * while a domain has outstanding PoD entries.  0 disables the sweeper.
+ */
+static unsigned int __read_mostly opt_pod_sweep_watermark = 1024;
+integer_param("pod-sweep-watermark", opt_pod_sweep_watermark);
+
 /* Enforce lock ordering when grabbing the "external" page_alloc lock */
 static inline void lock_page_alloc(struct p2m_domain *p2m)
 {
@@ -380,6 +387,7 @@ int p2m_pod_empty_cache(struct domain *d)
 
     /* After this barrier no new PoD activities can happen. */
     BUG_ON(!d->is_dying);
+    p2m_pod_sweeper_kill(p2m);
     spin_barrier(&p2m->pod.lock.lock);
 
     lock_page_alloc(p2m);
@@ -660,6 +668,9 @@ void p2m_pod_dump_data(struct domain *d)
 
     printk("    PoD entries=%ld cachesize=%ld\n",
            p2m->pod.entry_count, p2m->pod.count);
+    printk("    PoD sweeper: scanned=%lu reclaimed=%lu rate=%lu pages/s\n",
+           p2m->pod.sweeper.scanned, p2m->pod.sweeper.reclaimed,
+           p2m->pod.sweeper.rate);
 }
 
 
@@ -773,14 +784,7 @@ p2m_pod_zero_check_superpage(struct p2m_domain *p2m, unsigned long gfn)
     for ( i=0; i < SUPERPAGE_PAGES; i++ )
     {
         map = map_domain_page(_mfn(mfn_x(mfn0) + i));
-
-        for ( j=0; j<PAGE_SIZE/sizeof(*map); j++ )
-            if( *(map+j) != 0 )
-            {
-                reset = 1;
-                break;
-            }
-
+        reset = !page_is_zero(map);
         unmap_domain_page(map);
 
         if ( reset )
@@ -891,18 +895,17 @@ p2m_pod_zero_check(struct p2m_domain *p2m, unsigned long *gfns, int count)
     /* Now check each page for real */
     for ( i=0; i < count; i++ )
     {
+        bool zero;
+
         if(!map[i])
             continue;
 
-        for ( j=0; j<PAGE_SIZE/sizeof(*map[i]); j++ )
-            if( *(map[i]+j) != 0 )
-                break;
-
+        zero = page_is_zero(map[i]);
         unmap_domain_page(map[i]);
 
         /* See comment in p2m_pod_zero_check_superpage() re gnttab
          * check timing.  */
-        if ( j < PAGE_SIZE/sizeof(*map[i]) )
+        if ( !zero )
         {
             p2m_set_entry(p2m, gfns[i], mfns[i], PAGE_ORDER_4K,
                 types[i], p2m->default_access);
@@ -985,6 +988,213 @@ p2m_pod_emergency_sweep(struct p2m_domain *p2m)
 
 }
 
+/*
+ * Background sweeper.
+ *
+ * The emergency sweep only runs once the cache is empty, scanning with the
+ * p2m lock held while a vcpu waits on the fault.  Instead, while the cache
+ * is below opt_pod_sweep_watermark and the domain has outstanding PoD
+ * entries, a tasklet walks the p2m looking for pages which appear zero
+ * without holding any p2m locks, and only takes the locks to reclaim the
+ * candidates it finds.
+ */
+#define POD_SWEEPER_BATCH  1024          /* gfns examined per tasklet run */
+#define POD_SWEEPER_DELAY  MILLISECS(10) /* between runs */
+#define POD_SWEEPER_IDLE   MILLISECS(100) /* after a run which found nothing */
+
+static bool pod_sweeper_needed(const struct p2m_domain *p2m)
+{
+    return opt_pod_sweep_watermark && !p2m->domain->is_dying &&
+           p2m->pod.count < opt_pod_sweep_watermark &&
+           p2m->pod.entry_count > p2m->pod.count;
+}
+
+/* Arm the sweeper if the cache is running low.  Called with pod lock held. */
+static void pod_sweeper_kick(struct p2m_domain *p2m)
+{
+    struct pod_sweeper *sw = &p2m->pod.sweeper;
+
+    ASSERT(pod_locked_by_me(p2m));
+
+    if ( !sw->armed && pod_sweeper_needed(p2m) )
+    {
+        sw->armed = true;
+        set_timer(&sw->timer, NOW() + POD_SWEEPER_DELAY);
+    }
+}
+
+/*
+ * Check, without holding any p2m locks, whether gfn is backed by ram which
+ * appears to be zero.  This is only a hint, as the guest can write to the
+ * page at any point; p2m_pod_zero_check{,_superpage}() check again once
+ * the gfn has been unmapped.  Returns the number of gfns covered: a whole
+ * superpage if gfn starts one, else 1.
+ */
+static unsigned long pod_sweep_candidate(struct p2m_domain *p2m,
+                                         unsigned long gfn, bool *zero)
+{
+    struct domain *d = p2m->domain;
+    p2m_type_t t;
+    p2m_access_t a;
+    unsigned int order;
+    unsigned long i, n;
+    mfn_t mfn;
+
+    *zero = false;
+
+    mfn = p2m->get_entry(p2m, gfn, &t, &a, 0, &order, NULL);
+    n = (superpage_aligned(gfn) && order >= PAGE_ORDER_2M) ?
+        SUPERPAGE_PAGES : 1;
+
+    if ( !p2m_is_ram(t) || !mfn_valid(mfn) )
+        return n;
+
+    for ( i = 0; i < n; i++ )
+    {
+        struct page_info *page = mfn_to_page(mfn_add(mfn, i));
+        unsigned long *map;
+        bool z;
+
+        if ( !get_page(page, d) )
+            return n;
+
+        map = map_domain_page(mfn_add(mfn, i));
+        z = page_is_zero(map);
+        unmap_domain_page(map);
+        put_page(page);
+
+        if ( !z )
+            return n;
+    }
+
+    *zero = true;
+
+    return n;
+}
+
+/* Reclaim candidates found by pod_sweep_candidate(). */
+static void pod_sweep_reclaim(struct p2m_domain *p2m, unsigned long *gfns,
+                              unsigned int count, bool superpage)
+{
+    struct pod_sweeper *sw = &p2m->pod.sweeper;
+    long before;
+
+    p2m_lock(p2m);
+    pod_lock(p2m);
+
+    before = p2m->pod.count;
+
+    if ( superpage )
+        p2m_pod_zero_check_superpage(p2m, gfns[0]);
+    else
+        p2m_pod_zero_check(p2m, gfns, count);
+
+    if ( p2m->pod.count > before )
+    {
+        sw->reclaimed += p2m->pod.count - before;
+        perfc_add(pod_sweep_reclaimed, p2m->pod.count - before);
+    }
+
+    pod_unlock(p2m);
+    p2m_unlock(p2m);
+}
+
+static void pod_sweeper_tasklet(unsigned long data)
+{
+    struct p2m_domain *p2m = (struct p2m_domain *)data;
+    struct pod_sweeper *sw = &p2m->pod.sweeper;
+    unsigned long gfns[POD_SWEEP_STRIDE];
+    unsigned long gfn = sw->next_gfn, scanned = 0, reclaimed = sw->reclaimed;
+    unsigned long n;
+    unsigned int nr = 0;
+    s_time_t now;
+    bool zero;
+
+    perfc_incr(pod_sweep_runs);
+
+    while ( scanned < POD_SWEEPER_BATCH && pod_sweeper_needed(p2m) )
+    {
+        if ( gfn > p2m->max_mapped_pfn )
+            gfn = 0;
+
+        n = pod_sweep_candidate(p2m, gfn, &zero);
+
+        if ( zero && n > 1 )
+        {
+            unsigned long sgfn = gfn;
+
+            pod_sweep_reclaim(p2m, &sgfn, 1, true);
+        }
+        else if ( zero )
+        {
+            gfns[nr++] = gfn;
+            if ( nr == POD_SWEEP_STRIDE )
+            {
+                pod_sweep_reclaim(p2m, gfns, nr, false);
+                nr = 0;
+            }
+        }
+
+        gfn += n;
+        scanned += n;
+    }
+
+    if ( nr )
+        pod_sweep_reclaim(p2m, gfns, nr, false);
+
+    sw->next_gfn = gfn;
+    sw->scanned += scanned;
+    perfc_add(pod_sweep_scanned, scanned);
+
+    now = NOW();
+    if ( now - sw->window_start >= SECONDS(1) )
+    {
+        sw->rate = (sw->reclaimed - sw->window_reclaimed) * SECONDS(1) /
+                   (now - sw->window_start);
+        sw->window_start = now;
+        sw->window_reclaimed = sw->reclaimed;
+    }
+
+    pod_lock(p2m);
+    if ( pod_sweeper_needed(p2m) )
+        set_timer(&sw->timer, now + (sw->reclaimed != reclaimed ?
+                                     POD_SWEEPER_DELAY : POD_SWEEPER_IDLE));
+    else
+        sw->armed = false;
+    pod_unlock(p2m);
+}
+
+static void pod_sweeper_timer(void *data)
+{
+    struct p2m_domain *p2m = data;
+
+    tasklet_schedule(&p2m->pod.sweeper.tasklet);
+}
+
+void p2m_pod_sweeper_init(struct p2m_domain *p2m)
+{
+    struct pod_sweeper *sw = &p2m->pod.sweeper;
+    unsigned int cpu = cpumask_first(&cpu_online_map);
+    unsigned int i;
+
+    /*
+     * The tasklet runs where the timer fires: spread the domains over the
+     * online CPUs rather than leaving them all on the one creating them.
+     */
+    for ( i = p2m->domain->domain_id % num_online_cpus(); i; i-- )
+        cpu = cpumask_cycle(cpu, &cpu_online_map);
+
+    init_timer(&sw->timer, pod_sweeper_timer, p2m, cpu);
+    tasklet_init(&sw->tasklet, pod_sweeper_tasklet, (unsigned long)p2m);
+    sw->window_start = NOW();
+}
+
+void p2m_pod_sweeper_kill(struct p2m_domain *p2m)
+{
+    kill_timer(&p2m->pod.sweeper.timer);
+    tasklet_kill(&p2m->pod.sweeper.tasklet);
+}
+
 static void pod_eager_reclaim(struct p2m_domain *p2m)
 {
     struct pod_mrp_list *mrp = &p2m->pod.mrp;
@@ -1133,6 +1343,8 @@ p2m_pod_demand_populate(struct p2m_domain *p2m, unsigned long gfn,
         __trace_var(TRC_MEM_POD_POPULATE, 0, sizeof(t), &t);
     }
 
+    pod_sweeper_kick(p2m);
+
     pod_unlock(p2m);
     return 0;
 out_of_memory:
@@ -62,6 +62,7 @@ static int p2m_initialise(struct domain *d, struct p2m_domain *p2m)
     int ret = 0;
 
     mm_rwlock_init(&p2m->lock);
+    rwlock_set_class(&p2m->lock.lock.rwlock, p2m);
     mm_lock_init(&p2m->pod.lock);
     INIT_LIST_HEAD(&p2m->np2m_list);
     INIT_PAGE_LIST_HEAD(&p2m->pages);
@@ -126,6 +127,7 @@ static int p2m_init_hostp2m(struct domain *d)
                                             RANGESETF_prettyprint_hex);
         if ( p2m->logdirty_ranges )
         {
+            p2m_pod_sweeper_init(p2m);
             d->arch.p2m = p2m;
             return 0;
         }
@@ -141,6 +143,7 @@ static void p2m_teardown_hostp2m(struct domain *d)
 
     if ( p2m )
     {
+        p2m_pod_sweeper_kill(p2m);
         rangeset_destroy(p2m->logdirty_ranges);
         p2m_free_one(p2m);
         d->arch.p2m = NULL;
@@ -1032,6 +1035,10 @@ int p2m_finish_type_change(struct domain *d,
     last_gfn = min(last_gfn, p2m->max_mapped_pfn);
     while ( gfn <= last_gfn )
     {
+        unsigned int order;
+        p2m_access_t a;
+        p2m_type_t t;
+
         rc = p2m->recalc(p2m, gfn);
         /*
          * ept->recalc could return 0/1/-ENOMEM. pt->recalc could return
@@ -1047,7 +1054,12 @@ int p2m_finish_type_change(struct domain *d,
             break;
         }
 
-        gfn++;
+        /*
+         * The recalculation deals with a superpage (or a hole) as a whole,
+         * so skip to the end of the entry covering gfn.
+         */
+        p2m->get_entry(p2m, gfn, &t, &a, 0, &order, NULL);
+        gfn = (gfn | ((1UL << order) - 1)) + 1;
     }
 
     p2m_unlock(p2m);
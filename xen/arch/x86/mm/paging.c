@@ -28,6 +28,7 @@
 #include <asm/event.h>
 #include <asm/hvm/nestedhvm.h>
 #include <xen/numa.h>
+#include <xen/vmap.h>
 #include <xsm/xsm.h>
 #include <public/sched.h> /* SHUTDOWN_suspend */
 
@@ -215,6 +216,19 @@ static int paging_free_log_dirty_bitmap(struct domain *d, int rc)
     return rc;
 }
 
+static void paging_free_log_dirty_list(struct domain *d)
+{
+    uint64_t *list;
+
+    paging_lock(d);
+    list = d->arch.paging.log_dirty.list;
+    d->arch.paging.log_dirty.list = NULL;
+    d->arch.paging.log_dirty.list_count = 0;
+    paging_unlock(d);
+
+    vfree(list);
+}
+
 int paging_log_dirty_enable(struct domain *d, bool_t log_global)
 {
     int ret;
@@ -257,6 +271,8 @@ static int paging_log_dirty_disable(struct domain *d, bool_t resuming)
     if ( ret == -ERESTART )
         return ret;
 
+    paging_free_log_dirty_list(d);
+
     domain_unpause(d);
 
     return ret;
@@ -332,6 +348,15 @@ void paging_mark_pfn_dirty(struct domain *d, pfn_t pfn)
                      "d%d: marked mfn %" PRI_mfn " (pfn %" PRI_pfn ")\n",
                      d->domain_id, mfn_x(mfn), pfn_x(pfn));
         d->arch.paging.log_dirty.dirty_count++;
+
+        if ( d->arch.paging.log_dirty.list )
+        {
+            if ( d->arch.paging.log_dirty.list_count < LOGDIRTY_LIST_ENTRIES )
+                d->arch.paging.log_dirty.list[
+                    d->arch.paging.log_dirty.list_count++] = pfn_x(pfn);
+            else
+                d->arch.paging.log_dirty.list_overflow = 1;
+        }
     }
 
 out:
@@ -401,6 +426,41 @@ int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn)
     return rv;
 }
 
+/* Clear the dirty bit of a single guest pfn. */
+static void paging_clear_pfn_dirty(struct domain *d, pfn_t pfn)
+{
+    mfn_t mfn, *l4, *l3, *l2;
+    unsigned long *l1;
+
+    ASSERT(paging_locked_by_me(d));
+
+    mfn = d->arch.paging.log_dirty.top;
+    if ( !mfn_valid(mfn) )
+        return;
+
+    l4 = map_domain_page(mfn);
+    mfn = l4[L4_LOGDIRTY_IDX(pfn)];
+    unmap_domain_page(l4);
+    if ( !mfn_valid(mfn) )
+        return;
+
+    l3 = map_domain_page(mfn);
+    mfn = l3[L3_LOGDIRTY_IDX(pfn)];
+    unmap_domain_page(l3);
+    if ( !mfn_valid(mfn) )
+        return;
+
+    l2 = map_domain_page(mfn);
+    mfn = l2[L2_LOGDIRTY_IDX(pfn)];
+    unmap_domain_page(l2);
+    if ( !mfn_valid(mfn) )
+        return;
+
+    l1 = map_domain_page(mfn);
+    __clear_bit(L1_LOGDIRTY_IDX(pfn), l1);
+    unmap_domain_page(l1);
+}
+
 
 /* Read a domain's log-dirty bitmap and stats.  If the operation is a CLEAN,
  * clear the bitmap and stats as well. */
@@ -436,9 +496,22 @@ static int paging_log_dirty_op(struct domain *d,
 
     paging_lock(d);
 
+    clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
+
     if ( !d->arch.paging.preempt.dom )
+    {
         memset(&d->arch.paging.preempt.log_dirty, 0,
                sizeof(d->arch.paging.preempt.log_dirty));
+        /*
+         * Every pfn dirty so far is about to be reported, pfns which get
+         * dirtied from now on are recorded for the next CLEAN_LIST.
+         */
+        if ( clean )
+        {
+            d->arch.paging.log_dirty.list_count = 0;
+            d->arch.paging.log_dirty.list_overflow = 0;
+        }
+    }
     else if ( d->arch.paging.preempt.dom != current->domain ||
               d->arch.paging.preempt.op != sc->op )
     {
@@ -448,8 +521,6 @@ static int paging_log_dirty_op(struct domain *d,
         return -EBUSY;
     }
 
-    clean = (sc->op == XEN_DOMCTL_SHADOW_OP_CLEAN);
-
     PAGING_DEBUG(LOGDIRTY, "log-dirty %s: dom %u faults=%u dirty=%u\n",
                  (clean) ? "clean" : "peek",
                  d->domain_id,
@@ -577,6 +648,9 @@ static int paging_log_dirty_op(struct domain *d,
 
  out:
     d->arch.paging.preempt.dom = NULL;
+    /* The bitmap hasn't been fully cleaned, the list can't be trusted. */
+    if ( clean )
+        d->arch.paging.log_dirty.list_overflow = 1;
     paging_unlock(d);
     domain_unpause(d);
 
@@ -592,6 +666,92 @@ static int paging_log_dirty_op(struct domain *d,
     return rv;
 }
 
+/*
+ * Return the list of pfns dirtied since the last clean and clean them, at
+ * a cost proportional to the number of dirty pages rather than to the size
+ * of the guest. The list is only maintained once it has been asked for:
+ * the first call starts it and fails with -ENOBUFS.
+ */
+static int paging_log_dirty_clean_list(struct domain *d,
+                                       struct xen_domctl_shadow_op *sc)
+{
+    uint64_t *list = NULL;
+    unsigned int i, count;
+    int rv = 0;
+
+    if ( !d->arch.paging.log_dirty.list )
+    {
+        list = vmalloc(LOGDIRTY_LIST_ENTRIES * sizeof(*list));
+        if ( !list )
+            return -ENOMEM;
+    }
+
+    if ( is_hvm_domain(d) && (sc->mode & XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL) )
+        hvm_mapped_guest_frames_mark_dirty(d);
+
+    domain_pause(d);
+
+    /* Flush dirty GFNs potentially cached by hardware (e.g. PML). */
+    p2m_flush_hardware_cached_dirty(d);
+
+    paging_lock(d);
+
+    if ( unlikely(d->arch.paging.log_dirty.failed_allocs) )
+    {
+        rv = -ENOMEM;
+        goto out;
+    }
+
+    if ( !d->arch.paging.log_dirty.list )
+    {
+        /* Pages dirtied so far are unknown until the next bitmap CLEAN. */
+        d->arch.paging.log_dirty.list = list;
+        d->arch.paging.log_dirty.list_count = 0;
+        d->arch.paging.log_dirty.list_overflow = 1;
+        list = NULL;
+    }
+
+    count = d->arch.paging.log_dirty.list_count;
+    if ( d->arch.paging.log_dirty.list_overflow || count > sc->pages )
+    {
+        rv = -ENOBUFS;
+        goto out;
+    }
+
+    if ( !guest_handle_is_null(sc->dirty_bitmap) &&
+         copy_to_guest(sc->dirty_bitmap,
+                       (uint8_t *)d->arch.paging.log_dirty.list,
+                       count * sizeof(*d->arch.paging.log_dirty.list)) )
+    {
+        rv = -EFAULT;
+        goto out;
+    }
+
+    for ( i = 0; i < count; i++ )
+        paging_clear_pfn_dirty(d, _pfn(d->arch.paging.log_dirty.list[i]));
+
+    sc->pages = count;
+    sc->stats.fault_count = d->arch.paging.log_dirty.fault_count;
+    sc->stats.dirty_count = d->arch.paging.log_dirty.dirty_count;
+
+    d->arch.paging.log_dirty.fault_count = 0;
+    d->arch.paging.log_dirty.dirty_count = 0;
+    d->arch.paging.log_dirty.list_count = 0;
+
+ out:
+    paging_unlock(d);
+
+    /* Safe because the domain is paused. */
+    if ( !rv )
+        d->arch.paging.log_dirty.ops->clean(d);
+
+    domain_unpause(d);
+
+    vfree(list);
+
+    return rv;
+}
+
 void paging_log_dirty_range(struct domain *d,
                            unsigned long begin_pfn,
                            unsigned long nr,
@@ -744,6 +904,13 @@ int paging_domctl(struct domain *d, xen_domctl_shadow_op_t *sc,
         if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
             return -EINVAL;
         return paging_log_dirty_op(d, sc, resuming);
+
+    case XEN_DOMCTL_SHADOW_OP_CLEAN_LIST:
+        if ( sc->mode & ~XEN_DOMCTL_SHADOW_LOGDIRTY_FINAL )
+            return -EINVAL;
+        if ( !paging_mode_log_dirty(d) )
+            return -EINVAL;
+        return paging_log_dirty_clean_list(d, sc);
     }
 
     /* Here, dispatch domctl to the appropriate paging code */
@@ -814,6 +981,8 @@ int paging_teardown(struct domain *d)
     if ( rc == -ERESTART )
         return rc;
 
+    paging_free_log_dirty_list(d);
+
     /* Move populate-on-demand cache back to domain_list for destruction */
     rc = p2m_pod_empty_cache(d);
 
@@ -890,6 +1059,9 @@ void paging_dump_domain_info(struct domain *d)
         if ( paging_mode_external(d) )
             printk("external ");
         printk("\n");
+
+        if ( hap_enabled(d) )
+            p2m_coalesce_dump(d);
     }
 }
 
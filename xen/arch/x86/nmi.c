@@ -24,6 +24,7 @@
 #include <xen/smp.h>
 #include <xen/keyhandler.h>
 #include <xen/cpu.h>
+#include <xen/profile.h>
 #include <asm/current.h>
 #include <asm/mc146818rtc.h>
 #include <asm/msr.h>
@@ -32,9 +33,11 @@
 #include <asm/debugger.h>
 #include <asm/div64.h>
 #include <asm/apic.h>
+#include <asm/vpmu.h>
 
 unsigned int nmi_watchdog = NMI_NONE;
 static unsigned int nmi_hz = HZ;
+static unsigned int profile_hz; /* Sampling rate while profiling, or 0 */
 static unsigned int nmi_perfctr_msr;	/* the MSR to reset in NMI handler */
 static unsigned int nmi_p4_cccr_val;
 static DEFINE_PER_CPU(struct timer, nmi_timer);
@@ -205,10 +208,14 @@ static void nmi_timer_fn(void *unused)
     set_timer(&this_cpu(nmi_timer), NOW() + MILLISECS(1000));
 }
 
-void disable_lapic_nmi_watchdog(void)
+/* Rate of counter overflows: the watchdog's, or faster while profiling. */
+static inline unsigned int nmi_rate(void)
+{
+    return profile_hz ?: nmi_hz;
+}
+
+static void clear_watchdog_counter(void *unused)
 {
-    if (nmi_active <= 0)
-        return;
     switch (boot_cpu_data.x86_vendor) {
     case X86_VENDOR_AMD:
         wrmsr(MSR_K7_EVNTSEL0, 0, 0);
@@ -225,6 +232,13 @@ void disable_lapic_nmi_watchdog(void)
         }
         break;
     }
+}
+
+void disable_lapic_nmi_watchdog(void)
+{
+    if (nmi_active <= 0)
+        return;
+    clear_watchdog_counter(NULL);
     nmi_active = -1;
     /* tell do_nmi() and others that we're not active any more */
     nmi_watchdog = NMI_NONE;
@@ -243,6 +257,11 @@ int reserve_lapic_nmi(void)
     unsigned int old_owner;
 
     spin_lock(&lapic_nmi_owner_lock);
+    if (profile_hz) {
+        /* The sampling profiler is using the counter. */
+        spin_unlock(&lapic_nmi_owner_lock);
+        return -EBUSY;
+    }
     old_owner = lapic_nmi_owner;
     lapic_nmi_owner |= LAPIC_NMI_RESERVED;
     spin_unlock(&lapic_nmi_owner_lock);
@@ -282,7 +301,7 @@ static inline void write_watchdog_counter(const char *descr)
 {
     u64 count = (u64)cpu_khz * 1000;
 
-    do_div(count, nmi_hz);
+    do_div(count, nmi_rate());
     if(descr)
         Dprintk("setting %s to -%#"PRIx64"\n", descr, count);
     wrmsrl(nmi_perfctr_msr, 0 - count);
@@ -482,7 +501,7 @@ bool nmi_watchdog_tick(const struct cpu_user_regs *regs)
          * before doing the oops ...
          */
         this_cpu(alert_counter)++;
-        if ( this_cpu(alert_counter) == opt_watchdog_timeout*nmi_hz )
+        if ( this_cpu(alert_counter) >= opt_watchdog_timeout * nmi_rate() )
         {
             console_force_unlock();
             printk("Watchdog timer detects that CPU%d is stuck!\n",
@@ -538,9 +557,105 @@ bool nmi_watchdog_tick(const struct cpu_user_regs *regs)
         write_watchdog_counter(NULL);
     }
 
+    if ( watchdog_tick )
+        profile_sample(regs);
+
     return watchdog_tick;
 }
 
+#ifdef CONFIG_PROFILER
+/*
+ * The sampling profiler is driven by the watchdog's performance counter,
+ * reloaded for the sampling rate: every counter overflow NMI is also a
+ * sample.  If the watchdog isn't running the counter is set up just for
+ * the duration of the profiling.
+ */
+static bool profile_counters;
+static unsigned int profile_saved_owner;
+static int profile_saved_active;
+
+static void reload_watchdog_counter(void *unused)
+{
+    write_watchdog_counter(NULL);
+}
+
+static void start_profile_counter(void *unused)
+{
+    setup_apic_nmi_watchdog();
+}
+
+int arch_profile_start(unsigned int hz)
+{
+    int rc;
+
+    if ( nmi_watchdog == NMI_IO_APIC )
+        return -EBUSY;
+    if ( nmi_watchdog == NMI_LOCAL_APIC && nmi_active <= 0 )
+        return -EOPNOTSUPP;
+    rc = vpmu_profile_claim();
+    if ( rc )
+        return rc;
+
+    /*
+     * Writing the counter MSRs only sets their low 32 bits, which bounds
+     * the period from above; see check_nmi_watchdog().
+     */
+    hz = max_t(unsigned int, hz, max(1ul, cpu_khz >> 20));
+
+    spin_lock(&lapic_nmi_owner_lock);
+    if ( lapic_nmi_owner & LAPIC_NMI_RESERVED )
+    {
+        /* Xenoprof (or another user) owns the counter. */
+        spin_unlock(&lapic_nmi_owner_lock);
+        vpmu_profile_release();
+        return -EBUSY;
+    }
+    profile_hz = hz;
+    spin_unlock(&lapic_nmi_owner_lock);
+
+    if ( nmi_watchdog == NMI_LOCAL_APIC )
+    {
+        on_each_cpu(reload_watchdog_counter, NULL, 1);
+        return 0;
+    }
+
+    profile_saved_owner = lapic_nmi_owner;
+    profile_saved_active = nmi_active;
+    profile_counters = true;
+    nmi_watchdog = NMI_LOCAL_APIC;
+    on_each_cpu(start_profile_counter, NULL, 1);
+
+    if ( nmi_active <= 0 )
+    {
+        /* No counter we know how to drive on this processor. */
+        arch_profile_stop();
+        return -EOPNOTSUPP;
+    }
+
+    return 0;
+}
+
+void arch_profile_stop(void)
+{
+    spin_lock(&lapic_nmi_owner_lock);
+    profile_hz = 0;
+    spin_unlock(&lapic_nmi_owner_lock);
+
+    if ( !profile_counters )
+        on_each_cpu(reload_watchdog_counter, NULL, 1);
+    else
+    {
+        on_each_cpu(clear_watchdog_counter, NULL, 1);
+        nmi_watchdog = NMI_NONE;
+        nmi_active = profile_saved_active;
+        lapic_nmi_owner = profile_saved_owner;
+        profile_counters = false;
+    }
+
+    vpmu_profile_release();
+}
+#endif
+
 /*
  * For some reason the destination shorthand for self is not valid
  * when used with the NMI delivery mode. This is documented in Tables
@@ -212,7 +212,7 @@ void pv_hypercall(struct cpu_user_regs *regs)
     if ( curr->hcall_preempted )
         regs->rip -= 2;
 
-    perfc_incr(hypercalls);
+    perfc_incra(hypercalls, eax);
 }
 
 enum mc_disposition arch_do_multicall_call(struct mc_state *state)
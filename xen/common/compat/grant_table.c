@@ -125,6 +125,8 @@ int compat_grant_table_op(unsigned int cmd,
     if ( (int)count < 0 )
         rc = -EINVAL;
 
+    perfc_incra(grant_ops, cmd_op & GNTTABOP_CMD_MASK);
+
     for ( i = 0; i < count && rc == 0; )
     {
         unsigned int n;
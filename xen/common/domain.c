@@ -14,6 +14,7 @@
 #include <xen/domain.h>
 #include <xen/mm.h>
 #include <xen/event.h>
+#include <xen/exit_latency.h>
 #include <xen/vm_event.h>
 #include <xen/time.h>
 #include <xen/console.h>
@@ -800,6 +801,7 @@ static void complete_domain_destroy(struct rcu_head *head)
         if ( (v = d->vcpu[i]) == NULL )
             continue;
         tasklet_kill(&v->continue_hypercall_tasklet);
+        exit_latency_destroy(v);
         vcpu_destroy(v);
         sched_destroy_vcpu(v);
         destroy_waitqueue_vcpu(v);
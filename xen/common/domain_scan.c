@@ -0,0 +1,94 @@
+/******************************************************************************
+ * domain_scan.c
+ *
+ * Background scanners, such as those coalescing p2m superpages or looking
+ * for identical pages to share, spread over timer driven tasklet runs.
+ */
+
+#include <xen/domain_scan.h>
+#include <xen/lib.h>
+#include <xen/rcupdate.h>
+#include <xen/sched.h>
+
+/* Find the next domain to scan, taking a reference on it. */
+static struct domain *domain_scan_next(struct domain_scan *s)
+{
+    struct domain *d;
+
+    rcu_read_lock(&domlist_read_lock);
+
+    for_each_domain ( d )
+        if ( d->domain_id >= s->next_domain && s->want(d) && get_domain(d) )
+            break;
+
+    rcu_read_unlock(&domlist_read_lock);
+
+    return d;
+}
+
+static void domain_scan_run(unsigned long data)
+{
+    struct domain_scan *s = (struct domain_scan *)data;
+    unsigned long budget = s->budget;
+    struct domain *d;
+
+    if ( s->begin && !s->begin() )
+        return;
+
+    while ( budget )
+    {
+        if ( !s->end_of_pass )
+        {
+            if ( (d = domain_scan_next(s)) != NULL )
+            {
+                if ( s->scan(d, &budget) )
+                    s->next_domain = d->domain_id + 1;
+                put_domain(d);
+                continue;
+            }
+
+            s->end_of_pass = true;
+        }
+
+        if ( s->end_pass && !s->end_pass(&budget) )
+            break;
+
+        /* Start the next pass on the next run. */
+        s->end_of_pass = false;
+        s->next_domain = 0;
+        break;
+    }
+
+    set_timer(&s->timer, NOW() + s->interval);
+}
+
+static void domain_scan_timer(void *data)
+{
+    struct domain_scan *s = data;
+
+    tasklet_schedule(&s->tasklet);
+}
+
+void domain_scan_init(struct domain_scan *s)
+{
+    s->next_domain = 0;
+    s->end_of_pass = false;
+    init_timer(&s->timer, domain_scan_timer, s, 0);
+    tasklet_init(&s->tasklet, domain_scan_run, (unsigned long)s);
+}
+
+/* Have the scanner run soon, e.g. once there is something to scan again. */
+void domain_scan_kick(struct domain_scan *s)
+{
+    set_timer(&s->timer, NOW() + s->interval);
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -14,6 +14,7 @@
 #include <xen/sched-if.h>
 #include <xen/domain.h>
 #include <xen/event.h>
+#include <xen/exit_latency.h>
 #include <xen/domain_page.h>
 #include <xen/trace.h>
 #include <xen/console.h>
@@ -32,7 +33,7 @@
 #include <public/domctl.h>
 #include <xsm/xsm.h>
 
-static DEFINE_SPINLOCK(domctl_lock);
+static DEFINE_SPINLOCK_CLASS(domctl_lock, domctl);
 DEFINE_SPINLOCK(vcpu_alloc_lock);
 
 static int bitmap_to_xenctl_bitmap(struct xenctl_bitmap *xenctl_bitmap,
@@ -242,6 +243,27 @@ void domctl_lock_release(void)
     spin_unlock(&current->domain->hypercall_deadlock_mutex);
 }
 
+/*
+ * Operations which don't need to be serialised against other domctls: they
+ * only inspect state protected by RCU or by locks of its own (the scheduler
+ * ops take care of their locking by themselves, see sched_adjust()).  Keeping
+ * these out of domctl_lock means that monitoring and scheduler tuning aren't
+ * stalled by long running operations (building, saving, destroying) on
+ * unrelated domains.
+ */
+static bool_t domctl_needs_lock(const struct xen_domctl *op)
+{
+    switch ( op->cmd )
+    {
+    case XEN_DOMCTL_getdomaininfo:
+    case XEN_DOMCTL_getvcpuinfo:
+    case XEN_DOMCTL_scheduler_op:
+        return 0;
+    }
+
+    return 1;
+}
+
 static inline
 int vcpuaffinity_params_invalid(const xen_domctl_vcpuaffinity_t *vcpuaff)
 {
@@ -379,7 +401,7 @@ static struct vnuma_info *vnuma_init(const struct xen_domctl_vnuma *uinfo,
 long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
 {
     long ret = 0;
-    bool_t copyback = 0;
+    bool_t copyback = 0, locked;
     struct xen_domctl curop, *op = &curop;
     struct domain *d;
 
@@ -406,7 +428,8 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
     if ( ret )
         goto domctl_out_unlock_domonly;
 
-    if ( !domctl_lock_acquire() )
+    locked = domctl_needs_lock(op);
+    if ( locked && !domctl_lock_acquire() )
     {
         if ( d )
             rcu_unlock_domain(d);
@@ -1145,12 +1168,19 @@ long do_domctl(XEN_GUEST_HANDLE_PARAM(xen_domctl_t) u_domctl)
             copyback = 1;
         break;
 
+    case XEN_DOMCTL_exit_latency:
+        ret = exit_latency_domctl(d, &op->u.exit_latency);
+        if ( !ret )
+            copyback = 1;
+        break;
+
     default:
         ret = arch_do_domctl(op, d, u_domctl);
         break;
     }
 
-    domctl_lock_release();
+    if ( locked )
+        domctl_lock_release();
 
  domctl_out_unlock_domonly:
     if ( d )
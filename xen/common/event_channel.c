@@ -24,6 +24,7 @@
 #include <xen/compat.h>
 #include <xen/guest_access.h>
 #include <xen/keyhandler.h>
+#include <xen/numa.h>
 #include <xen/event_fifo.h>
 #include <asm/current.h>
 
@@ -124,7 +125,8 @@ static struct evtchn *alloc_evtchn_bucket(struct domain *d, unsigned int port)
     struct evtchn *chn;
     unsigned int i;
 
-    chn = xzalloc_array(struct evtchn, EVTCHNS_PER_BUCKET);
+    chn = xzalloc_array_node(struct evtchn, EVTCHNS_PER_BUCKET,
+                             domain_to_node(d));
     if ( !chn )
         return NULL;
 
@@ -673,6 +675,8 @@ int evtchn_send(struct domain *ld, unsigned int lport)
     if ( ret )
         goto out;
 
+    perfc_incr(evtchn_send);
+
     switch ( lchn->state )
     {
     case ECS_INTERDOMAIN:
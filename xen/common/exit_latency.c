@@ -0,0 +1,174 @@
+/******************************************************************************
+ * exit_latency.c
+ *
+ * Histograms of how long guest exits take, by exit reason, from the exit to
+ * the next entry of the vCPU into the guest.  The arch exit paths call
+ * exit_latency_begin() and exit_latency_end(), which do nothing but test a
+ * pointer unless the toolstack has enabled the histograms for the domain.
+ */
+
+#include <xen/errno.h>
+#include <xen/exit_latency.h>
+#include <xen/guest_access.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <xen/time.h>
+#include <xen/xmalloc.h>
+
+void __exit_latency_end(struct exit_latency *el)
+{
+    uint64_t delta = get_cycles() - el->start;
+    struct xen_domctl_exitlat_reason *r;
+    int b = fls64(delta) - 8;
+
+    /* Unexpected reasons are lumped together in the last slot. */
+    r = &el->r[min(el->reason, XEN_EXITLAT_NR_REASONS - 1u)];
+    el->start = 0;
+
+    r->count++;
+    r->cycles += delta;
+    if ( delta > r->max )
+        r->max = delta;
+    r->buckets[b < 0 ? 0 : min(b, XEN_EXITLAT_BUCKETS - 1)]++;
+}
+
+void exit_latency_destroy(struct vcpu *v)
+{
+    xfree(v->exit_latency);
+    v->exit_latency = NULL;
+}
+
+static int exit_latency_enable(struct domain *d)
+{
+    struct vcpu *v;
+
+    if ( is_pv_domain(d) )
+        return -EOPNOTSUPP;
+
+    for_each_vcpu ( d, v )
+    {
+        struct exit_latency *el;
+
+        if ( v->exit_latency )
+            continue;
+
+        el = xzalloc(struct exit_latency);
+        if ( !el )
+            return -ENOMEM;
+
+        /* Publish the histograms to the vCPU only once they are cleared. */
+        smp_wmb();
+        write_atomic(&v->exit_latency, el);
+    }
+
+    return 0;
+}
+
+static int exit_latency_disable(struct domain *d)
+{
+    struct vcpu *v;
+
+    if ( d == current->domain ) /* no domain_pause() */
+        return -EPERM;
+
+    domain_pause(d);
+    for_each_vcpu ( d, v )
+        exit_latency_destroy(v);
+    domain_unpause(d);
+
+    return 0;
+}
+
+/* Exits in progress on the vCPUs may still land in the cleared buckets. */
+static void exit_latency_reset(struct domain *d)
+{
+    struct vcpu *v;
+
+    for_each_vcpu ( d, v )
+        if ( v->exit_latency )
+            memset(v->exit_latency->r, 0, sizeof(v->exit_latency->r));
+}
+
+static int exit_latency_query(struct domain *d,
+                              struct xen_domctl_exit_latency *op)
+{
+    struct xen_domctl_exitlat_reason sum;
+    const struct vcpu *v;
+    unsigned int i, b;
+    bool enabled = false;
+
+    if ( op->vcpu != XEN_EXITLAT_ALL_VCPUS &&
+         (op->vcpu >= d->max_vcpus || !d->vcpu[op->vcpu]) )
+        return -EINVAL;
+
+    for_each_vcpu ( d, v )
+        enabled |= !!v->exit_latency;
+    if ( !enabled )
+        return -ENODATA;
+
+    for ( i = 0; i < min(op->nr_reasons, XEN_EXITLAT_NR_REASONS + 0u); i++ )
+    {
+        memset(&sum, 0, sizeof(sum));
+
+        for_each_vcpu ( d, v )
+        {
+            const struct xen_domctl_exitlat_reason *r;
+
+            if ( !v->exit_latency ||
+                 (op->vcpu != XEN_EXITLAT_ALL_VCPUS &&
+                  op->vcpu != v->vcpu_id) )
+                continue;
+
+            r = &v->exit_latency->r[i];
+            sum.count += r->count;
+            sum.cycles += r->cycles;
+            sum.max = max(sum.max, r->max);
+            for ( b = 0; b < XEN_EXITLAT_BUCKETS; b++ )
+                sum.buckets[b] += r->buckets[b];
+        }
+
+        if ( copy_to_guest_offset(op->reasons, i, &sum, 1) )
+            return -EFAULT;
+    }
+
+    op->nr_reasons = XEN_EXITLAT_NR_REASONS;
+#ifdef CONFIG_X86
+    op->type = cpu_has_vmx ? XEN_EXITLAT_TYPE_vmx : XEN_EXITLAT_TYPE_svm;
+#else
+    op->type = XEN_EXITLAT_TYPE_arm;
+#endif
+    op->cycles_per_sec = cpu_khz * 1000ULL;
+
+    return 0;
+}
+
+int exit_latency_domctl(struct domain *d, struct xen_domctl_exit_latency *op)
+{
+    switch ( op->cmd )
+    {
+    case XEN_DOMCTL_EXITLAT_enable:
+        return exit_latency_enable(d);
+
+    case XEN_DOMCTL_EXITLAT_disable:
+        return exit_latency_disable(d);
+
+    case XEN_DOMCTL_EXITLAT_reset:
+        exit_latency_reset(d);
+        return 0;
+
+    case XEN_DOMCTL_EXITLAT_query:
+        return exit_latency_query(d, op);
+    }
+
+    return -EOPNOTSUPP;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -98,6 +98,7 @@ struct gnttab_unmap_common {
     /* Shared state beteen *_unmap and *_unmap_complete */
     u16 done;
     unsigned long frame;
+    unsigned long gfn;
     struct domain *rd;
     grant_ref_t ref;
 };
@@ -1212,6 +1213,7 @@ __gnttab_unmap_common(
     }
 
     op->frame = act->frame;
+    op->gfn = act->gfn;
 
     if ( op->dev_bus_addr &&
          unlikely(op->dev_bus_addr != pfn_to_paddr(act->frame)) )
@@ -1271,7 +1273,7 @@ __gnttab_unmap_common(
 
     /* If just unmapped a writable mapping, mark as dirtied */
     if ( rc == GNTST_okay && !(flags & GNTMAP_readonly) )
-         gnttab_mark_dirty(rd, op->frame);
+         gnttab_mark_dirty(rd, op->frame, op->gfn);
 
     op->status = rc;
     rcu_unlock_domain(rd);
@@ -2067,7 +2069,7 @@ __release_grant_for_copy(
     }
     else
     {
-        gnttab_mark_dirty(rd, r_frame);
+        gnttab_mark_dirty(rd, r_frame, act->gfn);
 
         act->pin -= GNTPIN_hstw_inc;
         if ( !(act->pin & (GNTPIN_devw_mask|GNTPIN_hstw_mask)) )
@@ -2529,7 +2531,9 @@ static int gnttab_copy_buf(const struct gnttab_copy *op,
 
     memcpy(dest->virt + op->dest.offset, src->virt + op->source.offset,
            op->len);
-    gnttab_mark_dirty(dest->domain, dest->frame);
+    /* With a grant, release_grant_for_copy() will mark the gfn dirty. */
+    gnttab_mark_dirty(dest->domain, dest->frame,
+                      dest->have_grant ? gfn_x(INVALID_GFN) : dest->ptr.u.gmfn);
     rc = GNTST_okay;
  out:
     return rc;
@@ -3066,7 +3070,9 @@ do_grant_table_op(
 
     if ( (cmd &= GNTTABOP_CMD_MASK) != GNTTABOP_cache_flush && opaque_in )
         return -EINVAL;
-    
+
+    perfc_incra(grant_ops, cmd);
+
     rc = -EFAULT;
     switch ( cmd )
     {
@@ -3236,6 +3242,7 @@ grant_table_create(
 
     /* Simple stuff. */
     percpu_rwlock_resource_init(&t->lock, grant_rwlock);
+    rwlock_set_class(&t->lock.rwlock, grant);
     spin_lock_init(&t->maptrack_lock);
     t->nr_grant_frames = INITIAL_NR_GRANT_FRAMES;
 
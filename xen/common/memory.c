@@ -413,7 +413,7 @@ static void decrease_reservation(struct memop_args *a)
         }
 
         /* See if populate-on-demand wants to handle this */
-        if ( is_hvm_domain(a->domain)
+        if ( paging_mode_translate(a->domain)
              && p2m_pod_decrease_reservation(a->domain, gmfn, a->extent_order) )
             continue;
 
@@ -0,0 +1,99 @@
+/******************************************************************************
+ * common/p2m-coalesce.c
+ *
+ * Background reassembly of superpage p2m entries.
+ *
+ * Superpage entries get split by ballooning, grant mappings, mem_access,
+ * log-dirty and the like, and nothing ever merges them back, so the p2m of
+ * a long running guest slowly degrades to 4k entries.  A scanner walks the
+ * p2ms, 2M range at a time, and has the architecture map each range with a
+ * larger entry where it can (see arch_p2m_coalesce_range()).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <xen/domain_scan.h>
+#include <xen/init.h>
+#include <xen/lib.h>
+#include <xen/sched.h>
+#include <asm/p2m.h>
+
+/* Number of 2M ranges looked at per run of the scanner; 0 disables it. */
+static unsigned int __read_mostly opt_p2m_coalesce = 64;
+integer_param("p2m-coalesce", opt_p2m_coalesce);
+
+#define COALESCE_INTERVAL     MILLISECS(100)
+/* Ranges copied per run: each one is 2M of memcpy under the p2m lock. */
+#define COALESCE_MIGRATE_MAX  1
+
+static struct domain_scan coalesce_scan;
+static unsigned int coalesce_migrations;
+
+static bool coalesce_begin(void)
+{
+    coalesce_migrations = COALESCE_MIGRATE_MAX;
+
+    return true;
+}
+
+static bool coalesce_domain(struct domain *d, unsigned long *budget)
+{
+    gfn_t gfn, start, end;
+
+    arch_p2m_coalesce_bounds(d, &start, &end);
+    gfn = gfn_max(d->p2m_coalesce_gfn, start);
+
+    for ( ; *budget && gfn_x(gfn) < gfn_x(end) &&
+            arch_p2m_coalesce_domain(d);
+          --*budget )
+        gfn = gfn_add(gfn, arch_p2m_coalesce_range(d, gfn,
+                                                   &coalesce_migrations));
+
+    if ( gfn_x(gfn) < gfn_x(end) )
+    {
+        d->p2m_coalesce_gfn = gfn;
+        return false;
+    }
+
+    d->p2m_coalesce_gfn = _gfn(0);
+    arch_p2m_coalesce_pass_done(d);
+
+    return true;
+}
+
+static int __init p2m_coalesce_init(void)
+{
+    if ( !opt_p2m_coalesce || !arch_p2m_coalesce_supported() )
+        return 0;
+
+    coalesce_scan.budget = opt_p2m_coalesce;
+    coalesce_scan.interval = COALESCE_INTERVAL;
+    coalesce_scan.want = arch_p2m_coalesce_domain;
+    coalesce_scan.scan = coalesce_domain;
+    coalesce_scan.begin = coalesce_begin;
+    domain_scan_init(&coalesce_scan);
+    domain_scan_kick(&coalesce_scan);
+
+    return 0;
+}
+__initcall(p2m_coalesce_init);
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
@@ -390,7 +390,7 @@ static long total_avail_pages;
 static long midsize_alloc_zone_pages;
 #define MIDSIZE_ALLOC_FRAC 128
 
-static DEFINE_SPINLOCK(heap_lock);
+static DEFINE_SPINLOCK_CLASS(heap_lock, heap);
 static long outstanding_claims; /* total outstanding claims by all domains */
 
 unsigned long domain_adjust_tot_pages(struct domain *d, long pages)
@@ -816,6 +816,9 @@ static struct page_info *alloc_heap_pages(
     if ( d != NULL )
         d->last_alloc_node = node;
 
+    perfc_incra(page_alloc, order);
+    perfc_incra(page_alloc_node, node);
+
     for ( i = 0; i < (1 << order); i++ )
     {
         /* Reference count must continuously be zero for free pages. */
@@ -829,14 +832,27 @@ static struct page_info *alloc_heap_pages(
         /* Initialise fields which have other uses for free pages. */
         pg[i].u.inuse.type_info = 0;
         page_set_owner(&pg[i], NULL);
+    }
 
+    spin_unlock(&heap_lock);
+
+    /*
+     * The chunk is off the free lists and in use, so nobody else can get at
+     * it anymore.  Do the cache maintenance without holding the heap lock:
+     * for a superpage-sized request this is 512 or 262144 pages worth of
+     * work on platforms where flush_page_to_ram() isn't a no-op.
+     */
+    for ( i = 0; i < (1 << order); i++ )
+    {
         /* Ensure cache and RAM are consistent for platforms where the
          * guest can control its own visibility of/through the cache.
          */
-        flush_page_to_ram(page_to_mfn(&pg[i]), !(memflags & MEMF_no_icache_flush));
+        flush_page_to_ram(page_to_mfn(&pg[i]), false);
     }
 
-    spin_unlock(&heap_lock);
+    /* A single I-Cache invalidation covers the whole chunk. */
+    if ( !(memflags & MEMF_no_icache_flush) )
+        invalidate_icache();
 
     if ( need_tlbflush )
         filtered_flush_tlb_mask(tlbflush_timestamp);
@@ -930,6 +946,9 @@ static void free_heap_pages(
     ASSERT(order <= MAX_ORDER);
     ASSERT(node >= 0);
 
+    perfc_incra(page_free, order);
+    perfc_incra(page_free_node, node);
+
     spin_lock(&heap_lock);
 
     for ( i = 0; i < (1 << order); i++ )
@@ -1,4 +1,5 @@
 
+#include <xen/cache.h>
 #include <xen/lib.h>
 #include <xen/smp.h>
 #include <xen/time.h>
@@ -10,10 +11,12 @@
 #include <public/sysctl.h>
 #include <asm/perfc.h>
 
-#define PERFCOUNTER( var, name )              { name, TYPE_SINGLE, 0 },
-#define PERFCOUNTER_ARRAY( var, name, size )  { name, TYPE_ARRAY,  size },
-#define PERFSTATUS( var, name )               { name, TYPE_S_SINGLE, 0 },
-#define PERFSTATUS_ARRAY( var, name, size )   { name, TYPE_S_ARRAY,  size },
+#define PERFCOUNTER_CORE( var, name )         { name, TYPE_SINGLE, 0 },
+#define PERFCOUNTER_CORE_ARRAY( var, name, size ) { name, TYPE_ARRAY, size },
+#define PERFCOUNTER( var, name )
+#define PERFCOUNTER_ARRAY( var, name, size )
+#define PERFSTATUS( var, name )
+#define PERFSTATUS_ARRAY( var, name, size )
 static const struct {
     const char *name;
     enum { TYPE_SINGLE, TYPE_ARRAY,
@@ -21,12 +24,33 @@ static const struct {
     } type;
     unsigned int nr_elements;
 } perfc_info[] = {
+/* In the order of enum perfcounter: core counters first. */
+#include <xen/perfc_defn.h>
+#ifdef CONFIG_PERF_COUNTERS
+#undef PERFCOUNTER_CORE
+#undef PERFCOUNTER_CORE_ARRAY
+#undef PERFCOUNTER
+#undef PERFCOUNTER_ARRAY
+#undef PERFSTATUS
+#undef PERFSTATUS_ARRAY
+#define PERFCOUNTER_CORE( var, name )
+#define PERFCOUNTER_CORE_ARRAY( var, name, size )
+#define PERFCOUNTER( var, name )              { name, TYPE_SINGLE, 0 },
+#define PERFCOUNTER_ARRAY( var, name, size )  { name, TYPE_ARRAY,  size },
+#define PERFSTATUS( var, name )               { name, TYPE_S_SINGLE, 0 },
+#define PERFSTATUS_ARRAY( var, name, size )   { name, TYPE_S_ARRAY,  size },
 #include <xen/perfc_defn.h>
+#endif
 };
 
 #define NR_PERFCTRS (sizeof(perfc_info) / sizeof(perfc_info[0]))
 
-DEFINE_PER_CPU(perfc_t[NUM_PERFCOUNTERS], perfcounters);
+/*
+ * Only ever written by the CPU owning them, without atomic operations, and
+ * summed up across CPUs only when read.
+ */
+DEFINE_PER_CPU(perfc_t[NUM_ACTIVE_PERFCOUNTERS], perfcounters)
+    __cacheline_aligned;
 
 void perfc_printall(unsigned char key)
 {
@@ -0,0 +1,266 @@
+/******************************************************************************
+ * profile.c
+ *
+ * Sampling profiler for the hypervisor itself.
+ *
+ * Each performance counter overflow records the interrupted program counter
+ * and, with frame pointers, the call stack into a ring of the CPU it
+ * happened on.  The interrupt (an NMI on x86) is the only producer and the
+ * sysctl draining the ring the only consumer, so no lock is needed between
+ * them.
+ */
+
+#include <xen/errno.h>
+#include <xen/guest_access.h>
+#include <xen/kernel.h>
+#include <xen/lib.h>
+#include <xen/mm.h>
+#include <xen/percpu.h>
+#include <xen/profile.h>
+#include <xen/sched.h>
+#include <xen/spinlock.h>
+#include <xen/symbols.h>
+#include <asm/profile.h>
+
+/* Per-CPU ring of 2^16 words: several seconds of deep stacks at 1kHz. */
+#define PROFILE_BUF_SHIFT   16
+#define PROFILE_BUF_WORDS   (1u << PROFILE_BUF_SHIFT)
+#define PROFILE_BUF_ORDER   (PROFILE_BUF_SHIFT + 3 - PAGE_SHIFT)
+#define PROFILE_MAX_HZ      10000
+
+struct profile_buf {
+    uint64_t *data;
+    unsigned int prod, cons;
+    uint64_t lost;
+};
+
+static DEFINE_PER_CPU(struct profile_buf, profile_buf);
+static DEFINE_SPINLOCK(profile_lock);
+
+bool __read_mostly profile_active;
+
+/*
+ * Walk the frame pointer chain, which on x86-64 and AArch64 alike is a
+ * pair of the caller's frame pointer and the return address.  Only frames
+ * on the interrupted stack, above its stack pointer, are followed.
+ */
+static unsigned int profile_backtrace(const struct cpu_user_regs *regs,
+                                      uint64_t *pcs, unsigned int max)
+{
+    unsigned int n = 0;
+#ifdef CONFIG_FRAME_POINTER
+    unsigned long fp = profile_fp(regs);
+    unsigned long low = profile_sp(regs);
+    unsigned long high = (low | (STACK_SIZE - 1)) + 1;
+
+    while ( n < max && fp >= low && fp <= high - 2 * sizeof(long) &&
+            !(fp & (sizeof(long) - 1)) )
+    {
+        const unsigned long *frame = (const unsigned long *)fp;
+
+        if ( !is_active_kernel_text(frame[1]) )
+            break;
+        pcs[n++] = frame[1];
+        if ( frame[0] <= fp )
+            break;
+        fp = frame[0];
+    }
+#endif
+
+    return n;
+}
+
+void __profile_sample(const struct cpu_user_regs *regs)
+{
+    struct profile_buf *buf = &this_cpu(profile_buf);
+    uint64_t words[XEN_PROFILE_MAX_DEPTH + 1];
+    unsigned int i, n = 1, prod;
+
+    if ( !buf->data )
+        return;
+
+    words[0] = (uint64_t)current->domain->domain_id << 16;
+    if ( guest_mode(regs) )
+        words[0] |= XEN_PROFILE_GUEST;
+    else
+    {
+        words[n++] = profile_pc(regs);
+        n += profile_backtrace(regs, words + n, XEN_PROFILE_MAX_DEPTH - 1);
+        words[0] |= n - 1;
+    }
+
+    prod = buf->prod;
+    if ( PROFILE_BUF_WORDS - (prod - read_atomic(&buf->cons)) < n )
+    {
+        buf->lost++;
+        return;
+    }
+
+    for ( i = 0; i < n; i++ )
+        buf->data[(prod + i) & (PROFILE_BUF_WORDS - 1)] = words[i];
+
+    smp_wmb();
+    write_atomic(&buf->prod, prod + n);
+}
+
+static int profile_enable(unsigned int hz)
+{
+    unsigned int cpu;
+    int rc;
+
+    if ( !hz || hz > PROFILE_MAX_HZ )
+        return -EINVAL;
+    if ( profile_active )
+        return -EBUSY;
+
+    for_each_online_cpu ( cpu )
+    {
+        struct profile_buf *buf = &per_cpu(profile_buf, cpu);
+
+        if ( !buf->data )
+            buf->data = alloc_xenheap_pages(PROFILE_BUF_ORDER,
+                                            MEMF_node(cpu_to_node(cpu)));
+        if ( !buf->data )
+            return -ENOMEM;
+        buf->prod = buf->cons = 0;
+        buf->lost = 0;
+    }
+
+    profile_active = true;
+    smp_wmb();
+
+    rc = arch_profile_start(hz);
+    if ( rc )
+        profile_active = false;
+
+    return rc;
+}
+
+static void profile_disable(void)
+{
+    if ( !profile_active )
+        return;
+
+    arch_profile_stop();
+    profile_active = false;
+}
+
+/* Copy out as many whole samples as fit into the caller's buffer. */
+static int profile_read(struct xen_sysctl_profile_op *op)
+{
+    struct profile_buf *buf;
+    unsigned int prod, cons, end, len;
+    int rc = 0;
+
+    if ( op->u.read.cpu >= nr_cpu_ids || !cpu_online(op->u.read.cpu) )
+        return -EINVAL;
+
+    buf = &per_cpu(profile_buf, op->u.read.cpu);
+    op->u.read.lost = buf->lost;
+    if ( !buf->data )
+    {
+        op->u.read.nr_words = 0;
+        return 0;
+    }
+
+    prod = read_atomic(&buf->prod);
+    smp_rmb();
+    cons = buf->cons;
+
+    for ( end = cons; end != prod; end += len )
+    {
+        len = 1 + XEN_PROFILE_DEPTH(buf->data[end & (PROFILE_BUF_WORDS - 1)]);
+        if ( end + len - cons > op->u.read.nr_words )
+            break;
+    }
+
+    len = 0;
+    while ( cons != end )
+    {
+        unsigned int idx = cons & (PROFILE_BUF_WORDS - 1);
+        unsigned int chunk = min(end - cons, PROFILE_BUF_WORDS - idx);
+
+        if ( copy_to_guest_offset(op->u.read.buffer, len,
+                                  buf->data + idx, chunk) )
+        {
+            rc = -EFAULT;
+            break;
+        }
+        len += chunk;
+        cons += chunk;
+    }
+
+    smp_mb();
+    write_atomic(&buf->cons, cons);
+    op->u.read.nr_words = len;
+
+    return rc;
+}
+
+static int profile_symbol(struct xen_sysctl_profile_op *op)
+{
+    char namebuf[KSYM_NAME_LEN + 1];
+    unsigned long size, offset;
+    const char *name;
+    unsigned int len;
+
+    name = symbols_lookup(op->u.symbol.addr, &size, &offset, namebuf);
+    if ( !name )
+        return -ENOENT;
+
+    len = strlen(name) + 1;
+    if ( len > op->u.symbol.name_size )
+        return -ENOBUFS;
+    if ( copy_to_guest(op->u.symbol.name, name, len) )
+        return -EFAULT;
+
+    op->u.symbol.offset = offset;
+    op->u.symbol.size = size;
+
+    return 0;
+}
+
+int profile_op(struct xen_sysctl_profile_op *op)
+{
+    int rc;
+
+    spin_lock(&profile_lock);
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_PROFILE_enable:
+        rc = profile_enable(op->u.enable.hz);
+        break;
+
+    case XEN_SYSCTL_PROFILE_disable:
+        profile_disable();
+        rc = 0;
+        break;
+
+    case XEN_SYSCTL_PROFILE_read:
+        rc = profile_read(op);
+        break;
+
+    case XEN_SYSCTL_PROFILE_symbol:
+        rc = profile_symbol(op);
+        break;
+
+    default:
+        rc = -EOPNOTSUPP;
+        break;
+    }
+
+    spin_unlock(&profile_lock);
+
+    return rc;
+}
+
+/*
+ * Local variables:
+ * mode: C
+ * c-file-style: "BSD"
+ * c-basic-offset: 4
+ * tab-width: 4
+ * indent-tabs-mode: nil
+ * End:
+ */
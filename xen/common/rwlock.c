@@ -102,6 +102,35 @@ void queue_write_lock_slowpath(rwlock_t *lock)
     spin_unlock(&lock->lock);
 }
 
+void _read_lock_class(rwlock_t *lock)
+{
+    s64 stat = lock_stat_begin(lock, lock->cls);
+    bool contended = atomic_add_return(_QR_BIAS, &lock->cnts) & _QW_WMASK;
+
+    if ( contended )
+        queue_read_lock_slowpath(lock);
+    if ( unlikely(stat) )
+        lock_stat_acquired(stat, contended, __builtin_return_address(0));
+}
+
+/* _write_lock() without statistics, returning whether it had to wait. */
+static bool write_lock_nostat(rwlock_t *lock)
+{
+    if ( atomic_cmpxchg(&lock->cnts, 0, _QW_LOCKED) == 0 )
+        return false;
+
+    queue_write_lock_slowpath(lock);
+    return true;
+}
+
+void _write_lock_class(rwlock_t *lock)
+{
+    s64 stat = lock_stat_begin(lock, lock->cls);
+    bool contended = write_lock_nostat(lock);
+
+    if ( unlikely(stat) )
+        lock_stat_acquired(stat, contended, __builtin_return_address(0));
+}
 
 static DEFINE_PER_CPU(cpumask_t, percpu_rwlock_readers);
 
@@ -110,15 +139,22 @@ void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
 {
     unsigned int cpu;
     cpumask_t *rwlock_readers = &this_cpu(percpu_rwlock_readers);
+    rwlock_t *rwlock = &percpu_rwlock->rwlock;
+    bool contended;
+    s64 stat = 0;
 
     /* Validate the correct per_cpudata variable has been provided. */
     _percpu_rwlock_owner_check(per_cpudata, percpu_rwlock);
 
+    /* Statistics include waiting for the percpu readers to go away. */
+    if ( unlikely(rwlock->cls) )
+        stat = lock_stat_begin(rwlock, rwlock->cls);
+
     /*
      * First take the write lock to protect against other writers or slow
      * path readers.
      */
-    write_lock(&percpu_rwlock->rwlock);
+    contended = write_lock_nostat(rwlock);
 
     /* Now set the global variable so that readers start using read_lock. */
     percpu_rwlock->writer_activating = 1;
@@ -143,7 +179,11 @@ void _percpu_write_lock(percpu_rwlock_t **per_cpudata,
         /* Check if we've cleared all percpu readers from check mask. */
         if ( cpumask_empty(rwlock_readers) )
             break;
+        contended = true;
         /* Give the coherency fabric a break. */
         cpu_relax();
     };
+
+    if ( unlikely(stat) )
+        lock_stat_acquired(stat, contended, __builtin_return_address(0));
 }
@@ -618,6 +618,7 @@ static void activate_runqueue(struct csched2_private *prv, int rqi)
     INIT_LIST_HEAD(&rqd->svc);
     INIT_LIST_HEAD(&rqd->runq);
     spin_lock_init(&rqd->lock);
+    spin_lock_set_class(&rqd->lock, sched);
 
     __cpumask_set_cpu(rqi, &prv->active_queues);
 }
@@ -1543,6 +1543,7 @@ static int cpu_schedule_up(unsigned int cpu)
 
     per_cpu(scheduler, cpu) = &ops;
     spin_lock_init(&sd->_lock);
+    spin_lock_set_class(&sd->_lock, sched);
     sd->schedule_lock = &sd->_lock;
     sd->curr = idle_vcpu[cpu];
     init_timer(&sd->s_timer, s_timer_fn, NULL, cpu);
@@ -1,10 +1,14 @@
 #include <xen/lib.h>
+#include <xen/init.h>
 #include <xen/irq.h>
 #include <xen/smp.h>
 #include <xen/time.h>
 #include <xen/spinlock.h>
 #include <xen/guest_access.h>
 #include <xen/preempt.h>
+#include <xen/sort.h>
+#include <xen/symbols.h>
+#include <xen/xmalloc.h>
 #include <public/sysctl.h>
 #include <asm/processor.h>
 #include <asm/atomic.h>
@@ -129,12 +133,16 @@ static always_inline u16 observe_head(spinlock_tickets_t *t)
     return read_atomic(&t->head);
 }
 
-void _spin_lock(spinlock_t *lock)
+static always_inline void spin_lock_common(spinlock_t *lock,
+                                           const void *caller)
 {
     spinlock_tickets_t tickets = SPINLOCK_TICKET_INC;
+    s64 stat = 0;
     LOCK_PROFILE_VAR;
 
     check_lock(&lock->debug);
+    if ( unlikely(lock->cls) )
+        stat = lock_stat_begin(lock, lock->cls);
     tickets.head_tail = arch_fetch_and_add(&lock->tickets.head_tail,
                                            tickets.head_tail);
     while ( tickets.tail != observe_head(&lock->tickets) )
@@ -143,15 +151,22 @@ void _spin_lock(spinlock_t *lock)
         arch_lock_relax();
     }
     LOCK_PROFILE_GOT;
+    if ( unlikely(stat) )
+        lock_stat_acquired(stat, tickets.head != tickets.tail, caller);
     preempt_disable();
     arch_lock_acquire_barrier();
 }
 
+void _spin_lock(spinlock_t *lock)
+{
+    spin_lock_common(lock, __builtin_return_address(0));
+}
+
 void _spin_lock_irq(spinlock_t *lock)
 {
     ASSERT(local_irq_is_enabled());
     local_irq_disable();
-    _spin_lock(lock);
+    spin_lock_common(lock, __builtin_return_address(0));
 }
 
 unsigned long _spin_lock_irqsave(spinlock_t *lock)
@@ -159,7 +174,7 @@ unsigned long _spin_lock_irqsave(spinlock_t *lock)
     unsigned long flags;
 
     local_irq_save(flags);
-    _spin_lock(lock);
+    spin_lock_common(lock, __builtin_return_address(0));
     return flags;
 }
 
@@ -168,6 +183,8 @@ void _spin_unlock(spinlock_t *lock)
     arch_lock_release_barrier();
     preempt_enable();
     LOCK_PROFILE_REL;
+    if ( unlikely(lock->cls) )
+        lock_stat_release(lock);
     add_sized(&lock->tickets.head, 1);
     arch_lock_signal();
 }
@@ -198,29 +215,45 @@ int _spin_is_locked(spinlock_t *lock)
            : lock->recurse_cpu == smp_processor_id();
 }
 
-int _spin_trylock(spinlock_t *lock)
+static always_inline int spin_trylock_common(spinlock_t *lock,
+                                             const void *caller)
 {
     spinlock_tickets_t old, new;
+    s64 stat = 0;
 
     check_lock(&lock->debug);
+    if ( unlikely(lock->cls) )
+        stat = lock_stat_begin(lock, lock->cls);
     old = observe_lock(&lock->tickets);
     if ( old.head != old.tail )
-        return 0;
+        goto fail;
     new = old;
     new.tail++;
     if ( cmpxchg(&lock->tickets.head_tail,
                  old.head_tail, new.head_tail) != old.head_tail )
-        return 0;
+        goto fail;
 #ifdef CONFIG_LOCK_PROFILE
     if (lock->profile)
         lock->profile->time_locked = NOW();
 #endif
+    if ( unlikely(stat) )
+        lock_stat_acquired(stat, false, caller);
     preempt_disable();
     /*
      * cmpxchg() is a full barrier so no need for an
      * arch_lock_acquire_barrier().
      */
     return 1;
+
+ fail:
+    if ( unlikely(stat) )
+        lock_stat_failed(caller);
+    return 0;
+}
+
+int _spin_trylock(spinlock_t *lock)
+{
+    return spin_trylock_common(lock, __builtin_return_address(0));
 }
 
 void _spin_barrier(spinlock_t *lock)
@@ -259,7 +292,7 @@ int _spin_trylock_recursive(spinlock_t *lock)
 
     if ( likely(lock->recurse_cpu != cpu) )
     {
-        if ( !spin_trylock(lock) )
+        if ( !spin_trylock_common(lock, __builtin_return_address(0)) )
             return 0;
         lock->recurse_cpu = cpu;
     }
@@ -277,7 +310,7 @@ void _spin_lock_recursive(spinlock_t *lock)
 
     if ( likely(lock->recurse_cpu != cpu) )
     {
-        _spin_lock(lock);
+        spin_lock_common(lock, __builtin_return_address(0));
         lock->recurse_cpu = cpu;
     }
 
@@ -295,6 +328,338 @@ void _spin_unlock_recursive(spinlock_t *lock)
     }
 }
 
+/*
+ * Contention statistics by lock class.
+ *
+ * One in every lock_stat_rate acquisitions of locks with a class, counted
+ * per CPU, is timed.  A CPU times one lock at a time, so that interrupt
+ * handlers taking locks find the slot busy and leave the statistics alone:
+ * they are only ever updated by their CPU, without atomic operations, and
+ * summed up when read.
+ */
+static unsigned int __initdata opt_lock_stat_rate = 64;
+integer_param("lock-stat-rate", opt_lock_stat_rate);
+static unsigned int __read_mostly lock_stat_rate;
+
+struct lock_stat_caller {
+    const void *addr;
+    uint64_t count, wait;
+};
+
+struct lock_stat {
+    uint64_t count, contended;
+    uint64_t wait, wait_max;
+    uint64_t hold, hold_max;
+    struct lock_stat_caller callers[XEN_LOCKSTAT_CALLERS];
+};
+
+struct lock_stat_cpu {
+    unsigned int countdown;
+    unsigned int cls;
+    const void *lock;                /* being timed, NULL if none */
+    s_time_t acquired;
+    struct lock_stat stat[LOCK_CLASS_NR];
+};
+
+static DEFINE_PER_CPU(struct lock_stat_cpu, lock_stat);
+static DEFINE_SPINLOCK(lock_stat_lock);
+static s_time_t lock_stat_start;
+
+static const char *const lock_class_names[LOCK_CLASS_NR] = {
+    [LOCK_CLASS_heap]   = "heap",
+    [LOCK_CLASS_domctl] = "domctl",
+    [LOCK_CLASS_grant]  = "grant",
+    [LOCK_CLASS_sched]  = "sched",
+    [LOCK_CLASS_p2m]    = "p2m",
+};
+
+s64 lock_stat_begin(const void *lock, unsigned int cls)
+{
+    struct lock_stat_cpu *ls = &this_cpu(lock_stat);
+    s_time_t now;
+
+    if ( !lock_stat_rate )
+        return 0;
+    if ( ls->countdown )
+    {
+        ls->countdown--;
+        return 0;
+    }
+    if ( ls->lock )
+        return 0;
+
+    ls->countdown = lock_stat_rate - 1;
+    ls->lock = lock;
+    ls->cls = cls;
+    barrier();
+
+    now = NOW();
+    if ( !now )
+        ls->lock = NULL;
+
+    return now;
+}
+
+/* Account to the caller, replacing the least frequent one if not listed. */
+static void lock_stat_caller(struct lock_stat *st, const void *addr,
+                             s_time_t wait)
+{
+    struct lock_stat_caller *c, *min = &st->callers[0];
+
+    for ( c = st->callers; c < st->callers + XEN_LOCKSTAT_CALLERS; c++ )
+    {
+        if ( c->addr == addr )
+            break;
+        if ( c->count < min->count )
+            min = c;
+    }
+
+    if ( c == st->callers + XEN_LOCKSTAT_CALLERS )
+    {
+        c = min;
+        c->addr = addr;
+        c->count = 0;
+        c->wait = 0;
+    }
+
+    c->count++;
+    c->wait += wait;
+}
+
+void lock_stat_acquired(s64 start, bool contended, const void *caller)
+{
+    struct lock_stat_cpu *ls = &this_cpu(lock_stat);
+    struct lock_stat *st = &ls->stat[ls->cls];
+    s_time_t wait;
+
+    ls->acquired = NOW();
+    wait = ls->acquired - start;
+
+    st->count++;
+    if ( contended )
+        st->contended++;
+    st->wait += wait;
+    if ( wait > st->wait_max )
+        st->wait_max = wait;
+    lock_stat_caller(st, caller, wait);
+}
+
+/*
+ * A sampled trylock failed: count it as a contended acquisition which
+ * waited for nothing, and give the slot up as the lock is not held.
+ */
+void lock_stat_failed(const void *caller)
+{
+    struct lock_stat_cpu *ls = &this_cpu(lock_stat);
+    struct lock_stat *st = &ls->stat[ls->cls];
+
+    st->count++;
+    st->contended++;
+    lock_stat_caller(st, caller, 0);
+
+    barrier();
+    ls->lock = NULL;
+}
+
+void lock_stat_release(const void *lock)
+{
+    struct lock_stat_cpu *ls = &this_cpu(lock_stat);
+    struct lock_stat *st;
+    s_time_t hold;
+
+    if ( likely(ls->lock != lock) )
+        return;
+
+    st = &ls->stat[ls->cls];
+    hold = NOW() - ls->acquired;
+    st->hold += hold;
+    if ( hold > st->hold_max )
+        st->hold_max = hold;
+
+    barrier();
+    ls->lock = NULL;
+}
+
+static void lock_stat_merge_caller(struct xen_sysctl_lockstat_caller *out,
+                                   unsigned int *nr,
+                                   const struct lock_stat_caller *c)
+{
+    unsigned int i;
+
+    for ( i = 0; i < *nr; i++ )
+        if ( out[i].addr == (unsigned long)c->addr )
+            break;
+
+    if ( i == *nr )
+    {
+        out[i].addr = (unsigned long)c->addr;
+        out[i].count = 0;
+        out[i].wait = 0;
+        ++*nr;
+    }
+
+    out[i].count += c->count;
+    out[i].wait += c->wait;
+}
+
+static int cmp_caller(const void *a, const void *b)
+{
+    const struct xen_sysctl_lockstat_caller *l = a, *r = b;
+
+    return l->count < r->count ? 1 : l->count > r->count ? -1 : 0;
+}
+
+/* Sum up the CPUs' statistics of a class, keeping the busiest callers. */
+static void lock_stat_gather(unsigned int cls,
+                             struct xen_sysctl_lockstat_class *out,
+                             struct xen_sysctl_lockstat_caller *callers)
+{
+    unsigned int cpu, i, nr = 0;
+
+    memset(out, 0, sizeof(*out));
+    safe_strcpy(out->name, lock_class_names[cls]);
+
+    for_each_online_cpu ( cpu )
+    {
+        const struct lock_stat *st = &per_cpu(lock_stat, cpu).stat[cls];
+
+        out->count += st->count;
+        out->contended += st->contended;
+        out->wait += st->wait;
+        out->wait_max = max(out->wait_max, st->wait_max);
+        out->hold += st->hold;
+        out->hold_max = max(out->hold_max, st->hold_max);
+
+        for ( i = 0; i < XEN_LOCKSTAT_CALLERS; i++ )
+            if ( st->callers[i].count )
+                lock_stat_merge_caller(callers, &nr, &st->callers[i]);
+    }
+
+    sort(callers, nr, sizeof(*callers), cmp_caller, NULL);
+    memcpy(out->callers, callers,
+           min_t(unsigned int, nr, XEN_LOCKSTAT_CALLERS) * sizeof(*callers));
+}
+
+static int lock_stat_query(struct xen_sysctl_lockstat_op *op)
+{
+    struct xen_sysctl_lockstat_class *out;
+    struct xen_sysctl_lockstat_caller *callers;
+    unsigned int cls;
+    int rc = 0;
+
+    out = xmalloc(struct xen_sysctl_lockstat_class);
+    callers = xmalloc_array(struct xen_sysctl_lockstat_caller,
+                            nr_cpu_ids * XEN_LOCKSTAT_CALLERS);
+    if ( !out || !callers )
+        rc = -ENOMEM;
+
+    for ( cls = 1; !rc && cls < LOCK_CLASS_NR && cls <= op->nr_classes;
+          cls++ )
+    {
+        lock_stat_gather(cls, out, callers);
+        if ( copy_to_guest_offset(op->classes, cls - 1, out, 1) )
+            rc = -EFAULT;
+    }
+
+    xfree(callers);
+    xfree(out);
+
+    op->nr_classes = LOCK_CLASS_NR - 1;
+    op->time = NOW() - lock_stat_start;
+
+    return rc;
+}
+
+/* Updates in progress on other CPUs may survive the reset. */
+static void lock_stat_reset(void)
+{
+    unsigned int cpu;
+
+    for_each_online_cpu ( cpu )
+        memset(per_cpu(lock_stat, cpu).stat, 0,
+               sizeof(per_cpu(lock_stat, cpu).stat));
+
+    lock_stat_start = NOW();
+}
+
+/*
+ * The callers are reported as addresses: resolve them here, rather than
+ * through the profiler, which may not be built in.
+ */
+static int lock_stat_symbol(struct xen_sysctl_lockstat_op *op)
+{
+    char namebuf[KSYM_NAME_LEN + 1];
+    unsigned long size, offset;
+    const char *name;
+    unsigned int len;
+
+    name = symbols_lookup(op->addr, &size, &offset, namebuf);
+    if ( !name )
+        return -ENOENT;
+
+    len = strlen(name) + 1;
+    if ( len > op->name_size )
+        return -ENOBUFS;
+    if ( copy_to_guest(op->name, name, len) )
+        return -EFAULT;
+
+    op->addr = offset;
+
+    return 0;
+}
+
+int lock_stat_control(struct xen_sysctl_lockstat_op *op)
+{
+    int rc = 0;
+
+    spin_lock(&lock_stat_lock);
+
+    switch ( op->cmd )
+    {
+    case XEN_SYSCTL_LOCKSTAT_query:
+        rc = lock_stat_query(op);
+        break;
+
+    case XEN_SYSCTL_LOCKSTAT_reset:
+        lock_stat_reset();
+        break;
+
+    case XEN_SYSCTL_LOCKSTAT_set_rate:
+        write_atomic(&lock_stat_rate, op->rate);
+        break;
+
+    case XEN_SYSCTL_LOCKSTAT_symbol:
+        rc = lock_stat_symbol(op);
+        break;
+
+    default:
+        rc = -EOPNOTSUPP;
+        break;
+    }
+
+    op->rate = lock_stat_rate;
+
+    spin_unlock(&lock_stat_lock);
+
+    return rc;
+}
+
+static int __init lock_stat_init(void)
+{
+    BUILD_BUG_ON(LOCK_CLASS_heap != XEN_LOCKSTAT_CLASS_heap);
+    BUILD_BUG_ON(LOCK_CLASS_domctl != XEN_LOCKSTAT_CLASS_domctl);
+    BUILD_BUG_ON(LOCK_CLASS_grant != XEN_LOCKSTAT_CLASS_grant);
+    BUILD_BUG_ON(LOCK_CLASS_sched != XEN_LOCKSTAT_CLASS_sched);
+    BUILD_BUG_ON(LOCK_CLASS_p2m != XEN_LOCKSTAT_CLASS_p2m);
+    BUILD_BUG_ON(LOCK_CLASS_NR != XEN_LOCKSTAT_CLASS_NR);
+
+    lock_stat_start = NOW();
+    lock_stat_rate = opt_lock_stat_rate;
+
+    return 0;
+}
+__initcall(lock_stat_init);
+
 #ifdef CONFIG_LOCK_PROFILE
 
 struct lock_profile_anc {
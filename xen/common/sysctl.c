@@ -28,11 +28,13 @@
 #include <xen/pmstat.h>
 #include <xen/livepatch.h>
 #include <xen/gcov.h>
+#include <xen/profile.h>
 
 long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
 {
     long ret = 0;
     int copyback = -1;
+    bool_t locked;
     struct xen_sysctl curop, *op = &curop;
     static DEFINE_SPINLOCK(sysctl_lock);
 
@@ -46,12 +48,19 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     if ( ret )
         return ret;
 
+    /*
+     * Walking the domain list only requires the RCU read lock: don't make
+     * monitoring tools polling it queue up behind (or hold up) other
+     * sysctls.
+     */
+    locked = op->cmd != XEN_SYSCTL_getdomaininfolist;
+
     /*
      * Trylock here avoids deadlock with an existing sysctl critical section
      * which might (for some current or future reason) want to synchronise
      * with this vcpu.
      */
-    while ( !spin_trylock(&sysctl_lock) )
+    while ( locked && !spin_trylock(&sysctl_lock) )
         if ( hypercall_preempt_check() )
             return hypercall_create_continuation(
                 __HYPERVISOR_sysctl, "h", u_sysctl);
@@ -114,7 +123,7 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
     break;
 
-#ifdef CONFIG_PERF_COUNTERS
+#ifdef CONFIG_CORE_PERF_COUNTERS
     case XEN_SYSCTL_perfc_op:
         ret = perfc_control(&op->u.perfc_op);
         break;
@@ -125,6 +134,18 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
         ret = spinlock_profile_control(&op->u.lockprof_op);
         break;
 #endif
+
+#ifdef CONFIG_PROFILER
+    case XEN_SYSCTL_profile_op:
+        ret = profile_op(&op->u.profile_op);
+        copyback = 1;
+        break;
+#endif
+
+    case XEN_SYSCTL_lockstat_op:
+        ret = lock_stat_control(&op->u.lockstat_op);
+        copyback = 1;
+        break;
     case XEN_SYSCTL_debug_keys:
     {
         char c;
@@ -474,7 +495,8 @@ long do_sysctl(XEN_GUEST_HANDLE_PARAM(xen_sysctl_t) u_sysctl)
     }
 
  out:
-    spin_unlock(&sysctl_lock);
+    if ( locked )
+        spin_unlock(&sysctl_lock);
 
     if ( copyback && (!ret || copyback > 0) &&
          __copy_to_guest(u_sysctl, op, 1) )
@@ -200,7 +200,8 @@ static void tmem_free_page(struct tmem_pool *pool, struct page_info *pfp)
     atomic_dec_and_assert(global_page_count);
 }
 
-static noinline void *tmem_mempool_page_get(unsigned long size)
+static noinline void *tmem_mempool_page_get(unsigned long size,
+                                            struct xmem_pool *pool)
 {
     struct page_info *pi;
 
@@ -226,7 +227,8 @@ static int __init tmem_mempool_init(void)
 }
 
 /* Persistent pools are per-domain. */
-static void *tmem_persistent_pool_page_get(unsigned long size)
+static void *tmem_persistent_pool_page_get(unsigned long size,
+                                           struct xmem_pool *pool)
 {
     struct page_info *pi;
     struct domain *d = current->domain;
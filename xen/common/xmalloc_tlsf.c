@@ -25,6 +25,8 @@
 
 #include <xen/irq.h>
 #include <xen/mm.h>
+#include <xen/nodemask.h>
+#include <xen/numa.h>
 #include <xen/pfn.h>
 #include <asm/time.h>
 
@@ -117,6 +119,9 @@ struct xmem_pool {
 
     void *init_region;
     char name[MAX_POOL_NAME_LEN];
+
+    /* NUMA node backing the pool's regions, if any (see xmalloc below). */
+    nodeid_t node;
 };
 
 /*
@@ -318,6 +323,7 @@ struct xmem_pool *xmem_pool_create(
     pool->get_mem = get_mem;
     pool->put_mem = put_mem;
     strlcpy(pool->name, name, sizeof(pool->name));
+    pool->node = NUMA_NO_NODE;
 
     /* always obtain init_region lazily now to ensure it is get_mem'd
      * in the same "context" as all other regions */
@@ -374,7 +380,8 @@ void xmem_pool_destroy(struct xmem_pool *pool)
     free_xenheap_pages(pool,pool_order);
 }
 
-void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
+/* Allocate from the pool, getting it more memory only if grow is set. */
+static void *pool_alloc(unsigned long size, struct xmem_pool *pool, bool grow)
 {
     struct bhdr *b, *b2, *next_b, *region;
     int fl, sl;
@@ -382,7 +389,9 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
 
     if ( pool->init_region == NULL )
     {
-        if ( (region = pool->get_mem(pool->init_size)) == NULL )
+        if ( !grow )
+            goto out;
+        if ( (region = pool->get_mem(pool->init_size, pool)) == NULL )
             goto out;
         ADD_REGION(region, pool->init_size, pool);
         pool->init_region = region;
@@ -399,6 +408,8 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
     if ( !(b = FIND_SUITABLE_BLOCK(pool, &fl, &sl)) )
     {
         /* Not found */
+        if ( !grow )
+            goto out_locked;
         if ( size > (pool->grow_size - 2 * BHDR_OVERHEAD) )
             goto out_locked;
         if ( pool->max_size && (pool->init_size +
@@ -406,7 +417,7 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
                                 > pool->max_size) )
             goto out_locked;
         spin_unlock(&pool->lock);
-        if ( (region = pool->get_mem(pool->grow_size)) == NULL )
+        if ( (region = pool->get_mem(pool->grow_size, pool)) == NULL )
             goto out;
         spin_lock(&pool->lock);
         ADD_REGION(region, pool->grow_size, pool);
@@ -452,6 +463,11 @@ void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
     return NULL;
 }
 
+void *xmem_pool_alloc(unsigned long size, struct xmem_pool *pool)
+{
+    return pool_alloc(size, pool, true);
+}
+
 void xmem_pool_free(void *ptr, struct xmem_pool *pool)
 {
     struct bhdr *b, *tmp_b;
@@ -509,14 +525,33 @@ int xmem_pool_maxalloc(struct xmem_pool *pool)
 
 /*
  * Glue for xmalloc().
+ *
+ * Small allocations are served from one pool per NUMA node, each of which is
+ * only ever backed by memory of its node.  This both allows callers to ask
+ * for node local memory, and spreads the pool lock contention across nodes.
+ * xfree() finds the owning pool from the node the block lives on.  The
+ * pools are created on the first allocation for their node.
  */
 
-static struct xmem_pool *xenpool;
+static struct xmem_pool *xenpool[MAX_NUMNODES];
+static DEFINE_SPINLOCK(xenpool_lock);
+static bool_t xenpool_initialised;
 
-static void *xmalloc_pool_get(unsigned long size)
+static void *xmalloc_pool_get(unsigned long size, struct xmem_pool *pool)
 {
+    void *p;
+
     ASSERT(size == PAGE_SIZE);
-    return alloc_xenheap_page();
+    p = alloc_xenheap_pages(0, MEMF_node(pool->node) | MEMF_exact_node);
+
+    /* Memory relinquished by tmem may come from anywhere. */
+    if ( p && phys_to_nid(virt_to_maddr(p)) != pool->node )
+    {
+        free_xenheap_page(p);
+        p = NULL;
+    }
+
+    return p;
 }
 
 static void xmalloc_pool_put(void *p)
@@ -524,14 +559,65 @@ static void xmalloc_pool_put(void *p)
     free_xenheap_page(p);
 }
 
-static void *xmalloc_whole_pages(unsigned long size, unsigned long align)
+/* The pool of an online node, created if need be. */
+static struct xmem_pool *xmalloc_pool(nodeid_t node)
+{
+    struct xmem_pool *pool = read_atomic(&xenpool[node]);
+    char name[MAX_POOL_NAME_LEN];
+
+    if ( pool || !node_online(node) )
+        return pool;
+
+    spin_lock(&xenpool_lock);
+
+    pool = xenpool[node];
+    if ( !pool )
+    {
+        snprintf(name, sizeof(name), "xmalloc-node%u", node);
+        pool = xmem_pool_create(name, xmalloc_pool_get, xmalloc_pool_put,
+                                PAGE_SIZE, 0, PAGE_SIZE);
+        if ( pool )
+        {
+            pool->node = node;
+            smp_wmb();
+            write_atomic(&xenpool[node], pool);
+        }
+    }
+
+    spin_unlock(&xenpool_lock);
+
+    return pool;
+}
+
+static void *xmalloc_pool_alloc(unsigned long size, nodeid_t node)
+{
+    struct xmem_pool *pool = xmalloc_pool(node);
+    void *p = NULL;
+    nodeid_t n;
+
+    if ( pool )
+        p = xmem_pool_alloc(size, pool);
+
+    /*
+     * Fall back to the free blocks of other nodes rather than to whole
+     * pages, but don't take memory from those nodes to grow their pools.
+     */
+    for ( n = 0; !p && n < MAX_NUMNODES; n++ )
+        if ( n != node && (pool = read_atomic(&xenpool[n])) != NULL )
+            p = pool_alloc(size, pool, false);
+
+    return p;
+}
+
+static void *xmalloc_whole_pages(unsigned long size, unsigned long align,
+                                 nodeid_t node)
 {
     unsigned int i, order;
     void *res, *p;
 
     order = get_order_from_bytes(max(align, size));
 
-    res = alloc_xenheap_pages(order, 0);
+    res = alloc_xenheap_pages(order, MEMF_node(node));
     if ( res == NULL )
         return NULL;
 
@@ -553,10 +639,7 @@ static void tlsf_init(void)
 {
     INIT_LIST_HEAD(&pool_list_head);
     spin_lock_init(&pool_list_lock);
-    xenpool = xmem_pool_create(
-        "xmalloc", xmalloc_pool_get, xmalloc_pool_put,
-        PAGE_SIZE, 0, PAGE_SIZE);
-    BUG_ON(!xenpool);
+    xenpool_initialised = 1;
 }
 
 /*
@@ -568,7 +651,7 @@ static void tlsf_init(void)
 #define ZERO_BLOCK_PTR ((void *)-1L)
 #endif
 
-void *_xmalloc(unsigned long size, unsigned long align)
+void *_xmalloc_node(unsigned long size, unsigned long align, unsigned int node)
 {
     void *p = NULL;
     u32 pad;
@@ -583,13 +666,16 @@ void *_xmalloc(unsigned long size, unsigned long align)
         align = MEM_ALIGN;
     size += align - MEM_ALIGN;
 
-    if ( !xenpool )
+    if ( !xenpool_initialised )
         tlsf_init();
 
+    if ( node >= MAX_NUMNODES )
+        node = cpu_to_node(smp_processor_id());
+
     if ( size < PAGE_SIZE )
-        p = xmem_pool_alloc(size, xenpool);
+        p = xmalloc_pool_alloc(size, node);
     if ( p == NULL )
-        return xmalloc_whole_pages(size - align + MEM_ALIGN, align);
+        return xmalloc_whole_pages(size - align + MEM_ALIGN, align, node);
 
     /* Add alignment padding. */
     if ( (pad = -(long)p & (align - 1)) != 0 )
@@ -605,13 +691,23 @@ void *_xmalloc(unsigned long size, unsigned long align)
     return p;
 }
 
-void *_xzalloc(unsigned long size, unsigned long align)
+void *_xzalloc_node(unsigned long size, unsigned long align, unsigned int node)
 {
-    void *p = _xmalloc(size, align);
+    void *p = _xmalloc_node(size, align, node);
 
     return p ? memset(p, 0, size) : p;
 }
 
+void *_xmalloc(unsigned long size, unsigned long align)
+{
+    return _xmalloc_node(size, align, NUMA_NO_NODE);
+}
+
+void *_xzalloc(unsigned long size, unsigned long align)
+{
+    return _xzalloc_node(size, align, NUMA_NO_NODE);
+}
+
 void xfree(void *p)
 {
     struct bhdr *b;
@@ -648,5 +744,5 @@ void xfree(void *p)
         ASSERT(!(b->size & 1));
     }
 
-    xmem_pool_free(p, xenpool);
+    xmem_pool_free(p, xenpool[phys_to_nid(virt_to_maddr(p))]);
 }
@@ -35,6 +35,10 @@ int iommu_assign_dt_device(struct domain *d, struct dt_device_node *dev)
     if ( !dt_device_is_protected(dev) )
         return -EINVAL;
 
+    /* Device writes can't be logged, see p2m_log_dirty_enable(). */
+    if ( unlikely(!need_iommu(d) && p2m_get_hostp2m(d)->logdirty.enabled) )
+        return -EXDEV;
+
     spin_lock(&dtdevs_lock);
 
     if ( !list_empty(&dev->domain_list) )
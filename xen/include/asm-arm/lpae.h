@@ -102,6 +102,9 @@ typedef struct __packed {
 #define P2M_PERM_MASK (0x00400000000000C0ULL)
 #define P2M_CLEAR_PERM(pte) ((pte).bits & ~P2M_PERM_MASK)
 
+/* Software type bits, ignored by the hardware */
+#define P2M_TYPE_MASK (0x0780000000000000ULL)
+
 /*
  * Walk is the common bits of p2m and pt entries which are needed to
  * simply walk the table (e.g. for debug).
@@ -70,6 +70,11 @@ struct p2m_domain {
         /* Number of times we have shattered a mapping
          * at each p2m tree level. */
         unsigned long shattered[4];
+        /* Number of times mappings were coalesced into one
+         * at each p2m tree level (see p2m-coalesce.c). */
+        unsigned long coalesced[4];
+        /* Number of 2M ranges copied to a new block to do so. */
+        unsigned long migrated;
     } stats;
 
     /*
@@ -94,6 +99,37 @@ struct p2m_domain {
      */
     struct radix_tree_root mem_access_settings;
 
+    /* Log-dirty tracking state (see XEN_DOMCTL_shadow_op) */
+    struct {
+        /* Set while RAM entries may be of type p2m_ram_logdirty */
+        bool enabled;
+        /* A preempted operation is waiting to be continued */
+        bool preempted;
+        uint32_t preempted_op;
+        /* Where the preempted operation should resume */
+        unsigned long resume;
+        /* One bit per gfn in [0, nr_gfns) */
+        unsigned long *bitmap;
+        unsigned long nr_gfns;
+        /* Statistics since the last XEN_DOMCTL_SHADOW_OP_CLEAN */
+        uint32_t fault_count;
+        uint32_t dirty_count;
+    } logdirty;
+
+    /*
+     * Populate-on-demand state, protected by the p2m write lock.
+     * Entries of type p2m_populate_on_demand are invalid in the stage-2
+     * tables, and filled in from the cache when the guest faults on them.
+     */
+    struct {
+        struct page_list_head super,   /* List of 2M pages */
+                              single;  /* List of 4K pages */
+        long count,                    /* # of pages in cache lists */
+             entry_count;              /* # of gfns marked PoD in the p2m */
+        unsigned long reclaim_single;  /* Last gfn of a zero page sweep */
+        unsigned long max_guest;       /* Highest gfn demand-populated */
+    } pod;
+
     /* back pointer to domain */
     struct domain *domain;
 
@@ -118,6 +154,8 @@ typedef enum {
     p2m_map_foreign,    /* Ram pages from foreign domain */
     p2m_grant_map_rw,   /* Read/write grant mapping */
     p2m_grant_map_ro,   /* Read-only grant mapping */
+    p2m_ram_logdirty,   /* Read-only RAM; writes are logged then allowed */
+    p2m_populate_on_demand, /* Place-holder for empty memory */
     /* The types below are only used to decide the page attribute in the P2M */
     p2m_iommu_map_rw,   /* Read/write iommu mapping */
     p2m_iommu_map_ro,   /* Read-only iommu mapping */
@@ -129,7 +167,8 @@ typedef enum {
 
 /* RAM types, which map to real machine frames */
 #define P2M_RAM_TYPES (p2m_to_mask(p2m_ram_rw) |        \
-                       p2m_to_mask(p2m_ram_ro))
+                       p2m_to_mask(p2m_ram_ro) |        \
+                       p2m_to_mask(p2m_ram_logdirty))
 
 /* Grant mapping types, which map to a real frame in another VM */
 #define P2M_GRANT_TYPES (p2m_to_mask(p2m_grant_map_rw) |  \
@@ -220,9 +259,39 @@ int p2m_set_entry(struct p2m_domain *p2m,
                   p2m_type_t t,
                   p2m_access_t a);
 
+/*
+ * Force a synchronous P2M TLB flush.
+ * The P2M write lock should be taken.
+ */
+void p2m_flush_tlb_sync(struct p2m_domain *p2m);
+
 /* Clean & invalidate caches corresponding to a region of guest address space */
 int p2m_cache_flush(struct domain *d, gfn_t start, unsigned long nr);
 
+struct xen_domctl_shadow_op;
+
+/* Handle the log-dirty subset of XEN_DOMCTL_shadow_op */
+int p2m_log_dirty_op(struct domain *d, struct xen_domctl_shadow_op *sc);
+
+/*
+ * Handle a write permission fault on gfn. Returns true if the fault was
+ * caused by log-dirty tracking, in which case the page has been logged and
+ * made writable again.
+ */
+bool p2m_log_dirty_fault(struct domain *d, gfn_t gfn);
+
+/* Log gfn in the dirty bitmap, if any. The P2M write lock should be taken. */
+void p2m_log_dirty_mark(struct p2m_domain *p2m, gfn_t gfn);
+
+/*
+ * Grow the dirty bitmap, if any, to cover the gfns below end before they
+ * get mapped. The P2M write lock should be taken.
+ */
+int p2m_log_dirty_cover(struct p2m_domain *p2m, gfn_t end);
+
+/* Log a write to gfn made other than through the stage-2 (e.g. a grant) */
+void p2m_log_dirty_write(struct domain *d, gfn_t gfn);
+
 /*
  * Map a region in the guest p2m with a specific p2m type.
  * The memory attributes will be derived from the p2m type.
@@ -273,6 +342,21 @@ p2m_pod_decrease_reservation(struct domain *d,
                              xen_pfn_t gpfn,
                              unsigned int order);
 
+/* Set the number of pages the domain should have, growing the PoD cache */
+int p2m_pod_set_mem_target(struct domain *d, unsigned long target);
+
+/* Return the PoD cache to the domain's page list, when it is dying */
+int p2m_pod_empty_cache(struct domain *d);
+
+/* Print PoD statistics of a domain */
+void p2m_pod_dump_data(struct domain *d);
+
+/*
+ * Fill in the PoD entry covering gfn from the cache.  Returns true if gfn
+ * is now mapped, and the access which faulted on it should be retried.
+ */
+bool p2m_pod_demand_populate(struct domain *d, gfn_t gfn);
+
 /* Look up a GFN and take a reference count on the backing page. */
 typedef unsigned int p2m_query_t;
 #define P2M_ALLOC    (1u<<0)   /* Populate PoD and paged-out entries */
@@ -283,7 +367,14 @@ static inline struct page_info *get_page_from_gfn(
 {
     struct page_info *page;
     p2m_type_t p2mt;
-    unsigned long mfn = mfn_x(p2m_lookup(d, _gfn(gfn), &p2mt));
+    unsigned long mfn;
+
+ again:
+    mfn = mfn_x(p2m_lookup(d, _gfn(gfn), &p2mt));
+
+    if ( p2mt == p2m_populate_on_demand && (q & P2M_ALLOC) &&
+         p2m_pod_demand_populate(d, _gfn(gfn)) )
+        goto again;
 
     if (t)
         *t = p2mt;
@@ -4,24 +4,24 @@
 
 PERFCOUNTER(invalid_hypercalls, "invalid hypercalls")
 
-PERFCOUNTER(trap_wfi,      "trap: wfi")
-PERFCOUNTER(trap_wfe,      "trap: wfe")
-PERFCOUNTER(trap_cp15_32,  "trap: cp15 32-bit access")
-PERFCOUNTER(trap_cp15_64,  "trap: cp15 64-bit access")
-PERFCOUNTER(trap_cp14_32,  "trap: cp14 32-bit access")
-PERFCOUNTER(trap_cp14_64,  "trap: cp14 64-bit access")
-PERFCOUNTER(trap_cp14_dbg, "trap: cp14 dbg access")
-PERFCOUNTER(trap_cp,       "trap: cp access")
-PERFCOUNTER(trap_smc32,    "trap: 32-bit smc")
-PERFCOUNTER(trap_hvc32,    "trap: 32-bit hvc")
+PERFCOUNTER_CORE(trap_wfi,      "trap: wfi")
+PERFCOUNTER_CORE(trap_wfe,      "trap: wfe")
+PERFCOUNTER_CORE(trap_cp15_32,  "trap: cp15 32-bit access")
+PERFCOUNTER_CORE(trap_cp15_64,  "trap: cp15 64-bit access")
+PERFCOUNTER_CORE(trap_cp14_32,  "trap: cp14 32-bit access")
+PERFCOUNTER_CORE(trap_cp14_64,  "trap: cp14 64-bit access")
+PERFCOUNTER_CORE(trap_cp14_dbg, "trap: cp14 dbg access")
+PERFCOUNTER_CORE(trap_cp,       "trap: cp access")
+PERFCOUNTER_CORE(trap_smc32,    "trap: 32-bit smc")
+PERFCOUNTER_CORE(trap_hvc32,    "trap: 32-bit hvc")
 #ifdef CONFIG_ARM_64
-PERFCOUNTER(trap_smc64,    "trap: 64-bit smc")
-PERFCOUNTER(trap_hvc64,    "trap: 64-bit hvc")
-PERFCOUNTER(trap_sysreg,   "trap: sysreg access")
+PERFCOUNTER_CORE(trap_smc64,    "trap: 64-bit smc")
+PERFCOUNTER_CORE(trap_hvc64,    "trap: 64-bit hvc")
+PERFCOUNTER_CORE(trap_sysreg,   "trap: sysreg access")
 #endif
-PERFCOUNTER(trap_iabt,     "trap: guest instr abort")
-PERFCOUNTER(trap_dabt,     "trap: guest data abort")
-PERFCOUNTER(trap_uncond,   "trap: condition failed")
+PERFCOUNTER_CORE(trap_iabt,     "trap: guest instr abort")
+PERFCOUNTER_CORE(trap_dabt,     "trap: guest data abort")
+PERFCOUNTER_CORE(trap_uncond,   "trap: condition failed")
 
 PERFCOUNTER(vpsci_cpu_on,              "vpsci: cpu_on")
 PERFCOUNTER(vpsci_cpu_off,             "vpsci: cpu_off")
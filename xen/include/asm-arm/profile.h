@@ -0,0 +1,11 @@
+#ifndef __ASM_ARM_PROFILE_H__
+#define __ASM_ARM_PROFILE_H__
+
+#include <asm/regs.h>
+
+/* Interrupted program counter, stack and frame pointer of a sample. */
+#define profile_pc(regs) ((regs)->pc)
+#define profile_sp(regs) ((regs)->sp)
+#define profile_fp(regs) ((regs)->fp)
+
+#endif /* __ASM_ARM_PROFILE_H__ */
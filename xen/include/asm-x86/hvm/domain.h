@@ -170,6 +170,9 @@ struct hvm_domain {
     bool_t                 mem_sharing_enabled;
     bool_t                 qemu_mapcache_invalidate;
     bool_t                 is_s3_suspended;
+    /* Background deduplication scanner enabled, and its position. */
+    bool_t                 mem_sharing_scan;
+    unsigned long          mem_sharing_scan_gfn;
 
     /*
      * TSC value that VCPUs use to calculate their tsc_offset value.
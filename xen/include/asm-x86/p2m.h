@@ -28,6 +28,8 @@
 
 #include <xen/paging.h>
 #include <xen/p2m-common.h>
+#include <xen/tasklet.h>
+#include <xen/timer.h>
 #include <xen/mem_access.h>
 #include <asm/mem_sharing.h>
 #include <asm/page.h>    /* for pagetable_t */
@@ -332,6 +334,22 @@ struct p2m_domain {
             unsigned long list[NR_POD_MRP_ENTRIES];
             unsigned int idx;
         } mrp;
+
+        /*
+         * Background sweeper, topping the cache up with zero pages
+         * reclaimed from the guest before it runs dry.
+         */
+        struct pod_sweeper {
+            struct timer     timer;
+            struct tasklet   tasklet;
+            bool             armed;     /* Timer or tasklet pending         */
+            unsigned long    next_gfn;  /* Where the next run starts        */
+            unsigned long    scanned,   /* Total gfns examined              */
+                             reclaimed; /* Total pages added to the cache   */
+            s_time_t         window_start;
+            unsigned long    window_reclaimed;
+            unsigned long    rate;      /* Pages reclaimed per second       */
+        } sweeper;
         mm_lock_t        lock;         /* Locking of private pod structs,   *
                                         * not relying on the p2m lock.      */
     } pod;
@@ -354,6 +372,14 @@ struct p2m_domain {
          unsigned int flags;
          unsigned long entry_count;
      } ioreq;
+
+    /* Superpage reassembly (see p2m-coalesce.c), under the p2m lock. */
+    struct {
+        unsigned long pass[3];      /* RAM pages mapped 4K/2M/1G, this pass */
+        unsigned long mapped[3];    /* Same, as of the last complete pass */
+        unsigned long promoted;     /* Entries merged in place */
+        unsigned long migrated;     /* 2M ranges copied to a new block */
+    } coalesce;
 };
 
 /* get host p2m table */
@@ -635,6 +661,13 @@ int p2m_add_foreign(struct domain *tdom, unsigned long fgfn,
 /* Dump PoD information about the domain */
 void p2m_pod_dump_data(struct domain *d);
 
+/* Report the superpage coverage of the domain's p2m */
+void p2m_coalesce_dump(struct domain *d);
+
+/* Set up and stop the background PoD sweeper of a host p2m */
+void p2m_pod_sweeper_init(struct p2m_domain *p2m);
+void p2m_pod_sweeper_kill(struct p2m_domain *p2m);
+
 /* Move all pages from the populate-on-demand cache to the domain page_list
  * (usually in preparation for domain destruction) */
 int p2m_pod_empty_cache(struct domain *d);
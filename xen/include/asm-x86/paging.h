@@ -179,6 +179,13 @@ int paging_mfn_is_dirty(struct domain *d, mfn_t gmfn);
 #define L4_LOGDIRTY_IDX(pfn) ((pfn_x(pfn) >> (PAGE_SHIFT + 3 + PAGETABLE_ORDER * 2)) & \
                               (LOGDIRTY_NODE_ENTRIES-1))
 
+/*
+ * Size of the list of pfns newly marked dirty, used by
+ * XEN_DOMCTL_SHADOW_OP_CLEAN_LIST. Once full, the toolstack has to fall
+ * back to reading the whole bitmap for that round.
+ */
+#define LOGDIRTY_LIST_ENTRIES (1U << 16)
+
 /* VRAM dirty tracking support */
 struct sh_dirty_vram {
     unsigned long begin_pfn;
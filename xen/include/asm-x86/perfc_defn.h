@@ -6,12 +6,12 @@ PERFCOUNTER_ARRAY(exceptions,           "exceptions", 32)
 
 #define VMX_PERF_EXIT_REASON_SIZE 56
 #define VMX_PERF_VECTOR_SIZE 0x20
-PERFCOUNTER_ARRAY(vmexits,              "vmexits", VMX_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER_CORE_ARRAY(vmexits,         "vmexits", VMX_PERF_EXIT_REASON_SIZE)
 PERFCOUNTER_ARRAY(cause_vector,         "cause vector", VMX_PERF_VECTOR_SIZE)
 
 #define VMEXIT_NPF_PERFC 141
 #define SVM_PERF_EXIT_REASON_SIZE (1+141)
-PERFCOUNTER_ARRAY(svmexits,             "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
+PERFCOUNTER_CORE_ARRAY(svmexits,        "SVMexits", SVM_PERF_EXIT_REASON_SIZE)
 
 PERFCOUNTER(seg_fixups,             "segmentation fixups")
 
@@ -142,4 +142,11 @@ PERFCOUNTER(realmode_exits,      "vmexits from realmode")
 
 PERFCOUNTER(pauseloop_exits, "vmexits from Pause-Loop Detection")
 
+PERFCOUNTER(pod_sweep_runs,      "PoD sweeper runs")
+PERFCOUNTER(pod_sweep_scanned,   "PoD sweeper gfns scanned")
+PERFCOUNTER(pod_sweep_reclaimed, "PoD sweeper pages reclaimed")
+
+PERFCOUNTER(mem_sharing_scan_pages,  "mem_sharing scanner pages hashed")
+PERFCOUNTER(mem_sharing_scan_merged, "mem_sharing scanner pages merged")
+
 /*#endif*/ /* __XEN_PERFC_DEFN_H__ */
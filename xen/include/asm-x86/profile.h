@@ -0,0 +1,11 @@
+#ifndef __ASM_X86_PROFILE_H__
+#define __ASM_X86_PROFILE_H__
+
+#include <asm/regs.h>
+
+/* Interrupted program counter, stack and frame pointer of a sample. */
+#define profile_pc(regs) ((regs)->rip)
+#define profile_sp(regs) ((regs)->rsp)
+#define profile_fp(regs) ((regs)->rbp)
+
+#endif /* __ASM_X86_PROFILE_H__ */
@@ -126,6 +126,9 @@ static inline int vpmu_do_rdmsr(unsigned int msr, uint64_t *msr_content)
 extern unsigned int vpmu_mode;
 extern unsigned int vpmu_features;
 
+int vpmu_profile_claim(void);
+void vpmu_profile_release(void);
+
 /* Context switch */
 static inline void vpmu_switch_from(struct vcpu *prev)
 {
@@ -177,6 +177,14 @@ struct xen_domctl_getpageframeinfo3 {
 #define XEN_DOMCTL_SHADOW_OP_CLEAN       11
  /* Return the bitmap but do not modify internal copy. */
 #define XEN_DOMCTL_SHADOW_OP_PEEK        12
+ /*
+  * Like CLEAN, but return the list of pfns dirtied since the last CLEAN or
+  * CLEAN_LIST instead of the bitmap. dirty_bitmap then points to an array
+  * of uint64_t and pages holds its number of entries (on return, the number
+  * of pfns written). Fails with -ENOBUFS, without cleaning anything, if
+  * the list isn't complete or doesn't fit; CLEAN should be used instead.
+  */
+#define XEN_DOMCTL_SHADOW_OP_CLEAN_LIST  13
 
 /* Memory allocation accessors. */
 #define XEN_DOMCTL_SHADOW_OP_GET_ALLOCATION   30
@@ -881,14 +889,17 @@ DEFINE_XEN_GUEST_HANDLE(xen_domctl_vm_event_op_t);
  * Memory sharing operations
  */
 /* XEN_DOMCTL_mem_sharing_op.
- * The CONTROL sub-domctl is used for bringup/teardown. */
+ * The CONTROL sub-domctl is used for bringup/teardown.
+ * The SCAN sub-domctl starts or stops the hypervisor's background scanner
+ * sharing identical pages of the domain, which must have sharing enabled. */
 #define XEN_DOMCTL_MEM_SHARING_CONTROL          0
+#define XEN_DOMCTL_MEM_SHARING_SCAN             1
 
 struct xen_domctl_mem_sharing_op {
     uint8_t op; /* XEN_DOMCTL_MEM_SHARING_* */
 
     union {
-        uint8_t enable;                   /* CONTROL */
+        uint8_t enable;                   /* CONTROL, SCAN */
     } u;
 };
 typedef struct xen_domctl_mem_sharing_op xen_domctl_mem_sharing_op_t;
@@ -1149,6 +1160,57 @@ struct xen_domctl_psr_cat_op {
 typedef struct xen_domctl_psr_cat_op xen_domctl_psr_cat_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_domctl_psr_cat_op_t);
 
+/*
+ * XEN_DOMCTL_exit_latency
+ *
+ * Histograms of how long a domain's exits take, from the VM exit (trap to
+ * EL2 on ARM) to the next entry of the vCPU into the guest, by exit reason.
+ * Times are in cycles of the TSC (x86) or the generic timer (ARM), and
+ * include any time the vCPU spent blocked or descheduled in between: this
+ * is the guest's view of what the exit cost it.
+ *
+ * Reasons are the VMX basic exit reason, the SVM exit code or the ARM
+ * exception class (HSR.EC), according to 'type'.  SVM exit codes from
+ * VMEXIT_NPF (0x400) upwards are reported as 0xf0 + (code - 0x400).
+ *
+ * Bucket 0 counts the exits taking less than 2^8 cycles, bucket i those
+ * taking [2^(i+7), 2^(i+8)) cycles, the last one also all longer ones.
+ */
+#define XEN_DOMCTL_EXITLAT_enable       0
+#define XEN_DOMCTL_EXITLAT_disable      1
+#define XEN_DOMCTL_EXITLAT_reset        2
+#define XEN_DOMCTL_EXITLAT_query        3
+
+#define XEN_EXITLAT_TYPE_vmx            1
+#define XEN_EXITLAT_TYPE_svm            2
+#define XEN_EXITLAT_TYPE_arm            3
+
+#define XEN_EXITLAT_NR_REASONS          256
+#define XEN_EXITLAT_BUCKETS             24
+#define XEN_EXITLAT_ALL_VCPUS           (~0U)
+
+struct xen_domctl_exitlat_reason {
+    uint64_aligned_t count;             /* exits */
+    uint64_aligned_t cycles;            /* total of their latencies */
+    uint64_aligned_t max;               /* longest one */
+    uint32_t buckets[XEN_EXITLAT_BUCKETS];
+};
+typedef struct xen_domctl_exitlat_reason xen_domctl_exitlat_reason_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_exitlat_reason_t);
+
+struct xen_domctl_exit_latency {
+    uint32_t cmd;               /* IN: XEN_DOMCTL_EXITLAT_* */
+    uint32_t vcpu;              /* query: IN, vCPU or XEN_EXITLAT_ALL_VCPUS */
+    uint32_t nr_reasons;        /* query: IN size of buffer,
+                                   OUT reasons available */
+    uint32_t type;              /* query: OUT, XEN_EXITLAT_TYPE_* */
+    uint64_aligned_t cycles_per_sec;    /* query: OUT */
+    /* query: OUT, entry i for reason i */
+    XEN_GUEST_HANDLE_64(xen_domctl_exitlat_reason_t) reasons;
+};
+typedef struct xen_domctl_exit_latency xen_domctl_exit_latency_t;
+DEFINE_XEN_GUEST_HANDLE(xen_domctl_exit_latency_t);
+
 struct xen_domctl {
     uint32_t cmd;
 #define XEN_DOMCTL_createdomain                   1
@@ -1226,6 +1288,7 @@ struct xen_domctl {
 #define XEN_DOMCTL_monitor_op                    77
 #define XEN_DOMCTL_psr_cat_op                    78
 #define XEN_DOMCTL_soft_reset                    79
+#define XEN_DOMCTL_exit_latency                  80
 #define XEN_DOMCTL_gdbsx_guestmemio            1000
 #define XEN_DOMCTL_gdbsx_pausevcpu             1001
 #define XEN_DOMCTL_gdbsx_unpausevcpu           1002
@@ -1288,6 +1351,7 @@ struct xen_domctl {
         struct xen_domctl_psr_cmt_op        psr_cmt_op;
         struct xen_domctl_monitor_op        monitor_op;
         struct xen_domctl_psr_cat_op        psr_cat_op;
+        struct xen_domctl_exit_latency      exit_latency;
         uint8_t                             pad[128];
     } u;
 };
@@ -1095,6 +1095,112 @@ struct xen_sysctl_livepatch_op {
 typedef struct xen_sysctl_livepatch_op xen_sysctl_livepatch_op_t;
 DEFINE_XEN_GUEST_HANDLE(xen_sysctl_livepatch_op_t);
 
+/*
+ * XEN_SYSCTL_profile_op
+ *
+ * Sampling profiler: on every performance counter overflow each CPU
+ * records the interrupted hypervisor program counter and call stack
+ * into a buffer of its own, which is drained with XEN_SYSCTL_PROFILE_read.
+ *
+ * A sample is a header word followed by XEN_PROFILE_DEPTH(header) program
+ * counters, innermost first.  Samples taken while a guest was running
+ * carry XEN_PROFILE_GUEST and no program counters.
+ */
+#define XEN_SYSCTL_PROFILE_enable   0   /* Start sampling at hz per CPU. */
+#define XEN_SYSCTL_PROFILE_disable  1   /* Stop sampling. */
+#define XEN_SYSCTL_PROFILE_read     2   /* Drain one CPU's samples. */
+#define XEN_SYSCTL_PROFILE_symbol   3   /* Resolve a hypervisor address. */
+
+#define XEN_PROFILE_MAX_DEPTH       32
+#define XEN_PROFILE_DEPTH(h)        ((h) & 0xff)
+#define XEN_PROFILE_GUEST           (1u << 8)
+#define XEN_PROFILE_DOMID(h)        (((h) >> 16) & 0xffff)
+
+struct xen_sysctl_profile_op {
+    uint32_t cmd;                       /* IN: XEN_SYSCTL_PROFILE_* */
+    uint32_t pad;
+    union {
+        struct {
+            uint32_t hz;                /* IN: samples per second per CPU */
+        } enable;
+        struct {
+            uint32_t cpu;               /* IN */
+            uint32_t nr_words;          /* IN: size of buffer, OUT: filled */
+            uint64_aligned_t lost;      /* OUT: samples dropped, buffer full */
+            XEN_GUEST_HANDLE_64(uint64) buffer; /* OUT: whole samples */
+        } read;
+        struct {
+            uint64_aligned_t addr;      /* IN */
+            uint64_aligned_t offset;    /* OUT: addr - start of symbol */
+            uint64_aligned_t size;      /* OUT: size of symbol */
+            uint32_t name_size;         /* IN: size of name buffer */
+            uint32_t pad;
+            XEN_GUEST_HANDLE_64(char) name; /* OUT: NUL terminated */
+        } symbol;
+    } u;
+};
+typedef struct xen_sysctl_profile_op xen_sysctl_profile_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_profile_op_t);
+
+/*
+ * XEN_SYSCTL_lockstat_op
+ *
+ * Contention statistics of the busiest hypervisor locks, summed up by lock
+ * class.  One in every 'rate' acquisitions of a lock with a class is timed:
+ * how long the CPU waited for it, how long it held it, and from where it
+ * was taken.
+ */
+#define XEN_SYSCTL_LOCKSTAT_query       0
+#define XEN_SYSCTL_LOCKSTAT_reset       1
+#define XEN_SYSCTL_LOCKSTAT_set_rate    2
+#define XEN_SYSCTL_LOCKSTAT_symbol      3   /* Resolve a caller's address. */
+
+#define XEN_LOCKSTAT_CLASS_heap         1   /* page allocator heap_lock */
+#define XEN_LOCKSTAT_CLASS_domctl       2   /* domctl_lock */
+#define XEN_LOCKSTAT_CLASS_grant        3   /* grant table rwlocks */
+#define XEN_LOCKSTAT_CLASS_sched        4   /* scheduler runqueue locks */
+#define XEN_LOCKSTAT_CLASS_p2m          5   /* p2m locks */
+#define XEN_LOCKSTAT_CLASS_NR           6
+
+/* Callers taking the lock most often, per class. */
+#define XEN_LOCKSTAT_CALLERS            8
+
+struct xen_sysctl_lockstat_caller {
+    uint64_aligned_t addr;              /* hypervisor address of the call */
+    uint64_aligned_t count;             /* sampled acquisitions from addr */
+    uint64_aligned_t wait;              /* nsecs they waited for the lock */
+};
+
+struct xen_sysctl_lockstat_class {
+    char name[16];
+    uint64_aligned_t count;             /* sampled acquisitions or trylocks */
+    uint64_aligned_t contended;         /* of them found the lock taken */
+    uint64_aligned_t wait, wait_max;    /* nsecs waited for the lock */
+    uint64_aligned_t hold, hold_max;    /* nsecs the lock was held */
+    /* Most frequent first, unused ones have a zero count. */
+    struct xen_sysctl_lockstat_caller callers[XEN_LOCKSTAT_CALLERS];
+};
+typedef struct xen_sysctl_lockstat_class xen_sysctl_lockstat_class_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockstat_class_t);
+
+struct xen_sysctl_lockstat_op {
+    uint32_t cmd;                       /* IN: XEN_SYSCTL_LOCKSTAT_* */
+    uint32_t rate;                      /* IN for set_rate, else OUT; 0: off */
+    uint32_t nr_classes;                /* query: IN size of buffer,
+                                           OUT classes available */
+    uint32_t pad;
+    uint64_aligned_t time;              /* query: OUT nsecs since reset */
+    /* query: OUT, entry i for class i + 1 */
+    XEN_GUEST_HANDLE_64(xen_sysctl_lockstat_class_t) classes;
+    uint64_aligned_t addr;              /* symbol: IN address,
+                                           OUT its offset into the symbol */
+    uint32_t name_size;                 /* symbol: IN size of name buffer */
+    uint32_t pad2;
+    XEN_GUEST_HANDLE_64(char) name;     /* symbol: OUT, NUL terminated */
+};
+typedef struct xen_sysctl_lockstat_op xen_sysctl_lockstat_op_t;
+DEFINE_XEN_GUEST_HANDLE(xen_sysctl_lockstat_op_t);
+
 struct xen_sysctl {
     uint32_t cmd;
 #define XEN_SYSCTL_readconsole                    1
@@ -1123,6 +1229,8 @@ struct xen_sysctl {
 #define XEN_SYSCTL_get_cpu_levelling_caps        25
 #define XEN_SYSCTL_get_cpu_featureset            26
 #define XEN_SYSCTL_livepatch_op                  27
+#define XEN_SYSCTL_profile_op                    28
+#define XEN_SYSCTL_lockstat_op                   29
     uint32_t interface_version; /* XEN_SYSCTL_INTERFACE_VERSION */
     union {
         struct xen_sysctl_readconsole       readconsole;
@@ -1151,6 +1259,8 @@ struct xen_sysctl {
         struct xen_sysctl_cpu_levelling_caps cpu_levelling_caps;
         struct xen_sysctl_cpu_featureset    cpu_featureset;
         struct xen_sysctl_livepatch_op      livepatch;
+        struct xen_sysctl_profile_op        profile_op;
+        struct xen_sysctl_lockstat_op       lockstat_op;
         uint8_t                             pad[128];
     } u;
 };
@@ -0,0 +1,48 @@
+#ifndef __XEN_DOMAIN_SCAN_H__
+#define __XEN_DOMAIN_SCAN_H__
+
+#include <xen/sched.h>
+#include <xen/tasklet.h>
+#include <xen/time.h>
+#include <xen/timer.h>
+
+/*
+ * Background scanner, walking the domains one at a time, in order of their
+ * ids, a bounded amount of work per run.  Runs happen in a tasklet, kicked
+ * by a timer: the callbacks are never called on more than one CPU at a
+ * time, so state they alone use needs no locking.
+ */
+struct domain_scan {
+    unsigned long budget;       /* Units of work per run. */
+    s_time_t interval;          /* Time between runs. */
+
+    /* Whether d is to be scanned at all. */
+    bool (*want)(const struct domain *d);
+    /*
+     * Scan d, for at most *budget units of work.  Returns true when done
+     * with d for this pass.  It may only return false when the budget ran
+     * out, or d is no longer wanted.
+     */
+    bool (*scan)(struct domain *d, unsigned long *budget);
+    /*
+     * Optional, called once every domain has been scanned.  Returns false
+     * if it ran out of budget, to be called again on the next run.
+     */
+    bool (*end_pass)(unsigned long *budget);
+    /*
+     * Optional, called at the start of each run.  Returns false to leave
+     * the scanner idle until domain_scan_kick().
+     */
+    bool (*begin)(void);
+
+    /* Private to common/domain_scan.c. */
+    domid_t next_domain;        /* Lowest domid not yet scanned this pass. */
+    bool end_of_pass;
+    struct timer timer;
+    struct tasklet tasklet;
+};
+
+void domain_scan_init(struct domain_scan *s);
+void domain_scan_kick(struct domain_scan *s);
+
+#endif /* __XEN_DOMAIN_SCAN_H__ */
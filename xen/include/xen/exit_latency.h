@@ -0,0 +1,44 @@
+#ifndef __XEN_EXIT_LATENCY_H__
+#define __XEN_EXIT_LATENCY_H__
+
+#include <xen/sched.h>
+#include <asm/time.h>
+#include <public/domctl.h>
+
+/*
+ * Per-vCPU exit latency histograms, allocated while XEN_DOMCTL_exit_latency
+ * has them enabled for the domain.  Only the vCPU itself updates them, so
+ * no locking or atomics are needed.
+ */
+struct exit_latency {
+    cycles_t start;             /* Time of the pending exit, 0 if none. */
+    unsigned int reason;
+    struct xen_domctl_exitlat_reason r[XEN_EXITLAT_NR_REASONS];
+};
+
+int exit_latency_domctl(struct domain *d, struct xen_domctl_exit_latency *op);
+void exit_latency_destroy(struct vcpu *v);
+void __exit_latency_end(struct exit_latency *el);
+
+/* Called on guest exit, once the reason is known. */
+static inline void exit_latency_begin(struct vcpu *v, unsigned int reason)
+{
+    struct exit_latency *el = v->exit_latency;
+
+    if ( unlikely(el != NULL) )
+    {
+        el->start = get_cycles();
+        el->reason = reason;
+    }
+}
+
+/* Called right before entering the guest, with interrupts disabled. */
+static inline void exit_latency_end(struct vcpu *v)
+{
+    struct exit_latency *el = v->exit_latency;
+
+    if ( unlikely(el != NULL) && el->start )
+        __exit_latency_end(el);
+}
+
+#endif /* __XEN_EXIT_LATENCY_H__ */
@@ -52,6 +52,7 @@
 #include <xen/typesafe.h>
 #include <xen/kernel.h>
 #include <xen/perfc.h>
+#include <xen/zero_words.h>
 #include <public/memory.h>
 
 TYPE_SAFE(unsigned long, mfn);
@@ -626,4 +627,9 @@ static inline void filtered_flush_tlb_mask(uint32_t tlbflush_timestamp)
     }
 }
 
+static inline bool page_is_zero(const void *p)
+{
+    return words_are_zero(p, PAGE_SIZE / sizeof(unsigned long));
+}
+
 #endif /* __XEN_MM_H__ */
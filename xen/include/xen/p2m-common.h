@@ -20,4 +20,24 @@ int unmap_mmio_regions(struct domain *d,
                        unsigned long nr,
                        mfn_t mfn);
 
+/*
+ * Background reassembly of superpage entries (common/p2m-coalesce.c).  The
+ * architecture provides the steps below, which are only called from the
+ * scanner (see xen/domain_scan.h).
+ */
+bool arch_p2m_coalesce_supported(void);
+/* Whether d's p2m is to be coalesced at all. */
+bool arch_p2m_coalesce_domain(const struct domain *d);
+/* The range of gfns to scan, [*start, *end), *start being 2M aligned. */
+void arch_p2m_coalesce_bounds(struct domain *d, gfn_t *start, gfn_t *end);
+/*
+ * Try to map the 2M aligned range at gfn with a larger entry, moving its
+ * contents to a new block if *migrations allows.  Returns the number of
+ * gfns dealt with.
+ */
+unsigned long arch_p2m_coalesce_range(struct domain *d, gfn_t gfn,
+                                      unsigned int *migrations);
+/* The scanner went over the whole of d's p2m. */
+void arch_p2m_coalesce_pass_done(struct domain *d);
+
 #endif /* _XEN_P2M_COMMON_H */
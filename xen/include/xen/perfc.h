@@ -1,11 +1,12 @@
 #ifndef __XEN_PERFC_H__
 #define __XEN_PERFC_H__
 
-#ifdef CONFIG_PERF_COUNTERS
+#ifdef CONFIG_CORE_PERF_COUNTERS
 
 #include <xen/lib.h>
 #include <xen/smp.h>
 #include <xen/percpu.h>
+#include <public/grant_table.h>
 
 /*
  * NOTE: new counters must be defined in perfc_defn.h
@@ -13,6 +14,12 @@
  * Counter declarations:
  * PERFCOUNTER (counter, string)              define a new performance counter
  * PERFCOUNTER_ARRAY (counter, string, size)  define an array of counters
+ *
+ * Core counters are also kept without CONFIG_PERF_COUNTERS, so they are
+ * available in release builds.  Keep them to hot-path events cheap enough
+ * to count unconditionally:
+ * PERFCOUNTER_CORE (counter, string)         define a core counter
+ * PERFCOUNTER_CORE_ARRAY (counter, string, size) define an array of them
  * 
  * Unlike counters, status variables do not reset:
  * PERFSTATUS (counter, string)               define a new performance stauts
@@ -30,47 +37,87 @@
  * void perfc_print (counter)                  print out the counter
  */
 
+#define PERFCOUNTER_CORE( name, descr ) \
+  PERFC_##name,
+#define PERFCOUNTER_CORE_ARRAY( name, descr, size ) \
+  PERFC_##name,                                     \
+  PERFC_LAST_##name = PERFC_ ## name + (size) - sizeof(char[2 * !!(size) - 1]),
+#define PERFCOUNTER( name, descr )
+#define PERFCOUNTER_ARRAY( name, descr, size )
+#define PERFSTATUS( name, descr )
+#define PERFSTATUS_ARRAY( name, descr, size )
+
+/*
+ * Core counters are numbered first, so that without CONFIG_PERF_COUNTERS
+ * only they need storage.  The others still get numbers, for call sites
+ * to compile, but are never touched.
+ */
+enum perfcounter {
+#include <xen/perfc_defn.h>
+	NUM_CORE_PERFCOUNTERS,
+	PERFC_LAST_core = NUM_CORE_PERFCOUNTERS - 1,
+
+#undef PERFCOUNTER_CORE
+#undef PERFCOUNTER_CORE_ARRAY
+#undef PERFCOUNTER
+#undef PERFCOUNTER_ARRAY
+#undef PERFSTATUS
+#undef PERFSTATUS_ARRAY
+#define PERFCOUNTER_CORE( name, descr )
+#define PERFCOUNTER_CORE_ARRAY( name, descr, size )
 #define PERFCOUNTER( name, descr ) \
   PERFC_##name,
 #define PERFCOUNTER_ARRAY( name, descr, size ) \
   PERFC_##name,                                \
   PERFC_LAST_##name = PERFC_ ## name + (size) - sizeof(char[2 * !!(size) - 1]),
-
 #define PERFSTATUS       PERFCOUNTER
 #define PERFSTATUS_ARRAY PERFCOUNTER_ARRAY
 
-enum perfcounter {
 #include <xen/perfc_defn.h>
 	NUM_PERFCOUNTERS
 };
 
+#undef PERFCOUNTER_CORE
+#undef PERFCOUNTER_CORE_ARRAY
 #undef PERFCOUNTER
 #undef PERFCOUNTER_ARRAY
 #undef PERFSTATUS
 #undef PERFSTATUS_ARRAY
 
+#ifdef CONFIG_PERF_COUNTERS
+#define NUM_ACTIVE_PERFCOUNTERS NUM_PERFCOUNTERS
+#else
+#define NUM_ACTIVE_PERFCOUNTERS NUM_CORE_PERFCOUNTERS
+#endif
+
 typedef unsigned perfc_t;
 #define PRIperfc ""
 
-DECLARE_PER_CPU(perfc_t[NUM_PERFCOUNTERS], perfcounters);
-
-#define perfc_value(x)    this_cpu(perfcounters)[PERFC_ ## x]
-#define perfc_valuea(x,y)                                               \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 this_cpu(perfcounters)[PERFC_ ## x + (y)] : 0 )
-#define perfc_set(x,v)    (this_cpu(perfcounters)[PERFC_ ## x] = (v))
-#define perfc_seta(x,y,v)                                               \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 this_cpu(perfcounters)[PERFC_ ## x + (y)] = (v) : (v) )
-#define perfc_incr(x)     (++this_cpu(perfcounters)[PERFC_ ## x])
-#define perfc_decr(x)     (--this_cpu(perfcounters)[PERFC_ ## x])
-#define perfc_incra(x,y)                                                \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 ++this_cpu(perfcounters)[PERFC_ ## x + (y)] : 0 )
-#define perfc_add(x,v)    (this_cpu(perfcounters)[PERFC_ ## x] += (v))
-#define perfc_adda(x,y,v)                                               \
-    ( (y) <= PERFC_LAST_ ## x - PERFC_ ## x ?                           \
-	 this_cpu(perfcounters)[PERFC_ ## x + (y)] = (v) : (v) )
+DECLARE_PER_CPU(perfc_t[NUM_ACTIVE_PERFCOUNTERS], perfcounters);
+
+/*
+ * Counters without storage read as zero and ignore updates.  The index is
+ * clamped as well, so that the dead branch doesn't index out of bounds.
+ */
+#define perfc_active(x)   (PERFC_ ## x < NUM_ACTIVE_PERFCOUNTERS)
+#define perfc_ptr(x,y)                                                  \
+    (&this_cpu(perfcounters)[perfc_active(x) ? PERFC_ ## x + (y) : 0])
+#define perfc_inrange(x,y)                                              \
+    (perfc_active(x) && (y) <= PERFC_LAST_ ## x - PERFC_ ## x)
+
+#define perfc_value(x)    (perfc_active(x) ? *perfc_ptr(x, 0) : 0)
+#define perfc_valuea(x,y) (perfc_inrange(x, y) ? *perfc_ptr(x, y) : 0)
+#define perfc_update(x,op)                                              \
+    (perfc_active(x) ? (void)(*perfc_ptr(x, 0) op) : (void)0)
+#define perfc_updatea(x,y,op)                                           \
+    (perfc_inrange(x, y) ? (void)(*perfc_ptr(x, y) op) : (void)0)
+#define perfc_set(x,v)    perfc_update(x, = (v))
+#define perfc_seta(x,y,v) perfc_updatea(x, y, = (v))
+#define perfc_incr(x)     perfc_update(x, += 1)
+#define perfc_decr(x)     perfc_update(x, -= 1)
+#define perfc_incra(x,y)  perfc_updatea(x, y, += 1)
+#define perfc_add(x,v)    perfc_update(x, += (v))
+#define perfc_adda(x,y,v) perfc_updatea(x, y, += (v))
 
 /*
  * Histogram: special treatment for 0 and 1 count. After that equally spaced 
@@ -100,7 +147,7 @@ extern void perfc_printall(unsigned char key);
 extern void perfc_reset(unsigned char key);
 
     
-#else /* CONFIG_PERF_COUNTERS */
+#else /* CONFIG_CORE_PERF_COUNTERS */
 
 #define perfc_value(x)    (0)
 #define perfc_valuea(x,y) (0)
@@ -112,8 +159,8 @@ extern void perfc_reset(unsigned char key);
 #define perfc_decra(x,y)  ((void)0)
 #define perfc_add(x,y)    ((void)0)
 #define perfc_adda(x,y,z) ((void)0)
-#define perfc_incr_histo(x,y,z) ((void)0)
+#define perfc_incr_histo(x,v) ((void)0)
 
-#endif /* CONFIG_PERF_COUNTERS */
+#endif /* CONFIG_CORE_PERF_COUNTERS */
 
 #endif /* __XEN_PERFC_H__ */
@@ -4,7 +4,18 @@
 
 #include <asm/perfc_defn.h>
 
-PERFCOUNTER_ARRAY(hypercalls,           "hypercalls", NR_hypercalls)
+PERFCOUNTER_CORE_ARRAY(hypercalls,      "hypercalls", NR_hypercalls)
+
+PERFCOUNTER_CORE_ARRAY(page_alloc,      "page allocs by order",
+                       CONFIG_PAGEALLOC_MAX_ORDER + 1)
+PERFCOUNTER_CORE_ARRAY(page_alloc_node, "page allocs by node", NR_NODES)
+PERFCOUNTER_CORE_ARRAY(page_free,       "page frees by order",
+                       CONFIG_PAGEALLOC_MAX_ORDER + 1)
+PERFCOUNTER_CORE_ARRAY(page_free_node,  "page frees by node", NR_NODES)
+
+PERFCOUNTER_CORE_ARRAY(grant_ops,       "grant table ops",
+                       GNTTABOP_cache_flush + 1)
+PERFCOUNTER_CORE(evtchn_send,           "event channel sends")
 
 PERFCOUNTER(calls_to_multicall,         "calls to multicall")
 PERFCOUNTER(calls_from_multicall,       "calls from multicall")
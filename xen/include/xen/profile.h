@@ -0,0 +1,35 @@
+#ifndef __XEN_PROFILE_H__
+#define __XEN_PROFILE_H__
+
+#include <public/sysctl.h>
+
+struct cpu_user_regs;
+
+#ifdef CONFIG_PROFILER
+
+extern bool profile_active;
+
+int profile_op(struct xen_sysctl_profile_op *op);
+void __profile_sample(const struct cpu_user_regs *regs);
+
+/* Called from the performance counter overflow interrupt (or NMI). */
+static inline void profile_sample(const struct cpu_user_regs *regs)
+{
+    if ( unlikely(profile_active) )
+        __profile_sample(regs);
+}
+
+/*
+ * Arch hooks: make the performance counters of all CPUs overflow hz times
+ * a second, calling profile_sample() each time, and stop them again.
+ */
+int arch_profile_start(unsigned int hz);
+void arch_profile_stop(void);
+
+#else
+
+static inline void profile_sample(const struct cpu_user_regs *regs) {}
+
+#endif
+
+#endif /* __XEN_PROFILE_H__ */
@@ -9,6 +9,7 @@
 typedef struct {
     atomic_t cnts;
     spinlock_t lock;
+    u8 cls;                     /* enum lock_class */
 } rwlock_t;
 
 #define    RW_LOCK_UNLOCKED {           \
@@ -18,6 +19,7 @@ typedef struct {
 
 #define DEFINE_RWLOCK(l) rwlock_t l = RW_LOCK_UNLOCKED
 #define rwlock_init(l) (*(l) = (rwlock_t)RW_LOCK_UNLOCKED)
+#define rwlock_set_class(l, c) ((l)->cls = LOCK_CLASS_##c)
 
 /*
  * Writer states & reader shift and bias.
@@ -34,6 +36,10 @@ typedef struct {
 void queue_read_lock_slowpath(rwlock_t *lock);
 void queue_write_lock_slowpath(rwlock_t *lock);
 
+/* Locks with a class, sampling contention statistics. */
+void _read_lock_class(rwlock_t *lock);
+void _write_lock_class(rwlock_t *lock);
+
 /*
  * _read_trylock - try to acquire read lock of a queue rwlock.
  * @lock : Pointer to queue rwlock structure.
@@ -62,6 +68,12 @@ static inline void _read_lock(rwlock_t *lock)
 {
     u32 cnts;
 
+    if ( unlikely(lock->cls) )
+    {
+        _read_lock_class(lock);
+        return;
+    }
+
     cnts = atomic_add_return(_QR_BIAS, &lock->cnts);
     if ( likely(!(cnts & _QW_WMASK)) )
         return;
@@ -91,6 +103,8 @@ static inline unsigned long _read_lock_irqsave(rwlock_t *lock)
  */
 static inline void _read_unlock(rwlock_t *lock)
 {
+    if ( unlikely(lock->cls) )
+        lock_stat_release(lock);
     /*
      * Atomically decrement the reader count
      */
@@ -120,6 +134,12 @@ static inline int _rw_is_locked(rwlock_t *lock)
  */
 static inline void _write_lock(rwlock_t *lock)
 {
+    if ( unlikely(lock->cls) )
+    {
+        _write_lock_class(lock);
+        return;
+    }
+
     /* Optimize for the unfair lock case where the fair flag is 0. */
     if ( atomic_cmpxchg(&lock->cnts, 0, _QW_LOCKED) == 0 )
         return;
@@ -161,6 +181,8 @@ static inline int _write_trylock(rwlock_t *lock)
 
 static inline void _write_unlock(rwlock_t *lock)
 {
+    if ( unlikely(lock->cls) )
+        lock_stat_release(lock);
     /*
      * If the writer field is atomic, it can be cleared directly.
      * Otherwise, an atomic subtraction will be used to clear it.
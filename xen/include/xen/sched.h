@@ -138,6 +138,7 @@ void evtchn_destroy(struct domain *d); /* from domain_kill */
 void evtchn_destroy_final(struct domain *d); /* from complete_domain_destroy */
 
 struct waitqueue_vcpu;
+struct exit_latency;
 
 struct vcpu
 {
@@ -263,6 +264,9 @@ struct vcpu
 
     struct evtchn_fifo_vcpu *evtchn_fifo;
 
+    /* Exit latency histograms, see XEN_DOMCTL_exit_latency. */
+    struct exit_latency *exit_latency;
+
     struct arch_vcpu arch;
 };
 
@@ -444,6 +448,9 @@ struct domain
     /* OProfile support. */
     struct xenoprof *xenoprof;
 
+    /* Where superpage reassembly resumes (common/p2m-coalesce.c). */
+    gfn_t p2m_coalesce_gfn;
+
     /* Domain watchdog. */
 #define NR_DOMAIN_WATCHDOG_TIMERS 2
     spinlock_t watchdog_lock;
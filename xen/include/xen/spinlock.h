@@ -20,6 +20,20 @@ struct lock_debug { };
 #define spin_debug_disable() ((void)0)
 #endif
 
+/*
+ * Classes of locks for the contention statistics, see lock_stat_begin() in
+ * common/spinlock.c.  Numbered like XEN_LOCKSTAT_CLASS_*.
+ */
+enum lock_class {
+    LOCK_CLASS_none,
+    LOCK_CLASS_heap,
+    LOCK_CLASS_domctl,
+    LOCK_CLASS_grant,
+    LOCK_CLASS_sched,
+    LOCK_CLASS_p2m,
+    LOCK_CLASS_NR
+};
+
 #ifdef CONFIG_LOCK_PROFILE
 
 #include <public/sysctl.h>
@@ -82,10 +96,11 @@ struct lock_profile_qhead {
     static struct lock_profile * const __lock_profile_##name                  \
     __used_section(".lockprofile.data") =                                     \
     &__lock_profile_data_##name
-#define _SPIN_LOCK_UNLOCKED(x) { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG, x }
-#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(NULL)
-#define DEFINE_SPINLOCK(l)                                                    \
-    spinlock_t l = _SPIN_LOCK_UNLOCKED(NULL);                                 \
+#define _SPIN_LOCK_UNLOCKED(c, x)                                             \
+    { { 0 }, SPINLOCK_NO_CPU, 0, c, _LOCK_DEBUG, x }
+#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(LOCK_CLASS_none, NULL)
+#define DEFINE_SPINLOCK_CLASS(l, c)                                           \
+    spinlock_t l = _SPIN_LOCK_UNLOCKED(LOCK_CLASS_##c, NULL);                 \
     static struct lock_profile __lock_profile_data_##l = _LOCK_PROFILE(l);    \
     _LOCK_PROFILE_PTR(l)
 
@@ -96,7 +111,7 @@ struct lock_profile_qhead {
         if (!prof) break;                                                     \
         prof->name = #l;                                                      \
         prof->lock = &(s)->l;                                                 \
-        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(prof);                       \
+        (s)->l = (spinlock_t)_SPIN_LOCK_UNLOCKED(LOCK_CLASS_none, prof);      \
         prof->next = (s)->profile_head.elem_q;                                \
         (s)->profile_head.elem_q = prof;                                      \
     } while(0)
@@ -118,8 +133,10 @@ extern void spinlock_profile_reset(unsigned char key);
 
 struct lock_profile_qhead { };
 
-#define SPIN_LOCK_UNLOCKED { { 0 }, SPINLOCK_NO_CPU, 0, _LOCK_DEBUG }
-#define DEFINE_SPINLOCK(l) spinlock_t l = SPIN_LOCK_UNLOCKED
+#define _SPIN_LOCK_UNLOCKED(c) { { 0 }, SPINLOCK_NO_CPU, 0, c, _LOCK_DEBUG }
+#define SPIN_LOCK_UNLOCKED _SPIN_LOCK_UNLOCKED(LOCK_CLASS_none)
+#define DEFINE_SPINLOCK_CLASS(l, c)                                           \
+    spinlock_t l = _SPIN_LOCK_UNLOCKED(LOCK_CLASS_##c)
 
 #define spin_lock_init_prof(s, l) spin_lock_init(&((s)->l))
 #define lock_profile_register_struct(type, ptr, idx, print)
@@ -127,6 +144,8 @@ struct lock_profile_qhead { };
 
 #endif
 
+#define DEFINE_SPINLOCK(l) DEFINE_SPINLOCK_CLASS(l, none)
+
 typedef union {
     u32 head_tail;
     struct {
@@ -143,6 +162,7 @@ typedef struct spinlock {
 #define SPINLOCK_NO_CPU 0xfffu
     u16 recurse_cnt:4;
 #define SPINLOCK_MAX_RECURSE 0xfu
+    u8 cls;                          /* enum lock_class */
     struct lock_debug debug;
 #ifdef CONFIG_LOCK_PROFILE
     struct lock_profile *profile;
@@ -151,6 +171,20 @@ typedef struct spinlock {
 
 
 #define spin_lock_init(l) (*(l) = (spinlock_t)SPIN_LOCK_UNLOCKED)
+#define spin_lock_set_class(l, c) ((l)->cls = LOCK_CLASS_##c)
+
+/*
+ * Contention statistics, for locks with a class.  lock_stat_begin() returns
+ * the time the attempt to take the lock started if this acquisition is
+ * sampled, otherwise zero.
+ */
+s64 lock_stat_begin(const void *lock, unsigned int cls);
+void lock_stat_acquired(s64 start, bool contended, const void *caller);
+void lock_stat_failed(const void *caller);
+void lock_stat_release(const void *lock);
+
+struct xen_sysctl_lockstat_op;
+int lock_stat_control(struct xen_sysctl_lockstat_op *op);
 
 void _spin_lock(spinlock_t *lock);
 void _spin_lock_irq(spinlock_t *lock);
@@ -23,12 +23,28 @@
 #define xmalloc_bytes(_bytes) _xmalloc(_bytes, SMP_CACHE_BYTES)
 #define xzalloc_bytes(_bytes) _xzalloc(_bytes, SMP_CACHE_BYTES)
 
+/*
+ * Allocate space preferably backed by memory of the given NUMA node
+ * (NUMA_NO_NODE means the node of the calling CPU, like the above do).
+ */
+#define xmalloc_node(_type, _node) \
+    ((_type *)_xmalloc_node(sizeof(_type), __alignof__(_type), _node))
+#define xzalloc_node(_type, _node) \
+    ((_type *)_xzalloc_node(sizeof(_type), __alignof__(_type), _node))
+#define xzalloc_array_node(_type, _num, _node) \
+    ((_type *)_xzalloc_array_node(sizeof(_type), __alignof__(_type), _num, \
+                                  _node))
+
 /* Free any of the above. */
 extern void xfree(void *);
 
 /* Underlying functions */
 extern void *_xmalloc(unsigned long size, unsigned long align);
 extern void *_xzalloc(unsigned long size, unsigned long align);
+extern void *_xmalloc_node(unsigned long size, unsigned long align,
+                           unsigned int node);
+extern void *_xzalloc_node(unsigned long size, unsigned long align,
+                           unsigned int node);
 
 static inline void *_xmalloc_array(
     unsigned long size, unsigned long align, unsigned long num)
@@ -48,13 +64,24 @@ static inline void *_xzalloc_array(
     return _xzalloc(size * num, align);
 }
 
+static inline void *_xzalloc_array_node(
+    unsigned long size, unsigned long align, unsigned long num,
+    unsigned int node)
+{
+    /* Check for overflow. */
+    if ( size && num > UINT_MAX / size )
+        return NULL;
+    return _xzalloc_node(size * num, align, node);
+}
+
 /*
  * Pooled allocator interface.
  */
 
 struct xmem_pool;
 
-typedef void *(xmem_pool_get_memory)(unsigned long bytes);
+typedef void *(xmem_pool_get_memory)(unsigned long bytes,
+                                     struct xmem_pool *pool);
 typedef void (xmem_pool_put_memory)(void *ptr);
 
 /**
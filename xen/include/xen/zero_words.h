@@ -0,0 +1,24 @@
+#ifndef __XEN_ZERO_WORDS_H__
+#define __XEN_ZERO_WORDS_H__
+
+/*
+ * Check nr words, a multiple of 8, for zeroes.  Vector registers are off
+ * limits in the hypervisor, so OR together the words of a cache line at a
+ * time instead: the loads pipeline, and there is only one branch per line.
+ *
+ * Also used by the migration code in the tools, so this has to stand on its
+ * own: the includer provides bool.
+ */
+static inline bool words_are_zero(const unsigned long *p, unsigned int nr)
+{
+    unsigned int i;
+
+    for ( i = 0; i < nr; i += 8 )
+        if ( p[i] | p[i + 1] | p[i + 2] | p[i + 3] |
+             p[i + 4] | p[i + 5] | p[i + 6] | p[i + 7] )
+            return false;
+
+    return true;
+}
+
+#endif /* __XEN_ZERO_WORDS_H__ */
@@ -158,10 +158,10 @@ struct xsm_operations {
 #endif
 
     int (*platform_op) (uint32_t cmd);
+    int (*shadow_control) (struct domain *d, uint32_t op);
 
 #ifdef CONFIG_X86
     int (*do_mca) (void);
-    int (*shadow_control) (struct domain *d, uint32_t op);
     int (*mem_sharing_op) (struct domain *d, struct domain *cd, int op);
     int (*apic) (struct domain *d, int cmd);
     int (*memtype) (uint32_t access);
@@ -620,15 +620,15 @@ static inline int xsm_platform_op (xsm_default_t def, uint32_t op)
     return xsm_ops->platform_op(op);
 }
 
-#ifdef CONFIG_X86
-static inline int xsm_do_mca(xsm_default_t def)
+static inline int xsm_shadow_control (xsm_default_t def, struct domain *d, uint32_t op)
 {
-    return xsm_ops->do_mca();
+    return xsm_ops->shadow_control(d, op);
 }
 
-static inline int xsm_shadow_control (xsm_default_t def, struct domain *d, uint32_t op)
+#ifdef CONFIG_X86
+static inline int xsm_do_mca(xsm_default_t def)
 {
-    return xsm_ops->shadow_control(d, op);
+    return xsm_ops->do_mca();
 }
 
 static inline int xsm_mem_sharing_op (xsm_default_t def, struct domain *d, struct domain *cd, int op)
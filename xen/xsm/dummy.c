@@ -142,9 +142,9 @@ void __init xsm_fixup_ops (struct xsm_operations *ops)
 #endif
 
     set_to_dummy_if_null(ops, platform_op);
+    set_to_dummy_if_null(ops, shadow_control);
 #ifdef CONFIG_X86
     set_to_dummy_if_null(ops, do_mca);
-    set_to_dummy_if_null(ops, shadow_control);
     set_to_dummy_if_null(ops, mem_sharing_op);
     set_to_dummy_if_null(ops, apic);
     set_to_dummy_if_null(ops, machine_memory_map);
@@ -597,9 +597,10 @@ static int flask_domctl(struct domain *d, int cmd)
     /* These have individual XSM hooks (arch/../domctl.c) */
     case XEN_DOMCTL_bind_pt_irq:
     case XEN_DOMCTL_unbind_pt_irq:
+    /* This has an individual XSM hook (arch/x86/mm/paging.c, arch/arm/domctl.c) */
+    case XEN_DOMCTL_shadow_op:
 #ifdef CONFIG_X86
     /* These have individual XSM hooks (arch/x86/domctl.c) */
-    case XEN_DOMCTL_shadow_op:
     case XEN_DOMCTL_ioport_permission:
     case XEN_DOMCTL_ioport_mapping:
 #endif
@@ -748,6 +749,9 @@ static int flask_domctl(struct domain *d, int cmd)
     case XEN_DOMCTL_soft_reset:
         return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__SOFT_RESET);
 
+    case XEN_DOMCTL_exit_latency:
+        return current_has_perm(d, SECCLASS_DOMAIN2, DOMAIN2__EXIT_LATENCY);
+
     default:
         return avc_unknown_permission("domctl", cmd);
     }
@@ -792,6 +796,7 @@ static int flask_sysctl(int cmd)
         return domain_has_xen(current->domain, XEN__PM_OP);
 
     case XEN_SYSCTL_lockprof_op:
+    case XEN_SYSCTL_lockstat_op:
         return domain_has_xen(current->domain, XEN__LOCKPROF);
 
     case XEN_SYSCTL_cpupool_op:
@@ -825,6 +830,9 @@ static int flask_sysctl(int cmd)
     case XEN_SYSCTL_gcov_op:
         return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
                                     XEN2__GCOV_OP, NULL);
+    case XEN_SYSCTL_profile_op:
+        return avc_current_has_perm(SECINITSID_XEN, SECCLASS_XEN2,
+                                    XEN2__PROFILE_OP, NULL);
 
     default:
         return avc_unknown_permission("sysctl", cmd);
@@ -1437,12 +1445,6 @@ static int flask_platform_op(uint32_t op)
     }
 }
 
-#ifdef CONFIG_X86
-static int flask_do_mca(void)
-{
-    return domain_has_xen(current->domain, XEN__MCA_OP);
-}
-
 static int flask_shadow_control(struct domain *d, uint32_t op)
 {
     u32 perm;
@@ -1461,6 +1463,7 @@ static int flask_shadow_control(struct domain *d, uint32_t op)
     case XEN_DOMCTL_SHADOW_OP_ENABLE_LOGDIRTY:
     case XEN_DOMCTL_SHADOW_OP_PEEK:
     case XEN_DOMCTL_SHADOW_OP_CLEAN:
+    case XEN_DOMCTL_SHADOW_OP_CLEAN_LIST:
         perm = SHADOW__LOGDIRTY;
         break;
     default:
@@ -1470,6 +1473,12 @@ static int flask_shadow_control(struct domain *d, uint32_t op)
     return current_has_perm(d, SECCLASS_SHADOW, perm);
 }
 
+#ifdef CONFIG_X86
+static int flask_do_mca(void)
+{
+    return domain_has_xen(current->domain, XEN__MCA_OP);
+}
+
 struct ioport_has_perm_data {
     u32 ssid;
     u32 dsid;
@@ -1792,9 +1801,9 @@ static struct xsm_operations flask_ops = {
 #endif
 
     .platform_op = flask_platform_op,
+    .shadow_control = flask_shadow_control,
 #ifdef CONFIG_X86
     .do_mca = flask_do_mca,
-    .shadow_control = flask_shadow_control,
     .mem_sharing_op = flask_mem_sharing_op,
     .apic = flask_apic,
     .machine_memory_map = flask_machine_memory_map,
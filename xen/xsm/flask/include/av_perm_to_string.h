@@ -0,0 +1,172 @@
+/* This file is automatically generated.  Do not edit. */
+   S_(SECCLASS_XEN, XEN__SETTIME, "settime")
+   S_(SECCLASS_XEN, XEN__TBUFCONTROL, "tbufcontrol")
+   S_(SECCLASS_XEN, XEN__READCONSOLE, "readconsole")
+   S_(SECCLASS_XEN, XEN__CLEARCONSOLE, "clearconsole")
+   S_(SECCLASS_XEN, XEN__PERFCONTROL, "perfcontrol")
+   S_(SECCLASS_XEN, XEN__MTRR_ADD, "mtrr_add")
+   S_(SECCLASS_XEN, XEN__MTRR_DEL, "mtrr_del")
+   S_(SECCLASS_XEN, XEN__MTRR_READ, "mtrr_read")
+   S_(SECCLASS_XEN, XEN__MICROCODE, "microcode")
+   S_(SECCLASS_XEN, XEN__PHYSINFO, "physinfo")
+   S_(SECCLASS_XEN, XEN__QUIRK, "quirk")
+   S_(SECCLASS_XEN, XEN__WRITECONSOLE, "writeconsole")
+   S_(SECCLASS_XEN, XEN__READAPIC, "readapic")
+   S_(SECCLASS_XEN, XEN__WRITEAPIC, "writeapic")
+   S_(SECCLASS_XEN, XEN__PRIVPROFILE, "privprofile")
+   S_(SECCLASS_XEN, XEN__NONPRIVPROFILE, "nonprivprofile")
+   S_(SECCLASS_XEN, XEN__KEXEC, "kexec")
+   S_(SECCLASS_XEN, XEN__FIRMWARE, "firmware")
+   S_(SECCLASS_XEN, XEN__SLEEP, "sleep")
+   S_(SECCLASS_XEN, XEN__FREQUENCY, "frequency")
+   S_(SECCLASS_XEN, XEN__GETIDLE, "getidle")
+   S_(SECCLASS_XEN, XEN__DEBUG, "debug")
+   S_(SECCLASS_XEN, XEN__GETCPUINFO, "getcpuinfo")
+   S_(SECCLASS_XEN, XEN__HEAP, "heap")
+   S_(SECCLASS_XEN, XEN__PM_OP, "pm_op")
+   S_(SECCLASS_XEN, XEN__MCA_OP, "mca_op")
+   S_(SECCLASS_XEN, XEN__LOCKPROF, "lockprof")
+   S_(SECCLASS_XEN, XEN__CPUPOOL_OP, "cpupool_op")
+   S_(SECCLASS_XEN, XEN__TMEM_OP, "tmem_op")
+   S_(SECCLASS_XEN, XEN__TMEM_CONTROL, "tmem_control")
+   S_(SECCLASS_XEN, XEN__GETSCHEDULER, "getscheduler")
+   S_(SECCLASS_XEN, XEN__SETSCHEDULER, "setscheduler")
+   S_(SECCLASS_XEN2, XEN2__RESOURCE_OP, "resource_op")
+   S_(SECCLASS_XEN2, XEN2__PSR_CMT_OP, "psr_cmt_op")
+   S_(SECCLASS_XEN2, XEN2__PSR_CAT_OP, "psr_cat_op")
+   S_(SECCLASS_XEN2, XEN2__GET_SYMBOL, "get_symbol")
+   S_(SECCLASS_XEN2, XEN2__PMU_CTRL, "pmu_ctrl")
+   S_(SECCLASS_XEN2, XEN2__PMU_USE, "pmu_use")
+   S_(SECCLASS_XEN2, XEN2__GET_CPU_LEVELLING_CAPS, "get_cpu_levelling_caps")
+   S_(SECCLASS_XEN2, XEN2__GET_CPU_FEATURESET, "get_cpu_featureset")
+   S_(SECCLASS_XEN2, XEN2__LIVEPATCH_OP, "livepatch_op")
+   S_(SECCLASS_XEN2, XEN2__GCOV_OP, "gcov_op")
+   S_(SECCLASS_XEN2, XEN2__PROFILE_OP, "profile_op")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETVCPUCONTEXT, "setvcpucontext")
+   S_(SECCLASS_DOMAIN, DOMAIN__PAUSE, "pause")
+   S_(SECCLASS_DOMAIN, DOMAIN__UNPAUSE, "unpause")
+   S_(SECCLASS_DOMAIN, DOMAIN__RESUME, "resume")
+   S_(SECCLASS_DOMAIN, DOMAIN__CREATE, "create")
+   S_(SECCLASS_DOMAIN, DOMAIN__TRANSITION, "transition")
+   S_(SECCLASS_DOMAIN, DOMAIN__MAX_VCPUS, "max_vcpus")
+   S_(SECCLASS_DOMAIN, DOMAIN__DESTROY, "destroy")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETAFFINITY, "setaffinity")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETAFFINITY, "getaffinity")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETSCHEDULER, "getscheduler")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETDOMAININFO, "getdomaininfo")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETVCPUINFO, "getvcpuinfo")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETVCPUCONTEXT, "getvcpucontext")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETDOMAINMAXMEM, "setdomainmaxmem")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETDOMAINHANDLE, "setdomainhandle")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETDEBUGGING, "setdebugging")
+   S_(SECCLASS_DOMAIN, DOMAIN__HYPERCALL, "hypercall")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETTIME, "settime")
+   S_(SECCLASS_DOMAIN, DOMAIN__SET_TARGET, "set_target")
+   S_(SECCLASS_DOMAIN, DOMAIN__SHUTDOWN, "shutdown")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETADDRSIZE, "setaddrsize")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETADDRSIZE, "getaddrsize")
+   S_(SECCLASS_DOMAIN, DOMAIN__TRIGGER, "trigger")
+   S_(SECCLASS_DOMAIN, DOMAIN__GETPODTARGET, "getpodtarget")
+   S_(SECCLASS_DOMAIN, DOMAIN__SETPODTARGET, "setpodtarget")
+   S_(SECCLASS_DOMAIN, DOMAIN__SET_MISC_INFO, "set_misc_info")
+   S_(SECCLASS_DOMAIN, DOMAIN__SET_VIRQ_HANDLER, "set_virq_handler")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__RELABELFROM, "relabelfrom")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__RELABELTO, "relabelto")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__RELABELSELF, "relabelself")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__MAKE_PRIV_FOR, "make_priv_for")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SET_AS_TARGET, "set_as_target")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SET_CPUID, "set_cpuid")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__GETTSC, "gettsc")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SETTSC, "settsc")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SETSCHEDULER, "setscheduler")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SETCLAIM, "setclaim")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SET_MAX_EVTCHN, "set_max_evtchn")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__CACHEFLUSH, "cacheflush")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__CREATE_HARDWARE_DOMAIN, "create_hardware_domain")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SET_VNUMAINFO, "set_vnumainfo")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__GET_VNUMAINFO, "get_vnumainfo")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__PSR_CMT_OP, "psr_cmt_op")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__VM_EVENT, "vm_event")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__SOFT_RESET, "soft_reset")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__MEM_ACCESS, "mem_access")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__MEM_PAGING, "mem_paging")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__MEM_SHARING, "mem_sharing")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__PSR_CAT_OP, "psr_cat_op")
+   S_(SECCLASS_DOMAIN2, DOMAIN2__EXIT_LATENCY, "exit_latency")
+   S_(SECCLASS_HVM, HVM__SETHVMC, "sethvmc")
+   S_(SECCLASS_HVM, HVM__GETHVMC, "gethvmc")
+   S_(SECCLASS_HVM, HVM__SETPARAM, "setparam")
+   S_(SECCLASS_HVM, HVM__GETPARAM, "getparam")
+   S_(SECCLASS_HVM, HVM__BIND_IRQ, "bind_irq")
+   S_(SECCLASS_HVM, HVM__CACHEATTR, "cacheattr")
+   S_(SECCLASS_HVM, HVM__HVMCTL, "hvmctl")
+   S_(SECCLASS_HVM, HVM__MEM_SHARING, "mem_sharing")
+   S_(SECCLASS_HVM, HVM__AUDIT_P2M, "audit_p2m")
+   S_(SECCLASS_HVM, HVM__SHARE_MEM, "share_mem")
+   S_(SECCLASS_HVM, HVM__NESTED, "nested")
+   S_(SECCLASS_HVM, HVM__ALTP2MHVM, "altp2mhvm")
+   S_(SECCLASS_HVM, HVM__ALTP2MHVM_OP, "altp2mhvm_op")
+   S_(SECCLASS_HVM, HVM__DM, "dm")
+   S_(SECCLASS_EVENT, EVENT__BIND, "bind")
+   S_(SECCLASS_EVENT, EVENT__SEND, "send")
+   S_(SECCLASS_EVENT, EVENT__STATUS, "status")
+   S_(SECCLASS_EVENT, EVENT__CREATE, "create")
+   S_(SECCLASS_EVENT, EVENT__RESET, "reset")
+   S_(SECCLASS_GRANT, GRANT__MAP_READ, "map_read")
+   S_(SECCLASS_GRANT, GRANT__MAP_WRITE, "map_write")
+   S_(SECCLASS_GRANT, GRANT__UNMAP, "unmap")
+   S_(SECCLASS_GRANT, GRANT__TRANSFER, "transfer")
+   S_(SECCLASS_GRANT, GRANT__SETUP, "setup")
+   S_(SECCLASS_GRANT, GRANT__COPY, "copy")
+   S_(SECCLASS_GRANT, GRANT__QUERY, "query")
+   S_(SECCLASS_MMU, MMU__MAP_READ, "map_read")
+   S_(SECCLASS_MMU, MMU__MAP_WRITE, "map_write")
+   S_(SECCLASS_MMU, MMU__PAGEINFO, "pageinfo")
+   S_(SECCLASS_MMU, MMU__PAGELIST, "pagelist")
+   S_(SECCLASS_MMU, MMU__ADJUST, "adjust")
+   S_(SECCLASS_MMU, MMU__STAT, "stat")
+   S_(SECCLASS_MMU, MMU__UPDATEMP, "updatemp")
+   S_(SECCLASS_MMU, MMU__PHYSMAP, "physmap")
+   S_(SECCLASS_MMU, MMU__PINPAGE, "pinpage")
+   S_(SECCLASS_MMU, MMU__MEMORYMAP, "memorymap")
+   S_(SECCLASS_MMU, MMU__REMOTE_REMAP, "remote_remap")
+   S_(SECCLASS_MMU, MMU__MMUEXT_OP, "mmuext_op")
+   S_(SECCLASS_MMU, MMU__EXCHANGE, "exchange")
+   S_(SECCLASS_MMU, MMU__TARGET_HACK, "target_hack")
+   S_(SECCLASS_SHADOW, SHADOW__DISABLE, "disable")
+   S_(SECCLASS_SHADOW, SHADOW__ENABLE, "enable")
+   S_(SECCLASS_SHADOW, SHADOW__LOGDIRTY, "logdirty")
+   S_(SECCLASS_RESOURCE, RESOURCE__ADD, "add")
+   S_(SECCLASS_RESOURCE, RESOURCE__REMOVE, "remove")
+   S_(SECCLASS_RESOURCE, RESOURCE__USE, "use")
+   S_(SECCLASS_RESOURCE, RESOURCE__ADD_IRQ, "add_irq")
+   S_(SECCLASS_RESOURCE, RESOURCE__REMOVE_IRQ, "remove_irq")
+   S_(SECCLASS_RESOURCE, RESOURCE__ADD_IOPORT, "add_ioport")
+   S_(SECCLASS_RESOURCE, RESOURCE__REMOVE_IOPORT, "remove_ioport")
+   S_(SECCLASS_RESOURCE, RESOURCE__ADD_IOMEM, "add_iomem")
+   S_(SECCLASS_RESOURCE, RESOURCE__REMOVE_IOMEM, "remove_iomem")
+   S_(SECCLASS_RESOURCE, RESOURCE__STAT_DEVICE, "stat_device")
+   S_(SECCLASS_RESOURCE, RESOURCE__ADD_DEVICE, "add_device")
+   S_(SECCLASS_RESOURCE, RESOURCE__REMOVE_DEVICE, "remove_device")
+   S_(SECCLASS_RESOURCE, RESOURCE__PLUG, "plug")
+   S_(SECCLASS_RESOURCE, RESOURCE__UNPLUG, "unplug")
+   S_(SECCLASS_RESOURCE, RESOURCE__SETUP, "setup")
+   S_(SECCLASS_SECURITY, SECURITY__COMPUTE_AV, "compute_av")
+   S_(SECCLASS_SECURITY, SECURITY__COMPUTE_CREATE, "compute_create")
+   S_(SECCLASS_SECURITY, SECURITY__COMPUTE_MEMBER, "compute_member")
+   S_(SECCLASS_SECURITY, SECURITY__CHECK_CONTEXT, "check_context")
+   S_(SECCLASS_SECURITY, SECURITY__LOAD_POLICY, "load_policy")
+   S_(SECCLASS_SECURITY, SECURITY__COMPUTE_RELABEL, "compute_relabel")
+   S_(SECCLASS_SECURITY, SECURITY__SETENFORCE, "setenforce")
+   S_(SECCLASS_SECURITY, SECURITY__SETBOOL, "setbool")
+   S_(SECCLASS_SECURITY, SECURITY__SETSECPARAM, "setsecparam")
+   S_(SECCLASS_SECURITY, SECURITY__ADD_OCONTEXT, "add_ocontext")
+   S_(SECCLASS_SECURITY, SECURITY__DEL_OCONTEXT, "del_ocontext")
+   S_(SECCLASS_VERSION, VERSION__XEN_EXTRAVERSION, "xen_extraversion")
+   S_(SECCLASS_VERSION, VERSION__XEN_COMPILE_INFO, "xen_compile_info")
+   S_(SECCLASS_VERSION, VERSION__XEN_CAPABILITIES, "xen_capabilities")
+   S_(SECCLASS_VERSION, VERSION__XEN_CHANGESET, "xen_changeset")
+   S_(SECCLASS_VERSION, VERSION__XEN_PAGESIZE, "xen_pagesize")
+   S_(SECCLASS_VERSION, VERSION__XEN_GUEST_HANDLE, "xen_guest_handle")
+   S_(SECCLASS_VERSION, VERSION__XEN_COMMANDLINE, "xen_commandline")
+   S_(SECCLASS_VERSION, VERSION__XEN_BUILD_ID, "xen_build_id")
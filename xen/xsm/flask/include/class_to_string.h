@@ -0,0 +1,17 @@
+/* This file is automatically generated.  Do not edit. */
+/*
+ * Security object class definitions
+ */
+    S_("null")
+    S_("xen")
+    S_("xen2")
+    S_("domain")
+    S_("domain2")
+    S_("hvm")
+    S_("mmu")
+    S_("resource")
+    S_("shadow")
+    S_("event")
+    S_("grant")
+    S_("security")
+    S_("version")